@@ -0,0 +1,384 @@
+/*
+ *  i2c_async.c - queued I2C transactions clocked by the FRC1 timer
+ *  interrupt, see i2c_async.h
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <ets_sys.h>
+#include <osapi.h>
+#include <os_type.h>
+#include <gpio.h>
+#include <user_interface.h>
+#include "driver/i2c.h"
+
+#include "driver/i2c_async.h"
+
+/*
+ * FRC1 runs from the 80 MHz APB clock, whatever the CPU clock. The
+ * control bits are those of the SDK's hw_timer example.
+ */
+#define FRC1_ENABLE_TIMER   BIT7
+#define FRC1_AUTO_LOAD      BIT6
+#define FRC1_DIV_16         BIT2
+#define FRC1_TICKS_PER_US   5
+
+/*
+ * Each transaction is a series of steps, each a fixed number of
+ * interrupts:
+ *    START     1   SDA falls with SCL high
+ *    WRITE     18  8 data bits and the acknowledge, SCL low then high
+ *    READ      18
+ *    RESTART   3   SDA released, SCL high, SDA falls
+ *    STOP      3   SDA low, SCL high, SDA rises
+ * SDA is read at the start of the interrupt after SCL went high, which
+ * leaves it a whole half period to settle.
+ */
+enum step {
+    STEP_START,
+    STEP_WRITE,
+    STEP_READ,
+    STEP_RESTART,
+    STEP_STOP,
+};
+
+enum sample {
+    SAMPLE_NONE,
+    SAMPLE_DATA,
+    SAMPLE_ACK,
+};
+
+// written by the interrupt, and polled by i2c_async_cancel()
+static volatile struct {
+    i2c_xfer_t *xfer;   // on the bus, the head of the queue, or NULL
+    i2c_xfer_t *tail;   // last queued
+    uint8 step;         // enum step
+    uint8 tick;         // interrupts into the step
+    uint8 seq;          // steps into the transaction
+    uint8 index;        // data byte of a READ step
+    uint8 out;          // byte of a WRITE step
+    uint8 in;           // byte of a READ step
+    uint8 sample;       // enum sample, SDA to read this interrupt
+} bus;
+
+static os_event_t i2c_queue[I2C_ASYNC_QLEN];
+static bool started = false;
+static uint8 pending = 0;       // queued or posted, not yet called back
+static uint8 epoch = 0;         // completions from before a cancel differ
+
+
+/*
+ * The interrupt side, all of it in IRAM
+ */
+static void
+sda(uint8 state)
+{
+    if (state) {
+        gpio_output_set(1 << I2C_SDA_PIN, 0, 1 << I2C_SDA_PIN, 0);
+    } else {
+        gpio_output_set(0, 1 << I2C_SDA_PIN, 1 << I2C_SDA_PIN, 0);
+    }
+}
+
+static void
+scl(uint8 state)
+{
+    if (state) {
+        gpio_output_set(1 << I2C_SCK_PIN, 0, 1 << I2C_SCK_PIN, 0);
+    } else {
+        gpio_output_set(0, 1 << I2C_SCK_PIN, 1 << I2C_SCK_PIN, 0);
+    }
+}
+
+static void
+timer_start(void)
+{
+    RTC_REG_WRITE(FRC1_LOAD_ADDRESS, I2C_ASYNC_HALF_US * FRC1_TICKS_PER_US);
+    RTC_REG_WRITE(FRC1_CTRL_ADDRESS,
+            FRC1_DIV_16 | FRC1_AUTO_LOAD | FRC1_ENABLE_TIMER);
+    TM1_EDGE_INT_ENABLE();
+    ETS_FRC1_INTR_ENABLE();
+}
+
+static void
+timer_stop(void)
+{
+    ETS_FRC1_INTR_DISABLE();
+    TM1_EDGE_INT_DISABLE();
+    RTC_REG_WRITE(FRC1_CTRL_ADDRESS, 0);
+}
+
+static void finish(void);
+
+/*
+ * next_step - the step after the one just finished, from the next
+ * interrupt
+ */
+static void
+next_step(void)
+{
+    i2c_xfer_t *x = bus.xfer;
+    uint8 n = bus.seq++;
+
+    bus.tick = 0;
+    if (n == 0) {
+        bus.step = STEP_START;
+        return;
+    }
+    if (bus.step == STEP_STOP) {
+        finish();
+        return;
+    }
+    // address, register pointer, data
+    n--;
+    if (n < 2 + x->wlen) {
+        bus.step = STEP_WRITE;
+        bus.out = (n == 0) ? x->addr : (n == 1) ? x->reg : x->data[n - 2];
+        return;
+    }
+    n -= 2 + x->wlen;
+    // RESTART, read address, data
+    if (x->rlen > 0) {
+        if (n == 0) {
+            bus.step = STEP_RESTART;
+            return;
+        }
+        if (n == 1) {
+            bus.step = STEP_WRITE;
+            bus.out = x->addr | 1;
+            return;
+        }
+        if (n - 2 < x->rlen) {
+            bus.step = STEP_READ;
+            bus.index = n - 2;
+            return;
+        }
+    }
+    bus.step = STEP_STOP;
+} // end next_step()
+
+
+/*
+ * finish - post the transaction on the bus to the task, and start the
+ * next one
+ */
+static void
+finish(void)
+{
+    i2c_xfer_t *x = bus.xfer;
+
+    if (x->status == I2C_XFER_QUEUED) {
+        x->status = I2C_XFER_DONE;
+    }
+    bus.xfer = x->next;
+    if (bus.xfer == NULL) {
+        bus.tail = NULL;
+        timer_stop();
+    } else {
+        bus.seq = 0;
+        next_step();
+    }
+    system_os_post(I2C_ASYNC_PRIO, epoch, (os_param_t)x);
+} // end finish()
+
+
+/*
+ * i2c_intr - one SCL half period of the transaction on the bus
+ */
+static void
+i2c_intr(void *arg)
+{
+    i2c_xfer_t *x = bus.xfer;
+    uint8 t;
+    uint8 level;
+
+    RTC_CLR_REG_MASK(FRC1_INT_ADDRESS, FRC1_INT_CLR_MASK);
+    if (x == NULL) {
+        timer_stop();
+        return;
+    }
+
+    // SCL went high at the last interrupt
+    level = GPIO_INPUT_GET(GPIO_ID_PIN(I2C_SDA_PIN));
+    if (bus.sample == SAMPLE_DATA) {
+        bus.in = (bus.in << 1) | level;
+    } else if ((bus.sample == SAMPLE_ACK) && level) {
+        // give up on the rest of it
+        x->status = I2C_XFER_NACK;
+        bus.step = STEP_STOP;
+        bus.tick = 0;
+    }
+    bus.sample = SAMPLE_NONE;
+
+    t = bus.tick++;
+    switch (bus.step) {
+        case STEP_START:
+            sda(0);
+            break;
+
+        case STEP_WRITE:
+            if (t & 1) {
+                scl(1);
+                if (t == 17) {
+                    bus.sample = SAMPLE_ACK;
+                }
+            } else {
+                scl(0);
+                // the acknowledge bit is left to the device
+                sda((t == 16) ? 1 : (bus.out >> (7 - t / 2)) & 1);
+            }
+            break;
+
+        case STEP_READ:
+            if (t & 1) {
+                scl(1);
+                if (t < 16) {
+                    bus.sample = SAMPLE_DATA;
+                }
+            } else {
+                scl(0);
+                if (t == 16) {
+                    // acknowledge all but the last byte
+                    x->data[bus.index] = bus.in;
+                    sda(bus.index + 1 == x->rlen);
+                } else {
+                    sda(1);
+                }
+            }
+            break;
+
+        case STEP_RESTART:
+        case STEP_STOP:
+            if (t == 0) {
+                scl(0);
+                sda(bus.step == STEP_RESTART);
+            } else if (t == 1) {
+                scl(1);
+            } else {
+                sda(bus.step == STEP_STOP);
+            }
+            break;
+    }
+
+    if (bus.tick == ((bus.step == STEP_START) ? 1
+                : ((bus.step == STEP_WRITE) || (bus.step == STEP_READ)) ? 18
+                : 3)) {
+        next_step();
+    }
+} // end i2c_intr()
+
+
+/*
+ * i2c_task - call back the transactions the interrupt is done with
+ */
+static void ICACHE_FLASH_ATTR
+i2c_task(os_event_t *e)
+{
+    i2c_xfer_t *x = (i2c_xfer_t *)e->par;
+
+    pending--;
+    // from before i2c_async_cancel()
+    if ((uint8)e->sig != epoch) {
+        return;
+    }
+    if (x->done != NULL) {
+        x->done(x);
+    }
+} // end i2c_task()
+
+
+/*
+ * i2c_async_init - set up the pins, the timer interrupt and the task,
+ * call before queueing
+ *
+ * Later calls only set up the pins again.
+ */
+void ICACHE_FLASH_ATTR
+i2c_async_init(void)
+{
+    i2c_init();
+    if (started) {
+        return;
+    }
+    started = true;
+    ETS_FRC_TIMER1_INTR_ATTACH(i2c_intr, NULL);
+    system_os_task(i2c_task, I2C_ASYNC_PRIO, i2c_queue, I2C_ASYNC_QLEN);
+} // end i2c_async_init()
+
+
+/*
+ * i2c_async_queue - queue a transaction
+ *
+ * Returns FALSE if I2C_ASYNC_QLEN are already waiting for the bus or
+ * their callback.
+ */
+bool ICACHE_FLASH_ATTR
+i2c_async_queue(i2c_xfer_t *xfer)
+{
+    if (pending >= I2C_ASYNC_QLEN) {
+        return(false);
+    }
+    pending++;
+    xfer->status = I2C_XFER_QUEUED;
+    xfer->next = NULL;
+
+    ETS_FRC1_INTR_DISABLE();
+    if (bus.xfer == NULL) {
+        bus.xfer = xfer;
+        bus.tail = xfer;
+        bus.seq = 0;
+        bus.sample = SAMPLE_NONE;
+        next_step();
+        timer_start();
+    } else {
+        bus.tail->next = xfer;
+        bus.tail = xfer;
+        ETS_FRC1_INTR_ENABLE();
+    }
+    return(true);
+} // end i2c_async_queue()
+
+
+/*
+ * i2c_async_cancel - drop the queued transactions, and the callbacks of
+ * those done with
+ *
+ * A transaction already on the bus is let finish, so that the device is
+ * not left holding SDA; that takes under 10 ms at I2C_ASYNC_HALF_US.
+ */
+void ICACHE_FLASH_ATTR
+i2c_async_cancel(void)
+{
+    i2c_xfer_t *x = NULL;
+
+    ETS_FRC1_INTR_DISABLE();
+    if (bus.xfer != NULL) {
+        x = bus.xfer->next;
+        bus.xfer->next = NULL;
+        bus.tail = bus.xfer;
+    }
+    ETS_FRC1_INTR_ENABLE();
+
+    for ( ; x != NULL; x = x->next) {
+        pending--;
+    }
+    while (bus.xfer != NULL) {
+        os_delay_us(I2C_ASYNC_HALF_US);
+    }
+    // everything posted so far is ignored
+    epoch++;
+} // end i2c_async_cancel()
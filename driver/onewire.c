@@ -73,16 +73,19 @@ void ICACHE_FLASH_ATTR ds_init(int power)
  * Perform the onewire reset function. We will wait up to 250uS for
  * the bus to come high, if it doesn’t then it is broken or shorted
  * and we return;
+ *
+ * Returns TRUE if a device answered with a presence pulse.
  */
-void ICACHE_FLASH_ATTR ds_reset(void)
+bool ICACHE_FLASH_ATTR ds_reset(void)
 {
     uint8_t retries = 125;
+    bool present;
     GPIO_DIS_OUTPUT(ONEWIRE_PIN);
     // wait until the wire is high… just in case
     do {
         if (--retries == 0)
         {
-            return;
+            return(FALSE);
         }
         os_delay_us(2);
     } while (!GPIO_INPUT_GET(ONEWIRE_PIN));
@@ -90,8 +93,13 @@ void ICACHE_FLASH_ATTR ds_reset(void)
     GPIO_OUTPUT_SET(ONEWIRE_PIN, 0);
     os_delay_us(480);
     GPIO_DIS_OUTPUT(ONEWIRE_PIN);
-    os_delay_us(480);
+    // devices pull the wire low 15-60 us after it is released, for
+    // 60-240 us
+    os_delay_us(70);
+    present = !GPIO_INPUT_GET(ONEWIRE_PIN);
+    os_delay_us(410);
 
+    return(present);
 } // end ds_reset(void)
 
 
@@ -132,10 +140,11 @@ void ICACHE_FLASH_ATTR ds_write(uint8_t cmd)
         write_bit((bitMask & cmd) ? 1 : 0);
     }
 
+    // GPIO_OUTPUT_SET() would enable the driver again and hold the bus
+    // low, which a wired part takes for a reset
     if (DS_Power != ONEWIRE_PARASITIC_PWR)
     {
         GPIO_DIS_OUTPUT( ONEWIRE_PIN );
-        GPIO_OUTPUT_SET( ONEWIRE_PIN, 0 );
     }
 
 } // end ds_write()
@@ -30,7 +30,7 @@
 extern UartDevice    UartDev;
 //extern os_event_t    at_recvTaskQueue[at_recvTaskQueueLen];
 
-LOCAL void uart0_rx_intr_handler(void *para);
+LOCAL void uart0_intr_handler(void *para);
 
 /******************************************************************************
  * FunctionName : uart_config
@@ -50,7 +50,7 @@ uart_config(uint8 uart_no)
   else
   {
     /* rcv_buff size if 0x100 */
-    ETS_UART_INTR_ATTACH(uart0_rx_intr_handler,  &(UartDev.rcv_buff));
+    ETS_UART_INTR_ATTACH(uart0_intr_handler,  &(UartDev.rcv_buff));
     PIN_PULLUP_DIS(PERIPHS_IO_MUX_U0TXD_U);
     PIN_FUNC_SELECT(PERIPHS_IO_MUX_U0TXD_U, FUNC_U0TXD);
     PIN_FUNC_SELECT(PERIPHS_IO_MUX_MTDO_U, FUNC_U0RTS);
@@ -78,6 +78,7 @@ uart_config(uint8 uart_no)
     WRITE_PERI_REG(UART_CONF1(uart_no),
                    ((0x10 & UART_RXFIFO_FULL_THRHD) << UART_RXFIFO_FULL_THRHD_S) |
                    ((0x10 & UART_RX_FLOW_THRHD) << UART_RX_FLOW_THRHD_S) |
+                   ((0x10 & UART_TXFIFO_EMPTY_THRHD) << UART_TXFIFO_EMPTY_THRHD_S) |
                    UART_RX_FLOW_EN |
                    (0x02 & UART_RX_TOUT_THRHD) << UART_RX_TOUT_THRHD_S |
                    UART_RX_TOUT_EN);
@@ -96,28 +97,159 @@ uart_config(uint8 uart_no)
   SET_PERI_REG_MASK(UART_INT_ENA(uart_no), UART_RXFIFO_FULL_INT_ENA);
 }
 
+/*
+ * TX ring buffer
+ *
+ * Characters are queued here and moved into the 128 byte hardware FIFO
+ * by the TXFIFO_EMPTY interrupt, so logging does not busy-wait on the
+ * UART. The foreground only advances txHead and the interrupt handler
+ * only advances txTail.
+ */
+static uint8 txRing[UART_TX_RING_SIZE];
+static volatile uint16 txHead = 0;
+static volatile uint16 txTail = 0;
+static UartTxPolicy txPolicy = UART_TX_POLICY_DEFAULT;
+static uint32 txDropped = 0;
+static uint16 txHighWater = 0;
+
+#define TX_RING_MASK    (UART_TX_RING_SIZE - 1)
+#define TX_RING_USED()  ((uint16)(txHead - txTail) & TX_RING_MASK)
+
+/******************************************************************************
+ * FunctionName : uart_tx_fifo_cnt
+ * Description  : Internal used function
+ * Parameters   : uint8 uart - UART0 or UART1
+ * Returns      : number of characters in the hardware TX FIFO
+*******************************************************************************/
+LOCAL uint32
+uart_tx_fifo_cnt(uint8 uart)
+{
+  return (READ_PERI_REG(UART_STATUS(uart)) >> UART_TXFIFO_CNT_S) & UART_TXFIFO_CNT;
+}
+
+/******************************************************************************
+ * FunctionName : uart_tx_fill_fifo
+ * Description  : Internal used function
+ *                Move queued characters into the TX FIFO until it is
+ *                full or the ring is empty. The TXFIFO_EMPTY interrupt
+ *                is disabled once the ring drains.
+ * Parameters   : uint8 uart - UART0 or UART1
+ * Returns      : NONE
+*******************************************************************************/
+LOCAL void
+uart_tx_fill_fifo(uint8 uart)
+{
+  while ((txTail != txHead) && (uart_tx_fifo_cnt(uart) < 126))
+  {
+    WRITE_PERI_REG(UART_FIFO(uart), txRing[txTail]);
+    txTail = (txTail + 1) & TX_RING_MASK;
+  }
+
+  if (txTail == txHead)
+  {
+    CLEAR_PERI_REG_MASK(UART_INT_ENA(uart), UART_TXFIFO_EMPTY_INT_ENA);
+  }
+}
+
 /******************************************************************************
  * FunctionName : uart_tx_one_char
  * Description  : Internal used function
+ *                Queue a character for the TX interrupt. When the ring
+ *                is full the character is either dropped (and counted)
+ *                or the oldest queued character is pushed out by
+ *                polling, depending on the TX policy.
  * Parameters   : uint8 uart - UART0 or UART1
  * Parameters   : uint8 TxChar - character to tx
- * Returns      : OK
+ * Returns      : OK, or FAIL if the character was dropped
 *******************************************************************************/
 LOCAL STATUS
 uart_tx_one_char(uint8 uart, uint8 TxChar)
 {
-    while (true)
+    uint16 next = (txHead + 1) & TX_RING_MASK;
+
+    if (next == txTail)
     {
-      uint32 fifo_cnt = READ_PERI_REG(UART_STATUS(uart)) & (UART_TXFIFO_CNT<<UART_TXFIFO_CNT_S);
-      if ((fifo_cnt >> UART_TXFIFO_CNT_S & UART_TXFIFO_CNT) < 126) {
-        break;
+      if (txPolicy == UART_TX_DROP)
+      {
+        txDropped++;
+        return FAIL;
       }
+
+      // UART_TX_BLOCK: make room by hand. The interrupt is masked so
+      // that the handler cannot move txTail underneath us.
+      ETS_UART_INTR_DISABLE();
+      while (uart_tx_fifo_cnt(uart) >= 126)
+      {
+      }
+      uart_tx_fill_fifo(uart);
+      ETS_UART_INTR_ENABLE();
+    }
+
+    txRing[txHead] = TxChar;
+    txHead = next;
+    if (TX_RING_USED() > txHighWater)
+    {
+      txHighWater = TX_RING_USED();
     }
 
-    WRITE_PERI_REG(UART_FIFO(uart) , TxChar);
+    SET_PERI_REG_MASK(UART_INT_ENA(uart), UART_TXFIFO_EMPTY_INT_ENA);
     return OK;
 }
 
+/******************************************************************************
+ * FunctionName : uart_tx_set_policy
+ * Description  : select what happens when the TX ring is full
+ * Parameters   : UartTxPolicy policy - UART_TX_DROP or UART_TX_BLOCK
+ * Returns      : NONE
+*******************************************************************************/
+void ICACHE_FLASH_ATTR
+uart_tx_set_policy(UartTxPolicy policy)
+{
+  txPolicy = policy;
+}
+
+/******************************************************************************
+ * FunctionName : uart_tx_dropped
+ * Description  : number of characters dropped because the ring was full
+ * Returns      : dropped character count since uart_init()
+*******************************************************************************/
+uint32 ICACHE_FLASH_ATTR
+uart_tx_dropped(void)
+{
+  return txDropped;
+}
+
+/******************************************************************************
+ * FunctionName : uart_tx_highwater
+ * Description  : largest number of characters queued at one time
+ * Returns      : high water mark of the TX ring
+*******************************************************************************/
+uint16 ICACHE_FLASH_ATTR
+uart_tx_highwater(void)
+{
+  return txHighWater;
+}
+
+/******************************************************************************
+ * FunctionName : uart_tx_flush
+ * Description  : wait until the TX ring and the hardware FIFO are empty
+ *                Call before deep sleep so queued messages are not lost.
+ * Returns      : NONE
+*******************************************************************************/
+void ICACHE_FLASH_ATTR
+uart_tx_flush(void)
+{
+  while (txTail != txHead)
+  {
+    ETS_UART_INTR_DISABLE();
+    uart_tx_fill_fifo(UART0);
+    ETS_UART_INTR_ENABLE();
+  }
+  while (uart_tx_fifo_cnt(UART0) > 0)
+  {
+  }
+}
+
 /******************************************************************************
  * FunctionName : uart0_write_char
  * Description  : Internal used function
@@ -144,6 +276,9 @@ uart0_write_char(char c)
 /******************************************************************************
  * FunctionName : uart0_tx_buffer
  * Description  : use uart0 to transfer buffer
+ *                With UART_TX_DROP the buffer goes out whole or not at
+ *                all, so a framed record such as a TLOG entry is never
+ *                cut short on the wire.
  * Parameters   : uint8 *buf - point to send buffer
  *                uint16 len - buffer len
  * Returns      :
@@ -153,6 +288,13 @@ uart0_tx_buffer(uint8 *buf, uint16 len)
 {
   uint16 i;
 
+  // txTail only moves on in the interrupt, so the room can only grow
+  if ((txPolicy == UART_TX_DROP) && (len > TX_RING_MASK - TX_RING_USED()))
+  {
+    txDropped += len;
+    return;
+  }
+
   for (i = 0; i < len; i++)
   {
     uart_tx_one_char(UART0, buf[i]);
@@ -176,16 +318,17 @@ uart0_sendStr(const char *str)
 }
 
 /******************************************************************************
- * FunctionName : uart0_rx_intr_handler
+ * FunctionName : uart0_intr_handler
  * Description  : Internal used function
- *                UART0 interrupt handler, add self handle code inside
+ *                UART0 interrupt handler, refills the TX FIFO from the
+ *                TX ring and discards received characters
  * Parameters   : void *para - point to ETS_UART_INTR_ATTACH's arg
  * Returns      : NONE
 *******************************************************************************/
 //extern void at_recvTask(void);
 
 LOCAL void
-uart0_rx_intr_handler(void *para)
+uart0_intr_handler(void *para)
 {
   /* uart0 and uart1 intr combine togther, when interrupt occur, see reg
    * 0x3ff20020, bit2, bit0 represents uart1 and uart0 respectively
@@ -205,6 +348,12 @@ uart0_rx_intr_handler(void *para)
 //    system_os_post(at_recvTaskPrio, NULL, RcvChar);
 //    WRITE_PERI_REG(UART_INT_CLR(uart_no), UART_RXFIFO_FULL_INT_CLR);
 //  }
+  if(UART_TXFIFO_EMPTY_INT_ST == (READ_PERI_REG(UART_INT_ST(uart_no)) & UART_TXFIFO_EMPTY_INT_ST))
+  {
+    uart_tx_fill_fifo(uart_no);
+    WRITE_PERI_REG(UART_INT_CLR(uart_no), UART_TXFIFO_EMPTY_INT_CLR);
+  }
+
   if(UART_FRM_ERR_INT_ST == (READ_PERI_REG(UART_INT_ST(uart_no)) & UART_FRM_ERR_INT_ST))
   {
     os_printf("FRM_ERR\r\n");
@@ -214,7 +363,14 @@ uart0_rx_intr_handler(void *para)
   if(UART_RXFIFO_FULL_INT_ST == (READ_PERI_REG(UART_INT_ST(uart_no)) & UART_RXFIFO_FULL_INT_ST))
   {
 //    os_printf("fifo full\r\n");
-    ETS_UART_INTR_DISABLE();/////////
+    // Input is not used. Discard it rather than masking the UART
+    // interrupt, which would also stop the TX ring from draining.
+    while (READ_PERI_REG(UART_STATUS(uart_no)) & (UART_RXFIFO_CNT << UART_RXFIFO_CNT_S))
+    {
+      RcvChar = READ_PERI_REG(UART_FIFO(uart_no)) & 0xFF;
+    }
+    WRITE_PERI_REG(UART_INT_CLR(uart_no),
+                   UART_RXFIFO_FULL_INT_CLR | UART_RXFIFO_TOUT_INT_CLR);
 
     //system_os_post(at_recvTaskPrio, 0, 0);
 
@@ -228,7 +384,14 @@ uart0_rx_intr_handler(void *para)
   }
   else if(UART_RXFIFO_TOUT_INT_ST == (READ_PERI_REG(UART_INT_ST(uart_no)) & UART_RXFIFO_TOUT_INT_ST))
   {
-    ETS_UART_INTR_DISABLE();/////////
+    // Input is not used. Discard it rather than masking the UART
+    // interrupt, which would also stop the TX ring from draining.
+    while (READ_PERI_REG(UART_STATUS(uart_no)) & (UART_RXFIFO_CNT << UART_RXFIFO_CNT_S))
+    {
+      RcvChar = READ_PERI_REG(UART_FIFO(uart_no)) & 0xFF;
+    }
+    WRITE_PERI_REG(UART_INT_CLR(uart_no),
+                   UART_RXFIFO_FULL_INT_CLR | UART_RXFIFO_TOUT_INT_CLR);
 
 //    os_printf("stat:%02X",*(uint8 *)UART_INT_ENA(uart_no));
     //system_os_post(at_recvTaskPrio, 0, 0);
@@ -24,7 +24,7 @@
 
 void als_init(uint32_t pid, uint32_t id);
 void als_start(void);
-report_t* als_report(void);
+const report_t* als_report(void);
 void als_shutdown(void);
 
 #endif
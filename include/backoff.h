@@ -0,0 +1,52 @@
+/*
+ *  Sleep longer while the network is down
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef BACKOFF_H
+#define BACKOFF_H
+
+#include <c_types.h>
+
+/*
+ * A wake that ends without its report delivered (AP, DHCP or broker
+ * down) is a failure. The count of failures in a row is kept in RTC
+ * memory. While it is non-zero each wake gets BACKOFF_DEADLINE_MS
+ * instead of BACKOFF_NORMAL_MS to finish, and the sleep that follows
+ * doubles with every failure up to BACKOFF_MAX_SLEEP_S. The first
+ * delivered report restores the normal sleep.
+ *
+ * system_deep_sleep() takes a uint32 of micro-seconds, so the cap
+ * must stay below 4294 s.
+ */
+#ifndef BACKOFF_NORMAL_MS
+#define BACKOFF_NORMAL_MS       10000   // wake deadline
+#endif
+#ifndef BACKOFF_DEADLINE_MS
+#define BACKOFF_DEADLINE_MS     5000    // wake deadline after a failure
+#endif
+#ifndef BACKOFF_MAX_SLEEP_S
+#define BACKOFF_MAX_SLEEP_S     3600
+#endif
+
+void backoff_init(void);
+uint8 backoff_streak(void);
+uint32 backoff_deadline_ms(void);
+uint32 backoff_sleep_s(uint32 normal_s, bool delivered);
+
+#endif
@@ -24,7 +24,8 @@
 
 void battery_init(uint32_t pid, uint32_t id);
 void battery_start(void);
-report_t* battery_report(void);
+const report_t* battery_report(void);
+uint32_t battery_mv(void);
 void battery_shutdown(void);
 
 #endif
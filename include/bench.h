@@ -0,0 +1,62 @@
+/*
+ *  Bus primitive microbenchmarks
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <c_types.h>
+
+/*
+ * A BENCH=1 build replaces the application with a suite that times the
+ * 1-wire, I2C, ADC and formatting primitives with the CPU cycle
+ * counter. Each primitive is called once to load it into the flash
+ * cache, then BENCH_RUNS times, and one line per primitive is printed
+ * on the UART:
+ *
+ *    bench name=ds_reset runs=32 mhz=80 min=77012 med=77040 max=79311
+ *
+ * min, med and max are CPU cycles per call and include the cost of
+ * reading the counter, which the "empty" line measures. The suite
+ * starts with "bench start" and ends with "bench done".
+ *
+ * The simulator runs the same suite with tlsim -B. Its counter is the
+ * virtual bus time plus the host CPU time, both in cycles at the
+ * simulated clock, so host numbers only compare with other host runs.
+ * tools/bench.py compares two runs.
+ */
+#define BENCH_RUNS      32
+#define BENCH_GAP_MS    10      // between primitives, lets the SDK run
+
+#ifdef __XTENSA__
+static inline uint32
+bench_ccount(void)
+{
+    uint32 ccount;
+
+    __asm__ __volatile__("rsr %0, ccount" : "=r"(ccount));
+    return(ccount);
+}
+#else
+uint32 bench_ccount(void);      // host builds, see sim/sim_sdk.c
+#endif
+
+void bench_start(void);
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ *  MQTT broker failover
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef BROKER_H
+#define BROKER_H
+
+#include <c_types.h>
+#include "mqtt.h"
+
+/*
+ * MQTT_BROKERS in mqtt_config.h lists the brokers as strings, each a
+ * host name or IP address with an optional ":port":
+ *
+ *    #define MQTT_BROKERS  "192.168.148.1", "mqtt2.lan:1883"
+ *
+ * Without it MQTT_HOST and MQTT_PORT are the only broker.
+ *
+ * Each wake starts with the broker that last took a connection, then
+ * tries the others in list order. A broker that is not connected
+ * within BROKER_CONNECT_MS (BROKER_TLS_CONNECT_MS with TLS), host name
+ * lookup included, is given up for the next one.
+ *
+ * Host names are looked up with espconn_gethostbyname() and the
+ * address is kept in RTC memory for BROKER_DNS_TTL_S, timed by the
+ * walltime.h clock. The SDK does not pass on the TTL of the DNS answer,
+ * so this is a fixed time. An expired address is still used if a new
+ * lookup fails.
+ *
+ * The current broker's address and port are kept in sysCfg.mqtt_host
+ * and sysCfg.mqtt_port, where esp_mqtt and mqttpipe.c find them.
+ */
+#ifndef MQTT_BROKERS
+#define MQTT_BROKERS            MQTT_HOST
+#endif
+
+#define BROKER_MAX              4
+#define BROKER_CONNECT_MS       500
+#define BROKER_TLS_CONNECT_MS   3000
+#ifndef BROKER_DNS_TTL_S
+#define BROKER_DNS_TTL_S        3600
+#endif
+
+typedef void (*broker_cb_t)(void);
+
+void broker_init(void);
+void broker_attach(MQTT_Client *client);
+void broker_connect(broker_cb_t connect, broker_cb_t give_up);
+void broker_connected(void);
+void broker_stop(void);
+void broker_sleep(void);
+
+#endif
@@ -1,5 +1,16 @@
+
 // define as null to suppress debug messages from MQTT
 //#define INFO os_printf
+
+// Build with TLOG=1 to keep INFO messages in production firmware as
+// tokenized binary records (see include/tlog.h).
+#ifdef TLOG
+#include "tlog.h"
+#ifndef INFO
+#define INFO TLOG_PRINTF
+#endif
+#endif
+
 #ifndef INFO
 #define INFO
 #endif
@@ -0,0 +1,79 @@
+/*
+ *  Queued, interrupt driven I2C transactions
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef I2C_ASYNC_H
+#define I2C_ASYNC_H
+
+#include <c_types.h>
+
+/*
+ * The bit-banged calls of driver/i2c.h spin in os_delay_us() for the
+ * whole transfer. A queued transaction is clocked out by the FRC1 timer
+ * interrupt instead, one SCL half period of I2C_ASYNC_HALF_US per
+ * interrupt, on the same pins, and the CPU is free for Wi-Fi and MQTT
+ * in between. When it is done the interrupt posts it to a task at
+ * I2C_ASYNC_PRIO, which calls its done callback.
+ *
+ * The half period is not the bit-banged I2C_SLEEP_TIME: 10 us would be
+ * 100000 interrupts a second, more than the Wi-Fi and MAC interrupts
+ * can share the CPU with. 50 us is the shortest auto-reload period the
+ * SDK's hw_timer allows, and gives a 10 kHz SCL, which the ISL29035
+ * accepts.
+ *
+ * A transaction writes the register pointer and wlen bytes of data,
+ * then, if rlen is not 0, reads rlen bytes after a repeated start into
+ * data. A byte that is not acknowledged ends it with I2C_XFER_NACK.
+ * The transaction belongs to the driver from i2c_async_queue() until
+ * its callback, so keep it static. FRC1 is also the SDK's PWM and
+ * hw_timer clock, neither of which this firmware uses.
+ *
+ * Do not mix the bit-banged calls with queued transactions unless
+ * i2c_async_cancel() has returned.
+ */
+#define I2C_ASYNC_HALF_US   50  // SCL half period, one interrupt
+#define I2C_ASYNC_PRIO      2   // 0 used by MQTT, 1 by the reporter
+#define I2C_ASYNC_QLEN      4   // transactions queued at once
+#define I2C_ASYNC_MAX       4   // bytes of data written or read
+
+enum i2c_xfer_status {
+    I2C_XFER_QUEUED,
+    I2C_XFER_DONE,
+    I2C_XFER_NACK,
+};
+
+typedef struct i2c_xfer i2c_xfer_t;
+typedef void (*i2c_done_cb)(i2c_xfer_t *xfer);
+
+struct i2c_xfer {
+    uint8 addr;                 // device write address, e.g. ISL_WRITE_ADDR
+    uint8 reg;                  // register pointer, always written
+    uint8 wlen;                 // data bytes written after it
+    uint8 rlen;                 // data bytes read after a repeated start
+    uint8 data[I2C_ASYNC_MAX];
+    uint8 status;               // enum i2c_xfer_status
+    i2c_done_cb done;
+    i2c_xfer_t *next;           // driver use
+};
+
+void i2c_async_init(void);
+bool i2c_async_queue(i2c_xfer_t *xfer);
+void i2c_async_cancel(void);
+
+#endif
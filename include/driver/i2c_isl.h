@@ -73,6 +73,13 @@
 #define ISL_ADC_8_BIT       0x08
 #define ISL_ADC_4_BIT       0x0c
 
+/*
+ * ISL_ID_REG values
+ */
+#define ISL_ID_BOUT         0x80    // brownout
+#define ISL_ID_MASK         0x38
+#define ISL_ID_ISL29035     0x28
+
 void isl_write_byte(uint8 addr, uint8 data);
 uint8 isl_read_byte(uint8 addr);
 uint16 isl_read_word(uint8 addr);
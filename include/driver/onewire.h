@@ -32,7 +32,7 @@
 
 
 void ICACHE_FLASH_ATTR ds_init(int power);
-void ICACHE_FLASH_ATTR ds_reset(void);
+bool ICACHE_FLASH_ATTR ds_reset(void);
 void ICACHE_FLASH_ATTR ds_write(uint8_t cmd);
 uint8_t ICACHE_FLASH_ATTR ds_read(void);
 
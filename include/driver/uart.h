@@ -32,6 +32,28 @@
 #define UART0   0
 #define UART1   1
 
+/*
+ * Size of the interrupt drained TX ring. Must be a power of two.
+ */
+#ifndef UART_TX_RING_SIZE
+#define UART_TX_RING_SIZE   512
+#endif
+
+/*
+ * What to do when a character is written and the TX ring is full:
+ *   UART_TX_DROP  - discard the character and count it (no stall);
+ *                   uart0_tx_buffer() drops the whole buffer instead
+ *   UART_TX_BLOCK - push out the oldest character by polling (lossless)
+ */
+typedef enum {
+    UART_TX_DROP,
+    UART_TX_BLOCK
+} UartTxPolicy;
+
+#ifndef UART_TX_POLICY_DEFAULT
+#define UART_TX_POLICY_DEFAULT  UART_TX_DROP
+#endif
+
 typedef enum {
     FIVE_BITS = 0x0,
     SIX_BITS = 0x1,
@@ -118,7 +140,12 @@ typedef struct {
 } UartDevice;
 
 void uart_init(UartBautRate uart0_br);
+void uart0_tx_buffer(uint8 *buf, uint16 len);
 void uart0_sendStr(const char *str);
+void uart_tx_set_policy(UartTxPolicy policy);
+uint32 uart_tx_dropped(void);
+uint16 uart_tx_highwater(void);
+void uart_tx_flush(void);
 
 #endif
 
@@ -22,9 +22,30 @@
 #define DS18B20_H
 #include <report.h>
 
+/*
+ * DS18B20_WIRED builds are for boards that power the probe from VDD, so
+ * that it keeps its scratchpad through deep sleep. ds18B20_sleep()
+ * starts the conversion for the next wake just before the node sleeps,
+ * and ds18B20_init() reads the result straight away instead of waiting
+ * up to 750 ms for a new one. The reading is then as old as the sleep,
+ * so sleeps longer than DS18B20_FRESH_S are not pre-armed.
+ *
+ * With the conversion, the TH and TL bytes of the scratchpad are set to
+ * a tag kept in the RTC context of warm.h, and the reading is only used
+ * if the tag reads back after a warm boot. A probe that lost its supply
+ * comes back with TH and TL from its EEPROM, which is never written.
+ * Otherwise the wake converts and waits as usual. The alarm search that
+ * TH and TL are meant for is not used.
+ */
+#ifndef DS18B20_FRESH_S
+#define DS18B20_FRESH_S     900     // three wakes at 300 s
+#endif
+
 void ds18B20_init(uint32_t pid, uint32_t id);
 void ds18B20_start(void);
-report_t* ds18B20_report(void);
+const report_t* ds18B20_report(void);
+bool ds18B20_temp_mc(sint32 *mc);
 void ds18B20_shutdown(void);
+void ds18B20_sleep(uint32 sleepUs);
 
 #endif
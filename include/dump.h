@@ -0,0 +1,77 @@
+/*
+ *  Binary diagnostics record
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef DUMP_H
+#define DUMP_H
+
+#include <c_types.h>
+
+/*
+ * The system state that used to be printed by dumpInfo() goes out as a
+ * fixed DUMP_RECORD_LEN byte record on <device_id>/diag, alongside the
+ * report, on the first wake after any reset other than a deep sleep
+ * wake and every DUMP_WAKES wakes after that. A record that is not
+ * delivered is sent again the next wake; the reset it was for and its
+ * exception registers are kept in RTC memory until then. MAINS builds
+ * do not send it. TLOG builds also keep the last log records for after
+ * a reset, see tlog.h.
+ *
+ * Decode it with tools/dump.py:
+ *
+ *    $ mosquitto_sub -t '+/diag' -F '%t %x' | tools/dump.py
+ *
+ * All values are little endian:
+ *
+ *    0  version         u8, DUMP_VERSION
+ *    1  flags           u8, DUMP_RETRY: the reset was before this wake
+ *    2  reset reason    u8, enum rst_reason
+ *    3  exccause        u8
+ *    4  epc1            u32, 0 after a deep sleep wake
+ *    8  epc2            u32
+ *   12  epc3            u32
+ *   16  excvaddr        u32
+ *   20  depc            u32
+ *   24  flash ID        u32, spi_flash_get_id()
+ *   28  userbin addr    u32
+ *   32  RTC period      u32, us per tick with 12 fractional bits
+ *   36  RTC ticks       u32
+ *   40  time            u32, us since reset
+ *   44  free heap       u16, bytes
+ *   46  supply          u16, mV
+ *   48  wakes           u16, since the last record delivered
+ *   50  CPU clock       u8, MHz
+ *   51  flash size map  u8, enum flash_size_map
+ *   52  boot version    u8
+ *   53  boot mode       u8
+ *   54  SDK version     10 chars, NUL padded
+ */
+#ifndef DUMP_WAKES
+#define DUMP_WAKES          288     // a day at 300 s
+#endif
+#define DUMP_VERSION        1
+#define DUMP_RECORD_LEN     64
+#define DUMP_RETRY          0x01
+
+void dump_init(void);
+bool dump_due(void);
+uint8 dump_record(uint8 *buf);
+void dump_sleep(bool delivered);
+
+#endif
@@ -0,0 +1,76 @@
+/*
+ *  Per-wake energy estimate
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef ENERGY_H
+#define ENERGY_H
+
+#include <c_types.h>
+
+/*
+ * Time awake is split between the states below, and the charge used
+ * is the time in each state multiplied by the state's current. Sensor
+ * conversions run in parallel with the other states, so the drivers
+ * add their charge separately with energy_sensor().
+ *
+ * The currents are typical values for an ESP-12 module and should be
+ * adjusted to measurements of the actual board.
+ */
+typedef enum {
+    ENERGY_CPU,     // boot, RF calibration, CPU work without WiFi
+    ENERGY_ASSOC,   // radio on, associating with the AP and DHCP
+    ENERGY_RADIO,   // radio on, TCP/MQTT traffic
+    ENERGY_STATES
+} energy_state_t;
+
+#ifndef ENERGY_CPU_UA
+#define ENERGY_CPU_UA       30000
+#endif
+#ifndef ENERGY_ASSOC_UA
+#define ENERGY_ASSOC_UA     75000
+#endif
+#ifndef ENERGY_RADIO_UA
+#define ENERGY_RADIO_UA     85000
+#endif
+#ifndef ENERGY_SLEEP_UA
+#define ENERGY_SLEEP_UA     25      // ESP deep sleep plus regulator
+#endif
+
+/*
+ * Battery model for the days remaining estimate. The remaining
+ * capacity is taken to be linear in voltage between EMPTY and FULL.
+ */
+#ifndef ENERGY_BATTERY_MAH
+#define ENERGY_BATTERY_MAH  2000
+#endif
+#ifndef ENERGY_VBAT_FULL_MV
+#define ENERGY_VBAT_FULL_MV 3300
+#endif
+#ifndef ENERGY_VBAT_EMPTY_MV
+#define ENERGY_VBAT_EMPTY_MV 2800
+#endif
+
+void energy_init(void);
+void energy_state(energy_state_t state);
+void energy_sensor(uint32 usec, uint32 ua);
+void energy_sleep(uint32 sleep_us);
+uint32 energy_cycle_uah(void);
+uint32 energy_days_left(uint32 vbat_mv, uint32 cycle_uah);
+
+#endif
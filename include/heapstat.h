@@ -0,0 +1,50 @@
+/*
+ *  Heap instrumentation
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef HEAPSTAT_H
+#define HEAPSTAT_H
+
+#include <c_types.h>
+
+/*
+ * When built with HEAPSTAT=1, files that include this header after
+ * mem.h have their os_zalloc()/os_free() calls counted per call site.
+ * heapstat_check() is called from user_deep_sleep() to log the call
+ * sites and save a summary in RTC memory. The summary is published by
+ * the next wake with heapstat_summary().
+ */
+#define HEAPSTAT_SITES      16  // call sites tracked
+#define HEAPSTAT_LEAKS      4   // leaking call sites kept across sleep
+#define HEAPSTAT_BUF_SIZE   128 // space for heapstat_summary()
+
+void *heapstat_zalloc(uint32 size, const char *file, int line);
+void heapstat_free(void *ptr);
+void heapstat_check(void);
+uint8 heapstat_summary(char *buf, uint8 bsize);
+
+#if defined(HEAPSTAT) && !defined(HEAPSTAT_IMPL)
+#include <mem.h>
+#undef os_zalloc
+#undef os_free
+#define os_zalloc(s) heapstat_zalloc((s), __FILE__, __LINE__)
+#define os_free(p) heapstat_free(p)
+#endif
+
+#endif
@@ -0,0 +1,81 @@
+/*
+ *  Continuous sampling for mains powered nodes
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef MAINS_H
+#define MAINS_H
+
+#include <c_types.h>
+#include "report.h"
+
+#if defined(MAINS) && defined(MQTTSN)
+#error "MAINS needs the MQTT client, not MQTTSN"
+#endif
+
+/*
+ * A MAINS=1 build never deep sleeps. The MQTT connection stays up,
+ * kept alive by esp_mqtt's PINGREQ every MQTT_KEEPALIVE seconds and
+ * reconnected by it and broker.c when it drops. The drivers are
+ * started again every MAINS_SAMPLE_S, and each sample is kept until
+ * MAINS_BATCH_MS after the first one of a batch, or until
+ * MAINS_BATCH_MAX are waiting. They are then sent as one message on
+ * <device_id>/batch:
+ *
+ *    1,2,<samples>,<time>
+ *    <age>,<temperature>,<light>,<supply>
+ *    ...
+ *
+ * The first line is the device type (1), the batch version (2), and
+ * the Unix time of the publish from walltime.h, empty if it is not
+ * known yet. Each sample follows on a line of its own, oldest first.
+ * age is the seconds from the sample to the publish, to 0.1 s, so a
+ * sample was taken at time - age. The others are the fields of the
+ * report message, empty if the sensor did not answer.
+ *
+ * MAINS_BATCH_MS of 0 sends each sample as soon as it is taken.
+ * Samples and the message are in static memory; a batch esp_mqtt can
+ * not queue (QUEUE_BUFFER_SIZE) while the broker is away is lost.
+ * system_get_time() wraps after 71 minutes, so MAINS_BATCH_MS must be
+ * well below that.
+ */
+#ifndef MAINS_SAMPLE_S
+#define MAINS_SAMPLE_S      10
+#endif
+#ifndef MAINS_BATCH_MS
+#define MAINS_BATCH_MS      60000
+#endif
+#ifndef MAINS_BATCH_MAX
+#define MAINS_BATCH_MAX     16
+#endif
+
+#define MAINS_ID_VERSION_STR    "1,2"
+
+// longest sample line: an age, three reports, the commas and '\n'
+#define MAINS_LINE_MAX      (4 * REPORT_MAX_CHARS + 4)
+#define MAINS_BUF_SIZE      (32 + MAINS_BATCH_MAX * MAINS_LINE_MAX)
+
+typedef void (*mains_sample_cb_t)(void);
+typedef void (*mains_flush_cb_t)(const char *batch);
+
+void mains_start(mains_sample_cb_t sample, mains_flush_cb_t flush);
+void mains_add(const report_t *temperature, const report_t *light,
+        const report_t *supply);
+void mains_flush(void);
+
+#endif
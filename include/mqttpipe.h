@@ -0,0 +1,60 @@
+/*
+ *  Pipelined MQTT CONNECT and PUBLISH
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef MQTTPIPE_H
+#define MQTTPIPE_H
+
+#include <c_types.h>
+#include "mqtt.h"
+
+#if defined(MQTTPIPE) && defined(MQTTSN)
+#error "MQTTPIPE and MQTTSN can not be used together"
+#endif
+
+/*
+ * When built with MQTTPIPE=1, QoS 0 reports skip the CONNACK round
+ * trip: the CONNECT packet is built once from sysCfg, the PUBLISH
+ * packets are added behind it in the same static buffer, and the
+ * whole buffer, DISCONNECT included, is written as soon as the TCP
+ * connection is up.
+ *
+ * If the broker refuses the connection, closes it, or does not send
+ * CONNACK in time, the queued messages are handed to the esp_mqtt
+ * client instead and pipelining is skipped for MQTTPIPE_BACKOFF
+ * wakes. The broker must be an IP address, or a host name with an
+ * address in the broker.h cache, and TLS (DEFAULT_SECURITY 1) is not
+ * pipelined.
+ */
+#define MQTTPIPE_BUF_SIZE   512
+#define MQTTPIPE_TIMEOUT_MS 2000    // TCP connect to CONNACK
+#define MQTTPIPE_BACKOFF    32      // wakes to use esp_mqtt after a failure
+
+typedef void (*mqttpipe_cb_t)(uint32_t *args);
+
+bool mqttpipe_init(MQTT_Client *client);
+void mqttpipe_on_published(mqttpipe_cb_t cb);
+bool mqttpipe_connect(void);
+bool mqttpipe_publish(const char *topic, const char *data, uint16 len,
+        uint8 retain);
+void mqttpipe_flush(void);
+bool mqttpipe_disconnect(mqttpipe_cb_t cb);
+void mqttpipe_stop(void);
+
+#endif
@@ -0,0 +1,87 @@
+/*
+ *  MQTT-SN client over UDP
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef MQTTSN_H
+#define MQTTSN_H
+
+#include <c_types.h>
+#include "mqtt_config.h"
+
+/*
+ * When built with MQTTSN=1 the reports go to an MQTT-SN gateway over
+ * UDP instead of to the broker over TCP. Topics are pre-registered
+ * topic IDs, configured on the gateway, so no REGISTER exchange is
+ * needed.
+ *
+ * With MQTTSN_QOS -1 there is no connection at all: the connected
+ * callback is called as soon as mqttsn_connect() is called and each
+ * report is a single datagram. The gateway can not tell the nodes
+ * apart, so every node needs its own topic IDs. QoS 0 and 1 send
+ * CONNECT first and wait for CONNACK; QoS 1 also waits for PUBACK.
+ * A PUBACK that reports congestion sends the message again after
+ * MQTTSN_BUSY_MS. Any other rejection, or no PUBACK after the retries,
+ * goes to the failed callback instead of the published one.
+ *
+ * The settings below can be overridden in mqtt_config.h.
+ */
+#ifndef MQTTSN_HOST
+#define MQTTSN_HOST         MQTT_HOST   // gateway IP address
+#endif
+#ifndef MQTTSN_PORT
+#define MQTTSN_PORT         1884
+#endif
+#ifndef MQTTSN_QOS
+#define MQTTSN_QOS          (-1)
+#endif
+#ifndef MQTTSN_TOPIC_REPORT
+#define MQTTSN_TOPIC_REPORT 1       // <device_id>/report
+#endif
+#ifndef MQTTSN_TOPIC_HEAP
+#define MQTTSN_TOPIC_HEAP   2       // <device_id>/heap
+#endif
+#ifndef MQTTSN_TOPIC_DIAG
+#define MQTTSN_TOPIC_DIAG   3       // <device_id>/diag
+#endif
+#ifndef MQTTSN_TOPIC_LOG
+#define MQTTSN_TOPIC_LOG    4       // <device_id>/log
+#endif
+#ifndef MQTTSN_TOPIC_HW
+#define MQTTSN_TOPIC_HW     5       // <device_id>/hw
+#endif
+
+#define MQTTSN_RETRY_MS     500     // CONNECT and QoS 1 PUBLISH retry
+#define MQTTSN_RETRIES      3
+#define MQTTSN_BUSY_MS      1000    // PUBLISH retry after congestion
+#define MQTTSN_MAX_PACKET   255     // one length byte
+
+// callbacks have the esp_mqtt signature so app.c can use either client
+typedef void (*mqttsn_cb_t)(uint32_t *args);
+
+void mqttsn_init(const char *host, uint16 port, const char *client_id,
+        uint16 keepalive);
+void mqttsn_on_connected(mqttsn_cb_t cb);
+void mqttsn_on_published(mqttsn_cb_t cb);
+void mqttsn_on_failed(mqttsn_cb_t cb);
+void mqttsn_connect(void);
+bool mqttsn_publish(uint16 topic_id, const char *data, uint16 len,
+        sint8 qos, uint8 retain);
+bool mqttsn_disconnect(mqttsn_cb_t cb);
+
+#endif
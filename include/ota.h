@@ -0,0 +1,98 @@
+/*
+ *  Delta firmware updates over HTTP
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef OTA_H
+#define OTA_H
+
+#include <c_types.h>
+
+#if defined(OTA) && defined(MAINS)
+#error "OTA checks once the report is out, MAINS never gets there"
+#endif
+
+/*
+ * An OTA=1 build asks an HTTP server for an update on the first wake
+ * after power-on and every OTA_CHECK_WAKES after that, once the report
+ * is out:
+ *
+ *    GET /ota/<sha1 of the running image, 40 hex digits>
+ *
+ * The server answers 404 when it has nothing for that image, or with
+ * a delta from it to the new image, made and served by tools/ota.py:
+ *
+ *    $ tools/ota.py delta old/firmware new/firmware -o update.tld
+ *    $ tools/ota.py serve update.tld
+ *
+ * OTA builds use the two slot layout of the SDK boot loader, which is
+ * at 0x00000 and boots user1.bin at OTA_SLOT1_ADDR or user2.bin at
+ * OTA_SLOT2_ADDR. The two are the same build linked for each slot, as
+ * esptool.py elf2image --version=2 writes them, and the SHA1 is taken
+ * over the one running. The update never writes the slot it runs from:
+ *
+ *  1. The delta is applied as it arrives, into the other slot. A
+ *     sector of the new image is built in RAM, from bytes of the
+ *     running image and bytes of the delta, and written; then the next.
+ *     Reception is held while a sector is written, and the radio is
+ *     turned off once all of the delta is in.
+ *  2. The slot is read back and its SHA1 checked against the one in
+ *     the delta. A delta that is corrupt, for another image or for the
+ *     wrong slot goes no further.
+ *  3. The boot loader is told to boot the other slot, and the chip
+ *     restarts into the new image.
+ *
+ * Power lost before step 3 leaves the running image as it was, and the
+ * next check starts the update again. Sectors of the other slot that
+ * already hold the new bytes are not written again.
+ *
+ * The delta is a list of commands for each 4 KB sector of the new
+ * image: copy bytes from the running image, or take them from the
+ * delta. The two images are linked at different addresses, so every
+ * address of the irom code that the image holds differs between them
+ * and comes from the delta.
+ *
+ * There is no check while the battery is below OTA_MIN_MV.
+ */
+#ifndef OTA_HOST
+#define OTA_HOST            MQTT_HOST   // a local server, IP address
+#endif
+#ifndef OTA_PORT
+#define OTA_PORT            8266
+#endif
+#ifndef OTA_CHECK_WAKES
+#define OTA_CHECK_WAKES     288         // a day at 300 s
+#endif
+#ifndef OTA_MIN_MV
+#define OTA_MIN_MV          3000
+#endif
+#define OTA_TIMEOUT_MS      60000       // longest download
+#define OTA_BUF_SIZE        256
+
+// the 512 KB layout of eagle.app.v6.new.512.app1.ld and app2.ld: slot
+// 1 ends at the user parameter sectors, slot 2 at esp_init_data
+#define OTA_SLOT1_ADDR      0x01000
+#define OTA_SLOT2_ADDR      0x41000
+#define OTA_SLOT_SIZE       0x3B000
+
+typedef void (*ota_done_cb_t)(void);
+
+void ota_init(void);
+bool ota_check(ota_done_cb_t done);
+
+#endif
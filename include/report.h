@@ -21,13 +21,39 @@
 #ifndef REPORT_H
 #define REPORT_H
 
+#include <c_types.h>
+
+typedef enum {
+    UNIT_NONE = 0,
+    UNIT_CELSIUS,
+    UNIT_LUX,
+    UNIT_VOLT,
+    UNIT_SECOND,
+} report_unit_t;
+
+typedef enum {
+    REPORT_OK = 0,
+    REPORT_NOT_READY,   // not measured this wake
+    REPORT_NO_SENSOR,   // nothing answered
+} report_status_t;
+
+/*
+ * A measurement is value * 10^-scale in unit: { 21500, 3, UNIT_CELSIUS }
+ * is 21.5 C. Drivers keep their report in static memory and return a
+ * pointer that stays valid until the wake ends. Text is only made when
+ * the report is serialized.
+ */
 typedef struct report_s {
-    uint8_t len;    // length of null terminated string in buffer
-    uint8_t bsize;  // buffer size
-    char *  buffer; // buffer
+    sint32 value;
+    uint8 scale;    // decimal places, up to REPORT_MAX_SCALE
+    uint8 unit;     // report_unit_t
+    uint8 status;   // report_status_t
 } report_t;
 
-report_t *newReport(uint8_t bsize);
-void freeReport(report_t *report);
+#define REPORT_MAX_SCALE    9
+#define REPORT_MAX_CHARS    13  // "-2147483648" with a '.', plus NUL
+
+uint8 report_decimal(char *buf, sint32 value, uint8 scale);
+uint8 report_format(char *buf, const report_t *report);
 
 #endif
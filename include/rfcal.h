@@ -0,0 +1,53 @@
+/*
+ *  RF calibration policy across deep sleep
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef RFCAL_H
+#define RFCAL_H
+
+#include <c_types.h>
+
+/*
+ * system_deep_sleep_set_option() picks the RF calibration done on the
+ * next deep sleep wake. Power-on always does a full calibration.
+ * After that a wake is only calibrated when RFCAL_EVERY wakes have
+ * passed since the last calibration, or when the DS18B20 reading has
+ * moved RFCAL_TEMP_DELTA_MC from the one taken at that calibration.
+ * RFCAL_EVERY 1 calibrates every wake, as the SDK default does.
+ */
+#ifndef RFCAL_EVERY
+#define RFCAL_EVERY         24      // wakes, 2 hours at 300 s
+#endif
+#ifndef RFCAL_TEMP_DELTA_MC
+#define RFCAL_TEMP_DELTA_MC 5000    // milli-degC
+#endif
+
+// system_deep_sleep_set_option() values
+#define RFCAL_FULL          1       // RF_CAL after the wake
+#define RFCAL_SKIP          2       // no RF_CAL, lower current
+
+#define RFCAL_NO_TEMP       ((sint32)0x80000000)
+
+void rfcal_init(void);
+void rfcal_init_done(void);
+uint8 rfcal_mode(void);
+uint32 rfcal_init_ms(void);
+void rfcal_sleep(sint32 temp_mc);
+
+#endif
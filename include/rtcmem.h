@@ -0,0 +1,89 @@
+/*
+ *  RTC user memory map
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef RTCMEM_H
+#define RTCMEM_H
+
+/*
+ * The ESP8266 keeps 512 bytes of user RTC memory through deep sleep.
+ * It is addressed in 4 byte blocks, from block 64 to block 191, and is
+ * accessed with system_rtc_mem_read()/system_rtc_mem_write().
+ *
+ * Each module that keeps state across deep sleep owns one range below.
+ * The contents are garbage after power-on, so every record starts with
+ * a magic number that is checked before the record is used. The ranges
+ * of HEAPSTAT and TLOG are empty in builds without them, which moves
+ * the others; a record left by a different build fails the check.
+ */
+#define RTC_USER_BASE       64
+#define RTC_USER_END        192
+#define RTC_BLOCKS(bytes)   (((bytes) + 3) / 4)
+
+#define RTC_HEAPSTAT_ADDR   RTC_USER_BASE           // heapstat.c
+#ifdef HEAPSTAT
+#define RTC_HEAPSTAT_SIZE   21
+#else
+#define RTC_HEAPSTAT_SIZE   0
+#endif
+
+#define RTC_ENERGY_ADDR     (RTC_HEAPSTAT_ADDR + RTC_HEAPSTAT_SIZE) // energy.c
+#define RTC_ENERGY_SIZE     4
+
+#define RTC_MQTTPIPE_ADDR   (RTC_ENERGY_ADDR + RTC_ENERGY_SIZE) // mqttpipe.c
+#define RTC_MQTTPIPE_SIZE   2
+
+#define RTC_BACKOFF_ADDR    (RTC_MQTTPIPE_ADDR + RTC_MQTTPIPE_SIZE) // backoff.c
+#define RTC_BACKOFF_SIZE    2
+
+#define RTC_RFCAL_ADDR      (RTC_BACKOFF_ADDR + RTC_BACKOFF_SIZE) // rfcal.c
+#define RTC_RFCAL_SIZE      4
+
+#define RTC_BROKER_ADDR     (RTC_RFCAL_ADDR + RTC_RFCAL_SIZE) // broker.c
+#define RTC_BROKER_SIZE     12
+
+#define RTC_WALLTIME_ADDR   (RTC_BROKER_ADDR + RTC_BROKER_SIZE) // walltime.c
+#define RTC_WALLTIME_SIZE   8
+
+#define RTC_SCHEDULE_ADDR   (RTC_WALLTIME_ADDR + RTC_WALLTIME_SIZE) // schedule.c
+#define RTC_SCHEDULE_SIZE   3
+
+#define RTC_OTA_ADDR        (RTC_SCHEDULE_ADDR + RTC_SCHEDULE_SIZE) // ota.c
+#define RTC_OTA_SIZE        2
+
+#define RTC_DUMP_ADDR       (RTC_OTA_ADDR + RTC_OTA_SIZE) // dump.c
+#define RTC_DUMP_SIZE       7
+
+#define RTC_WARM_ADDR       (RTC_DUMP_ADDR + RTC_DUMP_SIZE) // warm.c
+#define RTC_WARM_SIZE       3
+
+#define RTC_TLOG_ADDR       (RTC_WARM_ADDR + RTC_WARM_SIZE) // tlog.c
+#ifdef TLOG
+#define RTC_TLOG_SIZE       32
+#else
+#define RTC_TLOG_SIZE       0
+#endif
+
+#define RTC_NEXT_ADDR       (RTC_TLOG_ADDR + RTC_TLOG_SIZE)
+
+#if RTC_NEXT_ADDR > RTC_USER_END
+#error "RTC memory ranges do not fit"
+#endif
+
+#endif
@@ -0,0 +1,70 @@
+/*
+ *  Wake schedule on a fixed grid
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <c_types.h>
+
+/*
+ * Wakes are put on a grid of whole multiples of the period on the
+ * walltime.h clock, which is Unix time once it has been synced: with
+ * a period of 300 s the node wakes at :00, :05, :10 and so on. The
+ * sleep is counted from the grid, not from the end of the wake, so the
+ * awake time and the RTC calibration error (the learned trim) no longer
+ * move the next wake.
+ *
+ * Each node wakes at its own offset into the period, so a fleet that
+ * was powered on together does not reach the AP and the broker in the
+ * same second. The offset is taken from system_get_chip_id(), spread
+ * over the period by a multiplicative hash, unless the broker assigns
+ * one: a retained message on <device_id>/slot holding the offset in
+ * milliseconds, for example:
+ *
+ *    mosquitto_pub -r -t <device_id>/slot -m 150000
+ *
+ * The node subscribes to it on the first wake after power-on
+ * and every SCHEDULE_CHECK_WAKES after that, and keeps the answer in
+ * RTC memory. A check that gets no message in SCHEDULE_SLOT_WAIT_MS
+ * goes back to the chip ID offset. MQTT-SN and pipelined MQTT builds
+ * do not subscribe and always use the chip ID.
+ *
+ * A longer sleep, such as a backoff, wakes on the grid point nearest
+ * to that much later. A wake that failed to report adds up to
+ * SCHEDULE_JITTER_MS at random, so nodes that failed together in one
+ * slot do not retry together. A wake never sleeps less than half a
+ * period. SCHEDULE_SLOT=0 puts every node at offset 0.
+ */
+#ifndef SCHEDULE_SLOT
+#define SCHEDULE_SLOT           1
+#endif
+#ifndef SCHEDULE_JITTER_MS
+#define SCHEDULE_JITTER_MS      5000
+#endif
+#define SCHEDULE_CHECK_WAKES    288     // a day at 300 s
+#define SCHEDULE_SLOT_WAIT_MS   500
+#define SCHEDULE_SLOT_TOPIC     "/slot"
+
+void schedule_init(void);
+bool schedule_check_due(void);
+void schedule_set_offset(const char *data, uint16 len);
+uint32 schedule_sleep_us(uint32 period_s, uint32 sleep_s, bool retry);
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ *  Tokenized logging
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef TLOG_H
+#define TLOG_H
+
+#include <c_types.h>
+
+/*
+ * TLOG_PRINTF(fmt, ...) replaces os_printf() for INFO messages when the
+ * firmware is built with TLOG=1.
+ *
+ * The format string is placed in the .tlog_fmt section, which
+ * tools/tlog.ld links as a non-loaded section starting at address 0.
+ * The string's offset in that section is its 16-bit message ID, so
+ * the strings take no space in flash and are never formatted on the
+ * target. tools/tlog.py builds the ID table from the .out file and
+ * decodes the UART stream on the host.
+ *
+ * Up to 8 arguments are supported. Each argument is sent either as a
+ * string (char or uint8 pointer/array) or as a 32-bit integer.
+ *
+ * Record format on the UART:
+ *    TLOG_SYNC, id (2 bytes, LSB first), payload length, payload
+ * Integers are sent as unsigned LEB128 varints, strings as a length
+ * byte followed by the characters.
+ */
+#define TLOG_SYNC       0xa5
+#define TLOG_MAX_ARGS   8
+#define TLOG_MAX_STR    24      // longer strings are truncated
+
+/*
+ * The records also go to a ring in RTC memory, which survives a reset,
+ * so the last TLOG_RING_LEN bytes of them are there after a watchdog
+ * or exception reset. A wake that ends in such a reset, or that goes
+ * to sleep without delivering its report, freezes the ring, and the
+ * next wake that reports publishes it on <device_id>/log. The ring
+ * starts on a record and is empty once delivered. Decode it with:
+ *
+ *    $ mosquitto_sub -t '+/log' -F '%x' | xxd -r -p \
+ *          | tools/tlog.py decode firmware/tlog_table.txt
+ *
+ * The registers of the exception are in the record of dump.h.
+ */
+#define TLOG_RING_LEN   120     // bytes, RTC_TLOG_SIZE less the header
+
+void tlog_write(uint16 id, uint8 nargs, uint8 strmask, ...);
+void tlog_ring_init(void);
+bool tlog_ring_due(void);
+uint8 tlog_ring_copy(uint8 *buf);
+void tlog_ring_sleep(bool delivered);
+
+#define TLOG_CAT_(a, b) a ## b
+#define TLOG_CAT(a, b) TLOG_CAT_(a, b)
+
+#define TLOG_NARGS(...) \
+    TLOG_NARGS_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define TLOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, N, ...) N
+
+#define TLOG_IS_STR(x) \
+    (__builtin_types_compatible_p(typeof((x) + 0), char *) \
+     || __builtin_types_compatible_p(typeof((x) + 0), const char *) \
+     || __builtin_types_compatible_p(typeof((x) + 0), uint8 *) \
+     || __builtin_types_compatible_p(typeof((x) + 0), const uint8 *))
+
+#define TLOG_M0()  0
+#define TLOG_M1(a) (TLOG_IS_STR(a))
+#define TLOG_M2(a, b) \
+    (TLOG_M1(a) | TLOG_IS_STR(b) << 1)
+#define TLOG_M3(a, b, c) \
+    (TLOG_M2(a, b) | TLOG_IS_STR(c) << 2)
+#define TLOG_M4(a, b, c, d) \
+    (TLOG_M3(a, b, c) | TLOG_IS_STR(d) << 3)
+#define TLOG_M5(a, b, c, d, e) \
+    (TLOG_M4(a, b, c, d) | TLOG_IS_STR(e) << 4)
+#define TLOG_M6(a, b, c, d, e, f) \
+    (TLOG_M5(a, b, c, d, e) | TLOG_IS_STR(f) << 5)
+#define TLOG_M7(a, b, c, d, e, f, g) \
+    (TLOG_M6(a, b, c, d, e, f) | TLOG_IS_STR(g) << 6)
+#define TLOG_M8(a, b, c, d, e, f, g, h) \
+    (TLOG_M7(a, b, c, d, e, f, g) | TLOG_IS_STR(h) << 7)
+#define TLOG_MASK(...) \
+    TLOG_CAT(TLOG_M, TLOG_NARGS(__VA_ARGS__))(__VA_ARGS__)
+
+#define TLOG_PRINTF(fmt, ...) do { \
+    static const char tlog_fmt[] \
+        __attribute__((section(".tlog_fmt"), used)) = fmt; \
+    tlog_write((uint16)(uint32)tlog_fmt, \
+            TLOG_NARGS(__VA_ARGS__), \
+            TLOG_MASK(__VA_ARGS__), ##__VA_ARGS__); \
+} while (0)
+
+#endif
@@ -0,0 +1,76 @@
+/*
+ *  Wall clock time across deep sleep
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef WALLTIME_H
+#define WALLTIME_H
+
+#include <c_types.h>
+
+/*
+ * The time is set by an SNTP query to WALLTIME_NTP_HOST, a dotted quad
+ * IP address, at most once every WALLTIME_SYNC_S. In between it is
+ * carried in RTC memory and moved on by the RTC counter, which keeps
+ * running through deep sleep: each interval is its ticks times the
+ * average of the system_rtc_clock_cali_proc() periods at its two
+ * ends.
+ *
+ * The calibration has an error of its own. When a sync comes at least
+ * WALLTIME_LEARN_S after the last one, the offset it finds is turned
+ * into a trim in parts per billion that is applied from then on, so
+ * the error at the next sync is smaller. Offsets over WALLTIME_MAX_PPM
+ * are taken as a bad reply and only step the clock.
+ *
+ * The SDK's own sntp_ API only gives whole seconds, so the query is
+ * made here over UDP, and the reply is corrected by half the round
+ * trip.
+ *
+ * The clock runs from power-on, before the first sync, and steps to
+ * Unix time then. The time is no longer known, but the trim is kept,
+ * after any reset other than a deep sleep wake or system_restart(),
+ * because the RTC counter starts over.
+ * The counter wraps after about 6.8 hours, so walltime_save() or
+ * walltime_now() must be called more often than that. A deep sleep can
+ * not be longer than 71 minutes anyway.
+ */
+#ifndef WALLTIME_NTP_HOST
+#define WALLTIME_NTP_HOST   MQTT_HOST   // a local server, IP address
+#endif
+#ifndef WALLTIME_SYNC_S
+#define WALLTIME_SYNC_S     86400
+#endif
+#define WALLTIME_LEARN_S    3600
+#define WALLTIME_MAX_PPM    500
+#define WALLTIME_REPLY_MS   200     // longest wait for a reply at sleep
+// system_deep_sleep(0) never wakes, so a wake that is already due
+// sleeps this long instead
+#define WALLTIME_MIN_SLEEP_US   1000000
+
+typedef void (*walltime_cb_t)(void);
+
+void walltime_init(void);
+void walltime_sync(void);
+bool walltime_wait(walltime_cb_t done);
+bool walltime_now(uint64 *us);
+uint64 walltime_clock_us(void);
+uint32 walltime_sleep_us(uint64 at_us);
+uint8 walltime_format(char *buf);
+void walltime_save(void);
+
+#endif
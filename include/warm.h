@@ -0,0 +1,81 @@
+/*
+ *  Warm boot context for deep sleep wakes
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef WARM_H
+#define WARM_H
+
+#include <c_types.h>
+
+/*
+ * A deep sleep wake whose RTC context checks out is a warm boot.
+ * user_init() then starts the sensor conversions before anything else,
+ * and the ISL29035 starts at the range the last reading settled on
+ * instead of ranging down from 64K lux, which takes a second
+ * integration whenever the light is under 14000 counts of that range.
+ * DS18B20_WIRED builds also keep the tag of the conversion started
+ * before the sleep, see ds18b20.h.
+ *
+ * RAM, the pin mux and the UART do not survive deep sleep, so those
+ * are still set up on every wake, after the conversions have started.
+ * The network state is already carried over by broker.h and rfcal.h.
+ *
+ * The context also holds the sensors found on the board. After a cold
+ * boot each driver looks for its part: a presence pulse on the 1-wire
+ * bus, an acknowledged read of ISL_ID_REG on I2C. A part that is not
+ * there is not started or waited on, and its report field is left
+ * empty. Parts that are found are still checked every wake by their
+ * bus traffic. One that misses a reply leaves its field empty for
+ * that wake only, and is taken as gone after WARM_HW_MISSES wakes in
+ * a row. Absent ones are looked for again every WARM_HW_RECHECK_WAKES
+ * wakes. The set goes out retained on
+ * <device_id>/hw, e.g. "ds18b20,isl29035" or "none", after it is first
+ * found and whenever it changes, until delivered. MAINS builds do not
+ * send it.
+ */
+#define WARM_NO_RANGE       0xff
+#define WARM_NO_TAG         0       // no DS18B20 conversion pre-armed
+
+#define WARM_HW_DS18B20     0x01
+#define WARM_HW_ISL29035    0x02
+#define WARM_HW_ALL         (WARM_HW_DS18B20 | WARM_HW_ISL29035)
+#define WARM_HW_BUF_SIZE    20      // "ds18b20,isl29035" and a NUL
+
+#ifndef WARM_HW_MISSES
+#define WARM_HW_MISSES          3
+#endif
+#ifndef WARM_HW_RECHECK_WAKES
+#define WARM_HW_RECHECK_WAKES   144     // half a day at 300 s
+#endif
+
+bool warm_init(void);
+bool warm_boot(void);
+uint8 warm_als_range(void);
+void warm_set_als_range(uint8 range);
+uint8 warm_ds_tag(void);
+uint8 warm_ds_arm(void);
+void warm_ds_disarm(void);
+bool warm_hw_known(uint8 part);
+bool warm_hw_present(uint8 part);
+void warm_hw_found(uint8 part, bool present);
+bool warm_hw_due(void);
+uint8 warm_hw_format(char *buf);
+void warm_sleep(bool delivered);
+
+#endif
@@ -0,0 +1,57 @@
+/*
+ * c_types.h - host replacement for the ESP8266 SDK header
+ *
+ * Part of the TLnodeFW simulator (see sim/README.md). Only the parts
+ * of the SDK used by the firmware are provided.
+ */
+#ifndef _C_TYPES_H_
+#define _C_TYPES_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef uint8_t     uint8;
+typedef uint8_t     u8;
+typedef int8_t      sint8;
+typedef int8_t      int8;
+typedef int8_t      s8;
+typedef uint16_t    uint16;
+typedef uint16_t    u16;
+typedef int16_t     sint16;
+typedef int16_t     s16;
+typedef uint32_t    uint32;
+typedef uint32_t    u32;
+typedef int32_t     sint32;
+typedef int32_t     s32;
+typedef int32_t     int32;
+typedef uint64_t    uint64;
+typedef uint64_t    u64;
+typedef int64_t     sint64;
+typedef unsigned char BOOL;
+
+typedef enum {
+    OK = 0,
+    FAIL,
+    PENDING,
+    BUSY,
+    CANCEL,
+} STATUS;
+
+#define BIT(nr)     (1UL << (nr))
+#define BIT0        0x00000001
+#define BIT1        0x00000002
+#define BIT2        0x00000004
+#define BIT3        0x00000008
+#define BIT4        0x00000010
+#define BIT5        0x00000020
+
+#define LOCAL       static
+#define TRUE        1
+#define FALSE       0
+
+#define ICACHE_FLASH_ATTR
+#define ICACHE_RODATA_ATTR
+#define STORE_ATTR  __attribute__((aligned(4)))
+
+#endif
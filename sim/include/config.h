@@ -0,0 +1,28 @@
+/*
+ * config.h - esp_mqtt configuration structure, for the simulator
+ */
+#ifndef USER_CONFIG_H_
+#define USER_CONFIG_H_
+
+#include "os_type.h"
+#include "user_config.h"
+
+typedef struct {
+    uint32_t cfg_holder;
+    uint8_t device_id[16];
+
+    uint8_t sta_ssid[64];
+    uint8_t sta_pwd[64];
+    uint32_t sta_type;
+
+    uint8_t mqtt_host[64];
+    uint32_t mqtt_port;
+    uint8_t mqtt_user[32];
+    uint8_t mqtt_pass[32];
+    uint32_t mqtt_keepalive;
+    uint8_t security;
+} SYSCFG;
+
+extern SYSCFG sysCfg;
+
+#endif
@@ -0,0 +1,40 @@
+/*
+ * eagle_soc.h - host replacement for the ESP8266 SDK header
+ *
+ * Peripheral registers are plain memory in the simulator.
+ */
+#ifndef _EAGLE_SOC_H_
+#define _EAGLE_SOC_H_
+
+#include "c_types.h"
+
+extern volatile uint32 sim_regs[1024];
+
+#define SIM_REG(addr)               sim_regs[((uint32)(addr) >> 2) & 0x3ff]
+#define READ_PERI_REG(addr)         SIM_REG(addr)
+#define WRITE_PERI_REG(addr, val)   (SIM_REG(addr) = (val))
+#define SET_PERI_REG_MASK(addr, m)  (SIM_REG(addr) |= (m))
+#define CLEAR_PERI_REG_MASK(addr, m) (SIM_REG(addr) &= ~(m))
+
+#define PERIPHS_IO_MUX_MTDO_U       0x10
+#define PERIPHS_IO_MUX_MTMS_U       0x14
+#define PERIPHS_IO_MUX_U0TXD_U      0x18
+#define PERIPHS_IO_MUX_GPIO0_U      0x1c
+#define PERIPHS_IO_MUX_GPIO2_U      0x20
+#define PERIPHS_IO_MUX_GPIO5_U      0x24
+
+#define FUNC_GPIO0                  0
+#define FUNC_GPIO2                  0
+#define FUNC_GPIO5                  0
+#define FUNC_GPIO14                 3
+#define FUNC_U0TXD                  0
+#define FUNC_U0RTS                  4
+#define FUNC_U1TXD_BK               2
+
+#define PIN_FUNC_SELECT(pin, func)  ((void)(pin), (void)(func))
+#define PIN_PULLUP_EN(pin)          ((void)(pin))
+#define PIN_PULLUP_DIS(pin)         ((void)(pin))
+
+#define UART_CLK_FREQ               80000000
+
+#endif
@@ -0,0 +1,47 @@
+/*
+ * espconn.h - ESP8266 SDK connection API, for the simulator
+ *
+ * UDP to the MQTT-SN gateway and an NTP server, TCP to the brokers and
+ * DNS are modeled, see sim/sim_net.c.
+ */
+#ifndef __ESPCONN_H__
+#define __ESPCONN_H__
+#include "c_types.h"
+#include "user_interface.h"
+typedef void (*espconn_connect_callback)(void *arg);
+typedef void (*espconn_reconnect_callback)(void *arg, sint8 err);
+typedef void (*espconn_recv_callback)(void *arg, char *pdata, unsigned short len);
+typedef void (*espconn_sent_callback)(void *arg);
+enum espconn_type { ESPCONN_INVALID = 0, ESPCONN_TCP = 0x10, ESPCONN_UDP = 0x20 };
+enum espconn_state { ESPCONN_NONE, ESPCONN_WAIT, ESPCONN_LISTEN, ESPCONN_CONNECT, ESPCONN_WRITE, ESPCONN_READ, ESPCONN_CLOSE };
+typedef struct _esp_tcp { int remote_port; int local_port; uint8 local_ip[4]; uint8 remote_ip[4];
+  espconn_connect_callback connect_callback; espconn_reconnect_callback reconnect_callback; espconn_connect_callback disconnect_callback; espconn_connect_callback write_finish_fn; } esp_tcp;
+typedef struct _esp_udp { int remote_port; int local_port; uint8 local_ip[4]; uint8 remote_ip[4]; } esp_udp;
+struct espconn { enum espconn_type type; enum espconn_state state; union { esp_tcp *tcp; esp_udp *udp; } proto;
+  espconn_recv_callback recv_callback; espconn_sent_callback sent_callback; uint8 link_cnt; void *reverse; };
+sint8 espconn_create(struct espconn *espconn);
+sint8 espconn_delete(struct espconn *espconn);
+sint8 espconn_sent(struct espconn *espconn, uint8 *psent, uint16 length);
+sint8 espconn_regist_sentcb(struct espconn *espconn, espconn_sent_callback sent_cb);
+sint8 espconn_regist_recvcb(struct espconn *espconn, espconn_recv_callback recv_cb);
+uint32 espconn_port(void);
+#define ESPCONN_CLIENT      0x01
+#define ESPCONN_SERVER      0x02
+#define ESPCONN_BOTH        0x03
+bool espconn_secure_set_size(uint8 level, uint16 size);
+sint8 espconn_secure_sent(struct espconn *espconn, uint8 *psent, uint16 length);
+sint8 espconn_connect(struct espconn *espconn);
+sint8 espconn_disconnect(struct espconn *espconn);
+sint8 espconn_abort(struct espconn *espconn);
+sint8 espconn_recv_hold(struct espconn *pespconn);
+sint8 espconn_recv_unhold(struct espconn *pespconn);
+sint8 espconn_regist_connectcb(struct espconn *espconn, espconn_connect_callback connect_cb);
+sint8 espconn_regist_reconcb(struct espconn *espconn, espconn_reconnect_callback recon_cb);
+sint8 espconn_regist_disconcb(struct espconn *espconn, espconn_connect_callback discon_cb);
+#define ESPCONN_OK          0
+#define ESPCONN_INPROGRESS  -5
+#define ESPCONN_ARG         -12
+typedef sint8 err_t;
+typedef void (*dns_found_callback)(const char *name, ip_addr_t *ipaddr, void *callback_arg);
+err_t espconn_gethostbyname(struct espconn *pespconn, const char *hostname, ip_addr_t *addr, dns_found_callback found);
+#endif
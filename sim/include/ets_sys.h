@@ -0,0 +1,40 @@
+/*
+ * ets_sys.h - host replacement for the ESP8266 SDK header
+ */
+#ifndef _ETS_SYS_H
+#define _ETS_SYS_H
+
+#include "c_types.h"
+#include "eagle_soc.h"
+
+typedef uint32 ETSSignal;
+typedef uint32 ETSParam;
+
+typedef struct ETSEventTag {
+    ETSSignal sig;
+    ETSParam  par;
+} ETSEvent;
+
+typedef void (*ETSTask)(ETSEvent *e);
+typedef void ETSTimerFunc(void *timer_arg);
+
+typedef struct _ETSTIMER_ {
+    struct _ETSTIMER_   *timer_next;
+    uint32              timer_expire;
+    uint32              timer_period;
+    ETSTimerFunc        *timer_func;
+    void                *timer_arg;
+} ETSTimer;
+
+void ets_isr_attach(int intr, void *handler, void *arg);
+
+#define ETS_UART_INUM   5
+#define ETS_UART_INTR_ATTACH(func, arg) ets_isr_attach(ETS_UART_INUM, (func), (void *)(arg))
+#define ETS_UART_INTR_ENABLE()      ((void)0)
+#define ETS_UART_INTR_DISABLE()     ((void)0)
+#define ETS_GPIO_INTR_ENABLE()      ((void)0)
+#define ETS_GPIO_INTR_DISABLE()     ((void)0)
+#define ETS_INTR_LOCK()             ((void)0)
+#define ETS_INTR_UNLOCK()           ((void)0)
+
+#endif
@@ -0,0 +1,28 @@
+/*
+ * gpio.h - host replacement for the ESP8266 SDK header
+ */
+#ifndef _GPIO_H_
+#define _GPIO_H_
+
+#include "c_types.h"
+#include "eagle_soc.h"
+
+#define GPIO_ID_PIN(n)              (n)
+#define GPIO_PIN_ADDR(i)            (0x28 + (i) * 4)
+#define GPIO_ENABLE_ADDRESS         0x0c
+#define GPIO_PAD_DRIVER_ENABLE      1
+#define GPIO_PIN_PAD_DRIVER_SET(x)  ((x) << 2)
+#define GPIO_REG_READ(reg)          READ_PERI_REG(reg)
+#define GPIO_REG_WRITE(reg, val)    WRITE_PERI_REG(reg, val)
+
+void gpio_output_set(uint32 set_mask, uint32 clear_mask,
+        uint32 enable_mask, uint32 disable_mask);
+uint32 gpio_input_get(void);
+
+#define GPIO_OUTPUT_SET(gpio_no, bit_value) \
+    gpio_output_set((bit_value) << (gpio_no), ((~(bit_value)) & 0x01) << (gpio_no), \
+            1 << (gpio_no), 0)
+#define GPIO_DIS_OUTPUT(gpio_no)    gpio_output_set(0, 0, 0, 1 << (gpio_no))
+#define GPIO_INPUT_GET(gpio_no)     ((gpio_input_get() >> (gpio_no)) & BIT0)
+
+#endif
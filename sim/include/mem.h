@@ -0,0 +1,17 @@
+/*
+ * mem.h - host replacement for the ESP8266 SDK header
+ */
+#ifndef __MEM_H__
+#define __MEM_H__
+
+#include "c_types.h"
+
+void *sim_malloc(size_t size);
+void *sim_zalloc(size_t size);
+void sim_free(void *ptr);
+
+#define os_malloc(s)    sim_malloc(s)
+#define os_zalloc(s)    sim_zalloc(s)
+#define os_free(p)      sim_free(p)
+
+#endif
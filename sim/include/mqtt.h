@@ -0,0 +1,106 @@
+/*
+ * mqtt.h - esp_mqtt client API, for the simulator
+ *
+ * The simulator implements the client calls used by the firmware on
+ * top of its network model (sim/sim_net.c). Only the client fields the
+ * firmware touches are kept.
+ */
+#ifndef USER_AT_MQTT_H_
+#define USER_AT_MQTT_H_
+
+#include "user_interface.h"
+#include "wifi.h"
+#include "espconn.h"
+
+typedef void (*MqttCallback)(uint32_t *args);
+typedef void (*MqttDataCallback)(uint32_t *args, const char *topic,
+        uint32_t topic_len, const char *data, uint32_t lengh);
+
+typedef enum {
+    WIFI_INIT,
+    WIFI_CONNECTING,
+    WIFI_CONNECTING_ERROR,
+    WIFI_CONNECTED,
+    DNS_RESOLVE,
+    TCP_DISCONNECTED,
+    TCP_RECONNECT_REQ,
+    TCP_RECONNECT,
+    TCP_CONNECTING,
+    TCP_CONNECTING_ERROR,
+    TCP_CONNECTED,
+    MQTT_CONNECT_SEND,
+    MQTT_CONNECT_SENDING,
+    MQTT_SUBSCIBE_SEND,
+    MQTT_SUBSCIBE_SENDING,
+    MQTT_DATA,
+    MQTT_PUBLISH_RECV,
+    MQTT_PUBLISHING
+} tConnState;
+
+// from mqtt_msg.h, only what app.c uses to send DISCONNECT
+typedef struct {
+    uint8_t *data;
+    uint16_t length;
+} mqtt_message_t;
+
+typedef struct {
+    uint8_t *buffer;
+    uint16_t buffer_length;
+    uint16_t message_id;
+} mqtt_connection_t;
+
+typedef struct {
+    mqtt_connection_t mqtt_connection;
+} mqtt_state_t;
+
+mqtt_message_t *mqtt_msg_disconnect(mqtt_connection_t *connection);
+
+typedef struct {
+    uint8_t *client_id;
+    uint8_t *username;
+    uint8_t *password;
+    uint8_t *will_topic;
+    uint8_t *will_msg;
+    uint32_t keepalive;
+    int will_qos;
+    int will_retain;
+    int clean_session;
+} mqtt_connect_info_t;
+
+typedef struct {
+    struct espconn *pCon;
+    uint8_t *host;
+    uint32_t port;
+    uint8_t security;
+    mqtt_state_t mqtt_state;
+    tConnState connState;
+    mqtt_connect_info_t connect_info;
+    MqttCallback connectedCb;
+    MqttCallback disconnectedCb;
+    MqttCallback publishedCb;
+    MqttDataCallback dataCb;
+    uint32_t keepAliveTick;
+    uint32_t reconnectTick;
+    uint32_t sendTimeout;
+    void *user_data;
+} MQTT_Client;
+
+void MQTT_InitConnection(MQTT_Client *mqttClient, uint8_t *host,
+        uint32 port, uint8_t security);
+void MQTT_InitClient(MQTT_Client *mqttClient, uint8_t *client_id,
+        uint8_t *client_user, uint8_t *client_pass,
+        uint32_t keepAliveTime, uint8_t cleanSession);
+void MQTT_InitLWT(MQTT_Client *mqttClient, uint8_t *will_topic,
+        uint8_t *will_msg, uint8_t will_qos, uint8_t will_retain);
+void MQTT_OnConnected(MQTT_Client *mqttClient, MqttCallback connectedCb);
+void MQTT_OnDisconnected(MQTT_Client *mqttClient,
+        MqttCallback disconnectedCb);
+void MQTT_OnPublished(MQTT_Client *mqttClient, MqttCallback publishedCb);
+void MQTT_OnData(MQTT_Client *mqttClient, MqttDataCallback dataCb);
+BOOL MQTT_Subscribe(MQTT_Client *client, char *topic, uint8_t qos);
+void MQTT_Connect(MQTT_Client *mqttClient);
+void MQTT_Disconnect(MQTT_Client *mqttClient);
+BOOL MQTT_Publish(MQTT_Client *client, const char *topic,
+        const char *data, int data_length, int qos, int retain);
+
+#endif
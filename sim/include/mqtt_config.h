@@ -0,0 +1,37 @@
+/*
+ * mqtt_config.h - network settings used by the simulator
+ *
+ * include/mqtt_config.h, when present, takes precedence.
+ */
+#ifndef _MQTT_SETTINGS_H
+#define _MQTT_SETTINGS_H
+
+#define CFG_HOLDER          0x00FF55A4
+#define CFG_LOCATION        0x3C
+
+#define MQTT_HOST           "192.168.148.1"
+#define MQTT_PORT           1880
+
+// broker 2 of the network trace, by name, for the failover
+#define MQTT_BROKERS        MQTT_HOST, "mqtt2.lan"
+#define MQTT_BUF_SIZE       1024
+#define MQTT_KEEPALIVE      30
+
+#define MQTT_CLIENT_ID      "DVES_%08X"
+#define MQTT_USER           "DVES_USER"
+#define MQTT_PASS           "DVES_PASS"
+
+#define STA_SSID            "DVES_HOME"
+#define STA_PASS            "yourpassword"
+#define STA_TYPE            AUTH_WPA2_PSK
+
+#define MQTT_RECONNECT_TIMEOUT  5
+
+#ifndef DEFAULT_SECURITY
+#define DEFAULT_SECURITY        0   // build with -DDEFAULT_SECURITY=1 for TLS
+#endif
+#define QUEUE_BUFFER_SIZE       2048
+
+#define PROTOCOL_NAMEv31
+
+#endif
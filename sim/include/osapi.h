@@ -0,0 +1,44 @@
+/*
+ * osapi.h - host replacement for the ESP8266 SDK header
+ *
+ * Timers and delays run on the simulator's virtual clock.
+ */
+#ifndef _OSAPI_H_
+#define _OSAPI_H_
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "os_type.h"
+#include "user_config.h"
+
+void os_delay_us(uint32 us);
+unsigned long os_random(void);
+int os_printf(const char *fmt, ...);
+void os_install_putc1(void *p);
+void uart_div_modify(uint8 uart_no, uint32 div);
+
+void os_timer_arm(ETSTimer *ptimer, uint32 msec, bool repeat);
+void os_timer_arm_us(ETSTimer *ptimer, uint32 usec, bool repeat);
+void os_timer_disarm(ETSTimer *ptimer);
+void os_timer_setfn(ETSTimer *ptimer, ETSTimerFunc *pfunction, void *parg);
+
+#define os_sprintf      sprintf
+#define os_snprintf     snprintf
+#define os_memcpy       memcpy
+#define os_memmove      memmove
+#define os_memset       memset
+#define os_memcmp       memcmp
+#define os_strlen       strlen
+#define os_strcpy       strcpy
+#define os_strncpy      strncpy
+#define os_strcmp       strcmp
+#define os_strncmp      strncmp
+#define os_strchr       strchr
+#define os_strstr       strstr
+#define os_strcat       strcat
+#define os_bzero(s, n)  memset((s), 0, (n))
+
+#include "user_interface.h"
+
+#endif
@@ -0,0 +1,23 @@
+/*
+ * spi_flash.h - host replacement for the ESP8266 SDK header
+ *
+ * The flash is memory in sim_flash.c, see -O in sim.c.
+ */
+#ifndef SPI_FLASH_H
+#define SPI_FLASH_H
+
+#include "c_types.h"
+
+typedef enum {
+    SPI_FLASH_RESULT_OK,
+    SPI_FLASH_RESULT_ERR,
+    SPI_FLASH_RESULT_TIMEOUT
+} SpiFlashOpResult;
+
+#define SPI_FLASH_SEC_SIZE      4096
+
+SpiFlashOpResult spi_flash_erase_sector(uint16 sec);
+SpiFlashOpResult spi_flash_write(uint32 des_addr, uint32 *src_addr, uint32 size);
+SpiFlashOpResult spi_flash_read(uint32 src_addr, uint32 *des_addr, uint32 size);
+
+#endif
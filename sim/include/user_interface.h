@@ -0,0 +1,112 @@
+/*
+ * user_interface.h - host replacement for the ESP8266 SDK header
+ */
+#ifndef __USER_INTERFACE_H__
+#define __USER_INTERFACE_H__
+
+#include "os_type.h"
+
+typedef struct ip_addr {
+    uint32 addr;
+} ip_addr_t;
+
+struct ip_info {
+    struct ip_addr ip;
+    struct ip_addr netmask;
+    struct ip_addr gw;
+};
+
+enum rst_reason {
+    REASON_DEFAULT_RST      = 0,
+    REASON_WDT_RST          = 1,
+    REASON_EXCEPTION_RST    = 2,
+    REASON_SOFT_WDT_RST     = 3,
+    REASON_SOFT_RESTART     = 4,
+    REASON_DEEP_SLEEP_AWAKE = 5,
+    REASON_EXT_SYS_RST      = 6
+};
+
+struct rst_info {
+    uint32 reason;
+    uint32 exccause;
+    uint32 epc1;
+    uint32 epc2;
+    uint32 epc3;
+    uint32 excvaddr;
+    uint32 depc;
+};
+
+enum flash_size_map {
+    FLASH_SIZE_4M_MAP_256_256 = 0,
+    FLASH_SIZE_2M,
+    FLASH_SIZE_8M_MAP_512_512,
+    FLASH_SIZE_16M_MAP_512_512,
+    FLASH_SIZE_32M_MAP_512_512,
+    FLASH_SIZE_16M_MAP_1024_1024,
+    FLASH_SIZE_32M_MAP_1024_1024
+};
+
+struct rst_info *system_get_rst_info(void);
+const char *system_get_sdk_version(void);
+void system_restart(void);
+void system_deep_sleep(uint32 time_in_us);
+bool system_deep_sleep_set_option(uint8 option);
+uint32 system_get_chip_id(void);
+uint32 ipaddr_addr(const char *cp);
+uint32 system_get_free_heap_size(void);
+void system_print_meminfo(void);
+uint32 system_get_time(void);
+uint32 system_get_rtc_time(void);
+uint32 system_rtc_clock_cali_proc(void);
+bool system_rtc_mem_write(uint8 des_addr, const void *src_addr, uint16 save_size);
+bool system_rtc_mem_read(uint8 src_addr, void *des_addr, uint16 save_size);
+uint16 system_get_vdd33(void);
+uint8 system_get_boot_version(void);
+uint32 system_get_userbin_addr(void);
+uint8 system_get_boot_mode(void);
+uint8 system_get_cpu_freq(void);
+#define SYS_CPU_80MHZ       80
+#define SYS_CPU_160MHZ      160
+bool system_update_cpu_freq(uint8 freq);
+enum flash_size_map system_get_flash_size_map(void);
+uint32 spi_flash_get_id(void);
+
+bool system_os_task(os_task_t task, uint8 prio, os_event_t *queue, uint8 qlen);
+bool system_os_post(uint8 prio, os_signal_t sig, os_param_t par);
+
+typedef void (*init_done_cb_t)(void);
+void system_init_done_cb(init_done_cb_t cb);
+
+#define AUTH_OPEN           0
+#define AUTH_WEP            1
+#define AUTH_WPA_PSK        2
+#define AUTH_WPA2_PSK       3
+#define AUTH_WPA_WPA2_PSK   4
+
+enum {
+    STATION_IDLE = 0,
+    STATION_CONNECTING,
+    STATION_WRONG_PASSWORD,
+    STATION_NO_AP_FOUND,
+    STATION_CONNECT_FAIL,
+    STATION_GOT_IP
+};
+
+#define NULL_MODE       0x00
+#define STATION_MODE    0x01
+bool wifi_set_opmode_current(uint8 opmode);
+
+#define STATION_IF  0x00
+bool wifi_get_ip_info(uint8 if_index, struct ip_info *info);
+uint8 wifi_station_get_connect_status(void);
+
+#define UPGRADE_FW_BIN1         0x00
+#define UPGRADE_FW_BIN2         0x01
+#define UPGRADE_FLAG_IDLE       0x00
+#define UPGRADE_FLAG_START      0x01
+#define UPGRADE_FLAG_FINISH     0x02
+uint8 system_upgrade_userbin_check(void);
+void system_upgrade_flag_set(uint8 flag);
+void system_upgrade_reboot(void);
+
+#endif
@@ -0,0 +1,13 @@
+/*
+ * wifi.h - esp_mqtt WiFi helper API, for the simulator
+ */
+#ifndef USER_WIFI_H_
+#define USER_WIFI_H_
+
+#include "os_type.h"
+
+typedef void (*WifiCallback)(uint8_t);
+
+void WIFI_Connect(uint8_t *ssid, uint8_t *pass, WifiCallback cb);
+
+#endif
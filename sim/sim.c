@@ -0,0 +1,827 @@
+/*
+ *  sim.c - accelerated virtual-time simulator for TLnodeFW
+ *
+ *  Runs the firmware in user/ through wake after wake against a
+ *  virtual clock, scripted sensor values and a scripted network, and
+ *  reports publish counts, lost reports and projected battery life.
+ *  See sim/README.md.
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <getopt.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <osapi.h>
+#include <user_interface.h>
+#include "energy.h"
+
+#include "sim.h"
+
+#define US_PER_DAY      (86400ULL * 1000000ULL)
+#define MAX_DAYS        (20 * 365)
+
+// the firmware's period, see user/app.c
+#ifndef DEEP_SLEEP_SECONDS
+#define DEEP_SLEEP_SECONDS 300
+#endif
+
+sim_config_t sim_cfg = {
+    .chip_id = 0x00a1b2c3,
+    .boot_us = 60000,
+    .rfcal_us = 120000,
+    .rfskip_us = 60000,
+    .assoc_us = 1500000,
+    .connect_us = 60000,
+    .publish_us = 20000,
+    .rtt_us = 20000,
+    .tls_cpu_us = 2000000,
+    .conversion_us = 600000,
+    .rtc_ppm = 0,
+    .slot_ms = -1,
+    .verbose = 0,
+};
+
+sim_shared_t *sim;
+static uint64 *fleetFree = NULL;    // -F, when the AP and broker are free
+
+// current of each state, uA, defaults from energy.h
+static double stateUa[SIM_STATES] = {
+    ENERGY_CPU_UA,
+    ENERGY_ASSOC_UA,
+    ENERGY_RADIO_UA,
+};
+static double sleepUa = ENERGY_SLEEP_UA;
+static double capacityMah = ENERGY_BATTERY_MAH;
+
+typedef struct {
+    uint64 wakes;
+    uint64 reports;
+    uint64 publishes;
+    uint64 crashes;
+    uint64 hangs;
+    uint64 leaks;
+    uint64 freed_live;
+    uint64 awake_us;
+    uint32 max_awake_us;
+    uint64 connect_us;
+    uint64 connects;
+    uint64 tail_us;
+    uint64 tails;
+    uint64 closes;
+    uint64 rfcals;
+    uint64 dns;
+    uint64 ntp;
+    uint64 diags;
+    uint64 logs;
+    uint64 inventories;
+    uint64 blanks;
+    uint64 convert_ns[2];   // cold and warm boots
+    uint64 converts[2];
+    uint64 prearmed;
+    uint64 integrations;
+    uint64 i2c_cpu_us;
+    uint64 stamped;
+    double stamp_err_ms;    // sum of the absolute errors
+    double max_stamp_err_ms;
+    uint64 intervals;       // between wakes that both reported
+    double interval_s;      // running mean
+    double interval_m2;     // running sum of squared deviations, s^2
+    uint64 ota_checks;
+    uint64 ota_bytes;
+    uint64 ota_download_us;
+    uint64 ota_installs;
+    uint64 ota_install_us;
+    uint64 state_us[SIM_STATES];
+    double charge_uas;
+} totals_t;
+
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -d days      days to simulate, 0 = until the battery is empty (365)\n"
+        "  -s file      sensor trace (CSV)\n"
+        "  -n file      network trace\n"
+        "  -a ms        association time (%u)\n"
+        "  -c ms        MQTT connect time (%u)\n"
+        "  -p ms        time per publish (%u)\n"
+        "  -t ms        round trip for MQTT-SN and pipelined MQTT (%u)\n"
+        "  -R           broker closes connections that send before CONNACK\n"
+        "  -C ms        RF init time when calibration is skipped (%u)\n"
+        "  -T ms        TLS full handshake crypto time at 80 MHz (%u)\n"
+        "  -S           model TLS session resumption (not in the firmware)\n"
+        "  -b mAh       battery capacity (%.0f)\n"
+        "  -i id        chip ID (0x%08x)\n"
+        "  -r ppm       RTC calibration error (%d)\n"
+        "  -x wakes     every this many wakes, one crashes 1 s after reset\n"
+        "  -H parts     leave parts off the board, 1 = DS18B20, 2 = ISL29035\n"
+        "  -g wakes     every this many wakes, each sensor misses one reply\n"
+        "  -B           run one wake and print only its UART output, for\n"
+        "               CONFIG=-DBENCH builds\n"
+        "  -M s         run one wake this long, for CONFIG=-DMAINS builds\n"
+        "  -O dir       flash the user1.bin in dir into the first OTA slot\n"
+        "  -U file      update for the stand-in OTA server, see tools/ota.py\n"
+        "  -F nodes     run a fleet powered on together, sharing the AP\n"
+        "  -A           broker assigns wake offsets, spread over the fleet\n"
+        "  -m           machine readable output\n"
+        "  -v           verbose, repeat for firmware output\n",
+        prog, sim_cfg.assoc_us / 1000, sim_cfg.connect_us / 1000,
+        sim_cfg.publish_us / 1000, sim_cfg.rtt_us / 1000,
+        sim_cfg.rfskip_us / 1000, sim_cfg.tls_cpu_us / 1000, capacityMah, sim_cfg.chip_id,
+        sim_cfg.rtc_ppm);
+    exit(2);
+}
+
+
+/*
+ * battery voltage from the fraction of charge left, using the same
+ * linear model as energy.c
+ */
+static uint32
+battery_model_mv(double remaining)
+{
+    if (remaining < 0) {
+        remaining = 0;
+    }
+    return(ENERGY_VBAT_EMPTY_MV
+            + (uint32)((ENERGY_VBAT_FULL_MV - ENERGY_VBAT_EMPTY_MV) * remaining));
+}
+
+
+static int crashed = 0;     // the last wake run
+
+static void
+run_one(void)
+{
+    pid_t pid;
+    int status;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        sim_run_wake();
+        fflush(stdout);
+        _exit(0);
+    }
+
+    waitpid(pid, &status, 0);
+    crashed = !WIFEXITED(status);
+    if (crashed) {
+        // the firmware crashed: treat as an exception reset
+        sim->awake_us = 0;
+        sim->sleep_us = 0;
+        sim->reset_reason = REASON_EXCEPTION_RST;
+    }
+}
+
+
+/*
+ * run_wake - run the wake of the node in sim that starts at clock
+ *
+ * remaining is the fraction of the battery left, for the supply voltage
+ * when the sensor trace has none.
+ */
+static void
+run_wake(uint64 clock, uint32 wake, double remaining)
+{
+    sim->clock_us = clock;
+    sim->wake = wake;
+    sim_sensors_sample(clock, &sim->sample);
+    if (sim->sample.vbat_mv == 0) {
+        sim->sample.vbat_mv = battery_model_mv(remaining);
+    }
+    sim->awake_us = 0;
+    sim->sleep_us = 0;
+    sim->sensor_uaus = 0;
+    sim->publishes = 0;
+    sim->reports = 0;
+    sim->leaks = 0;
+    sim->freed_live = 0;
+    sim->connect_us = 0;
+    sim->tail_us = 0;
+    sim->closes = 0;
+    sim->dns = 0;
+    sim->ntp = 0;
+    sim->subscribes = 0;
+    sim->diags = 0;
+    sim->logs = 0;
+    sim->inventories = 0;
+    sim->blanks = 0;
+    sim->convert_ns = 0;
+    sim->prearmed = 0;
+    sim->integrations = 0;
+    sim->i2c_cpu_us = 0;
+    sim->stamped = 0;
+    sim->ota_checks = 0;
+    sim->ota_bytes = 0;
+    sim->ota_start_us = 0;
+    sim->ota_end_us = 0;
+    sim->ota_off_us = 0;
+    sim->ota_reset_us = 0;
+    sim->ota_installs = 0;
+    memset(sim->state_us, 0, sizeof(sim->state_us));
+    memset(sim->wait_us, 0, sizeof(sim->wait_us));
+
+    run_one();
+}
+
+
+/*
+ * wake_charge - charge of the wake just run and the sleep after it,
+ * uA * us
+ */
+static double
+wake_charge(void)
+{
+    double charge = sim->sleep_us * sleepUa + sim->sensor_uaus;
+    int i;
+
+    for (i = 0; i < SIM_STATES; i++) {
+        charge += sim->state_us[i] * stateUa[i];
+    }
+    return(charge);
+}
+
+
+/*
+ * next_reset - the reset the next wake of the node in sim starts with
+ */
+static void
+next_reset(void)
+{
+    if (crashed) {
+        return;
+    }
+    if (sim->ota_reset_us != 0) {
+        sim->reset_reason = REASON_SOFT_RESTART;
+        return;
+    }
+    sim->reset_reason = (sim->sleep_us == 0) ? REASON_WDT_RST
+        : REASON_DEEP_SLEEP_AWAKE;
+}
+
+
+/*
+ * sim_queue_us - how long a request that reaches the AP or the broker
+ * at ready_us waits behind the rest of the fleet
+ *
+ * Each serves one node at a time, SIM_AP_SERVICE_US for an association
+ * and DHCP, SIM_BROKER_SERVICE_US for a CONNECT. Wakes run in time
+ * order, so requests are served in the order their wakes started. A
+ * request that would wait over SIM_QUEUE_MAX_US is given up on and
+ * takes no time from the others.
+ */
+uint32
+sim_queue_us(int what, uint64 ready_us)
+{
+    static const uint32 service[SIM_SHARED] = {
+        SIM_AP_SERVICE_US, SIM_BROKER_SERVICE_US
+    };
+    uint64 start;
+
+    if (fleetFree == NULL) {
+        return(0);
+    }
+    start = (fleetFree[what] > ready_us) ? fleetFree[what] : ready_us;
+    if (start - ready_us <= SIM_QUEUE_MAX_US) {
+        fleetFree[what] = start + service[what];
+    }
+    return((uint32)(start - ready_us));
+}
+
+
+/*
+ * fleet_run - run a fleet of nodes powered on together for days
+ *
+ * The nodes have consecutive chip IDs and share the AP and the broker,
+ * see sim_queue_us().
+ */
+static int
+fleet_run(uint32 nodes, double days, int assign, int machine)
+{
+    sim_shared_t *fleet;
+    uint64 *next = calloc(nodes, sizeof(uint64));
+    uint32 *wakes = calloc(nodes, sizeof(uint32));
+    double *chargeUas = calloc(nodes, sizeof(double));
+    uint32 baseChip = sim_cfg.chip_id;
+    double capacityUas = capacityMah * 1000.0 * 3600.0;
+    uint64 endClock = (uint64)(days * US_PER_DAY);
+    uint64 totWakes = 0;
+    uint64 totReports = 0;
+    uint64 totAwakeUs = 0;
+    uint64 totWaitUs[SIM_SHARED] = { 0 };
+    uint32 maxWaitUs[SIM_SHARED] = { 0 };
+    uint64 totSubscribes = 0;
+    uint32 maxAwakeUs = 0;
+    double totChargeUas = 0;
+    struct timeval t0, t1;
+    double wall;
+    uint32 i;
+    uint32 j;
+
+    // the wakes update fleetFree, so it is shared too
+    fleet = mmap(NULL, nodes * sizeof(*fleet) + sizeof(uint64) * SIM_SHARED,
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if ((fleet == MAP_FAILED) || (next == NULL) || (wakes == NULL)
+            || (chargeUas == NULL)) {
+        perror("fleet");
+        return(1);
+    }
+    fleetFree = (uint64 *)&fleet[nodes];
+
+    // powered on within the same second, RTC memory holds garbage
+    for (i = 0; i < nodes; i++) {
+        srandom(baseChip + i);
+        for (j = 0; j < SIM_RTC_BLOCKS; j++) {
+            fleet[i].rtc[j] = random();
+        }
+        fleet[i].reset_reason = REASON_DEFAULT_RST;
+        next[i] = (uint64)(random() % 1000) * 1000;
+        fleet[i].poweron_us = next[i];
+    }
+
+    gettimeofday(&t0, NULL);
+    for (;;) {
+        uint64 clock;
+        int k;
+
+        for (i = 0, j = 1; j < nodes; j++) {
+            if (next[j] < next[i]) {
+                i = j;
+            }
+        }
+        clock = next[i];
+        if (clock >= endClock) {
+            break;
+        }
+
+        sim = &fleet[i];
+        sim_cfg.chip_id = baseChip + i;
+        sim_cfg.slot_ms = assign
+            ? (int32)((uint64)i * DEEP_SLEEP_SECONDS * 1000 / nodes) : -1;
+        run_wake(clock, wakes[i]++, 1.0 - chargeUas[i] / capacityUas);
+
+        chargeUas[i] += wake_charge() / 1e6;
+        totChargeUas += wake_charge() / 1e6;
+        totWakes++;
+        totReports += sim->reports;
+        totAwakeUs += sim->awake_us;
+        totSubscribes += sim->subscribes;
+        if (sim->awake_us > maxAwakeUs) {
+            maxAwakeUs = sim->awake_us;
+        }
+        for (k = 0; k < SIM_SHARED; k++) {
+            totWaitUs[k] += sim->wait_us[k];
+            if (sim->wait_us[k] > maxWaitUs[k]) {
+                maxWaitUs[k] = sim->wait_us[k];
+            }
+        }
+        if (sim_cfg.verbose == 1) {
+            printf("%4u %6u %10.1f s  awake %5u ms  waited %u ms for the AP, "
+                    "%u ms for the broker\n", i, sim->wake, clock / 1e6,
+                    sim->awake_us / 1000, sim->wait_us[SIM_AP] / 1000,
+                    sim->wait_us[SIM_BROKER] / 1000);
+        }
+
+        next[i] = clock + sim->awake_us + sim->sleep_us;
+        next_reset();
+    }
+    gettimeofday(&t1, NULL);
+    wall = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+
+    {
+        uint64 lost = totWakes - totReports;
+        double meanAwake = totWakes ? totAwakeUs / 1000.0 / totWakes : 0;
+        double meanAp = totWakes ? totWaitUs[SIM_AP] / 1000.0 / totWakes : 0;
+        double meanBroker = totWakes
+            ? totWaitUs[SIM_BROKER] / 1000.0 / totWakes : 0;
+        double avgUa = (endClock > 0)
+            ? totChargeUas * 1e6 / endClock / nodes : 0;
+
+        if (machine) {
+            printf("nodes=%u days=%.3f wakes=%llu reports=%llu lost=%llu "
+                    "mean_awake_ms=%.1f max_awake_ms=%u mean_ap_wait_ms=%.1f "
+                    "max_ap_wait_ms=%u mean_broker_wait_ms=%.1f "
+                    "max_broker_wait_ms=%u subscribes=%llu avg_ua=%.2f "
+                    "wakes_per_s=%.0f\n",
+                    nodes, days, (unsigned long long)totWakes,
+                    (unsigned long long)totReports, (unsigned long long)lost,
+                    meanAwake, maxAwakeUs / 1000, meanAp,
+                    maxWaitUs[SIM_AP] / 1000, meanBroker,
+                    maxWaitUs[SIM_BROKER] / 1000,
+                    (unsigned long long)totSubscribes, avgUa, totWakes / wall);
+        } else {
+            printf("fleet         %u nodes, %.2f days, %llu wakes "
+                    "(%.0f wakes/s)\n", nodes, days,
+                    (unsigned long long)totWakes, totWakes / wall);
+            printf("reports       %llu delivered, %llu lost (%.2f%%)\n",
+                    (unsigned long long)totReports, (unsigned long long)lost,
+                    totWakes ? 100.0 * lost / totWakes : 0);
+            printf("awake         mean %.1f ms, max %u ms\n",
+                    meanAwake, maxAwakeUs / 1000);
+            printf("queued        for the AP mean %.1f ms, max %u ms; "
+                    "for the broker mean %.1f ms, max %u ms\n",
+                    meanAp, maxWaitUs[SIM_AP] / 1000, meanBroker,
+                    maxWaitUs[SIM_BROKER] / 1000);
+            printf("slot checks   %llu\n", (unsigned long long)totSubscribes);
+            printf("current       %.2f uA average per node\n", avgUa);
+        }
+    }
+    return(0);
+} // end fleet_run()
+
+
+/*
+ * mains_results - print the results of a -M run
+ */
+static void
+mains_results(int machine)
+{
+    double secs = sim->awake_us / 1e6;
+    double perMsg = sim->publishes ? (double)sim->reports / sim->publishes : 0;
+
+    if (machine) {
+        printf("secs=%.1f samples=%u publishes=%u samples_per_publish=%.1f "
+                "heap_peak=%u leaks=%u crashed=%d\n",
+                secs, sim->reports, sim->publishes, perMsg, sim->heap_peak,
+                sim->leaks, crashed);
+        return;
+    }
+    printf("simulated     %.1f s awake\n", secs);
+    printf("samples       %u delivered in %u publishes (%.1f each)\n",
+            sim->reports, sim->publishes, perMsg);
+    printf("heap          peak %u bytes, %u blocks allocated at the end\n",
+            sim->heap_peak, sim->leaks);
+    if (crashed) {
+        printf("crashed\n");
+    }
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    double days = 365;
+    const char *sensorPath = NULL;
+    const char *netPath = NULL;
+    int machine = 0;
+    int bench = 0;
+    uint32 nodes = 0;
+    int assign = 0;
+    double mainsS = 0;
+    const char *flashDir = NULL;
+    const char *updatePath = NULL;
+    int opt;
+    totals_t tot;
+    uint64 clock = 0;
+    uint64 reportClock = 0; // start of the last wake that reported
+    uint64 endClock;
+    double capacityUas;
+    struct timeval t0, t1;
+    double wall;
+    int i;
+
+    while ((opt = getopt(argc, argv, "d:s:n:a:c:p:t:RC:T:Sb:i:r:x:H:g:BM:O:U:F:Amv")) != -1) {
+        switch (opt) {
+            case 'd': days = atof(optarg); break;
+            case 's': sensorPath = optarg; break;
+            case 'n': netPath = optarg; break;
+            case 'a': sim_cfg.assoc_us = atoi(optarg) * 1000; break;
+            case 'c': sim_cfg.connect_us = atoi(optarg) * 1000; break;
+            case 'p': sim_cfg.publish_us = atoi(optarg) * 1000; break;
+            case 't': sim_cfg.rtt_us = atoi(optarg) * 1000; break;
+            case 'R': sim_cfg.broker_no_pipeline = 1; break;
+            case 'C': sim_cfg.rfskip_us = atoi(optarg) * 1000; break;
+            case 'T': sim_cfg.tls_cpu_us = atoi(optarg) * 1000; break;
+            case 'S': sim_cfg.tls_resume = 1; break;
+            case 'b': capacityMah = atof(optarg); break;
+            case 'i': sim_cfg.chip_id = strtoul(optarg, NULL, 0); break;
+            case 'r': sim_cfg.rtc_ppm = atoi(optarg); break;
+            case 'x': sim_cfg.crash_every = strtoul(optarg, NULL, 0); break;
+            case 'H': sim_cfg.missing = strtoul(optarg, NULL, 0); break;
+            case 'g': sim_cfg.glitch_every = strtoul(optarg, NULL, 0); break;
+            case 'B': bench = 1; sim_cfg.uart = 1; break;
+            case 'F': nodes = strtoul(optarg, NULL, 0); break;
+            case 'A': assign = 1; sim_cfg.slot_ms = 0; break;
+            case 'M': mainsS = atof(optarg); break;
+            case 'O': flashDir = optarg; break;
+            case 'U': updatePath = optarg; break;
+            case 'm': machine = 1; break;
+            case 'v': sim_cfg.verbose++; break;
+            default: usage(argv[0]);
+        }
+    }
+    if ((mainsS < 0) || (mainsS * 1e6 >= SIM_MAX_MAINS_US)) {
+        fprintf(stderr, "-M must be under %u s\n",
+                SIM_MAX_MAINS_US / 1000000);
+        return(2);
+    }
+    sim_cfg.mains_us = mainsS * 1e6;
+    if ((sensorPath != NULL) && (sim_sensors_load(sensorPath) < 0)) {
+        return(1);
+    }
+    if ((netPath != NULL) && (sim_net_load(netPath) < 0)) {
+        return(1);
+    }
+    if ((nodes > 0) && ((flashDir != NULL) || (updatePath != NULL))) {
+        fprintf(stderr, "-O and -U are for one node, not -F\n");
+        return(2);
+    }
+    if (sim_flash_init(flashDir, updatePath) < 0) {
+        return(1);
+    }
+
+    if (nodes > 0) {
+        if (days <= 0) {
+            fprintf(stderr, "-F needs -d\n");
+            return(2);
+        }
+        return(fleet_run(nodes, days, assign, machine));
+    }
+
+    sim = mmap(NULL, sizeof(*sim), PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (sim == MAP_FAILED) {
+        perror("mmap");
+        return(1);
+    }
+
+    // RTC memory holds garbage after power-on
+    srandom(sim_cfg.chip_id);
+    for (i = 0; i < SIM_RTC_BLOCKS; i++) {
+        sim->rtc[i] = random();
+    }
+    sim->reset_reason = REASON_DEFAULT_RST;
+    sim->poweron_us = 0;
+
+    if (bench) {
+        sim_sensors_sample(0, &sim->sample);
+        if (sim->sample.vbat_mv == 0) {
+            sim->sample.vbat_mv = battery_model_mv(1.0);
+        }
+        run_one();
+        return(crashed);
+    }
+
+    if (sim_cfg.mains_us > 0) {
+        sim_sensors_sample(0, &sim->sample);
+        if (sim->sample.vbat_mv == 0) {
+            sim->sample.vbat_mv = battery_model_mv(1.0);
+        }
+        run_one();
+        mains_results(machine);
+        return(crashed);
+    }
+
+    memset(&tot, 0, sizeof(tot));
+    capacityUas = capacityMah * 1000.0 * 3600.0;
+    endClock = (days > 0) ? (uint64)(days * US_PER_DAY) : MAX_DAYS * US_PER_DAY;
+    gettimeofday(&t0, NULL);
+
+    while ((clock < endClock) && (tot.charge_uas < capacityUas)) {
+        double charge;
+
+        run_wake(clock, tot.wakes, 1.0 - tot.charge_uas / capacityUas);
+
+        charge = wake_charge();
+        for (i = 0; i < SIM_STATES; i++) {
+            tot.state_us[i] += sim->state_us[i];
+        }
+        tot.charge_uas += charge / 1000000.0;
+        tot.wakes++;
+        tot.reports += sim->reports;
+        tot.publishes += sim->publishes;
+        tot.leaks += sim->leaks;
+        tot.freed_live += sim->freed_live;
+        tot.awake_us += sim->awake_us;
+        if (sim->connect_us > 0) {
+            tot.connect_us += sim->connect_us;
+            tot.connects++;
+        }
+        if ((sim->publishes > 0) && (sim->sleep_us > 0)) {
+            tot.tail_us += sim->tail_us;
+            tot.tails++;
+        }
+        tot.closes += sim->closes;
+        tot.rfcals += sim->rfcal;
+        tot.dns += sim->dns;
+        tot.ntp += sim->ntp;
+        tot.diags += sim->diags;
+        tot.logs += sim->logs;
+        tot.inventories += sim->inventories;
+        tot.blanks += sim->blanks;
+        {
+            int warm = (sim->reset_reason == REASON_DEEP_SLEEP_AWAKE);
+
+            // wakes that read a pre-armed conversion start none
+            if (sim->convert_ns > 0) {
+                tot.convert_ns[warm] += sim->convert_ns;
+                tot.converts[warm]++;
+            }
+        }
+        tot.prearmed += sim->prearmed;
+        tot.integrations += sim->integrations;
+        tot.i2c_cpu_us += sim->i2c_cpu_us;
+        tot.ota_checks += sim->ota_checks;
+        tot.ota_bytes += sim->ota_bytes;
+        if (sim->ota_off_us > 0) {
+            // the update is all in by then
+            tot.ota_download_us += sim->ota_off_us - sim->ota_start_us;
+        } else if (sim->ota_checks > 0) {
+            tot.ota_download_us += sim->ota_end_us - sim->ota_start_us;
+        }
+        if (sim->ota_installs) {
+            tot.ota_installs++;
+            tot.ota_install_us += sim->ota_reset_us - sim->ota_off_us;
+        }
+        if (sim->stamped) {
+            double err = (sim->stamp_err_ms < 0) ? -sim->stamp_err_ms
+                : sim->stamp_err_ms;
+
+            tot.stamped++;
+            tot.stamp_err_ms += err;
+            if (err > tot.max_stamp_err_ms) {
+                tot.max_stamp_err_ms = err;
+            }
+        }
+        if (sim->reports && (reportClock > 0)) {
+            double d = (clock - reportClock) / 1e6 - tot.interval_s;
+
+            tot.intervals++;
+            tot.interval_s += d / tot.intervals;
+            tot.interval_m2 += d * ((clock - reportClock) / 1e6 - tot.interval_s);
+        }
+        reportClock = sim->reports ? clock : 0;
+        if (sim->awake_us > tot.max_awake_us) {
+            tot.max_awake_us = sim->awake_us;
+        }
+
+        if (sim_cfg.verbose == 1) {
+            printf("%6u %10.1f s  awake %5u ms  sleep %4u s  %s %s\n",
+                    sim->wake, clock / 1000000.0, sim->awake_us / 1000,
+                    sim->sleep_us / 1000000,
+                    sim->reports ? sim->last_topic : "-",
+                    sim->reports ? sim->last_msg : "");
+        }
+
+        clock += sim->awake_us + sim->sleep_us;
+        if (crashed) {
+            tot.crashes++;
+        } else if ((sim->sleep_us == 0) && (sim->ota_reset_us == 0)) {
+            tot.hangs++;
+        }
+        next_reset();
+    }
+
+    gettimeofday(&t1, NULL);
+    wall = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+
+    {
+        double simDays = clock / (double)US_PER_DAY;
+        double avgUa = (clock > 0) ? tot.charge_uas * 1e6 / clock : 0;
+        double lifeDays = (avgUa > 0) ? capacityMah * 1000.0 / avgUa / 24.0 : 0;
+        uint64 lost = tot.wakes - tot.reports;
+        double sdMs = (tot.intervals > 1)
+            ? sqrt(tot.interval_m2 / (tot.intervals - 1)) * 1000.0 : 0;
+
+        if (machine) {
+            printf("days=%.3f wakes=%llu reports=%llu lost=%llu "
+                    "publishes=%llu hangs=%llu crashes=%llu leaks=%llu freed_live=%llu "
+                    "mean_awake_ms=%.1f max_awake_ms=%u mean_connect_ms=%.1f "
+                    "mean_tail_ms=%.1f closes=%llu rfcals=%llu dns=%llu ntp=%llu diags=%llu logs=%llu inventories=%llu blanks=%llu "
+                    "cold_convert_us=%.1f warm_convert_us=%.1f prearmed=%llu "
+                    "integrations=%llu i2c_cpu_us=%.1f "
+                    "stamped=%llu mean_time_err_ms=%.1f max_time_err_ms=%.1f "
+                    "mean_interval_s=%.3f sd_interval_ms=%.1f "
+                    "ota_checks=%llu ota_installs=%llu ota_bytes=%llu "
+                    "mean_download_ms=%.1f mean_install_ms=%.1f "
+                    "cpu_s=%.1f assoc_s=%.1f radio_s=%.1f "
+                    "avg_ua=%.2f life_days=%.1f wakes_per_s=%.0f\n",
+                    simDays, (unsigned long long)tot.wakes,
+                    (unsigned long long)tot.reports, (unsigned long long)lost,
+                    (unsigned long long)tot.publishes,
+                    (unsigned long long)tot.hangs,
+                    (unsigned long long)tot.crashes,
+                    (unsigned long long)tot.leaks,
+                    (unsigned long long)tot.freed_live,
+                    tot.wakes ? tot.awake_us / 1000.0 / tot.wakes : 0,
+                    tot.max_awake_us / 1000,
+                    tot.connects ? tot.connect_us / 1000.0 / tot.connects : 0,
+                    tot.tails ? tot.tail_us / 1000.0 / tot.tails : 0,
+                    (unsigned long long)tot.closes,
+                    (unsigned long long)tot.rfcals,
+                    (unsigned long long)tot.dns,
+                    (unsigned long long)tot.ntp,
+                    (unsigned long long)tot.diags,
+                    (unsigned long long)tot.logs,
+                    (unsigned long long)tot.inventories,
+                    (unsigned long long)tot.blanks,
+                    tot.converts[0] ? tot.convert_ns[0] / 1000.0 / tot.converts[0] : 0,
+                    tot.converts[1] ? tot.convert_ns[1] / 1000.0 / tot.converts[1] : 0,
+                    (unsigned long long)tot.prearmed,
+                    (unsigned long long)tot.integrations,
+                    tot.wakes ? (double)tot.i2c_cpu_us / tot.wakes : 0,
+                    (unsigned long long)tot.stamped,
+                    tot.stamped ? tot.stamp_err_ms / tot.stamped : 0,
+                    tot.max_stamp_err_ms, tot.interval_s, sdMs,
+                    (unsigned long long)tot.ota_checks,
+                    (unsigned long long)tot.ota_installs,
+                    (unsigned long long)tot.ota_bytes,
+                    tot.ota_checks ? tot.ota_download_us / 1000.0 / tot.ota_checks : 0,
+                    tot.ota_installs ? tot.ota_install_us / 1000.0 / tot.ota_installs : 0,
+                    tot.state_us[SIM_CPU] / 1e6, tot.state_us[SIM_ASSOC] / 1e6,
+                    tot.state_us[SIM_RADIO] / 1e6,
+                    avgUa, lifeDays, tot.wakes / wall);
+        } else {
+            printf("simulated     %.1f days, %llu wakes (%.0f wakes/s)\n",
+                    simDays, (unsigned long long)tot.wakes, tot.wakes / wall);
+            printf("reports       %llu delivered, %llu lost (%.2f%%), "
+                    "%llu blank readings\n",
+                    (unsigned long long)tot.reports, (unsigned long long)lost,
+                    tot.wakes ? 100.0 * lost / tot.wakes : 0,
+                    (unsigned long long)tot.blanks);
+            printf("publishes     %llu\n", (unsigned long long)tot.publishes);
+            printf("resets        %llu hung, %llu crashed\n",
+                    (unsigned long long)tot.hangs,
+                    (unsigned long long)tot.crashes);
+            printf("heap          %llu blocks left allocated at sleep, "
+                    "%llu espconns freed in use\n",
+                    (unsigned long long)tot.leaks,
+                    (unsigned long long)tot.freed_live);
+            printf("awake         mean %.1f ms, max %u ms\n",
+                    tot.wakes ? tot.awake_us / 1000.0 / tot.wakes : 0,
+                    tot.max_awake_us / 1000);
+            printf("mqtt connect  mean %.1f ms\n",
+                    tot.connects ? tot.connect_us / 1000.0 / tot.connects : 0);
+            printf("tail          mean %.1f ms last delivery to sleep, "
+                    "%llu sessions closed\n",
+                    tot.tails ? tot.tail_us / 1000.0 / tot.tails : 0,
+                    (unsigned long long)tot.closes);
+            printf("rf cal        %llu of %llu wakes\n",
+                    (unsigned long long)tot.rfcals,
+                    (unsigned long long)tot.wakes);
+            printf("dns           %llu queries\n",
+                    (unsigned long long)tot.dns);
+            printf("diag          %llu records delivered, %llu logs, "
+                    "%llu hardware sets\n",
+                    (unsigned long long)tot.diags,
+                    (unsigned long long)tot.logs,
+                    (unsigned long long)tot.inventories);
+            printf("conversion    started %.1f us after user_init() cold, "
+                    "%.1f us warm, %llu pre-armed; %.2f light integrations "
+                    "per wake\n",
+                    tot.converts[0] ? tot.convert_ns[0] / 1000.0 / tot.converts[0] : 0,
+                    tot.converts[1] ? tot.convert_ns[1] / 1000.0 / tot.converts[1] : 0,
+                    (unsigned long long)tot.prearmed,
+                    tot.wakes ? (double)tot.integrations / tot.wakes : 0);
+            printf("i2c           %.1f us of CPU per wake\n",
+                    tot.wakes ? (double)tot.i2c_cpu_us / tot.wakes : 0);
+            printf("wall clock    %llu ntp queries, %llu reports stamped, "
+                    "error mean %.1f ms, max %.1f ms\n",
+                    (unsigned long long)tot.ntp,
+                    (unsigned long long)tot.stamped,
+                    tot.stamped ? tot.stamp_err_ms / tot.stamped : 0,
+                    tot.max_stamp_err_ms);
+            printf("interval      mean %.3f s, sd %.1f ms between reporting "
+                    "wakes\n", tot.interval_s, sdMs);
+            printf("ota           %llu checks, %llu bytes, download mean "
+                    "%.1f ms; %llu installs, mean %.1f ms radio off to reset\n",
+                    (unsigned long long)tot.ota_checks,
+                    (unsigned long long)tot.ota_bytes,
+                    tot.ota_checks ? tot.ota_download_us / 1000.0 / tot.ota_checks : 0,
+                    (unsigned long long)tot.ota_installs,
+                    tot.ota_installs ? tot.ota_install_us / 1000.0 / tot.ota_installs : 0);
+            printf("time          cpu %.0f s, assoc %.0f s, radio %.0f s\n",
+                    tot.state_us[SIM_CPU] / 1e6, tot.state_us[SIM_ASSOC] / 1e6,
+                    tot.state_us[SIM_RADIO] / 1e6);
+            printf("current       %.2f uA average\n", avgUa);
+            printf("battery life  %.1f days (%.0f mAh)\n",
+                    lifeDays, capacityMah);
+        }
+    }
+    return(0);
+}
@@ -0,0 +1,187 @@
+/*
+ *  sim.h - TLnodeFW simulator internals
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef SIM_H
+#define SIM_H
+
+#include <os_type.h>
+
+/*
+ * Each wake runs in a forked child, so the firmware's static data
+ * starts fresh every time just as it does after a real deep sleep.
+ * Anything that must survive the wake (RTC memory, the virtual clock,
+ * the results) lives in the shared sim_shared_t.
+ */
+#define SIM_RTC_BLOCKS  192     // 64 system + 128 user blocks
+#define SIM_MAX_WAKE_US 120000000
+#define SIM_MAX_MAINS_US 4000000000U    // the wake clock is a uint32
+#define SIM_EPOCH_S     1445212800ULL   // Unix time at power-on
+#define SIM_AP_SERVICE_US       200000  // per association, see sim_queue_us()
+#define SIM_BROKER_SERVICE_US   20000   // per MQTT connect
+#define SIM_QUEUE_MAX_US        10000000
+
+enum {
+    SIM_CPU,        // awake, radio idle
+    SIM_ASSOC,      // WIFI_Connect() until an IP address
+    SIM_RADIO,      // connected
+    SIM_STATES
+};
+
+enum {
+    SIM_AP,         // associating, DHCP
+    SIM_BROKER,     // MQTT connect
+    SIM_SHARED
+};
+
+typedef struct {
+    int32  temp_mc;     // DS18B20 temperature, milli-degC
+    uint32 lux;         // ISL29035 illuminance, lux
+    uint32 vbat_mv;     // supply voltage, 0 = use the battery model
+} sim_sample_t;
+
+typedef struct {
+    uint64 poweron_us;      // the node power-on it was last reset at
+    uint64 convert_us;      // virtual time of the last Convert T
+    uint64 temp_us;         // the Convert T of the register, 0 = none
+    sint16 temp;            // temperature register, 1/16 degC
+    sint16 result;          // what that conversion measures
+    uint8  converting;      // result not yet in the register
+    uint8  wired;           // powered from VDD, kept through deep sleep
+    uint8  th, tl, config;
+    uint8  valid;
+} sim_ds18b20_t;
+
+typedef struct {
+    // set by the parent before each wake
+    uint64 clock_us;        // virtual time at the start of the wake
+    uint64 poweron_us;      // virtual time of the last power-on
+    uint32 reset_reason;
+    uint32 wake;
+    uint8  rf_option;       // system_deep_sleep_set_option(), kept
+    sim_ds18b20_t ds;       // kept while the probe has a supply
+    sim_sample_t sample;
+    uint32 rtc[SIM_RTC_BLOCKS];
+
+    // set by the wake
+    uint32 awake_us;
+    uint32 sleep_us;        // 0 if the wake did not reach deep sleep
+    uint32 state_us[SIM_STATES];
+    uint64 sensor_uaus;     // sensor charge, uA * us
+    uint32 connect_us;      // MQTT_Connect() to the connected callback
+    uint32 publishes;       // messages delivered to the broker
+    uint32 reports;         // .../report messages delivered, and the
+                            // samples in .../batch messages
+    uint32 delivered_us;    // when the last message was delivered
+    uint32 tail_us;         // last delivery to deep sleep
+    uint32 closes;          // DISCONNECTs the broker or gateway saw
+    uint32 rfcal;           // 1 if the wake did a full RF calibration
+    uint32 dns;             // DNS queries sent
+    uint32 ntp;             // NTP queries sent
+    uint32 subscribes;      // MQTT SUBSCRIBEs sent
+    uint32 diags;           // diagnostics records delivered
+    uint32 logs;            // TLOG rings delivered
+    uint32 inventories;     // <id>/hw sets delivered
+    uint32 blanks;          // empty temperature or light fields in
+                            // the reports delivered
+    uint32 convert_ns;      // user_init() to the DS18B20 conversion
+                            // command, host CPU time included
+    uint32 prearmed;        // 1 if the reading was converted before
+                            // the wake
+    uint32 integrations;    // ISL29035 measurements started
+    uint32 i2c_cpu_us;      // CPU time the I2C bus took
+    uint32 wait_us[SIM_SHARED];     // queued behind other nodes for each
+    uint32 stamped;         // 1 if the report carried a time
+    double stamp_err_ms;    // its time less the true time
+    uint32 leaks;           // allocations not freed at deep sleep
+    uint32 freed_live;      // espconns freed while the SDK had them
+    uint32 heap_peak;       // most bytes allocated at once
+    uint32 ota_checks;      // update requests the server answered
+    uint32 ota_bytes;       // bytes of the answers
+    uint32 ota_start_us;    // connect to the update server
+    uint32 ota_end_us;      // the last byte of the answer
+    uint32 ota_off_us;      // radio off with the update in, 0 = not
+    uint32 ota_reset_us;    // system_upgrade_reboot(), 0 if the wake
+                            // slept
+    uint32 ota_installs;    // 1 if the reset was into the update
+    char   last_topic[64];
+    char   last_msg[256];
+} sim_shared_t;
+
+typedef struct {
+    uint32 chip_id;
+    uint32 boot_us;         // reset to user_init()
+    uint32 rfcal_us;        // user_init() to the init done callback
+    uint32 rfskip_us;       // the same without RF calibration
+    uint32 assoc_us;        // WIFI_Connect() to STATION_GOT_IP
+    uint32 connect_us;      // MQTT_Connect() to the connected callback
+    uint32 publish_us;      // MQTT_Publish() to the published callback
+    uint32 rtt_us;          // round trip to the broker or gateway
+    int    broker_no_pipeline;  // close on data sent before CONNACK
+    uint32 tls_cpu_us;      // TLS full handshake crypto time at 80 MHz
+    int    tls_resume;      // abbreviated handshakes after the first wake
+    uint32 conversion_us;   // DS18B20 12-bit conversion
+    int32  rtc_ppm;         // error of the calibrated RTC period
+    int    uart;            // os_printf() to stdout as is
+    uint32 mains_us;        // run one wake this long, 0 = to deep sleep
+    int32  slot_ms;         // retained <id>/slot offset, -1 = none
+    uint32 crash_every;     // wakes, 0 = none crash
+    uint32 missing;         // SIM_NO_* parts left off the board
+    uint32 glitch_every;    // wakes, 0 = the sensors always answer
+    int    verbose;
+} sim_config_t;
+
+#define SIM_NO_DS18B20      0x01
+#define SIM_NO_ISL29035     0x02
+
+extern sim_config_t sim_cfg;
+extern sim_shared_t *sim;
+extern uint32 sim_now_us;
+extern uint8 sim_cpu_mhz;
+extern uint64 sim_init_ns;      // sim_cpu_ns() at user_init()
+
+// sim_sdk.c
+void sim_run_wake(void);
+void sim_wake_end(void);
+void sim_advance(uint32 usec);
+uint64 sim_cpu_ns(void);
+void sim_state(int state);
+uint64 sim_clock_us(void);
+void sim_call_after(ETSTimer *timer, uint32 usec,
+        ETSTimerFunc *fn, void *arg);
+int sim_log(const char *fmt, ...);
+
+// sim_net.c
+int sim_net_load(const char *path);
+uint32 sim_net_blocks(void);
+bool sim_ap_up(uint64 clock_us);
+bool sim_broker_up(uint64 clock_us);
+
+// sim_flash.c
+int sim_flash_init(const char *dir, const char *updatePath);
+const uint8 *sim_flash_update(const char *hex, uint32 *len);
+
+// sim.c
+uint32 sim_queue_us(int what, uint64 ready_us);
+
+// sim_sensors.c
+int sim_sensors_load(const char *path);
+void sim_sensors_sample(uint64 clock_us, sim_sample_t *sample);
+
+#endif
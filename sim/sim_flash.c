@@ -0,0 +1,403 @@
+/*
+ *  sim_flash.c - simulated SPI flash and the ROM routines that use it
+ *
+ *  The flash is shared memory, so what a wake writes is there for the
+ *  next, and erased bits only clear when written, as on the chip. -O
+ *  loads a build's user1.bin into the first slot of the SDK boot
+ *  loader, and -U an update for the stand-in server in sim_net.c.
+ *  Erase, write and read are charged to the virtual clock at typical
+ *  datasheet times.
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <sys/mman.h>
+#include <unistd.h>
+#include <osapi.h>
+#include <user_interface.h>
+#include <spi_flash.h>
+#include "ota.h"
+
+#include "sim.h"
+
+#define FLASH_SIZE      0x400000    // as spi_flash_get_id() says
+#define ERASE_US        45000       // 4 KB sector
+#define PAGE_US         700         // 256 byte page program
+#define READ_BYTES_PER_US 8
+#define SHA1_BLOCK_US   40          // 64 bytes at 80 MHz, ROM code
+
+// the delta header of user/ota.c, as far as the simulator needs it
+#define UPDATE_MAGIC    0x32444c54
+#define UPDATE_LEN      4
+#define UPDATE_OLD_SHA1 8
+#define UPDATE_NEW_SHA1 28
+#define UPDATE_ADDR     48
+#define UPDATE_NEW_LEN  56
+#define UPDATE_HEADER   60
+
+typedef struct {
+    uint8 slot;                     // the boot loader runs, 1 or 2
+    uint8 flag;                     // system_upgrade_flag_set()
+    uint8 bytes[FLASH_SIZE];
+} flash_t;
+
+typedef struct {
+    uint32 state[5];
+    uint32 count[2];
+    uint8 buffer[64];
+} SHA1_CTX;
+
+static flash_t *flash = NULL;
+static uint8 *update = NULL;
+static uint32 updateLen = 0;
+static const uint8 *served = NULL;  // the part of it sent this wake
+
+
+static bool
+in_flash(uint32 addr, uint32 size)
+{
+    return((addr <= FLASH_SIZE) && (size <= FLASH_SIZE - addr));
+}
+
+/*
+ * An update only writes the slot the boot loader does not run
+ */
+static void
+check_write(uint32 addr, uint32 size)
+{
+    uint32 run = (flash->slot == 1) ? OTA_SLOT1_ADDR : OTA_SLOT2_ADDR;
+
+    if ((addr < run + OTA_SLOT_SIZE) && (addr + size > run)) {
+        fprintf(stderr, "wake %u: write to the running slot at 0x%05x\n",
+                sim->wake, addr);
+    }
+}
+
+static uint32
+get_le32(const uint8 *p)
+{
+    return(p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32)p[3] << 24));
+}
+
+static long
+load(const char *path, uint8 *dst, uint32 max)
+{
+    FILE *f = fopen(path, "rb");
+    long n;
+
+    if (f == NULL) {
+        perror(path);
+        return(-1);
+    }
+    n = fread(dst, 1, max, f);
+    if (!feof(f) && (fgetc(f) != EOF)) {
+        fprintf(stderr, "%s: more than %u bytes\n", path, max);
+        n = -1;
+    }
+    fclose(f);
+    return(n);
+}
+
+
+/*
+ * sim_flash_init - erased flash, with the user1.bin in dir and the
+ * update at updatePath if not NULL
+ *
+ * Call before the first wake.
+ */
+int
+sim_flash_init(const char *dir, const char *updatePath)
+{
+    char path[1024];
+    uint32 pos;
+    uint32 len;
+    long n;
+
+    flash = mmap(NULL, sizeof(*flash), PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (flash == MAP_FAILED) {
+        perror("mmap");
+        return(-1);
+    }
+    memset(flash->bytes, 0xff, sizeof(flash->bytes));
+    flash->slot = 1;
+    flash->flag = UPGRADE_FLAG_IDLE;
+
+    if (dir != NULL) {
+        snprintf(path, sizeof(path), "%s/user1.bin", dir);
+        if (load(path, &flash->bytes[OTA_SLOT1_ADDR], OTA_SLOT_SIZE) < 0) {
+            return(-1);
+        }
+    }
+
+    if (updatePath != NULL) {
+        update = malloc(FLASH_SIZE);
+        n = load(updatePath, update, FLASH_SIZE);
+        if (n < 0) {
+            return(-1);
+        }
+        // tools/ota.py writes a delta for each slot, back to back
+        for (pos = 0; (pos == 0) || (pos < n); pos += len) {
+            len = (n - pos < UPDATE_HEADER) ? 0
+                : get_le32(&update[pos + UPDATE_LEN]);
+            if ((len < UPDATE_HEADER) || (len > n - pos)
+                    || (get_le32(&update[pos]) != UPDATE_MAGIC)) {
+                fprintf(stderr, "%s: not an update\n", updatePath);
+                return(-1);
+            }
+        }
+        updateLen = n;
+    }
+    return(0);
+}
+
+/*
+ * sim_flash_update - the delta of the update loaded with -U that
+ * applies to the image with the SHA1 in hex, else NULL
+ */
+const uint8 *
+sim_flash_update(const char *hex, uint32 *len)
+{
+    const uint8 *part;
+    char want[41];
+    uint32 pos;
+    int i;
+
+    for (pos = 0; pos < updateLen; pos += *len) {
+        part = &update[pos];
+        *len = get_le32(&part[UPDATE_LEN]);
+        for (i = 0; i < 20; i++) {
+            sprintf(&want[2 * i], "%02x", part[UPDATE_OLD_SHA1 + i]);
+        }
+        if (strncasecmp(hex, want, 40) == 0) {
+            served = part;
+            return(part);
+        }
+    }
+    return(NULL);
+}
+
+
+/*
+ * SDK calls
+ */
+SpiFlashOpResult
+spi_flash_erase_sector(uint16 sec)
+{
+    if (!in_flash(sec * SPI_FLASH_SEC_SIZE, SPI_FLASH_SEC_SIZE)) {
+        return(SPI_FLASH_RESULT_ERR);
+    }
+    sim_log("flash erase 0x%05x\n", sec * SPI_FLASH_SEC_SIZE);
+    check_write(sec * SPI_FLASH_SEC_SIZE, SPI_FLASH_SEC_SIZE);
+    memset(&flash->bytes[sec * SPI_FLASH_SEC_SIZE], 0xff, SPI_FLASH_SEC_SIZE);
+    sim_advance(ERASE_US);
+    return(SPI_FLASH_RESULT_OK);
+}
+
+SpiFlashOpResult
+spi_flash_write(uint32 des_addr, uint32 *src_addr, uint32 size)
+{
+    const uint8 *src = (const uint8 *)src_addr;
+    uint32 i;
+
+    if ((des_addr & 3) || (size & 3) || !in_flash(des_addr, size)) {
+        return(SPI_FLASH_RESULT_ERR);
+    }
+    check_write(des_addr, size);
+    // programming only clears bits
+    for (i = 0; i < size; i++) {
+        flash->bytes[des_addr + i] &= src[i];
+    }
+    sim_advance((size + 255) / 256 * PAGE_US);
+    return(SPI_FLASH_RESULT_OK);
+}
+
+SpiFlashOpResult
+spi_flash_read(uint32 src_addr, uint32 *des_addr, uint32 size)
+{
+    if ((src_addr & 3) || (size & 3) || !in_flash(src_addr, size)) {
+        return(SPI_FLASH_RESULT_ERR);
+    }
+    memcpy(des_addr, &flash->bytes[src_addr], size);
+    sim_advance(1 + size / READ_BYTES_PER_US);
+    return(SPI_FLASH_RESULT_OK);
+}
+
+
+/*
+ * ROM calls, see user/ota.c
+ */
+#define ROL(v, n)   (((v) << (n)) | ((v) >> (32 - (n))))
+
+static void
+sha1_block(SHA1_CTX *ctx, const uint8 *p)
+{
+    uint32 w[80];
+    uint32 a, b, c, d, e, f, k, t;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        w[i] = ((uint32)p[4 * i] << 24) | (p[4 * i + 1] << 16)
+            | (p[4 * i + 2] << 8) | p[4 * i + 3];
+    }
+    for (i = 16; i < 80; i++) {
+        w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    a = ctx->state[0];
+    b = ctx->state[1];
+    c = ctx->state[2];
+    d = ctx->state[3];
+    e = ctx->state[4];
+    for (i = 0; i < 80; i++) {
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+        t = ROL(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = ROL(b, 30);
+        b = a;
+        a = t;
+    }
+    ctx->state[0] += a;
+    ctx->state[1] += b;
+    ctx->state[2] += c;
+    ctx->state[3] += d;
+    ctx->state[4] += e;
+    sim_advance(SHA1_BLOCK_US * 80 / sim_cpu_mhz);
+}
+
+void
+SHA1Init(SHA1_CTX *ctx)
+{
+    static const uint32 init[5] = {
+        0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+    };
+
+    memcpy(ctx->state, init, sizeof(init));
+    ctx->count[0] = 0;
+    ctx->count[1] = 0;
+}
+
+void
+SHA1Update(SHA1_CTX *ctx, const uint8 *data, uint32 len)
+{
+    uint32 have = ctx->count[0] % 64;
+    uint32 n;
+
+    ctx->count[1] += (ctx->count[0] + len < ctx->count[0]);
+    ctx->count[0] += len;
+    while (len > 0) {
+        n = (64 - have < len) ? 64 - have : len;
+        memcpy(&ctx->buffer[have], data, n);
+        have += n;
+        data += n;
+        len -= n;
+        if (have == 64) {
+            sha1_block(ctx, ctx->buffer);
+            have = 0;
+        }
+    }
+}
+
+void
+SHA1Final(uint8 digest[20], SHA1_CTX *ctx)
+{
+    uint64 bits = (((uint64)ctx->count[1] << 32) | ctx->count[0]) << 3;
+    uint8 pad[72];
+    uint32 n = 64 - (ctx->count[0] + 8) % 64;
+    int i;
+
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+    for (i = 0; i < 8; i++) {
+        pad[n + i] = bits >> (56 - 8 * i);
+    }
+    SHA1Update(ctx, pad, n + 8);
+    for (i = 0; i < 20; i++) {
+        digest[i] = ctx->state[i / 4] >> (24 - 8 * (i % 4));
+    }
+}
+
+
+/*
+ * The SDK boot loader, which boots the slot set by the last update
+ */
+uint8
+system_upgrade_userbin_check(void)
+{
+    return((flash->slot == 2) ? UPGRADE_FW_BIN2 : UPGRADE_FW_BIN1);
+}
+
+void
+system_upgrade_flag_set(uint8 flag)
+{
+    flash->flag = flag;
+}
+
+/*
+ * system_upgrade_reboot - end the wake in a reset, into the other slot
+ * once the update is in
+ *
+ * The image in that slot is checked against the one the delta makes,
+ * which is what the next wake runs.
+ */
+void
+system_upgrade_reboot(void)
+{
+    uint8 digest[20];
+    uint32 addr;
+    SHA1_CTX ctx;
+    bool same = false;
+
+    sim->ota_reset_us = sim_now_us;
+    if (flash->flag == UPGRADE_FLAG_FINISH) {
+        flash->flag = UPGRADE_FLAG_IDLE;
+        flash->slot = (flash->slot == 1) ? 2 : 1;
+        addr = (flash->slot == 1) ? OTA_SLOT1_ADDR : OTA_SLOT2_ADDR;
+        if ((served != NULL) && (get_le32(&served[UPDATE_ADDR]) == addr)) {
+            // the check is not the chip's time
+            SHA1Init(&ctx);
+            SHA1Update(&ctx, &flash->bytes[addr],
+                    get_le32(&served[UPDATE_NEW_LEN]));
+            SHA1Final(digest, &ctx);
+            sim_now_us = sim->ota_reset_us;
+            same = (memcmp(digest, &served[UPDATE_NEW_SHA1], 20) == 0);
+        }
+        if (same) {
+            sim->ota_installs++;
+        } else {
+            fprintf(stderr, "wake %u: slot %u is not the update's image\n",
+                    sim->wake, flash->slot);
+        }
+    }
+    // the heap goes with the reset
+    sim_wake_end();
+    sim->leaks = 0;
+    fflush(stdout);
+    _exit(0);
+}
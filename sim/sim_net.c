@@ -0,0 +1,1251 @@
+/*
+ *  sim_net.c - WiFi, broker and esp_mqtt client model
+ *
+ *  The access point and the broker are up or down according to a
+ *  network trace. Connection set-up and publishing take the fixed
+ *  times given on the command line.
+ *
+ *  Network trace format, one event per line, '#' starts a comment:
+ *      <time_s> ap|broker|broker<N> up|down
+ *  All start out up. Broker N is at 192.168.148.N and the DNS server
+ *  resolves mqtt<N>.lan to it; "broker" is broker 1. For MQTT-SN
+ *  builds the broker 1 entries apply to the gateway, which answers
+ *  each datagram after one round trip.
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <osapi.h>
+#include <mem.h>
+#include <mqtt.h>
+#include <wifi.h>
+#include <espconn.h>
+#include "mqttsn.h"
+#include "ota.h"
+#include "dump.h"
+
+#include "sim.h"
+
+#define WIFI_POLL_US    1000000     // esp_mqtt wifi.c status poll
+#define RECONNECT_US    (MQTT_RECONNECT_TIMEOUT * 1000000)
+#define MAX_EVENTS      1024
+#define MAX_QUEUE       8
+#define UDP_TX_US       1000        // short datagram on air
+#define MAX_REPLIES     4
+#define TLS_RESUME_CPU_US 15000     // abbreviated handshake, no public key math
+#define DNS_TIMEOUT_US  5000000     // lwIP gives up on an unanswered query
+#define BROKER_NET      0x0094a8c0  // 192.168.148.0
+#define NO_BROKER       0
+#define NTP_PORT        123
+#define NTP_PACKET_LEN  48
+#define NTP_UNIX_S      2208988800ULL
+#define HTTP_MSS        1460
+#define HTTP_WINDOW     4           // segments, lwIP's TCP_WND
+
+typedef struct {
+    uint64 time_us;
+    uint8 broker;   // 0 = AP, N = broker N
+    uint8 up;
+} net_event_t;
+
+static net_event_t events[MAX_EVENTS];
+static int nevents = 0;
+
+typedef struct {
+    char topic[64];
+    char data[MQTT_BUF_SIZE];
+    int len;
+} message_t;
+
+static WifiCallback wifiCb = NULL;
+static uint8 wifiStatus = STATION_IDLE;
+static ETSTimer wifiTimer;
+
+static MQTT_Client *client = NULL;
+static uint8 mqttBroker = NO_BROKER;
+static ETSTimer connectTimer;
+static ETSTimer publishTimer;
+static ETSTimer disconnectTimer;
+static ETSTimer mqttSentTimer;
+static ETSTimer retainedTimer;
+static char retainedTopic[64];
+static struct espconn *mqttLive = NULL;    // esp_mqtt's, while the SDK has it
+static ETSTimer mqttAbortTimer;
+static uint32 connectStart = 0;
+static message_t queue[MAX_QUEUE];
+static int qhead = 0;
+static int qcount = 0;
+
+typedef struct {
+    ETSTimer timer;
+    struct espconn *conn;
+    uint8 buf[NTP_PACKET_LEN];
+    uint8 len;      // 0 = free, REPLY_CLOSE = close the connection
+} reply_t;
+
+#define REPLY_CLOSE     0xff
+
+static struct espconn *udpConn = NULL;
+static struct espconn *ntpConn = NULL;
+static ETSTimer udpSentTimer;
+static int udpSentPending = 0;
+static reply_t replies[MAX_REPLIES];
+static uint16 gwLastMsgId = 0;
+
+static struct espconn *tcpConn = NULL;
+static uint8 tcpBroker = NO_BROKER;
+static ETSTimer tcpTimer;
+static ETSTimer tcpSentTimer;
+static bool tcpUp = false;
+static bool brokerSession = false;
+
+static struct espconn *httpConn = NULL;
+static ETSTimer httpTimer;
+static bool httpUp = false;
+static uint8 *httpData = NULL;
+static uint32 httpLen = 0;
+static uint32 httpPos = 0;
+static bool httpHeld = false;       // espconn_recv_hold()
+static uint32 httpHeldLen = 0;      // bytes taken since
+static bool httpStalled = false;    // on a closed window
+
+static ETSTimer dnsTimer;
+static struct espconn *dnsConn = NULL;
+static dns_found_callback dnsCb = NULL;
+static const char *dnsName = NULL;
+static ip_addr_t dnsAddr;
+
+
+int
+sim_net_load(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[128];
+
+    if (f == NULL) {
+        perror(path);
+        return(-1);
+    }
+    while ((fgets(line, sizeof(line), f) != NULL) && (nevents < MAX_EVENTS)) {
+        double t;
+        char what[16];
+        char state[16];
+        unsigned n = 1;
+
+        if ((line[0] == '#') || (sscanf(line, "%lf %15s %15s", &t, what, state) != 3)) {
+            continue;
+        }
+        events[nevents].time_us = (uint64)(t * 1000000.0);
+        if ((strncmp(what, "broker", 6) == 0)
+                && ((what[6] == '\0') || (sscanf(what + 6, "%u", &n) == 1))) {
+            events[nevents].broker = n;
+        } else {
+            events[nevents].broker = 0;
+        }
+        events[nevents].up = (strcmp(state, "up") == 0);
+        nevents++;
+    }
+    fclose(f);
+    return(0);
+}
+
+static bool
+is_up(uint64 clock_us, uint8 broker)
+{
+    bool up = true;
+    int i;
+
+    for (i = 0; (i < nevents) && (events[i].time_us <= clock_us); i++) {
+        if (events[i].broker == broker) {
+            up = events[i].up;
+        }
+    }
+    return(up);
+}
+
+bool sim_ap_up(uint64 clock_us) { return(is_up(clock_us, 0)); }
+bool sim_broker_up(uint64 clock_us) { return(is_up(clock_us, 1)); }
+
+/*
+ * Broker N is at 192.168.148.N, nothing answers anywhere else
+ */
+static uint8
+ip_broker(uint32 ip)
+{
+    if (((ip & 0x00ffffff) != BROKER_NET) || ((ip >> 24) == 0)) {
+        return(NO_BROKER);
+    }
+    return(ip >> 24);
+}
+
+static bool
+broker_up(uint8 broker)
+{
+    return((broker != NO_BROKER) && is_up(sim_clock_us(), broker));
+}
+
+
+/*
+ * WiFi, modelled on esp_mqtt's wifi.c: the callback is called when the
+ * polled station status changes.
+ */
+static void
+wifi_poll(void *arg)
+{
+    uint8 status;
+
+    if (sim_ap_up(sim_clock_us())) {
+        status = STATION_GOT_IP;
+        sim_state(SIM_RADIO);
+    } else {
+        status = STATION_NO_AP_FOUND;
+        os_timer_arm_us(&wifiTimer, WIFI_POLL_US, 0);
+    }
+    if ((status != wifiStatus) && (wifiCb != NULL)) {
+        wifiStatus = status;
+        sim_log("wifi status %d\n", status);
+        wifiCb(status);
+    }
+}
+
+void
+WIFI_Connect(uint8_t *ssid, uint8_t *pass, WifiCallback cb)
+{
+    // the AP's part is the end of the association
+    uint32 wait = sim_queue_us(SIM_AP,
+            sim_clock_us() + sim_cfg.assoc_us - SIM_AP_SERVICE_US);
+
+    wifiCb = cb;
+    sim_state(SIM_ASSOC);
+    sim->wait_us[SIM_AP] = wait;
+    sim_call_after(&wifiTimer, sim_cfg.assoc_us + wait, wifi_poll, NULL);
+}
+
+uint8
+wifi_station_get_connect_status(void)
+{
+    return(wifiStatus);
+}
+
+bool
+wifi_set_opmode_current(uint8 opmode)
+{
+    if (opmode == NULL_MODE) {
+        wifiStatus = STATION_IDLE;
+        sim_state(SIM_CPU);
+        sim->ota_off_us = sim_now_us;
+    }
+    return(true);
+}
+
+bool
+wifi_get_ip_info(uint8 if_index, struct ip_info *info)
+{
+    memset(info, 0, sizeof(*info));
+    if (wifiStatus == STATION_GOT_IP) {
+        info->ip.addr = 0x6494a8c0;     // 192.168.148.100
+        info->gw.addr = 0x0194a8c0;
+        info->netmask.addr = 0x00ffffff;
+    }
+    return(true);
+}
+
+
+/*
+ * field - the n-th comma separated field of a message, NULL if short
+ */
+static const char *
+field(const char *data, int len, int n)
+{
+    int i;
+
+    for (i = 0; (n > 0) && (i < len); i++) {
+        if (data[i] == ',') {
+            n--;
+        }
+    }
+    return((n == 0) ? &data[i] : NULL);
+}
+
+/*
+ * check_stamp - compare the time on a report with the virtual clock
+ *
+ * The report's elapsed field (6) is system_get_time() when it was made,
+ * and the time field (11) follows with no virtual time in between.
+ */
+static void
+check_stamp(const char *data, int len)
+{
+    const char *elapsed = field(data, len, 5);
+    const char *stamp = field(data, len, 11);
+    double trueS;
+
+    if ((elapsed == NULL) || (stamp == NULL) || (stamp >= data + len)
+            || (*stamp == ',')) {
+        return;
+    }
+    trueS = SIM_EPOCH_S + sim->clock_us / 1e6 + atof(elapsed);
+    sim->stamped = 1;
+    sim->stamp_err_ms = (atof(stamp) - trueS) * 1000.0;
+}
+
+/*
+ * A message reached the broker
+ */
+static void
+deliver(const char *topic, const char *data, int len)
+{
+    int tlen = strlen(topic);
+    unsigned samples;
+    int i;
+
+    sim->publishes++;
+    if ((tlen >= 7) && (strcmp(topic + tlen - 7, "/report") == 0)) {
+        const char *temp = field(data, len, 2);
+        const char *lux = field(data, len, 3);
+
+        sim->reports++;
+        sim->blanks += ((temp != NULL) && (*temp == ','))
+            + ((lux != NULL) && (*lux == ','));
+        check_stamp(data, len);
+    }
+    if ((tlen >= 5) && (strcmp(topic + tlen - 5, "/diag") == 0)
+            && (len == DUMP_RECORD_LEN) && (data[0] == DUMP_VERSION)) {
+        sim->diags++;
+    }
+    if ((tlen >= 4) && (strcmp(topic + tlen - 4, "/log") == 0)) {
+        sim->logs++;
+    }
+    if ((tlen >= 3) && (strcmp(topic + tlen - 3, "/hw") == 0)) {
+        sim->inventories++;
+    }
+    // "1,2,<samples>,<time>" heads a MAINS batch
+    if ((tlen >= 6) && (strcmp(topic + tlen - 6, "/batch") == 0)
+            && (sscanf(data, "%*u,%*u,%u", &samples) == 1)) {
+        sim->reports += samples;
+    }
+    sim->delivered_us = sim_now_us;
+    snprintf(sim->last_topic, sizeof(sim->last_topic), "%s", topic);
+    if (((tlen >= 5) && (strcmp(topic + tlen - 5, "/diag") == 0))
+            || ((tlen >= 4) && (strcmp(topic + tlen - 4, "/log") == 0))) {
+        // binary, as hex for tools/dump.py and tools/tlog.py
+        for (i = 0; (i < len) && (2 * i + 2 < sizeof(sim->last_msg)); i++) {
+            sprintf(&sim->last_msg[2 * i], "%02x", (uint8)data[i]);
+        }
+    } else {
+        snprintf(sim->last_msg, sizeof(sim->last_msg), "%.*s", len, data);
+    }
+    sim_log("published %s: %s\n", sim->last_topic, sim->last_msg);
+}
+
+
+/*
+ * MQTT client
+ */
+static void
+mqtt_connected(void *arg)
+{
+    if (!broker_up(mqttBroker)) {
+        // esp_mqtt retries after MQTT_RECONNECT_TIMEOUT
+        sim_log("mqtt connect failed\n");
+        client->connState = TCP_RECONNECT_REQ;
+        os_timer_arm_us(&connectTimer, RECONNECT_US, 0);
+        return;
+    }
+    client->connState = MQTT_DATA;
+    sim->connect_us = sim_now_us - connectStart;
+    if (client->connectedCb != NULL) {
+        client->connectedCb((uint32_t *)client);
+    }
+    if (qcount > 0) {
+        os_timer_arm_us(&publishTimer, sim_cfg.publish_us, 0);
+    }
+}
+
+static void
+mqtt_published(void *arg)
+{
+    message_t *m = &queue[qhead];
+
+    if ((client->connState != MQTT_DATA) || (qcount == 0)) {
+        return;
+    }
+    if (broker_up(mqttBroker)) {
+        deliver(m->topic, m->data, m->len);
+    }
+    qhead = (qhead + 1) % MAX_QUEUE;
+    qcount--;
+
+    if (client->publishedCb != NULL) {
+        client->publishedCb((uint32_t *)client);
+    }
+    if (qcount > 0) {
+        os_timer_arm_us(&publishTimer, sim_cfg.publish_us, 0);
+    }
+}
+
+static void
+mqtt_sent(void *arg)
+{
+    if ((client->pCon != NULL) && (client->pCon->sent_callback != NULL)) {
+        client->pCon->sent_callback(client->pCon);
+    }
+}
+
+static void
+mqtt_disconnected(void *arg)
+{
+    if (client->disconnectedCb != NULL) {
+        client->disconnectedCb((uint32_t *)client);
+    }
+}
+
+/*
+ * With -A the broker holds a retained wake offset on <id>/slot, see
+ * include/schedule.h. Nothing else is retained.
+ */
+static void
+mqtt_retained(void *arg)
+{
+    char data[16];
+
+    if ((client->connState != MQTT_DATA) || !broker_up(mqttBroker)
+            || (client->dataCb == NULL)) {
+        return;
+    }
+    snprintf(data, sizeof(data), "%d", sim_cfg.slot_ms);
+    client->dataCb((uint32_t *)client, retainedTopic, strlen(retainedTopic),
+            data, strlen(data));
+}
+
+void
+MQTT_InitConnection(MQTT_Client *mqttClient, uint8_t *host, uint32 port,
+        uint8_t security)
+{
+    memset(mqttClient, 0, sizeof(*mqttClient));
+    // esp_mqtt keeps a copy
+    mqttClient->host = os_zalloc(strlen((char *)host) + 1);
+    strcpy((char *)mqttClient->host, (char *)host);
+    mqttClient->port = port;
+    mqttClient->security = security;
+    client = mqttClient;
+    os_timer_setfn(&connectTimer, mqtt_connected, NULL);
+    os_timer_setfn(&publishTimer, mqtt_published, NULL);
+    os_timer_setfn(&disconnectTimer, mqtt_disconnected, NULL);
+    os_timer_setfn(&mqttSentTimer, mqtt_sent, NULL);
+    os_timer_setfn(&retainedTimer, mqtt_retained, NULL);
+}
+
+void
+MQTT_InitClient(MQTT_Client *mqttClient, uint8_t *client_id,
+        uint8_t *client_user, uint8_t *client_pass,
+        uint32_t keepAliveTime, uint8_t cleanSession)
+{
+    mqttClient->connect_info.client_id = client_id;
+    mqttClient->connect_info.username = client_user;
+    mqttClient->connect_info.password = client_pass;
+    mqttClient->connect_info.keepalive = keepAliveTime;
+    mqttClient->connect_info.clean_session = cleanSession;
+}
+
+void
+MQTT_InitLWT(MQTT_Client *mqttClient, uint8_t *will_topic,
+        uint8_t *will_msg, uint8_t will_qos, uint8_t will_retain)
+{
+    mqttClient->connect_info.will_topic = will_topic;
+    mqttClient->connect_info.will_msg = will_msg;
+    mqttClient->connect_info.will_qos = will_qos;
+    mqttClient->connect_info.will_retain = will_retain;
+}
+
+void MQTT_OnConnected(MQTT_Client *c, MqttCallback cb) { c->connectedCb = cb; }
+void MQTT_OnDisconnected(MQTT_Client *c, MqttCallback cb) { c->disconnectedCb = cb; }
+void MQTT_OnPublished(MQTT_Client *c, MqttCallback cb) { c->publishedCb = cb; }
+void MQTT_OnData(MQTT_Client *c, MqttDataCallback cb) { c->dataCb = cb; }
+
+BOOL
+MQTT_Subscribe(MQTT_Client *c, char *topic, uint8_t qos)
+{
+    int tlen = strlen(topic);
+
+    sim->subscribes++;
+    if ((sim_cfg.slot_ms >= 0) && (tlen >= 5)
+            && (strcmp(topic + tlen - 5, "/slot") == 0)) {
+        snprintf(retainedTopic, sizeof(retainedTopic), "%s", topic);
+        os_timer_arm_us(&retainedTimer, sim_cfg.rtt_us, 0);
+    }
+    return(TRUE);
+}
+
+/*
+ * TLS adds a full handshake (two round trips and the public key math)
+ * to every connection, or with -S an abbreviated one (one round trip)
+ * on every wake after power-on, as if the session were resumed.
+ */
+static uint32
+tls_handshake_us(void)
+{
+    if (sim_cfg.tls_resume && (sim->wake > 0)) {
+        return(sim_cfg.rtt_us + TLS_RESUME_CPU_US);
+    }
+    return(2 * sim_cfg.rtt_us + sim_cfg.tls_cpu_us * 80 / sim_cpu_mhz);
+}
+
+/*
+ * esp_mqtt frees its espconn without closing it. If the SDK still has
+ * the connection, its next callback would run on freed memory.
+ */
+static void
+mqtt_free(MQTT_Client *mqttClient)
+{
+    if (mqttClient->pCon == NULL) {
+        return;
+    }
+    if (mqttClient->pCon == mqttLive) {
+        sim_log("esp_mqtt's espconn freed while the SDK has it\n");
+        sim->freed_live++;
+        mqttLive = NULL;
+    }
+    os_free(mqttClient->pCon->proto.tcp);
+    os_free(mqttClient->pCon);
+    mqttClient->pCon = NULL;
+}
+
+uint32
+sim_net_blocks(void)
+{
+    return(((client != NULL) && (client->pCon != NULL)) ? 2 : 0);
+}
+
+static void
+mqtt_aborted(void *arg)
+{
+    struct espconn *pCon = (struct espconn *)arg;
+
+    if (pCon->proto.tcp->disconnect_callback != NULL) {
+        pCon->proto.tcp->disconnect_callback(pCon);
+    }
+}
+
+void
+MQTT_Connect(MQTT_Client *mqttClient)
+{
+    uint32 wait = sim_queue_us(SIM_BROKER,
+            sim_clock_us() + sim_cfg.connect_us - SIM_BROKER_SERVICE_US);
+    uint32 usec = sim_cfg.connect_us + wait;
+
+    if (mqttClient->security) {
+        usec += tls_handshake_us();
+    }
+    mqttBroker = ip_broker(ipaddr_addr((char *)mqttClient->host));
+    if ((mqttBroker == NO_BROKER)
+            && (sscanf((char *)mqttClient->host, "mqtt%hhu.lan", &mqttBroker) == 1)) {
+        // esp_mqtt looks the name up itself
+        sim->dns++;
+        usec += sim_cfg.rtt_us;
+    }
+    // a new espconn for each connection
+    mqtt_free(mqttClient);
+    mqttClient->pCon = (struct espconn *)os_zalloc(sizeof(struct espconn));
+    mqttClient->pCon->type = ESPCONN_TCP;
+    mqttClient->pCon->proto.tcp = (esp_tcp *)os_zalloc(sizeof(esp_tcp));
+    mqttLive = mqttClient->pCon;
+    mqttClient->connState = TCP_CONNECTING;
+    connectStart = sim_now_us;
+    sim->wait_us[SIM_BROKER] = wait;
+    os_timer_arm_us(&connectTimer, usec, 0);
+}
+
+void
+MQTT_Disconnect(MQTT_Client *mqttClient)
+{
+    bool wasConnected = (mqttClient->connState == MQTT_DATA);
+
+    os_timer_disarm(&connectTimer);
+    os_timer_disarm(&publishTimer);
+    os_timer_disarm(&mqttSentTimer);
+    os_timer_disarm(&retainedTimer);
+    mqttClient->connState = TCP_DISCONNECTED;
+    mqtt_free(mqttClient);
+    if (wasConnected) {
+        os_timer_arm_us(&disconnectTimer, 1000, 0);
+    }
+}
+
+BOOL
+MQTT_Publish(MQTT_Client *c, const char *topic, const char *data,
+        int data_length, int qos, int retain)
+{
+    message_t *m;
+
+    if (qcount >= MAX_QUEUE) {
+        return(FALSE);
+    }
+    m = &queue[(qhead + qcount) % MAX_QUEUE];
+    snprintf(m->topic, sizeof(m->topic), "%s", topic);
+    m->len = (data_length < (int)sizeof(m->data)) ? data_length
+        : (int)sizeof(m->data) - 1;
+    memcpy(m->data, data, m->len);
+    m->data[m->len] = '\0';
+    qcount++;
+
+    if ((c->connState == MQTT_DATA) && (qcount == 1)) {
+        os_timer_arm_us(&publishTimer, sim_cfg.publish_us, 0);
+    }
+    return(TRUE);
+}
+
+mqtt_message_t *
+mqtt_msg_disconnect(mqtt_connection_t *connection)
+{
+    static uint8 packet[2] = { 0xe0, 0 };
+    static mqtt_message_t msg = { packet, sizeof(packet) };
+
+    return(&msg);
+}
+
+/*
+ * app.c writes DISCONNECT on esp_mqtt's connection itself. The sent
+ * callback comes with the broker's ACK.
+ */
+static sint8
+mqtt_conn_sent(uint8 *psent, uint16 length)
+{
+    if ((client == NULL) || (client->connState != MQTT_DATA)) {
+        return(-1);
+    }
+    if (broker_up(mqttBroker)) {
+        if ((length == 2) && (psent[0] == 0xe0)) {
+            sim->closes++;
+        }
+        os_timer_arm_us(&mqttSentTimer, sim_cfg.rtt_us, 0);
+    }
+    return(0);
+}
+
+
+/*
+ * UDP and a stand-in MQTT-SN gateway with the topic IDs from
+ * include/mqttsn.h pre-registered for this node.
+ */
+static void
+udp_sent(void *arg)
+{
+    udpSentPending--;
+    if (udpSentPending > 0) {
+        os_timer_arm_us(&udpSentTimer, UDP_TX_US, 0);
+    }
+    if (udpConn->sent_callback != NULL) {
+        udpConn->sent_callback(udpConn);
+    }
+}
+
+static void tcp_closed(void *arg);
+
+static void
+net_reply(void *arg)
+{
+    reply_t *r = (reply_t *)arg;
+    uint8 len = r->len;
+
+    r->len = 0;
+    if (len == REPLY_CLOSE) {
+        tcp_closed(NULL);
+    } else if (sim_ap_up(sim_clock_us()) && (r->conn->recv_callback != NULL)) {
+        r->conn->recv_callback(r->conn, (char *)r->buf, len);
+    }
+}
+
+static void
+send_reply(struct espconn *conn, const uint8 *buf, uint8 len)
+{
+    int i;
+
+    for (i = 0; i < MAX_REPLIES; i++) {
+        if (replies[i].len == 0) {
+            if (len != REPLY_CLOSE) {
+                memcpy(replies[i].buf, buf, len);
+            }
+            replies[i].conn = conn;
+            replies[i].len = len;
+            sim_call_after(&replies[i].timer, sim_cfg.rtt_us, net_reply,
+                    &replies[i]);
+            return;
+        }
+    }
+}
+
+static void
+gateway_reply(const uint8 *buf, uint8 len)
+{
+    send_reply(udpConn, buf, len);
+}
+
+static void
+gateway_recv(const uint8 *p, uint16 len)
+{
+    char topic[64];
+    uint16 topicId;
+    uint16 msgId;
+    uint8 qos;
+    uint8 rc = 0;
+
+    if ((len < 2) || (p[0] != len)) {
+        return;
+    }
+    switch (p[1]) {
+        case 0x04: {    // CONNECT
+            uint8 connack[3] = { 3, 0x05, 0 };
+            gateway_reply(connack, sizeof(connack));
+            break;
+        }
+        case 0x0c: {    // PUBLISH
+            uint8 puback[7];
+
+            if (len < 7) {
+                break;
+            }
+            topicId = (p[3] << 8) | p[4];
+            msgId = (p[5] << 8) | p[6];
+            qos = (p[2] >> 5) & 0x03;
+            if (topicId == MQTTSN_TOPIC_REPORT) {
+                snprintf(topic, sizeof(topic), MQTT_CLIENT_ID "/report",
+                        sim_cfg.chip_id);
+            } else if (topicId == MQTTSN_TOPIC_HEAP) {
+                snprintf(topic, sizeof(topic), MQTT_CLIENT_ID "/heap",
+                        sim_cfg.chip_id);
+            } else if (topicId == MQTTSN_TOPIC_DIAG) {
+                snprintf(topic, sizeof(topic), MQTT_CLIENT_ID "/diag",
+                        sim_cfg.chip_id);
+            } else if (topicId == MQTTSN_TOPIC_LOG) {
+                snprintf(topic, sizeof(topic), MQTT_CLIENT_ID "/log",
+                        sim_cfg.chip_id);
+            } else if (topicId == MQTTSN_TOPIC_HW) {
+                snprintf(topic, sizeof(topic), MQTT_CLIENT_ID "/hw",
+                        sim_cfg.chip_id);
+            } else {
+                rc = 0x02;      // invalid topic ID
+            }
+            if ((rc == 0) && !((p[2] & 0x80) && (msgId == gwLastMsgId))) {
+                deliver(topic, (const char *)&p[7], len - 7);
+            }
+            gwLastMsgId = msgId;
+            if (qos == 1) {
+                puback[0] = 7;
+                puback[1] = 0x0d;
+                puback[2] = p[3];
+                puback[3] = p[4];
+                puback[4] = p[5];
+                puback[5] = p[6];
+                puback[6] = rc;
+                gateway_reply(puback, sizeof(puback));
+            }
+            break;
+        }
+        case 0x18: {    // DISCONNECT
+            uint8 disconnect[2] = { 2, 0x18 };
+
+            sim->closes++;
+            gateway_reply(disconnect, sizeof(disconnect));
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+/*
+ * TCP to the broker, for the pipelined client in user/mqttpipe.c.
+ * The broker answers CONNECT after one round trip. With -R it closes
+ * the connection without CONNACK if anything follows CONNECT in the
+ * same segment.
+ */
+static void
+tcp_closed(void *arg)
+{
+    tcpUp = false;
+    brokerSession = false;
+    os_timer_disarm(&tcpSentTimer);
+    if ((tcpConn != NULL) && (tcpConn->proto.tcp->disconnect_callback != NULL)) {
+        tcpConn->proto.tcp->disconnect_callback(tcpConn);
+    }
+}
+
+static void
+tcp_connected(void *arg)
+{
+    if (!sim_ap_up(sim_clock_us()) || !broker_up(tcpBroker)) {
+        if (tcpConn->proto.tcp->reconnect_callback != NULL) {
+            tcpConn->proto.tcp->reconnect_callback(tcpConn, -9);
+        }
+        return;
+    }
+    tcpUp = true;
+    if (tcpConn->proto.tcp->connect_callback != NULL) {
+        tcpConn->proto.tcp->connect_callback(tcpConn);
+    }
+}
+
+static void
+tcp_sent(void *arg)
+{
+    if (tcpConn->sent_callback != NULL) {
+        tcpConn->sent_callback(tcpConn);
+    }
+}
+
+static void
+broker_recv(const uint8 *p, uint16 len)
+{
+    uint16 pos = 0;
+
+    while (pos + 2 <= len) {
+        uint8 type = p[pos] & 0xf0;
+        uint32 remaining = 0;
+        int shift = 0;
+        uint16 start;
+
+        pos++;
+        do {
+            remaining |= (p[pos] & 0x7f) << shift;
+            shift += 7;
+        } while (p[pos++] & 0x80);
+        start = pos;
+        if (start + remaining > len) {
+            break;
+        }
+
+        if (type == 0x10) {             // CONNECT
+            uint8 connack[4] = { 0x20, 2, 0, 0 };
+
+            if (sim_cfg.broker_no_pipeline && (start + remaining < len)) {
+                send_reply(tcpConn, NULL, REPLY_CLOSE);
+                return;
+            }
+            send_reply(tcpConn, connack, sizeof(connack));
+            brokerSession = true;
+        } else if ((type == 0x30) && brokerSession) {  // PUBLISH QoS 0
+            char topic[64];
+            uint16 tlen = (p[start] << 8) | p[start + 1];
+
+            snprintf(topic, sizeof(topic), "%.*s", tlen, &p[start + 2]);
+            deliver(topic, (const char *)&p[start + 2 + tlen],
+                    remaining - 2 - tlen);
+        } else if ((type == 0xe0) && brokerSession) {  // DISCONNECT
+            sim->closes++;
+            brokerSession = false;
+        }
+        pos = start + remaining;
+    }
+}
+
+/*
+ * A stand-in update server on OTA_PORT of every address, for OTA=1
+ * builds. It answers a GET for the image the update loaded with -U
+ * applies to with the update, and any other with 404, and closes.
+ * The answer starts a round trip after the request and comes in
+ * HTTP_MSS segments, HTTP_WINDOW of them a round trip, but never
+ * before the firmware has returned from the last one. While the
+ * firmware holds reception, the segments already in flight still
+ * come, up to a window, and then the server waits for the window to
+ * open again.
+ */
+static void
+http_closed(void *arg)
+{
+    httpUp = false;
+    os_timer_disarm(&httpTimer);
+    free(httpData);
+    httpData = NULL;
+    if ((httpConn != NULL) && (httpConn->proto.tcp->disconnect_callback != NULL)) {
+        httpConn->proto.tcp->disconnect_callback(httpConn);
+    }
+}
+
+static void
+http_connected(void *arg)
+{
+    if (!sim_ap_up(sim_clock_us())) {
+        if (httpConn->proto.tcp->reconnect_callback != NULL) {
+            httpConn->proto.tcp->reconnect_callback(httpConn, -9);
+        }
+        return;
+    }
+    httpUp = true;
+    if (httpConn->proto.tcp->connect_callback != NULL) {
+        httpConn->proto.tcp->connect_callback(httpConn);
+    }
+}
+
+static void
+http_segment(void *arg)
+{
+    uint32 n = (httpLen - httpPos < HTTP_MSS) ? httpLen - httpPos : HTTP_MSS;
+
+    // a lost segment stalls the rest, the firmware times out
+    if (!httpUp || !sim_ap_up(sim_clock_us())) {
+        return;
+    }
+    if (n == 0) {
+        http_closed(NULL);
+        return;
+    }
+    if (httpHeld && (httpHeldLen >= HTTP_WINDOW * HTTP_MSS)) {
+        httpStalled = true;
+        return;
+    }
+    if (httpHeld) {
+        httpHeldLen += n;
+    }
+    httpPos += n;
+    sim->ota_bytes += n;
+    sim->ota_end_us = sim_now_us;
+    if (httpConn->recv_callback != NULL) {
+        httpConn->recv_callback(httpConn, (char *)&httpData[httpPos - n], n);
+    }
+    if (httpUp) {
+        sim_call_after(&httpTimer, sim_cfg.rtt_us / HTTP_WINDOW,
+                http_segment, NULL);
+    }
+}
+
+static void
+http_request(const uint8 *p, uint16 len)
+{
+    char req[128];
+    char hex[41];
+    const uint8 *update = NULL;
+    uint32 updateLen = 0;
+    int n;
+
+    if (httpData != NULL) {
+        return;
+    }
+    snprintf(req, sizeof(req), "%.*s", len, (const char *)p);
+    if (sscanf(req, "GET /ota/%40[0-9a-fA-F] ", hex) == 1) {
+        update = sim_flash_update(hex, &updateLen);
+    }
+    httpData = malloc(updateLen + 128);
+    if (update != NULL) {
+        n = sprintf((char *)httpData, "HTTP/1.0 200 OK\r\n"
+                "Content-Type: application/octet-stream\r\n"
+                "Content-Length: %u\r\n\r\n", updateLen);
+        memcpy(&httpData[n], update, updateLen);
+        httpLen = n + updateLen;
+    } else {
+        httpLen = sprintf((char *)httpData,
+                "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+    }
+    httpPos = 0;
+    httpHeld = false;
+    httpStalled = false;
+    sim->ota_checks++;
+    sim_call_after(&httpTimer, sim_cfg.rtt_us, http_segment, NULL);
+}
+
+sint8
+espconn_connect(struct espconn *espconn)
+{
+    uint32 ip;
+
+    if (espconn->proto.tcp->remote_port == OTA_PORT) {
+        httpConn = espconn;
+        if (!sim_ap_up(sim_clock_us())) {
+            return(-1);
+        }
+        sim->ota_start_us = sim_now_us;
+        sim_call_after(&httpTimer, sim_cfg.rtt_us, http_connected, NULL);
+        return(0);
+    }
+    tcpConn = espconn;
+    memcpy(&ip, espconn->proto.tcp->remote_ip, 4);
+    tcpBroker = ip_broker(ip);
+    os_timer_setfn(&tcpSentTimer, tcp_sent, NULL);
+    if (!sim_ap_up(sim_clock_us())) {
+        return(-1);
+    }
+    // SYN, SYN-ACK
+    sim_call_after(&tcpTimer, sim_cfg.rtt_us, tcp_connected, NULL);
+    return(0);
+}
+
+sint8
+espconn_disconnect(struct espconn *espconn)
+{
+    if (espconn == httpConn) {
+        if (httpUp) {
+            httpUp = false;
+            sim_call_after(&httpTimer, 1000, http_closed, NULL);
+        }
+        return(0);
+    }
+    if (tcpUp) {
+        tcpUp = false;
+        sim_call_after(&tcpTimer, 1000, tcp_closed, NULL);
+    }
+    return(0);
+}
+
+/*
+ * Drops a connect that is still out as well as an open connection.
+ * The disconnect callback follows, as for espconn_disconnect().
+ */
+sint8
+espconn_abort(struct espconn *espconn)
+{
+    if (espconn == httpConn) {
+        httpUp = false;
+        sim_call_after(&httpTimer, 1000, http_closed, NULL);
+        return(0);
+    }
+    if ((espconn == mqttLive) && (mqttLive != NULL)) {
+        os_timer_disarm(&connectTimer);
+        os_timer_disarm(&publishTimer);
+        os_timer_disarm(&mqttSentTimer);
+        os_timer_disarm(&retainedTimer);
+        mqttLive = NULL;
+        sim_call_after(&mqttAbortTimer, 1000, mqtt_aborted, espconn);
+        return(0);
+    }
+    if (espconn != tcpConn) {
+        return(-12);
+    }
+    tcpUp = false;
+    sim_call_after(&tcpTimer, 1000, tcp_closed, NULL);
+    return(0);
+}
+
+/*
+ * The SDK only stops opening the receive window, see http_segment()
+ */
+sint8
+espconn_recv_hold(struct espconn *espconn)
+{
+    if (espconn == httpConn) {
+        httpHeld = true;
+        httpHeldLen = 0;
+    }
+    return(0);
+}
+
+sint8
+espconn_recv_unhold(struct espconn *espconn)
+{
+    if ((espconn == httpConn) && httpHeld) {
+        httpHeld = false;
+        if (httpStalled && httpUp) {
+            // the window update out, and the next segment back
+            httpStalled = false;
+            sim_call_after(&httpTimer, sim_cfg.rtt_us, http_segment, NULL);
+        }
+    }
+    return(0);
+}
+
+sint8
+espconn_regist_connectcb(struct espconn *espconn, espconn_connect_callback cb)
+{
+    espconn->proto.tcp->connect_callback = cb;
+    return(0);
+}
+
+sint8
+espconn_regist_reconcb(struct espconn *espconn, espconn_reconnect_callback cb)
+{
+    espconn->proto.tcp->reconnect_callback = cb;
+    return(0);
+}
+
+sint8
+espconn_regist_disconcb(struct espconn *espconn, espconn_connect_callback cb)
+{
+    espconn->proto.tcp->disconnect_callback = cb;
+    return(0);
+}
+
+/*
+ * A stand-in NTP server on every address, answering with the virtual
+ * clock as it is half a round trip after the query.
+ */
+static void
+ntp_query(const uint8 *p, uint16 len)
+{
+    uint8 reply[NTP_PACKET_LEN];
+    uint64 us = SIM_EPOCH_S * 1000000ULL + sim_clock_us() + sim_cfg.rtt_us / 2;
+    uint64 sec = us / 1000000 + NTP_UNIX_S;
+    uint64 frac = ((us % 1000000) << 32) / 1000000;
+    int i;
+
+    sim->ntp++;
+    if ((len < NTP_PACKET_LEN) || !sim_ap_up(sim_clock_us())) {
+        return;
+    }
+    memset(reply, 0, sizeof(reply));
+    reply[0] = 0x24;    // version 4, server
+    reply[1] = 2;       // stratum
+    for (i = 0; i < 4; i++) {
+        reply[40 + i] = sec >> (24 - 8 * i);
+        reply[44 + i] = frac >> (24 - 8 * i);
+    }
+    send_reply(ntpConn, reply, sizeof(reply));
+}
+
+sint8
+espconn_create(struct espconn *espconn)
+{
+    if (espconn->proto.udp->remote_port == NTP_PORT) {
+        ntpConn = espconn;
+        return(0);
+    }
+    udpConn = espconn;
+    os_timer_setfn(&udpSentTimer, udp_sent, NULL);
+    return(0);
+}
+
+sint8
+espconn_delete(struct espconn *espconn)
+{
+    if (espconn == ntpConn) {
+        ntpConn = NULL;
+        return(0);
+    }
+    os_timer_disarm(&udpSentTimer);
+    udpConn = NULL;
+    return(0);
+}
+
+sint8
+espconn_sent(struct espconn *espconn, uint8 *psent, uint16 length)
+{
+    if ((client != NULL) && (espconn == client->pCon)) {
+        return(mqtt_conn_sent(psent, length));
+    }
+    if ((espconn == httpConn) && (httpConn != NULL)) {
+        if (!httpUp) {
+            return(-1);
+        }
+        http_request(psent, length);
+        return(0);
+    }
+    if (espconn->type == ESPCONN_TCP) {
+        if (!tcpUp) {
+            return(-1);
+        }
+        if (broker_up(tcpBroker)) {
+            broker_recv(psent, length);
+        }
+        // sent once the broker's ACK is back
+        os_timer_arm_us(&tcpSentTimer, sim_cfg.rtt_us, 0);
+        return(0);
+    }
+    if ((espconn == ntpConn) && (ntpConn != NULL)) {
+        ntp_query(psent, length);
+        return(0);
+    }
+    if (udpConn == NULL) {
+        return(-1);
+    }
+    if (udpSentPending++ == 0) {
+        os_timer_arm_us(&udpSentTimer, UDP_TX_US, 0);
+    }
+    if (sim_ap_up(sim_clock_us()) && sim_broker_up(sim_clock_us())) {
+        gateway_recv(psent, length);
+    }
+    return(0);
+}
+
+sint8
+espconn_regist_sentcb(struct espconn *espconn, espconn_sent_callback cb)
+{
+    espconn->sent_callback = cb;
+    return(0);
+}
+
+sint8
+espconn_regist_recvcb(struct espconn *espconn, espconn_recv_callback cb)
+{
+    espconn->recv_callback = cb;
+    return(0);
+}
+
+uint32
+espconn_port(void)
+{
+    return(49152);
+}
+
+uint32
+ipaddr_addr(const char *cp)
+{
+    unsigned a, b, c, d;
+
+    if (sscanf(cp, "%u.%u.%u.%u", &a, &b, &c, &d) != 4) {
+        return(0xffffffff);
+    }
+    return(a | (b << 8) | (c << 16) | (d << 24));
+}
+
+/*
+ * DNS, one query at a time. The server answers after a round trip
+ * while the AP is up; lwIP gives up on the query otherwise.
+ */
+static void
+dns_reply(void *arg)
+{
+    dns_found_callback cb = dnsCb;
+    unsigned n;
+
+    dnsCb = NULL;
+    if (cb == NULL) {
+        return;
+    }
+    if (sim_ap_up(sim_clock_us()) && (sscanf(dnsName, "mqtt%u.lan", &n) == 1)
+            && (n > 0) && (n < 255)) {
+        dnsAddr.addr = BROKER_NET | (n << 24);
+        cb(dnsName, &dnsAddr, dnsConn);
+    } else {
+        cb(dnsName, NULL, dnsConn);
+    }
+}
+
+err_t
+espconn_gethostbyname(struct espconn *pespconn, const char *hostname,
+        ip_addr_t *addr, dns_found_callback found)
+{
+    if ((hostname == NULL) || (found == NULL) || (dnsCb != NULL)) {
+        return(ESPCONN_ARG);
+    }
+    sim->dns++;
+    dnsConn = pespconn;
+    dnsCb = found;
+    dnsName = hostname;
+    sim_call_after(&dnsTimer, sim_ap_up(sim_clock_us())
+            ? sim_cfg.rtt_us : DNS_TIMEOUT_US, dns_reply, NULL);
+    return(ESPCONN_INPROGRESS);
+}
+
+bool
+espconn_secure_set_size(uint8 level, uint16 size)
+{
+    return(true);
+}
+
+sint8
+espconn_secure_sent(struct espconn *espconn, uint8 *psent, uint16 length)
+{
+    return(espconn_sent(espconn, psent, length));
+}
@@ -0,0 +1,542 @@
+/*
+ *  sim_sdk.c - virtual-time ESP8266 SDK for the TLnodeFW simulator
+ *
+ *  Timers, tasks, the system clock, RTC memory and deep sleep run
+ *  against a virtual clock. A wake runs until the firmware calls
+ *  system_deep_sleep() or has nothing left to do.
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdarg.h>
+#include <malloc.h>
+#include <time.h>
+#include <signal.h>
+#include <ets_sys.h>
+#include <osapi.h>
+#include <mem.h>
+#include <user_interface.h>
+#include <driver/uart.h>
+
+#include "sim.h"
+
+#define TASK_PRIOS      3
+#define TIMER_DISPATCH_US 5
+#define HEAP_SIZE       40000   // free heap after SDK start-up
+#define RTC_PERIOD_US   5.7     // typical RTC clock period
+#define SIM_CRASH_US    1000000 // into a wake that crashes, see -x
+
+volatile uint32 sim_regs[1024];
+uint32 sim_now_us = 0;
+uint8 sim_cpu_mhz = 80;
+uint64 sim_init_ns = 0;
+
+static ETSTimer *timers = NULL;
+static init_done_cb_t initDoneCb = NULL;
+static ETSTimer initDoneTimer;
+static bool sleeping = false;
+static int state = SIM_CPU;
+static uint32 stateStart = 0;
+static uint32 heapUsed = 0;
+static uint32 heapBlocks = 0;
+static struct rst_info rstInfo;
+
+static struct {
+    os_task_t task;
+    os_event_t *queue;
+    uint8 qlen;
+    uint8 head;
+    uint8 count;
+} tasks[TASK_PRIOS];
+
+
+/*
+ * Virtual clock
+ */
+void
+sim_advance(uint32 usec)
+{
+    sim_now_us += usec;
+}
+
+uint64
+sim_clock_us(void)
+{
+    return(sim->clock_us + sim_now_us);
+}
+
+void
+sim_state(int newState)
+{
+    sim->state_us[state] += sim_now_us - stateStart;
+    stateStart = sim_now_us;
+    state = newState;
+}
+
+int
+sim_log(const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    if (sim_cfg.verbose < 2) {
+        return(0);
+    }
+    printf("[%6u %8u.%03u] ", sim->wake,
+            sim_now_us / 1000, sim_now_us % 1000);
+    va_start(ap, fmt);
+    n = vprintf(fmt, ap);
+    va_end(ap);
+    return(n);
+}
+
+
+/*
+ * Timers - a list sorted by expiry time
+ */
+static void
+timer_insert(ETSTimer *ptimer)
+{
+    ETSTimer **pp = &timers;
+
+    while ((*pp != NULL) && ((*pp)->timer_expire <= ptimer->timer_expire)) {
+        pp = &(*pp)->timer_next;
+    }
+    ptimer->timer_next = *pp;
+    *pp = ptimer;
+}
+
+void
+os_timer_disarm(ETSTimer *ptimer)
+{
+    ETSTimer **pp = &timers;
+
+    while (*pp != NULL) {
+        if (*pp == ptimer) {
+            *pp = ptimer->timer_next;
+            break;
+        }
+        pp = &(*pp)->timer_next;
+    }
+    ptimer->timer_next = NULL;
+}
+
+void
+os_timer_setfn(ETSTimer *ptimer, ETSTimerFunc *pfunction, void *parg)
+{
+    os_timer_disarm(ptimer);
+    ptimer->timer_func = pfunction;
+    ptimer->timer_arg = parg;
+}
+
+void
+os_timer_arm_us(ETSTimer *ptimer, uint32 usec, bool repeat)
+{
+    os_timer_disarm(ptimer);
+    ptimer->timer_expire = sim_now_us + usec;
+    ptimer->timer_period = repeat ? usec : 0;
+    timer_insert(ptimer);
+}
+
+void
+os_timer_arm(ETSTimer *ptimer, uint32 msec, bool repeat)
+{
+    os_timer_arm_us(ptimer, msec * 1000, repeat);
+}
+
+void
+sim_call_after(ETSTimer *ptimer, uint32 usec, ETSTimerFunc *fn, void *arg)
+{
+    os_timer_setfn(ptimer, fn, arg);
+    os_timer_arm_us(ptimer, usec, 0);
+}
+
+void
+os_delay_us(uint32 us)
+{
+    sim_advance(us);
+}
+
+
+/*
+ * Tasks
+ */
+bool
+system_os_task(os_task_t task, uint8 prio, os_event_t *queue, uint8 qlen)
+{
+    if (prio >= TASK_PRIOS) {
+        return(false);
+    }
+    tasks[prio].task = task;
+    tasks[prio].queue = queue;
+    tasks[prio].qlen = qlen;
+    tasks[prio].head = 0;
+    tasks[prio].count = 0;
+    return(true);
+}
+
+bool
+system_os_post(uint8 prio, os_signal_t sig, os_param_t par)
+{
+    os_event_t *e;
+
+    if ((prio >= TASK_PRIOS) || (tasks[prio].task == NULL)
+            || (tasks[prio].count >= tasks[prio].qlen)) {
+        sim_log("system_os_post(%d) failed\n", prio);
+        return(false);
+    }
+    e = &tasks[prio].queue[(tasks[prio].head + tasks[prio].count)
+        % tasks[prio].qlen];
+    e->sig = sig;
+    e->par = par;
+    tasks[prio].count++;
+    return(true);
+}
+
+static bool
+run_one_task(void)
+{
+    int prio;
+
+    for (prio = TASK_PRIOS - 1; prio >= 0; prio--) {
+        if (tasks[prio].count > 0) {
+            os_event_t e = tasks[prio].queue[tasks[prio].head];
+            tasks[prio].head = (tasks[prio].head + 1) % tasks[prio].qlen;
+            tasks[prio].count--;
+            tasks[prio].task(&e);
+            return(true);
+        }
+    }
+    return(false);
+}
+
+
+/*
+ * System
+ */
+void
+system_init_done_cb(init_done_cb_t cb)
+{
+    initDoneCb = cb;
+}
+
+static void
+init_done(void *arg)
+{
+    if (initDoneCb != NULL) {
+        initDoneCb();
+    }
+}
+
+void
+system_deep_sleep(uint32 time_in_us)
+{
+    sim_log("system_deep_sleep(%u)\n", time_in_us);
+    // the SDK counts the sleep in RTC ticks of the calibrated period,
+    // so it is off by the calibration error
+    sim->sleep_us = (time_in_us == 0) ? 1 : (uint32)((double)time_in_us
+            * RTC_PERIOD_US * 4096.0 / system_rtc_clock_cali_proc());
+    if (sim->publishes > 0) {
+        sim->tail_us = sim_now_us - sim->delivered_us;
+    }
+    sleeping = true;
+}
+
+void
+system_restart(void)
+{
+    sim_log("system_restart()\n");
+    sleeping = true;
+}
+
+uint32
+system_get_time(void)
+{
+    return(sim_now_us);
+}
+
+/*
+ * The RTC counter runs from power-on and is not reset by deep sleep.
+ * The calibration value is the tick period in us, with 12 fractional
+ * bits, and is off by sim_cfg.rtc_ppm from the true period.
+ */
+uint32
+system_get_rtc_time(void)
+{
+    return((uint32)((sim_clock_us() - sim->poweron_us) / RTC_PERIOD_US));
+}
+
+uint32
+system_rtc_clock_cali_proc(void)
+{
+    return((uint32)(RTC_PERIOD_US * 4096.0
+                * (1.0 + sim_cfg.rtc_ppm / 1000000.0)));
+}
+
+bool
+system_rtc_mem_write(uint8 des_addr, const void *src_addr, uint16 save_size)
+{
+    if ((des_addr < 64) || (des_addr * 4 + save_size > SIM_RTC_BLOCKS * 4)) {
+        return(false);
+    }
+    memcpy(&sim->rtc[des_addr], src_addr, save_size);
+    return(true);
+}
+
+bool
+system_rtc_mem_read(uint8 src_addr, void *des_addr, uint16 save_size)
+{
+    if ((src_addr < 64) || (src_addr * 4 + save_size > SIM_RTC_BLOCKS * 4)) {
+        return(false);
+    }
+    memcpy(des_addr, &sim->rtc[src_addr], save_size);
+    return(true);
+}
+
+struct rst_info *
+system_get_rst_info(void)
+{
+    rstInfo.reason = sim->reset_reason;
+    return(&rstInfo);
+}
+
+bool
+system_deep_sleep_set_option(uint8 option)
+{
+    sim->rf_option = option;
+    return(true);
+}
+
+uint32 system_get_chip_id(void) { return(sim_cfg.chip_id); }
+
+/*
+ * The hardware RNG, repeatable for a given chip ID and wake
+ */
+unsigned long
+os_random(void)
+{
+    static uint32 calls = 0;
+    uint32 x = sim_cfg.chip_id ^ (sim->wake * 0x9e3779b9U) ^ ++calls;
+
+    // murmur3 finalizer
+    x ^= x >> 16;
+    x *= 0x85ebca6bU;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35U;
+    x ^= x >> 16;
+    return(x);
+}
+const char *system_get_sdk_version(void) { return("1.3.0(sim)"); }
+void system_print_meminfo(void) { }
+uint8 system_get_boot_version(void) { return(0); }
+uint32 system_get_userbin_addr(void) { return(0); }
+uint8 system_get_boot_mode(void) { return(0); }
+uint8 system_get_cpu_freq(void) { return(sim_cpu_mhz); }
+
+bool
+system_update_cpu_freq(uint8 freq)
+{
+    sim_cpu_mhz = freq;
+    return(true);
+}
+enum flash_size_map system_get_flash_size_map(void)
+{
+    return(FLASH_SIZE_4M_MAP_256_256);
+}
+uint32 spi_flash_get_id(void) { return(0x1640e0); }
+
+uint32
+system_get_free_heap_size(void)
+{
+    return(HEAP_SIZE - heapUsed);
+}
+
+void *
+sim_malloc(size_t size)
+{
+    void *p = malloc(size);
+    if (p != NULL) {
+        heapUsed += malloc_usable_size(p);
+        heapBlocks++;
+        if (heapUsed > sim->heap_peak) {
+            sim->heap_peak = heapUsed;
+        }
+    }
+    return(p);
+}
+
+void *
+sim_zalloc(size_t size)
+{
+    void *p = sim_malloc(size);
+    if (p != NULL) {
+        memset(p, 0, size);
+    }
+    return(p);
+}
+
+void
+sim_free(void *ptr)
+{
+    if (ptr != NULL) {
+        heapUsed -= malloc_usable_size(ptr);
+        heapBlocks--;
+        free(ptr);
+    }
+}
+
+int
+os_printf(const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    if (sim_cfg.uart) {
+        va_start(ap, fmt);
+        n = vprintf(fmt, ap);
+        va_end(ap);
+        return(n);
+    }
+    if (sim_cfg.verbose < 2) {
+        return(0);
+    }
+    printf("[%6u %8u.%03u] ", sim->wake,
+            sim_now_us / 1000, sim_now_us % 1000);
+    va_start(ap, fmt);
+    n = vprintf(fmt, ap);
+    va_end(ap);
+    return(n);
+}
+
+/*
+ * sim_cpu_ns - the virtual time, which the bus models advance, plus the
+ * host CPU time
+ */
+uint64
+sim_cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return((uint64)ts.tv_sec * 1000000000ULL + ts.tv_nsec
+        + (uint64)sim_now_us * 1000);
+}
+
+/*
+ * CCOUNT for BENCH builds: sim_cpu_ns() in cycles at the simulated
+ * clock
+ */
+uint32
+bench_ccount(void)
+{
+    return((uint32)(sim_cpu_ns() * sim_cpu_mhz / 1000));
+}
+
+void ets_isr_attach(int intr, void *handler, void *arg) { }
+void os_install_putc1(void *p) { }
+void uart_div_modify(uint8 uart_no, uint32 div) { }
+void uart_init(UartBautRate uart0_br) { }
+void uart_tx_set_policy(UartTxPolicy policy) { }
+uint32 uart_tx_dropped(void) { return(0); }
+uint16 uart_tx_highwater(void) { return(0); }
+void uart_tx_flush(void) { }
+
+void
+uart0_tx_buffer(uint8 *buf, uint16 len)
+{
+    if (sim_cfg.uart) {
+        fwrite(buf, 1, len, stdout);
+    }
+}
+void gpio_output_set(uint32 set_mask, uint32 clear_mask,
+        uint32 enable_mask, uint32 disable_mask) { }
+uint32 gpio_input_get(void) { return(0xffffffff); }
+
+
+/*
+ * sim_run_wake - run the firmware from reset to deep sleep
+ *
+ * Called in the child process for each wake.
+ */
+extern void user_init(void);
+
+void
+sim_run_wake(void)
+{
+    uint32 limit = sim_cfg.mains_us ? sim_cfg.mains_us : SIM_MAX_WAKE_US;
+
+    sim_now_us = 0;
+    sim_advance(sim_cfg.boot_us);
+
+    // option 2 skips the RF calibration on deep sleep wakes only
+    sim->rfcal = (sim->reset_reason != REASON_DEEP_SLEEP_AWAKE)
+        || (sim->rf_option != 2);
+
+    sim_init_ns = sim_cpu_ns();
+    user_init();
+    sim_call_after(&initDoneTimer,
+            sim->rfcal ? sim_cfg.rfcal_us : sim_cfg.rfskip_us, init_done, NULL);
+
+    while (!sleeping && (sim_now_us < limit)) {
+        ETSTimer *t;
+
+        if (sim_cfg.crash_every && (sim_now_us >= SIM_CRASH_US)
+                && (sim->wake % sim_cfg.crash_every == sim_cfg.crash_every - 1)) {
+            // an exception reset, see run_one()
+            sim_log("crash\n");
+            fflush(stdout);
+            raise(SIGKILL);
+        }
+
+        if (run_one_task()) {
+            continue;
+        }
+        if (timers == NULL) {
+            sim_log("nothing left to run\n");
+            break;
+        }
+
+        t = timers;
+        timers = t->timer_next;
+        t->timer_next = NULL;
+        if (t->timer_expire > sim_now_us) {
+            sim_now_us = t->timer_expire;
+        }
+        if (t->timer_period != 0) {
+            t->timer_expire += t->timer_period;
+            timer_insert(t);
+        }
+        // the SDK's timer dispatch is not free, and charging for it
+        // keeps a 0 ms timer loop from stopping the clock
+        sim_advance(TIMER_DISPATCH_US);
+        t->timer_func(t->timer_arg);
+    }
+
+    sim_wake_end();
+}
+
+/*
+ * sim_wake_end - the wake's results, at deep sleep or a reset
+ */
+void
+sim_wake_end(void)
+{
+    sim_state(state);
+    sim->awake_us = sim_now_us;
+    // esp_mqtt holds its connection until the reset
+    sim->leaks = heapBlocks - sim_net_blocks();
+}
@@ -0,0 +1,461 @@
+/*
+ *  sim_sensors.c - simulated 1-wire and I2C sensors
+ *
+ *  Replaces driver/onewire.c, driver/i2c.c, driver/i2c_async.c and the
+ *  ISL29035 routines of driver/i2c_isl.c with bus models that answer
+ *  from a sensor trace and charge the bus time to the virtual clock.
+ *
+ *  Sensor trace format, CSV, '#' starts a comment:
+ *      time_s,temperature_C,lux,vbat_V
+ *  Values hold until the next line; vbat_V may be 0 to use the
+ *  battery model. The trace repeats with a period of its last time.
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <osapi.h>
+#include <user_interface.h>
+#include "driver/onewire.h"
+#include "driver/i2c.h"
+#include "driver/i2c_isl.h"
+#include "driver/i2c_async.h"
+
+#include "sim.h"
+
+#define MAX_SAMPLES     4096
+#define DS_CONVERT_UA   1500
+#define DS_POWERON_TEMP 0x0550  // scratchpad before the first conversion
+
+// bus time of each operation, from the bit timing in the drivers
+#define DS_RESET_US     960
+#define DS_BYTE_US      (8 * 70)
+#define I2C_BYTE_US     (9 * 2 * I2C_SLEEP_TIME)
+#define I2C_INTR_NS     5000    // FRC1 interrupt per SCL half period,
+                                // vector entry and exit, GPIO and state
+
+typedef struct {
+    uint64 time_us;
+    sim_sample_t sample;
+} trace_t;
+
+static trace_t trace[MAX_SAMPLES];
+static int nsamples = 0;
+
+static uint8 dsLastCmd = 0;
+static uint8 dsReadPos = 0;
+static uint8 dsWritePos = 0;
+static bool dsConverted = false;    // a Convert T this wake
+static bool dsArming = false;       // a Write Scratchpad this wake
+static bool dsGlitched = false;     // -g, a reply was missed this wake
+static bool islGlitched = false;
+
+static uint8 islRange = ISL_RANGE_1K;
+static const uint32 islFullScale[4] = { 1000, 4000, 16000, 64000 };
+
+static i2c_xfer_t *i2cQueue = NULL;    // the head is on the bus
+static ETSTimer i2cTimer;
+static os_event_t i2cEvents[I2C_ASYNC_QLEN];
+static i2c_xfer_t *i2cDone[I2C_ASYNC_QLEN];     // posted, in order
+static uint8 i2cDoneHead = 0;
+static uint8 i2cDoneCount = 0;
+static bool i2cStarted = false;
+static uint8 i2cPending = 0;
+static uint8 i2cEpoch = 0;
+
+
+int
+sim_sensors_load(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[128];
+
+    if (f == NULL) {
+        perror(path);
+        return(-1);
+    }
+    while ((fgets(line, sizeof(line), f) != NULL) && (nsamples < MAX_SAMPLES)) {
+        double t, temp, lux, vbat;
+
+        if ((line[0] == '#')
+                || (sscanf(line, "%lf,%lf,%lf,%lf", &t, &temp, &lux, &vbat) != 4)) {
+            continue;
+        }
+        trace[nsamples].time_us = (uint64)(t * 1000000.0);
+        trace[nsamples].sample.temp_mc =
+            (int32)(temp * 1000.0 + ((temp < 0) ? -0.5 : 0.5));
+        trace[nsamples].sample.lux = (uint32)lux;
+        trace[nsamples].sample.vbat_mv = (uint32)(vbat * 1000.0);
+        nsamples++;
+    }
+    fclose(f);
+    return(0);
+}
+
+void
+sim_sensors_sample(uint64 clock_us, sim_sample_t *sample)
+{
+    int i;
+
+    if (nsamples == 0) {
+        sample->temp_mc = 21000;
+        sample->lux = 300;
+        sample->vbat_mv = 0;
+        return;
+    }
+    if (trace[nsamples - 1].time_us > 0) {
+        clock_us %= trace[nsamples - 1].time_us;
+    }
+    for (i = 0; (i + 1 < nsamples) && (trace[i + 1].time_us <= clock_us); i++) {
+    }
+    *sample = trace[i].sample;
+}
+
+
+/*
+ * 1-wire bus with a single DS18B20
+ *
+ * Its scratchpad lives in the shared state. A parasite powered probe
+ * has no supply while the pin is held low in deep sleep, so it starts
+ * each wake from power-on; a wired one keeps it, and a conversion
+ * started before the sleep finishes during it.
+ */
+static void
+ds_poweron(void)
+{
+    sim->ds.poweron_us = sim->poweron_us;
+    sim->ds.temp = DS_POWERON_TEMP;
+    sim->ds.temp_us = 0;
+    sim->ds.converting = 0;
+    sim->ds.th = 0x4b;      // EEPROM defaults
+    sim->ds.tl = 0x46;
+    sim->ds.config = 0x7f;  // 12 bits
+    sim->ds.valid = 1;
+}
+
+void
+ds_init(int power)
+{
+    sim->ds.wired = (power == ONEWIRE_WIRED_PWR);
+    if (!sim->ds.valid || !sim->ds.wired
+            || (sim->ds.poweron_us != sim->poweron_us)) {
+        ds_poweron();
+    }
+}
+
+/*
+ * glitch - TRUE for the first reply of a part on every -g'th wake
+ */
+static bool
+glitch(bool *done)
+{
+    if ((sim_cfg.glitch_every == 0) || *done
+            || (sim->wake % sim_cfg.glitch_every != sim_cfg.glitch_every - 1)) {
+        return(false);
+    }
+    *done = true;
+    return(true);
+}
+
+bool
+ds_reset(void)
+{
+    sim_advance(DS_RESET_US);
+    dsLastCmd = 0;
+    dsReadPos = 0;
+    if (glitch(&dsGlitched)) {
+        return(false);
+    }
+    return(!(sim_cfg.missing & SIM_NO_DS18B20));
+}
+
+void
+ds_write(uint8_t cmd)
+{
+    sim_advance(DS_BYTE_US);
+    if (sim_cfg.missing & SIM_NO_DS18B20) {
+        return;
+    }
+    if (dsLastCmd == 0x4e) {
+        // TH, TL and configuration follow Write Scratchpad
+        dsArming = true;
+        switch (dsWritePos++) {
+            case 0: sim->ds.th = cmd; break;
+            case 1: sim->ds.tl = cmd; break;
+            case 2: sim->ds.config = cmd; break;
+        }
+        return;
+    }
+    if ((dsLastCmd == 0) ? (cmd != 0xcc) : (dsLastCmd != 0xcc)) {
+        // only Skip ROM after a reset, then one function command; the
+        // part ignores the bus until the next reset
+        dsLastCmd = 0xff;
+        return;
+    }
+    if (cmd == 0x44) {
+        // not the one ds18B20_sleep() starts for the next wake
+        if (!dsConverted && !dsArming) {
+            sim->convert_ns = sim_cpu_ns() - sim_init_ns;
+        }
+        // nearest 1/16 degC, negative values too
+        sim->ds.result = (sint16)((sim->sample.temp_mc * 16
+                    + ((sim->sample.temp_mc < 0) ? -500 : 500)) / 1000);
+        sim->ds.convert_us = sim_clock_us();
+        sim->ds.converting = 1;
+        sim->sensor_uaus += (uint64)sim_cfg.conversion_us * DS_CONVERT_UA;
+        dsConverted = true;
+    }
+    dsLastCmd = cmd;
+    dsWritePos = 0;
+}
+
+uint8_t
+ds_read(void)
+{
+    sim_advance(DS_BYTE_US);
+    if ((dsLastCmd != 0xbe) || (sim_cfg.missing & SIM_NO_DS18B20)) {
+        // nothing drives the bus
+        return(0xff);
+    }
+    if (sim->ds.converting
+            && (sim_clock_us() - sim->ds.convert_us >= sim_cfg.conversion_us)) {
+        sim->ds.temp = sim->ds.result;
+        sim->ds.temp_us = sim->ds.convert_us;
+        sim->ds.converting = 0;
+    }
+    if (dsReadPos == 0) {
+        // the last read of the wake is the one reported
+        sim->prearmed = (sim->ds.temp_us != 0)
+            && (sim->ds.temp_us < sim->clock_us);
+    }
+    switch (dsReadPos++) {
+        case 0: return(sim->ds.temp & 0xff);
+        case 1: return((sim->ds.temp >> 8) & 0xff);
+        case 2: return(sim->ds.th);
+        case 3: return(sim->ds.tl);
+        case 4: return(sim->ds.config);
+        default: return(0xff);      // reserved bytes and CRC not modeled
+    }
+}
+
+
+/*
+ * I2C bus with an ISL29035
+ *
+ * The bit level calls are only used by BENCH builds. They charge the
+ * bus time and read back as an idle bus.
+ */
+void i2c_init(void) { }
+void i2c_start(void) { sim_advance(I2C_BYTE_US / 9); }
+void i2c_stop(void) { sim_advance(I2C_BYTE_US / 9); }
+void i2c_send_ack(uint8 state) { sim_advance(I2C_BYTE_US / 9); }
+uint8 i2c_check_ack(void) { sim_advance(I2C_BYTE_US / 9); return(0); }
+void i2c_writeByte(uint8 data) { sim_advance(I2C_BYTE_US * 8 / 9); }
+
+uint8
+i2c_readByte(void)
+{
+    sim_advance(I2C_BYTE_US * 8 / 9);
+    return(0xff);
+}
+
+static void
+isl_write(uint8 addr, uint8 data)
+{
+    if (sim_cfg.missing & SIM_NO_ISL29035) {
+        return;
+    }
+    if (addr == ISL_CMD2_REG) {
+        islRange = data & 0x03;
+    } else if ((addr == ISL_CMD1_REG) && (data != ISL_MODE_PD)) {
+        sim->integrations++;
+    }
+}
+
+static uint16
+isl_read(uint8 addr)
+{
+    uint32 counts;
+
+    if (sim_cfg.missing & SIM_NO_ISL29035) {
+        // nothing drives SDA
+        return(0xffff);
+    }
+    if (addr == ISL_ID_REG) {
+        return(ISL_ID_ISL29035);
+    }
+    if (addr != ISL_DATA_REG) {
+        return(0);
+    }
+    counts = (uint32)((uint64)sim->sample.lux * 65536 / islFullScale[islRange]);
+    return((counts > 0xffff) ? 0xffff : counts);
+}
+
+void
+isl_write_byte(uint8 addr, uint8 data)
+{
+    sim_advance(3 * I2C_BYTE_US);
+    sim->i2c_cpu_us += 3 * I2C_BYTE_US;
+    isl_write(addr, data);
+}
+
+uint8
+isl_read_byte(uint8 addr)
+{
+    sim_advance(4 * I2C_BYTE_US);
+    sim->i2c_cpu_us += 4 * I2C_BYTE_US;
+    return(isl_read(addr));
+}
+
+uint16
+isl_read_word(uint8 addr)
+{
+    sim_advance(5 * I2C_BYTE_US);
+    sim->i2c_cpu_us += 5 * I2C_BYTE_US;
+    return(isl_read(addr));
+}
+
+
+/*
+ * Queued transactions with the ISL29035
+ *
+ * The bus time passes on a timer and only the interrupts, one per SCL
+ * half period as counted by driver/i2c_async.c, are charged to the
+ * virtual clock. os_param_t does not hold a host pointer, so the task
+ * takes the transactions from i2cDone.
+ */
+static uint32
+xfer_intrs(const i2c_xfer_t *x)
+{
+    uint32 n = 1 + (2 + x->wlen) * 18 + 3;
+
+    if (sim_cfg.missing & SIM_NO_ISL29035) {
+        // START, the address and STOP
+        return(1 + 18 + 3);
+    }
+    if (x->rlen > 0) {
+        n += 3 + (1 + x->rlen) * 18;
+    }
+    return(n);
+}
+
+static void
+xfer_done(void *arg)
+{
+    i2c_xfer_t *x = i2cQueue;
+    uint32 us = xfer_intrs(x) * I2C_INTR_NS / 1000;
+    uint8 i;
+
+    sim_advance(us);
+    sim->i2c_cpu_us += us;
+    if ((x->addr != ISL_WRITE_ADDR) || (sim_cfg.missing & SIM_NO_ISL29035)
+            || glitch(&islGlitched)) {
+        // the address is not acknowledged
+        x->status = I2C_XFER_NACK;
+    } else {
+        for (i = 0; i < x->wlen; i++) {
+            isl_write(x->reg + i, x->data[i]);
+        }
+        if (x->rlen > 0) {
+            uint16 v = isl_read(x->reg);
+
+            x->data[0] = v;
+            x->data[1] = v >> 8;
+        }
+        x->status = I2C_XFER_DONE;
+    }
+
+    i2cQueue = x->next;
+    if (i2cQueue != NULL) {
+        sim_call_after(&i2cTimer, xfer_intrs(i2cQueue) * I2C_ASYNC_HALF_US,
+                xfer_done, NULL);
+    }
+    i2cDone[(i2cDoneHead + i2cDoneCount++) % I2C_ASYNC_QLEN] = x;
+    system_os_post(I2C_ASYNC_PRIO, i2cEpoch, 0);
+}
+
+static void
+i2c_task(os_event_t *e)
+{
+    i2c_xfer_t *x = i2cDone[i2cDoneHead];
+
+    i2cDoneHead = (i2cDoneHead + 1) % I2C_ASYNC_QLEN;
+    i2cDoneCount--;
+    i2cPending--;
+    if (((uint8)e->sig == i2cEpoch) && (x->done != NULL)) {
+        x->done(x);
+    }
+}
+
+void
+i2c_async_init(void)
+{
+    if (!i2cStarted) {
+        i2cStarted = true;
+        system_os_task(i2c_task, I2C_ASYNC_PRIO, i2cEvents, I2C_ASYNC_QLEN);
+    }
+}
+
+bool
+i2c_async_queue(i2c_xfer_t *xfer)
+{
+    i2c_xfer_t **pp = &i2cQueue;
+
+    if (i2cPending >= I2C_ASYNC_QLEN) {
+        return(false);
+    }
+    i2cPending++;
+    xfer->status = I2C_XFER_QUEUED;
+    xfer->next = NULL;
+    while (*pp != NULL) {
+        pp = &(*pp)->next;
+    }
+    *pp = xfer;
+    if (i2cQueue == xfer) {
+        sim_call_after(&i2cTimer, xfer_intrs(xfer) * I2C_ASYNC_HALF_US,
+                xfer_done, NULL);
+    }
+    return(true);
+}
+
+void
+i2c_async_cancel(void)
+{
+    if (i2cQueue != NULL) {
+        i2c_xfer_t *x;
+
+        for (x = i2cQueue->next; x != NULL; x = x->next) {
+            i2cPending--;
+        }
+        i2cQueue->next = NULL;
+        // waits out the one on the bus, which the model has no
+        // position in, so call it a whole transaction
+        os_timer_disarm(&i2cTimer);
+        sim_advance(xfer_intrs(i2cQueue) * I2C_ASYNC_HALF_US);
+        xfer_done(NULL);
+    }
+    i2cEpoch++;
+}
+
+
+/*
+ * Supply voltage, in 1/1024 V
+ */
+uint16
+system_get_vdd33(void)
+{
+    return(sim->sample.vbat_mv * 1024 / 1000);
+}
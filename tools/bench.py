@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+#
+# bench.py - compare two runs of the BENCH=1 microbenchmarks
+#
+#   bench.py [-t percent] baseline.txt current.txt
+#
+# Each file is the UART output of a BENCH=1 firmware, or the output of
+# tlsim -B for a CONFIG=-DBENCH simulator build; other lines are
+# ignored. The cost of reading the cycle counter (the "empty" line) is
+# taken off each median before comparing. Exits with status 1 if any
+# primitive's median grew by more than the threshold.
+#
+#   $ sim/buildbench/tlsim -B > base.txt
+#   ... change a driver, rebuild ...
+#   $ sim/buildbench/tlsim -B > new.txt
+#   $ tools/bench.py base.txt new.txt
+#
+# Copyright (C) 2015 Jerry Dunmire
+# This file is part of TLnodeFW
+#
+# TLnodeFW is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# TLnodeFW is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+
+import argparse
+import sys
+
+# medians this close to the counter overhead are noise, cycles
+MIN_CYCLES = 50
+
+
+def load(path):
+    runs = {}
+    with open(path, errors='replace') as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) < 2 or fields[0] != 'bench' or '=' not in fields[1]:
+                continue
+            kv = dict(x.split('=', 1) for x in fields[1:] if '=' in x)
+            runs[kv['name']] = {k: int(v) for k, v in kv.items()
+                                if k != 'name'}
+    if not runs:
+        sys.exit('%s: no bench lines' % path)
+    return runs
+
+
+def net(runs, name):
+    empty = runs.get('empty', {}).get('med', 0)
+    return max(runs[name]['med'] - empty, 0)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='compare bench runs')
+    parser.add_argument('-t', '--threshold', type=float, default=10,
+                        help='allowed median growth, percent (10)')
+    parser.add_argument('baseline')
+    parser.add_argument('current')
+    args = parser.parse_args()
+
+    base = load(args.baseline)
+    cur = load(args.current)
+    failed = []
+
+    print('%-18s %10s %10s %8s' % ('primitive', 'base', 'current', 'change'))
+    for name in cur:
+        if name == 'empty':
+            continue
+        if name not in base:
+            print('%-18s %10s %10d %8s' % (name, '-', net(cur, name), 'new'))
+            continue
+        b = net(base, name)
+        c = net(cur, name)
+        change = (c - b) * 100.0 / b if b > 0 else 0.0
+        mark = ''
+        if max(b, c) >= MIN_CYCLES and change > args.threshold:
+            mark = ' <-'
+            failed.append(name)
+        print('%-18s %10d %10d %+7.1f%%%s' % (name, b, c, change, mark))
+
+    if failed:
+        print('slower: %s' % ' '.join(failed))
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+#
+# dump.py - decode the diagnostics records of include/dump.h
+#
+#   dump.py [file ...]
+#
+# Each file holds one raw record. Without files, records are read from
+# stdin as lines whose last field is the record in hex, optionally
+# after the topic, as mosquitto_sub prints them with -F '%t %x' and
+# tlsim -vv logs them; other lines are ignored. One line is printed
+# per record.
+#
+#   $ mosquitto_sub -t '+/diag' -F '%t %x' | tools/dump.py
+#   $ sim/build/tlsim -d 2 -vv | tools/dump.py
+#
+# Copyright (C) 2015 Jerry Dunmire
+# This file is part of TLnodeFW
+#
+# TLnodeFW is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# TLnodeFW is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+
+import struct
+import sys
+
+DUMP_VERSION = 1
+DUMP_RECORD_LEN = 64
+DUMP_RETRY = 0x01
+
+# after the version and flags bytes, see include/dump.h
+LAYOUT = '<BBBB5I5I3HBBBB10s'
+
+REASONS = ['power_on', 'wdt', 'exception', 'soft_wdt', 'soft_restart',
+           'deep_sleep', 'ext_reset']
+FLASH_MAPS = ['512K', '256K', '1M', '2M', '4M', '2M_c1', '4M_c1']
+
+
+def name(names, i):
+    return names[i] if i < len(names) else str(i)
+
+
+def decode(rec):
+    if len(rec) != DUMP_RECORD_LEN:
+        return 'bad length %d' % len(rec)
+    if rec[0] != DUMP_VERSION:
+        return 'unknown version %d' % rec[0]
+    (_, flags, reason, exccause, epc1, epc2, epc3, excvaddr, depc,
+     flash_id, userbin, period, ticks, time_us, heap, mv, wakes,
+     mhz, flash_map, boot_ver, boot_mode, sdk) = struct.unpack(LAYOUT, rec)
+    out = ['reset=%s' % name(REASONS, reason)]
+    if flags & DUMP_RETRY:
+        out.append('retry')
+    if name(REASONS, reason) in ('wdt', 'exception', 'soft_wdt'):
+        out += ['exccause=%d' % exccause,
+                'epc1=0x%08x' % epc1, 'epc2=0x%08x' % epc2,
+                'epc3=0x%08x' % epc3, 'excvaddr=0x%08x' % excvaddr,
+                'depc=0x%08x' % depc]
+    out += ['heap=%d' % heap, 'mv=%d' % mv, 'wakes=%d' % wakes,
+            'uptime_ms=%.1f' % (time_us / 1000.0),
+            'rtc_period_us=%.3f' % (period / 4096.0),
+            'rtc_ticks=%d' % ticks,
+            'cpu_mhz=%d' % mhz,
+            'flash_id=0x%06x' % flash_id,
+            'flash_map=%s' % name(FLASH_MAPS, flash_map),
+            'userbin=0x%05x' % userbin,
+            'boot=%d/%d' % (boot_ver, boot_mode),
+            'sdk=%s' % sdk.rstrip(b'\0').decode('ascii', 'replace')]
+    return ' '.join(out)
+
+
+def main():
+    if len(sys.argv) > 1:
+        for path in sys.argv[1:]:
+            with open(path, 'rb') as f:
+                print('%s %s' % (path, decode(f.read())))
+        return
+
+    for line in sys.stdin:
+        fields = line.split()
+        if not fields or len(fields[-1]) != 2 * DUMP_RECORD_LEN:
+            continue
+        try:
+            rec = bytes.fromhex(fields[-1])
+        except ValueError:
+            continue
+        topic = fields[-2].rstrip(':') if len(fields) > 1 else '-'
+        print('%s %s' % (topic, decode(rec)))
+        sys.stdout.flush()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+#
+# latency_proxy.py - TCP proxy that adds a round trip delay
+#
+#   latency_proxy.py [-l port] [-d rtt_ms] broker_host[:port]
+#
+# Put it between a TLnode and a local broker to see how the MQTT
+# connect and publish times grow with network latency, for example
+# to compare MQTTPIPE=1 with the default build:
+#
+#   $ mosquitto -p 1883 &
+#   $ tools/latency_proxy.py -l 1880 -d 100 localhost:1883
+#
+# Each direction is delayed by half the round trip.
+#
+# Copyright (C) 2015 Jerry Dunmire
+# This file is part of TLnodeFW
+#
+# TLnodeFW is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# TLnodeFW is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+
+import argparse
+import asyncio
+import time
+
+
+async def pipe(reader, writer, delay, name, start):
+    try:
+        while True:
+            data = await reader.read(4096)
+            if not data:
+                break
+            await asyncio.sleep(delay)
+            writer.write(data)
+            await writer.drain()
+            print('%8.1f ms %s %d bytes' % (
+                (time.monotonic() - start) * 1000, name, len(data)))
+    except ConnectionError:
+        pass
+    finally:
+        writer.close()
+
+
+async def handle(creader, cwriter, host, port, delay):
+    start = time.monotonic()
+    peer = cwriter.get_extra_info('peername')[0]
+    print('%s: connected' % peer)
+    # the SYN/SYN-ACK round trip
+    await asyncio.sleep(2 * delay)
+    breader, bwriter = await asyncio.open_connection(host, port)
+    await asyncio.gather(
+        pipe(creader, bwriter, delay, '-> broker', start),
+        pipe(breader, cwriter, delay, '<- broker', start))
+    print('%s: closed after %.1f ms' % (
+        peer, (time.monotonic() - start) * 1000))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='TCP latency proxy')
+    parser.add_argument('-l', '--listen', type=int, default=1880)
+    parser.add_argument('-d', '--delay', type=float, default=100,
+                        help='round trip time to add, ms')
+    parser.add_argument('broker')
+    args = parser.parse_args()
+
+    host, _, port = args.broker.partition(':')
+    port = int(port) if port else 1883
+    delay = args.delay / 2000
+
+    async def serve():
+        server = await asyncio.start_server(
+            lambda r, w: handle(r, w, host, port, delay), '', args.listen)
+        async with server:
+            await server.serve_forever()
+
+    asyncio.run(serve())
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+#
+# mqttsn_gw.py - stand-in MQTT-SN gateway for testing MQTTSN=1 builds
+#
+#   mqttsn_gw.py [-p port] [-d delay_ms] id=topic [id=topic ...]
+#
+# Answers CONNECT, PUBLISH and DISCONNECT from TLnodes and prints each
+# message published to a pre-registered topic ID, with the time since
+# the node's first datagram of the wake. -d delays every reply to
+# stand in for a distant gateway.
+#
+#   $ tools/mqttsn_gw.py 1=DVES_00A1B2C3/report 2=DVES_00A1B2C3/heap \
+#         3=DVES_00A1B2C3/diag
+#
+# Copyright (C) 2015 Jerry Dunmire
+# This file is part of TLnodeFW
+#
+# TLnodeFW is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# TLnodeFW is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+
+import argparse
+import socket
+import sys
+import time
+
+CONNECT = 0x04
+CONNACK = 0x05
+PUBLISH = 0x0c
+PUBACK = 0x0d
+DISCONNECT = 0x18
+
+ACCEPTED = 0x00
+INVALID_TOPIC = 0x02
+
+QOS = {0: '0', 1: '1', 2: '2', 3: '-1'}
+
+# a gap this long between datagrams starts a new wake
+WAKE_GAP = 5.0
+
+
+def main():
+    parser = argparse.ArgumentParser(description='stand-in MQTT-SN gateway')
+    parser.add_argument('-p', '--port', type=int, default=1884)
+    parser.add_argument('-d', '--delay', type=float, default=0,
+                        help='reply delay, ms')
+    parser.add_argument('topics', nargs='+', metavar='id=topic')
+    args = parser.parse_args()
+
+    topics = {}
+    for t in args.topics:
+        tid, _, name = t.partition('=')
+        topics[int(tid, 0)] = name
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(('', args.port))
+    print('listening on udp port %d' % args.port, file=sys.stderr)
+
+    first = {}
+    last = {}
+    seen = {}
+    while True:
+        p, addr = sock.recvfrom(1024)
+        now = time.monotonic()
+        if now - last.get(addr, 0) > WAKE_GAP:
+            first[addr] = now
+        last[addr] = now
+        t = (now - first[addr]) * 1000
+
+        if len(p) < 2 or p[0] != len(p):
+            print('%s: %.1f ms bad packet %s' % (addr[0], t, p.hex()))
+            continue
+
+        reply = None
+        if p[1] == CONNECT:
+            print('%s: %.1f ms CONNECT %s' % (addr[0], t, p[6:].decode()))
+            reply = bytes([3, CONNACK, ACCEPTED])
+        elif p[1] == PUBLISH and len(p) >= 7:
+            flags = p[2]
+            qos = QOS[(flags >> 5) & 3]
+            tid = (p[3] << 8) | p[4]
+            mid = (p[5] << 8) | p[6]
+            rc = ACCEPTED if tid in topics else INVALID_TOPIC
+            dup = (flags & 0x80) and seen.get(addr) == mid
+            seen[addr] = mid
+            if rc == ACCEPTED and not dup:
+                # diagnostics and logs are binary, in hex for
+                # tools/dump.py and tools/tlog.py
+                if topics[tid].endswith(('/diag', '/log')):
+                    data = p[7:].hex()
+                else:
+                    data = p[7:].decode(errors='replace')
+                print('%s: %.1f ms qos %s %s%s %s' % (
+                    addr[0], t, qos, topics[tid],
+                    ' (retain)' if flags & 0x10 else '', data))
+            elif rc != ACCEPTED:
+                print('%s: %.1f ms unknown topic ID %d' % (addr[0], t, tid))
+            if qos == '1':
+                reply = bytes([7, PUBACK, p[3], p[4], p[5], p[6], rc])
+        elif p[1] == DISCONNECT:
+            print('%s: %.1f ms DISCONNECT' % (addr[0], t))
+            reply = bytes([2, DISCONNECT])
+        else:
+            print('%s: %.1f ms type 0x%02x ignored' % (addr[0], t, p[1]))
+
+        if reply is not None:
+            if args.delay > 0:
+                time.sleep(args.delay / 1000)
+            sock.sendto(reply, addr)
+        sys.stdout.flush()
+
+
+if __name__ == '__main__':
+    main()
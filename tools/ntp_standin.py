@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+#
+# ntp_standin.py - stand-in NTP server for testing the wall clock
+#
+#   ntp_standin.py [-p port] [-o offset_ms] [-s ppm]
+#
+# Answers SNTP queries with the host's time, moved by -o and running
+# fast (or slow, negative) by -s parts per million from when the server
+# started. A skew makes the node's drift trim (include/walltime.h)
+# learn a known error without waiting days for the RTC to drift. Each
+# query is printed with the time served.
+#
+#   $ sudo tools/ntp_standin.py -s 100
+#   ... build with -DWALLTIME_NTP_HOST=\"<this host>\" -DWALLTIME_SYNC_S=3600
+#
+# Port 123 needs root; -p serves elsewhere for the simulator or a
+# firewall redirect.
+#
+# Copyright (C) 2015 Jerry Dunmire
+# This file is part of TLnodeFW
+#
+# TLnodeFW is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# TLnodeFW is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+
+import argparse
+import socket
+import struct
+import sys
+import time
+
+NTP_UNIX_S = 2208988800
+PACKET_LEN = 48
+MODE_CLIENT = 3
+MODE_SERVER = 4
+STRATUM = 2
+
+
+def ntp_time(t):
+    sec = int(t)
+    frac = int((t - sec) * (1 << 32)) & 0xffffffff
+    return struct.pack('!II', sec + NTP_UNIX_S, frac)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='stand-in NTP server')
+    parser.add_argument('-p', '--port', type=int, default=123)
+    parser.add_argument('-o', '--offset', type=float, default=0,
+                        help='offset from the host clock, ms')
+    parser.add_argument('-s', '--skew', type=float, default=0,
+                        help='rate error from the host clock, ppm')
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(('', args.port))
+    print('listening on udp port %d' % args.port, file=sys.stderr)
+
+    start = time.time()
+
+    def served():
+        now = time.time()
+        return now + args.offset / 1000 + (now - start) * args.skew / 1e6
+
+    while True:
+        p, addr = sock.recvfrom(1024)
+        rx = served()
+        if len(p) < PACKET_LEN or (p[0] & 7) != MODE_CLIENT:
+            print('%s: ignored %d bytes' % (addr[0], len(p)))
+            continue
+        version = (p[0] >> 3) & 7
+        reply = bytearray(PACKET_LEN)
+        reply[0] = (version << 3) | MODE_SERVER
+        reply[1] = STRATUM
+        reply[2] = p[2]                         # poll
+        reply[3] = 0xec                         # precision, about 1 us
+        reply[12:16] = b'LOCL'                  # reference ID
+        reply[24:32] = p[40:48]                 # originate = client transmit
+        reply[32:40] = ntp_time(rx)             # receive
+        tx = served()
+        reply[16:24] = ntp_time(tx)             # reference
+        reply[40:48] = ntp_time(tx)             # transmit
+        sock.sendto(bytes(reply), addr)
+        print('%s: %s.%03d' % (addr[0],
+                               time.strftime('%Y-%m-%d %H:%M:%S',
+                                             time.gmtime(tx)),
+                               int(tx * 1000) % 1000))
+        sys.stdout.flush()
+
+
+if __name__ == '__main__':
+    main()
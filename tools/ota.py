@@ -0,0 +1,387 @@
+#!/usr/bin/env python3
+#
+# ota.py - make, check and serve firmware deltas for OTA=1 builds
+#
+#   ota.py hash FW_DIR
+#   ota.py delta [--full] OLD_FW_DIR NEW_FW_DIR -o update.tld
+#   ota.py check OLD_FW_DIR update.tld [NEW_FW_DIR]
+#   ota.py serve [-p port] update.tld ...
+#
+# A firmware directory holds the user1.bin and user2.bin of an OTA=1
+# build, as `make` leaves them in firmware/. Keep a copy of the one
+# the nodes run: the delta is made against it.
+#
+# hash prints the SHA1 a node running each image asks for. delta
+# writes, for a node running either slot, the commands that build the
+# new image for the other slot, in the format of user/ota.c, and
+# checks them by applying them the way the node will. The two go in
+# one file, back to back. --full makes deltas of literal bytes only,
+# the size of a full image download, to compare.
+#
+# serve answers GET /ota/<sha1> with the delta made from that image,
+# and 404 for any other, and prints how long each took to send:
+#
+#   $ tools/ota.py delta deployed/ firmware/ -o update.tld
+#   $ tools/ota.py serve update.tld
+#   ... build with -DOTA_HOST=\"<this host>\"
+#
+# Copyright (C) 2015 Jerry Dunmire
+# This file is part of TLnodeFW
+#
+# TLnodeFW is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# TLnodeFW is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+
+import argparse
+import bisect
+import hashlib
+import http.server
+import os
+import struct
+import sys
+import time
+
+# see include/ota.h and user/ota.c
+DELTA_MAGIC = 0x32444c54
+HEADER = struct.Struct('<II20s20sIII')
+SECTOR = 4096
+SLOT_ADDR = (0x01000, 0x41000)
+SLOT_SIZE = 0x3b000
+IMAGE_V2_MAGIC = 0xea
+IMAGE_MAGIC = 0xe9
+COPY = 0x01
+
+KEY = 8             # bytes hashed to find a copy source
+CANDIDATES = 16     # sources tried for each key
+
+
+def image_len(img):
+    """Length of user1.bin or user2.bin from its headers, as the node
+    finds it."""
+    if len(img) < 16 or img[0] != IMAGE_V2_MAGIC:
+        raise ValueError('not an image for the SDK boot loader')
+    off = 16 + struct.unpack_from('<I', img, 12)[0]
+    if off + 8 > len(img) or img[off] != IMAGE_MAGIC:
+        raise ValueError('no image after the irom0 segment')
+    count = img[off + 1]
+    off += 8
+    for _ in range(count):
+        size = struct.unpack_from('<I', img, off + 4)[0]
+        off += 8 + size
+    # the checksum byte, padded to 16, and a CRC32
+    return (off | 15) + 1 + 4
+
+
+def load(fw_dir):
+    """The images of a build for slot 1 and slot 2."""
+    images = []
+    for name in ('user1.bin', 'user2.bin'):
+        with open(os.path.join(fw_dir, name), 'rb') as f:
+            img = f.read()
+        n = image_len(img)
+        if n > len(img):
+            raise ValueError('%s is cut short' % name)
+        if n > SLOT_SIZE:
+            raise ValueError('%s is larger than a slot' % name)
+        images.append(img[:n])
+    return images
+
+
+def image_sha1(img):
+    return hashlib.sha1(img).digest()
+
+
+def varint(v):
+    out = bytearray()
+    while v >= 0x80:
+        out.append((v & 0x7f) | 0x80)
+        v >>= 7
+    out.append(v)
+    return out
+
+
+def zigzag(v):
+    return (v << 1) if v >= 0 else ((-v << 1) - 1)
+
+
+def match_len(old, src, new, pos, limit):
+    n = 0
+    while n < limit and old[src + n] == new[pos + n]:
+        n += 1
+    return n
+
+
+def encode(old, new, full):
+    """Commands that build new from old, a sector at a time."""
+    index = {}
+    if not full:
+        for i in range(len(old) - KEY + 1):
+            index.setdefault(old[i:i + KEY], []).append(i)
+    out = bytearray()
+    shift = 0
+
+    for start in range(0, len(new), SECTOR):
+        end = min(start + SECTOR, len(new))
+        literal = bytearray()
+        pos = start
+
+        def flush():
+            if literal:
+                out.extend(varint(len(literal) << 1))
+                out.extend(literal)
+                literal.clear()
+
+        while pos < end:
+            best_n, best_src = 0, 0
+            src = pos + shift
+            if not full and 0 <= src < len(old):
+                best_n = match_len(old, src, new, pos,
+                                   min(end - pos, len(old) - src))
+                best_src = src
+            if not full and best_n < 16 and pos + KEY <= end:
+                cands = index.get(new[pos:pos + KEY], ())
+                # the nearest to where the last copy left off first
+                i = bisect.bisect_left(cands, pos + shift)
+                for c in cands[max(0, i - CANDIDATES // 2):i + CANDIDATES // 2]:
+                    n = match_len(old, c, new, pos, min(end - pos, len(old) - c))
+                    if n > best_n:
+                        best_n, best_src = n, c
+            cost = len(varint(best_n << 1)) \
+                + len(varint(zigzag(best_src - pos - shift)))
+            if best_n > cost + 1:
+                flush()
+                out.extend(varint((best_n << 1) | COPY))
+                out.extend(varint(zigzag(best_src - pos - shift)))
+                shift = best_src - pos
+                pos += best_n
+            else:
+                literal.append(new[pos])
+                pos += 1
+        flush()
+    return out
+
+
+def make_delta(old, new, addr, full=False):
+    """The delta that builds new, linked for the slot at addr, on a node
+    running old."""
+    body = encode(old, new, full)
+    header = HEADER.pack(DELTA_MAGIC, HEADER.size + len(body),
+                         image_sha1(old), image_sha1(new),
+                         addr, len(old), len(new))
+    return header + body
+
+
+def parts(data):
+    """The deltas of an update file."""
+    pos = 0
+    while pos == 0 or pos < len(data):
+        if len(data) - pos < HEADER.size:
+            raise ValueError('not a delta')
+        fields = HEADER.unpack_from(data, pos)
+        if fields[0] != DELTA_MAGIC or fields[1] < HEADER.size \
+                or pos + fields[1] > len(data):
+            raise ValueError('not a delta')
+        yield data[pos:pos + fields[1]]
+        pos += fields[1]
+
+
+class Reader:
+    def __init__(self, data, pos):
+        self.data = data
+        self.pos = pos
+
+    def byte(self):
+        if self.pos >= len(self.data):
+            raise ValueError('delta ends early')
+        self.pos += 1
+        return self.data[self.pos - 1]
+
+    def varint(self):
+        v, shift = 0, 0
+        while True:
+            c = self.byte()
+            v |= (c & 0x7f) << shift
+            shift += 7
+            if not c & 0x80:
+                return v
+
+
+def apply(old, delta):
+    """Build the new image from the old one, as user/ota.c does.
+    Returns the new image and the address of its slot."""
+    magic, length, old_sha1, new_sha1, addr, old_len, new_len = \
+        HEADER.unpack_from(delta)
+    if magic != DELTA_MAGIC or length != len(delta):
+        raise ValueError('not a delta')
+    if old_sha1 != image_sha1(old) or old_len != len(old):
+        raise ValueError('delta is for another image')
+    if addr not in SLOT_ADDR or not 0 < new_len <= SLOT_SIZE:
+        raise ValueError('delta is for no slot')
+    rd = Reader(delta, HEADER.size)
+    new = bytearray()
+    shift = 0
+    for start in range(0, new_len, SECTOR):
+        length = min(SECTOR, new_len - start)
+        sector = bytearray()
+        while len(sector) < length:
+            v = rd.varint()
+            n = v >> 1
+            if n == 0 or n > length - len(sector):
+                raise ValueError('command crosses a sector')
+            if v & COPY:
+                d = rd.varint()
+                d = (d >> 1) ^ -(d & 1)
+                pos = start + len(sector)
+                src = pos + shift + d
+                if src < 0 or src + n > old_len:
+                    raise ValueError('copy from outside the image')
+                sector += old[src:src + n]
+                shift = src - pos
+            else:
+                sector += bytes(rd.byte() for _ in range(n))
+        new += sector
+    if rd.pos != len(delta):
+        raise ValueError('bytes left over')
+    if image_sha1(new) != new_sha1:
+        raise ValueError('new image SHA1 does not match')
+    return bytes(new), addr
+
+
+def cmd_hash(args):
+    for slot, img in enumerate(load(args.fw)):
+        print('%s  user%d.bin' % (image_sha1(img).hex(), slot + 1))
+
+
+def cmd_delta(args):
+    old = load(args.old)
+    new = load(args.new)
+    out = bytearray()
+    for slot in (0, 1):
+        # a node running this slot builds the image for the other
+        other = 1 - slot
+        delta = make_delta(old[slot], new[other], SLOT_ADDR[other], args.full)
+        if apply(old[slot], delta) != (new[other], SLOT_ADDR[other]):
+            sys.exit('delta does not rebuild the new image')
+        print('user%d.bin %s -> user%d.bin %s: %d bytes, %.1f%% of the '
+              '%d byte image'
+              % (slot + 1, image_sha1(old[slot]).hex()[:12],
+                 other + 1, image_sha1(new[other]).hex()[:12],
+                 len(delta), 100.0 * len(delta) / len(new[other]),
+                 len(new[other])))
+        out += delta
+    with open(args.output, 'wb') as f:
+        f.write(out)
+
+
+def cmd_check(args):
+    old = load(args.old)
+    new = load(args.new) if args.new is not None else None
+    with open(args.delta, 'rb') as f:
+        data = f.read()
+    hashes = [image_sha1(img) for img in old]
+    try:
+        for delta in parts(data):
+            old_sha1 = HEADER.unpack_from(delta)[2]
+            if old_sha1 not in hashes:
+                raise ValueError('a delta is for another image')
+            slot = hashes.index(old_sha1)
+            img, addr = apply(old[slot], delta)
+            other = SLOT_ADDR.index(addr)
+            if other == slot:
+                raise ValueError('user%d.bin would overwrite itself'
+                                 % (slot + 1))
+            if new is not None and img != new[other]:
+                raise ValueError('does not make user%d.bin of %s'
+                                 % (other + 1, args.new))
+            print('%s: ok, user%d.bin makes user%d.bin %s'
+                  % (args.delta, slot + 1, other + 1, image_sha1(img).hex()))
+    except ValueError as e:
+        sys.exit('%s: %s' % (args.delta, e))
+
+
+def cmd_serve(args):
+    deltas = {}
+    for path in args.delta:
+        with open(path, 'rb') as f:
+            data = f.read()
+        for delta in parts(data):
+            old_sha1 = HEADER.unpack_from(delta)[2].hex()
+            deltas[old_sha1] = (path, delta)
+            print('%s: for %s' % (path, old_sha1), file=sys.stderr)
+
+    class Handler(http.server.BaseHTTPRequestHandler):
+        def do_GET(self):
+            t0 = time.time()
+            found = None
+            if self.path.startswith('/ota/'):
+                found = deltas.get(self.path[5:].lower())
+            if found is None:
+                self.send_error(404)
+                return
+            path, data = found
+            self.send_response(200)
+            self.send_header('Content-Type', 'application/octet-stream')
+            self.send_header('Content-Length', str(len(data)))
+            self.end_headers()
+            self.wfile.write(data)
+            self.wfile.flush()
+            print('%s: %s, %d bytes in %.0f ms'
+                  % (self.client_address[0], path, len(data),
+                     (time.time() - t0) * 1000))
+            sys.stdout.flush()
+
+        def log_message(self, fmt, *a):
+            if not fmt.startswith('"GET'):
+                sys.stderr.write('%s: %s\n' % (self.client_address[0], fmt % a))
+
+    server = http.server.HTTPServer(('', args.port), Handler)
+    print('listening on tcp port %d' % args.port, file=sys.stderr)
+    server.serve_forever()
+
+
+def main():
+    parser = argparse.ArgumentParser(description='firmware deltas for OTA=1')
+    sub = parser.add_subparsers(dest='cmd')
+    sub.required = True
+
+    p = sub.add_parser('hash', help='SHA1 of each image')
+    p.add_argument('fw')
+    p.set_defaults(func=cmd_hash)
+
+    p = sub.add_parser('delta', help='make a delta')
+    p.add_argument('old')
+    p.add_argument('new')
+    p.add_argument('-o', '--output', required=True)
+    p.add_argument('--full', action='store_true',
+                   help='literal bytes only, a full image download')
+    p.set_defaults(func=cmd_delta)
+
+    p = sub.add_parser('check', help='apply a delta as the node will')
+    p.add_argument('old')
+    p.add_argument('delta')
+    p.add_argument('new', nargs='?')
+    p.set_defaults(func=cmd_check)
+
+    p = sub.add_parser('serve', help='stand-in update server')
+    p.add_argument('-p', '--port', type=int, default=8266)
+    p.add_argument('delta', nargs='+')
+    p.set_defaults(func=cmd_serve)
+
+    args = parser.parse_args()
+    try:
+        args.func(args)
+    except (OSError, ValueError) as e:
+        sys.exit(str(e))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,171 @@
+#!/usr/bin/env python3
+#
+# tlog.py - host side of the TLnodeFW tokenized logger
+#
+#   tlog.py table <app.out>            print the message ID table
+#   tlog.py decode <table> [capture]   decode a UART stream (default stdin)
+#
+# Copyright (C) 2015 Jerry Dunmire
+# This file is part of TLnodeFW
+#
+# TLnodeFW is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# TLnodeFW is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+
+import re
+import struct
+import sys
+
+TLOG_SYNC = 0xa5
+SECTION = '.tlog_fmt'
+
+# printf conversion, as understood by the SDK's os_printf
+CONVERSION = re.compile(r'%([-+ #0]*\d*(?:\.\d+)?)[hl]*([diouxXcsp%])')
+
+
+def elf_section(path, name):
+    """Return the contents of section 'name' of a 32-bit little endian ELF."""
+    with open(path, 'rb') as f:
+        elf = f.read()
+    if elf[:4] != b'\x7fELF' or elf[4] != 1 or elf[5] != 1:
+        sys.exit('%s: not a 32-bit little endian ELF file' % path)
+
+    shoff, = struct.unpack_from('<I', elf, 0x20)
+    shentsize, shnum, shstrndx = struct.unpack_from('<HHH', elf, 0x2e)
+
+    def header(i):
+        return struct.unpack_from('<IIIIIIIIII', elf, shoff + i * shentsize)
+
+    strtab = header(shstrndx)
+    for i in range(shnum):
+        sh = header(i)
+        start = strtab[4] + sh[0]
+        sname = elf[start:elf.index(b'\0', start)].decode()
+        if sname == name:
+            return elf[sh[4]:sh[4] + sh[5]]
+    sys.exit('%s: no %s section, was it built with TLOG=1?' % (path, name))
+
+
+def escape(s):
+    return s.replace('\\', '\\\\').replace('\r', '\\r') \
+            .replace('\n', '\\n').replace('\t', '\\t')
+
+
+def unescape(s):
+    return re.sub(r'\\(.)',
+                  lambda m: {'r': '\r', 'n': '\n', 't': '\t'}.get(
+                      m.group(1), m.group(1)), s)
+
+
+def make_table(elf_path):
+    data = elf_section(elf_path, SECTION)
+    offset = 0
+    while offset < len(data):
+        end = data.index(b'\0', offset)
+        if end > offset:
+            text = data[offset:end].decode('latin-1')
+            print('0x%04x\t%s' % (offset, escape(text)))
+        # gcc may pad between the strings
+        offset = end + 1
+        while offset < len(data) and data[offset] == 0:
+            offset += 1
+
+
+def load_table(path):
+    table = {}
+    with open(path, encoding='latin-1') as f:
+        for line in f:
+            line = line.rstrip('\n')
+            if line:
+                msgid, fmt = line.split('\t', 1)
+                table[int(msgid, 16)] = unescape(fmt)
+    return table
+
+
+def format_record(fmt, payload):
+    pos = 0
+
+    def varint():
+        nonlocal pos
+        value = shift = 0
+        while True:
+            b = payload[pos]
+            pos += 1
+            value |= (b & 0x7f) << shift
+            shift += 7
+            if b < 0x80:
+                return value
+
+    def convert(m):
+        nonlocal pos
+        flags, conv = m.groups()
+        if conv == '%':
+            return '%'
+        if conv == 's':
+            n = payload[pos]
+            arg = payload[pos + 1:pos + 1 + n].decode('latin-1')
+            pos += 1 + n
+        else:
+            arg = varint()
+            if conv in 'di' and arg & 0x80000000:
+                arg -= 1 << 32
+            if conv == 'p':
+                conv = 'x'
+        return ('%' + flags + conv) % arg
+
+    return CONVERSION.sub(convert, fmt)
+
+
+def decode(table, stream, out):
+    while True:
+        c = stream.read(1)
+        if not c:
+            return
+        if c[0] != TLOG_SYNC:
+            # plain text from the SDK or os_printf()
+            out.write(c.decode('latin-1'))
+            continue
+
+        header = stream.read(3)
+        if len(header) < 3:
+            return
+        msgid, length = struct.unpack('<HB', header)
+        payload = stream.read(length)
+        fmt = table.get(msgid)
+        if fmt is None:
+            out.write('<tlog: unknown id 0x%04x>\n' % msgid)
+            continue
+        try:
+            out.write(format_record(fmt, payload))
+        except (IndexError, TypeError, ValueError):
+            out.write('<tlog: bad record for 0x%04x "%s">\n'
+                      % (msgid, escape(fmt)))
+        out.flush()
+
+
+def main(argv):
+    if len(argv) == 3 and argv[1] == 'table':
+        make_table(argv[2])
+    elif len(argv) in (3, 4) and argv[1] == 'decode':
+        table = load_table(argv[2])
+        if len(argv) == 4:
+            with open(argv[3], 'rb') as stream:
+                decode(table, stream, sys.stdout)
+        else:
+            decode(table, sys.stdin.buffer, sys.stdout)
+    else:
+        sys.exit('usage: tlog.py table <app.out>\n'
+                 '       tlog.py decode <table> [capture]')
+
+
+if __name__ == '__main__':
+    main(sys.argv)
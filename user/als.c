@@ -1,7 +1,7 @@
 /*
  *  Ambient light sensor support routines
  *
- *  The light sensor is the ISL29035. Reported values are in 1/64 lux.
+ *  The light sensor is the ISL29035. Reported values are in 1/100 lux.
  *
  *  Copyright (C) 2015 Jerry Dunmire
  *  This file is part of TLnodeFW
@@ -31,9 +31,12 @@
 #include "user_config.h"
 #include "driver/i2c.h"
 #include "driver/i2c_isl.h"
+#include "driver/i2c_async.h"
 //#define INFO os_printf  // override debug.h
 #include "debug.h"
 #include "report.h"
+#include "energy.h"
+#include "warm.h"
 
 #include "als.h"
 
@@ -43,55 +46,48 @@
  * scale.
  */
 #define MEASUREMENT_US (105000 * 2)
+#define OPERATING_UA    90      // supply current from the datasheet
+#define OVER_RANGE      0xffff  // the count of a level above the range
+#define MAX_READS       8       // of the data until two agree
                                     
 
 static uint32_t reportPID = 0;
 static uint32_t myid = 0;
-static report_t *myReport;
+static report_t myReport = { 0, 2, UNIT_LUX, REPORT_NOT_READY };
 
 static os_timer_t read_timer;
 static uint32_t measurement_start_time;
 
 static uint16_t Lux = 0;
+static uint8_t reads;
 
 /*
- * read light level from isl92035
- *
+ * The sensor is driven with queued transactions, see i2c_async.h, so
+ * the bus time overlaps with Wi-Fi and MQTT instead of spinning in
+ * os_delay_us().
  */
-static uint16_t ICACHE_FLASH_ATTR
-readData16(void)
-{
-    uint16_t lux = 0;
-    uint16_t lux_check = 1;
-    int maxloops = 5;
-
-    lux = isl_read_word(ISL_DATA_REG);
-    lux_check = isl_read_word(ISL_DATA_REG);
-
-    // make sure the reading didn't change between LSB/MSB reads
-    while ((lux != lux_check) && (maxloops >= 0)) {
-        lux = lux_check;
-        maxloops -= 1;
-        lux_check = isl_read_word(ISL_DATA_REG);
-    }
-    return (lux);
-
-} //end readData16();
-
+static i2c_xfer_t cmd2Xfer = { ISL_WRITE_ADDR, ISL_CMD2_REG, 1, 0 };
+static i2c_xfer_t cmd1Xfer = { ISL_WRITE_ADDR, ISL_CMD1_REG, 1, 0 };
+static i2c_xfer_t dataXfer = { ISL_WRITE_ADDR, ISL_DATA_REG, 0, 2 };
+static i2c_xfer_t idXfer = { ISL_WRITE_ADDR, ISL_ID_REG, 0, 1 };
 
 /*
  * read light levels
  *    - a state machine to read ambient level in full
  *      dynamic range.
- *    - measurements will be reported in 1/64 lux per bit.
- *    - called from a timer that allows time for each read.
+ *    - measurements will be reported in 1/100 lux per bit.
+ *    - run from the completion of each read, which is started
+ *      from a timer that allows time for the measurement.
  */
 enum alsState_t {
+    als_probing,    // reading ISL_ID_REG, see warm.h
     als_ranging,
     als_ready,
+    als_absent,     // no sensor, nothing to wait for
 };
 
 static enum alsState_t alsState = als_ranging;
+static bool started = false;    // als_start() has been called
 static uint8_t Range = ISL_RANGE_64K;
 
 /*
@@ -99,50 +95,171 @@ static uint8_t Range = ISL_RANGE_64K;
  */
 static uint8_t Gain[4] = {1, 4, 15, 61};
 
+/*
+ * pickRange - the range for the level just read
+ *
+ * The cut-off points are in counts of the 64K range, are based on
+ * ISL29035gainAnalysis.ods and allow for gain variation between range
+ * settings. A reading over a lower range says nothing more than that
+ * the level is higher, so it goes back to the 64K range.
+ */
+static uint8_t ICACHE_FLASH_ATTR
+pickRange(void)
+{
+    uint16_t counts = Lux >> (2 * (ISL_RANGE_64K - Range));
+
+    if ((Range != ISL_RANGE_64K) && (Lux == OVER_RANGE)) {
+        return(ISL_RANGE_64K);
+    }
+    if (counts >= 14000) {
+        return(ISL_RANGE_64K);
+    } else if (counts >= 3500) {
+        return(ISL_RANGE_16K);
+    } else if (counts >= 880) {
+        return(ISL_RANGE_4K);
+    }
+    return(ISL_RANGE_1K);
+}
+
+/*
+ * startMeasurement - queue the writes that start a measurement at Range
+ */
 static void ICACHE_FLASH_ATTR
-readLightLevels(void)
+startMeasurement(void)
+{
+    cmd2Xfer.data[0] = Range | ISL_ADC_16_BIT;
+    cmd1Xfer.data[0] = ISL_MODE_ALS_CONT;
+    (void)i2c_async_queue(&cmd2Xfer);
+    (void)i2c_async_queue(&cmd1Xfer);
+}
+
+static void ICACHE_FLASH_ATTR
+checkRange(void)
 {
     uint32_t mtime = MEASUREMENT_US / 1000;
+    uint8_t next;
 
-    Lux = readData16();
     switch(alsState) {
         case als_ranging:
             INFO("Ranging starting at %d, lux = %d\r\n", Range, Lux);
             // check range and re-measure if necessary
-            // cut-off points are based on ISL29035gainAnalysis.ods
-            // and allow for gain variation between range settings.
-            alsState = als_ready;
-            if (Lux < 14000) {
-                Range = ISL_RANGE_16K;
-                if (Lux < 880) {
-                    Range = ISL_RANGE_1K;
-                } else if (Lux < 3500) {
-                    Range = ISL_RANGE_4K;
+            next = pickRange();
+            if (next != Range) {
+                // once more from the top if the level is unknown
+                if (Lux != OVER_RANGE) {
+                    alsState = als_ready;
                 }
+                Range = next;
                 INFO("Change range to %d\r\n", Range);
-                isl_write_byte(ISL_CMD2_REG, (Range | ISL_ADC_16_BIT));
-                isl_write_byte(ISL_CMD1_REG, ISL_MODE_ALS_CONT);
+                startMeasurement();
                 os_timer_arm(&read_timer, mtime, 0);
                 break;
-            } else {
-                // range is OK, no need to re-read.
-                // Fall through to the als_ready state.
             }
-            // Conditional breaks above.
-            // Fall through otherwise.
+            // range is OK, no need to re-read.
+            alsState = als_ready;
+            // Fall through to the als_ready state.
 
         case als_ready:
             INFO("ALS ready ...\r\n");
+            warm_set_als_range(Range);
             system_os_post(reportPID, myid, 0);
             break;
 
         default:
-            os_printf("State error in readLightLevels()\r\n");
+            os_printf("State error in checkRange()\r\n");
             break;
 
     } // end switch(alsState)
 
-} // end readLightLevels()
+} // end checkRange()
+
+
+/*
+ * lost - the sensor stopped answering
+ */
+static void ICACHE_FLASH_ATTR
+lost(void)
+{
+    INFO("ALS not answering\r\n");
+    alsState = als_absent;
+    warm_hw_found(WARM_HW_ISL29035, false);
+}
+
+static void ICACHE_FLASH_ATTR
+cmdWritten(i2c_xfer_t *xfer)
+{
+    if ((xfer->status != I2C_XFER_DONE) && (alsState != als_absent)) {
+        // the read timer finds it absent
+        lost();
+    }
+}
+
+
+/*
+ * dataRead - a read of the data register is done
+ *
+ * The data is read again until two reads agree, to make sure the
+ * reading didn't change between the LSB and MSB reads.
+ */
+static void ICACHE_FLASH_ATTR
+dataRead(i2c_xfer_t *xfer)
+{
+    uint16_t lux = (xfer->data[1] << 8) | xfer->data[0];
+
+    if (xfer->status != I2C_XFER_DONE) {
+        lost();
+        system_os_post(reportPID, myid, 0);
+        return;
+    }
+    warm_hw_found(WARM_HW_ISL29035, true);  // clears a missed wake
+    if ((reads == 1) || ((lux != Lux) && (reads < MAX_READS))) {
+        Lux = lux;
+        reads++;
+        (void)i2c_async_queue(&dataXfer);
+        return;
+    }
+    Lux = lux;
+    checkRange();
+} // end dataRead()
+
+
+/*
+ * readLightLevels - start reading the measurement, called from a timer
+ * that allows time for it to complete
+ */
+static void ICACHE_FLASH_ATTR
+readLightLevels(void)
+{
+    if (alsState == als_absent) {
+        system_os_post(reportPID, myid, 0);
+        return;
+    }
+    reads = 1;
+    (void)i2c_async_queue(&dataXfer);
+}
+
+
+/*
+ * idRead - the ISL29035 identified itself, or nothing answered
+ */
+static void ICACHE_FLASH_ATTR
+idRead(i2c_xfer_t *xfer)
+{
+    bool found = (xfer->status == I2C_XFER_DONE)
+        && ((xfer->data[0] & ISL_ID_MASK) == ISL_ID_ISL29035);
+
+    warm_hw_found(WARM_HW_ISL29035, found);
+    if (!found) {
+        alsState = als_absent;
+    } else {
+        alsState = als_ranging;
+        startMeasurement();
+        measurement_start_time = system_get_time();
+    }
+    if (started) {
+        als_start();
+    }
+} // end idRead()
 
 
 /*
@@ -158,18 +275,36 @@ als_init(uint32_t pid, uint32_t id)
     myid = id;
 
     INFO("als_init()\r\n");
-    i2c_init();
-    // Start the light sensor measurements.
-    Range = ISL_RANGE_64K;
-    isl_write_byte(ISL_CMD2_REG, (Range | ISL_ADC_16_BIT));
-    isl_write_byte(ISL_CMD1_REG, ISL_MODE_ALS_CONT);
-
-    measurement_start_time = system_get_time();
+    i2c_async_init();
+    cmd2Xfer.done = cmdWritten;
+    cmd1Xfer.done = cmdWritten;
+    dataXfer.done = dataRead;
+    idXfer.done = idRead;
+    started = false;
 
     // Setup up the timer, but don't start it
     os_timer_disarm(&read_timer);
     os_timer_setfn(&read_timer, (os_timer_func_t *)readLightLevels, NULL);
 
+    // Start the light sensor measurements at the range of the last
+    // reading, which is most likely still right, see warm.h. After a
+    // cold boot, make sure there is a sensor first.
+    Range = warm_als_range();
+    if (Range == WARM_NO_RANGE) {
+        Range = ISL_RANGE_64K;
+    }
+    if (!warm_hw_known(WARM_HW_ISL29035)) {
+        alsState = als_probing;
+        (void)i2c_async_queue(&idXfer);
+    } else if (warm_hw_present(WARM_HW_ISL29035)) {
+        alsState = als_ranging;
+        startMeasurement();
+    } else {
+        alsState = als_absent;
+    }
+
+    measurement_start_time = system_get_time();
+
     return;
 } // end als_init()
 
@@ -182,14 +317,24 @@ void ICACHE_FLASH_ATTR
 als_start()
 {
     INFO("als_start()\r\n");
-    
+    started = true;
+    if (alsState == als_probing) {
+        // idRead() comes back here
+        return;
+    }
+    if (alsState == als_absent) {
+        system_os_post(reportPID, myid, 0);
+        return;
+    }
+
     // Read and report the measured temperature.
     // No need to worry about overflow or 32-bit wrap because
     // system_get_time() always starts from zero.
     uint32_t elapsed_us = system_get_time() - measurement_start_time;
     if (elapsed_us < MEASUREMENT_US) {
         INFO("Delaying %d us\r\n", MEASUREMENT_US - elapsed_us);
-        os_timer_arm(&read_timer, (MEASUREMENT_US - elapsed_us) / 1000 , 0);
+        // round up, a 0 ms timer would come straight back here
+        os_timer_arm(&read_timer, (MEASUREMENT_US - elapsed_us + 999) / 1000 , 0);
     }
     else
     {
@@ -201,17 +346,25 @@ als_start()
 
 
 /*
- * format light level for reporting process
+ * report the light level in 1/100 lux
  *
+ * Full scale of the 16-bit count is 1000 << (2 * Range) lux, so the
+ * level is Lux * (1 << (2 * Range)) * 100000 / 65536, worked in two
+ * parts to stay inside 32 bits.
  */
-report_t* ICACHE_FLASH_ATTR
+const report_t* ICACHE_FLASH_ATTR
 als_report(void)
 {
-    myReport = newReport(12);
-    os_sprintf(myReport->buffer, "%d", Lux);
-    myReport->len = strlen(myReport->buffer);
+    uint32 counts = (uint32)Lux << (2 * Range);
+
+    if (alsState == als_absent) {
+        myReport.status = REPORT_NO_SENSOR;
+        return(&myReport);
+    }
+    myReport.value = (counts >> 11) * 3125 + (counts & 0x7ff) * 3125 / 2048;
+    myReport.status = REPORT_OK;
 
-    return(myReport);
+    return(&myReport);
 
 } //end als_report(void)
 
@@ -220,9 +373,13 @@ void ICACHE_FLASH_ATTR
 als_shutdown(void)
 {
     INFO("als_shutdown()\r\n");
-    // power down the light sensor
-    isl_write_byte(ISL_CMD1_REG, ISL_MODE_PD);
-    freeReport(myReport);
+    // power down the light sensor, right away as deep sleep is next
+    i2c_async_cancel();
+    if (alsState != als_absent) {
+        isl_write_byte(ISL_CMD1_REG, ISL_MODE_PD);
+        energy_sensor(system_get_time() - measurement_start_time,
+                OPERATING_UA);
+    }
 
     return;
 }  //end als_shutdown()
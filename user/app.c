@@ -30,6 +30,8 @@
 #include <os_type.h>
 #include <gpio.h>
 #include <mem.h>
+#include <espconn.h>
+#include "heapstat.h"
 #include "mqtt.h"
 #include "config.h"
 #include "als.h"
@@ -37,13 +39,48 @@
 #include "user_config.h"
 #include "ds18b20.h"
 #include "battery.h"
-
-// Device ID = 1, Application version = 1
-#define ID_VERSION_STR  "1,1"
-
+#include "energy.h"
+#include "backoff.h"
+#include "rfcal.h"
+#include "mqttsn.h"
+#include "mqttpipe.h"
+#include "bench.h"
+#include "broker.h"
+#include "mains.h"
+#include "walltime.h"
+#include "schedule.h"
+#include "ota.h"
+#include "dump.h"
+#include "warm.h"
+#include "tlog.h"
+
+// Device ID = 1, Report version = 6
+// Then: temperature C, light lux, supply V (empty if the sensor did
+// not answer), elapsed s, uAh per cycle, days left, failed wakes,
+// RF cal mode, init ms, Unix time s (empty until the first sync, see
+// walltime.h).
+#define ID_VERSION_STR  "1,6"
+
+#ifndef DEEP_SLEEP_SECONDS
 #define DEEP_SLEEP_SECONDS 300
+#endif
 #define US_PER_SEC 1000000
 
+// espconn_secure buffer, must hold the broker's certificate chain
+#define TLS_BUF_SIZE    4096
+
+// Longest wait for the broker or gateway to confirm DISCONNECT, long
+// enough for a broker across a WAN, with a delayed ACK. At
+// MQTTSN_QOS -1 there is nothing to confirm and this is how long the
+// last datagram is given to leave the radio.
+#define CLOSE_DEADLINE_MS   500
+#define UDP_DRAIN_MS        5
+
+// the broker's wake offset needs a subscription, see schedule.h
+#if !defined(MQTTSN) && !defined(MQTTPIPE) && !defined(MAINS)
+#define SLOT_CHECK
+#endif
+
 static os_timer_t shutdown_timer;
 static os_timer_t watchdog_timer;
 
@@ -52,14 +89,118 @@ static os_timer_t watchdog_timer;
 #define DRIVER_1        0x01
 #define DRIVER_2        0x02
 #define DRIVER_3        0x04
+#define SIG_SLEEP       0x100   // session closed, go to deep sleep
 // system_os_post(REPORTER_PID, driverID, driverStatus );
 
 static os_event_t       reporter_queue[REPORTER_QLEN];
 static uint8_t          driverStatusMask = 0;
+static uint8_t          pendingPublish = 0;  // messages not yet sent
+static bool             sensorsStarted = false;
+static bool             closing = false;     // DISCONNECT sent
+#ifdef MQTTSN
+static bool             publishFailed = false;  // a message was lost
+#endif
+static bool             sleepPosted = false;
+#ifdef SLOT_CHECK
+static bool             slotWaiting = false; // for the broker's offset
+static bool             closeAfterSlot = false;
+static os_timer_t       slot_timer;
+#endif
+#ifdef MAINS
+static bool             sampling = false;    // drivers still measuring
+#endif
 
 MQTT_Client mqttClient;
 
 
+#ifndef MQTTSN
+/*
+ * brokerConnect - connect to the broker in sysCfg, see broker.h
+ */
+static void ICACHE_FLASH_ATTR
+brokerConnect(void)
+{
+    mqttClient.port = sysCfg.mqtt_port;
+#ifdef MQTTPIPE
+    if (mqttpipe_connect()) {
+        return;
+    }
+#endif
+    if (sysCfg.security) {
+        // the TLS handshake is mostly public key math, so run it
+        // at 160 MHz and get the radio off sooner
+        system_update_cpu_freq(SYS_CPU_160MHZ);
+    }
+    MQTT_Connect(&mqttClient);
+    // The INFO message will be 'TCP: Connect to...'
+}
+
+
+/*
+ * droppedConnCb - the SDK is done with an espconn taken from esp_mqtt
+ */
+static void ICACHE_FLASH_ATTR
+droppedConnCb(void *arg)
+{
+    struct espconn *pCon = (struct espconn *)arg;
+
+    os_free(pCon->proto.tcp);
+    os_free(pCon);
+}
+
+
+static void ICACHE_FLASH_ATTR
+droppedErrorCb(void *arg, sint8 err)
+{
+    droppedConnCb(arg);
+}
+
+
+/*
+ * mqtt_drop - end esp_mqtt's connection, whatever state it is in
+ *
+ * MQTT_Disconnect() frees the espconn without closing it, so the SDK
+ * would call back into freed memory for a connect still out. The
+ * espconn is taken from the client and aborted instead, and freed by
+ * its disconnect or error callback. If neither comes, it is left for
+ * the next reset. The client is free to connect again right away.
+ */
+static void ICACHE_FLASH_ATTR
+mqtt_drop(MQTT_Client *client)
+{
+    struct espconn *pCon = client->pCon;
+
+    client->pCon = NULL;
+    if (pCon != NULL) {
+        espconn_regist_disconcb(pCon, droppedConnCb);
+        espconn_regist_reconcb(pCon, droppedErrorCb);
+#ifdef CLIENT_SSL_ENABLE
+        if (client->security) {
+            espconn_secure_disconnect(pCon);
+        } else
+#endif
+        {
+            espconn_abort(pCon);
+        }
+    }
+    MQTT_Disconnect(client);
+} // end mqtt_drop()
+
+
+/*
+ * brokerGiveUp - drop the connection to a broker that did not answer
+ */
+static void ICACHE_FLASH_ATTR
+brokerGiveUp(void)
+{
+#ifdef MQTTPIPE
+    mqttpipe_stop();
+#endif
+    mqtt_drop(&mqttClient);
+}
+#endif // MQTTSN
+
+
 /*
  * This gets called when the connection to the WiFi AP
  * changes.
@@ -70,19 +211,163 @@ wifiConnectCb(uint8_t status)
     INFO("wifiConnectCb\r\n");
     ip_addr_t *addr = (ip_addr_t *)os_zalloc(sizeof(ip_addr_t));
     if(status == STATION_GOT_IP){
-        MQTT_Connect(&mqttClient);
-        // The INFO message will be 'TCP: Connect to...'
+        energy_state(ENERGY_RADIO);
+        walltime_sync();
+#if defined(MQTTSN)
+        mqttsn_connect();
+#else
+        broker_connect(brokerConnect, brokerGiveUp);
+#endif
     }
     else
     {
-        MQTT_Disconnect(&mqttClient);
+#ifndef MQTTSN
+        broker_stop();
+        mqtt_drop(&mqttClient);
         // The INFO message will be 'Free memory'
+#endif
     }
     os_free(addr);
     INFO("wifiConnectCb exit\r\n");
 }
 
 
+/*
+ * sessionClosedCb - the broker or gateway has everything we sent
+ *
+ * Called from a network callback, so leave deep sleep to the reporter
+ * task.
+ */
+static void ICACHE_FLASH_ATTR
+sessionClosedCb(uint32_t *args)
+{
+    if (sleepPosted) {
+        return;
+    }
+    sleepPosted = true;
+    INFO("session closed\r\n");
+    os_timer_disarm(&shutdown_timer);
+    system_os_post(REPORTER_PID, SIG_SLEEP, 0);
+}
+
+
+/*
+ * closeDeadlineCb - DISCONNECT was not confirmed in time
+ *
+ * Sleeps the same way as a confirmed close, so a time sync or an
+ * update check that is due still runs.
+ */
+static void ICACHE_FLASH_ATTR
+closeDeadlineCb(void *arg)
+{
+    if (sleepPosted) {
+        return;
+    }
+    INFO("session close not confirmed\r\n");
+    sleepPosted = true;
+    system_os_post(REPORTER_PID, SIG_SLEEP, 0);
+}
+
+
+/*
+ * sleepAfterSync - the time sync is done, on to deep sleep
+ */
+static void ICACHE_FLASH_ATTR
+sleepAfterSync(void)
+{
+    system_os_post(REPORTER_PID, SIG_SLEEP, 0);
+}
+
+
+#if !defined(MQTTSN)
+static void ICACHE_FLASH_ATTR
+disconnectSentCb(void *arg)
+{
+    sessionClosedCb(NULL);
+}
+
+
+/*
+ * mqtt_send_disconnect - send DISCONNECT on the esp_mqtt connection
+ *
+ * This version of esp_mqtt has no call that sends DISCONNECT, so the
+ * packet is built with its mqtt_msg.c and written here. Nothing else
+ * is outstanding once the last message is published, so the sent
+ * callback is taken over: it comes when the broker ACKs DISCONNECT,
+ * and TCP ACKs are cumulative, so the reports are safe too.
+ */
+static bool ICACHE_FLASH_ATTR
+mqtt_send_disconnect(MQTT_Client *client)
+{
+    mqtt_message_t *msg;
+    sint8 err;
+
+    if ((client->pCon == NULL) || (client->connState != MQTT_DATA)) {
+        return(FALSE);
+    }
+    msg = mqtt_msg_disconnect(&client->mqtt_state.mqtt_connection);
+    espconn_regist_sentcb(client->pCon, disconnectSentCb);
+#ifdef CLIENT_SSL_ENABLE
+    if (client->security) {
+        err = espconn_secure_sent(client->pCon, msg->data, msg->length);
+    } else
+#endif
+    {
+        err = espconn_sent(client->pCon, msg->data, msg->length);
+    }
+    return(err == 0);
+} // end mqtt_send_disconnect()
+#endif // !MQTTSN
+
+
+/*
+ * session_close - every message is out, end the session and sleep
+ *
+ * Over TCP the published callback already means the broker has ACKed
+ * the data (the espconn sent callback, or CONNACK for pipelined
+ * messages), as does PUBACK for MQTT-SN QoS 1. DISCONNECT lets the
+ * broker drop the session now instead of at the keepalive timeout,
+ * and deep sleep follows as soon as it is confirmed, or at
+ * CLOSE_DEADLINE_MS.
+ */
+static void ICACHE_FLASH_ATTR
+session_close(void)
+{
+    bool waiting;
+
+    if (closing) {
+        return;
+    }
+#ifdef SLOT_CHECK
+    if (slotWaiting) {
+        closeAfterSlot = true;
+        return;
+    }
+#endif
+    closing = true;
+
+#if defined(MQTTSN)
+    waiting = mqttsn_disconnect(sessionClosedCb);
+    // UDP has no ACK, give the last datagram time to leave
+    os_timer_arm(&shutdown_timer,
+            waiting ? CLOSE_DEADLINE_MS : UDP_DRAIN_MS, 0);
+#else
+    waiting = false;
+#ifdef MQTTPIPE
+    waiting = mqttpipe_disconnect(sessionClosedCb);
+#endif
+    if (!waiting) {
+        waiting = mqtt_send_disconnect(&mqttClient);
+    }
+    if (waiting) {
+        os_timer_arm(&shutdown_timer, CLOSE_DEADLINE_MS, 0);
+    } else {
+        sessionClosedCb(NULL);
+    }
+#endif
+} // end session_close()
+
+
 /*
  * handle MQTT disconnect
  *
@@ -92,6 +377,10 @@ mqttDisconnectedCb(uint32_t *args)
 {
     MQTT_Client* client = (MQTT_Client*)args;
     INFO("MQTT: Disconnected\r\n");
+    if (closing) {
+        // the broker closes the connection after DISCONNECT
+        sessionClosedCb(args);
+    }
 }
 
 /*
@@ -104,9 +393,134 @@ mqttPublishedCb(uint32_t *args)
     MQTT_Client* client = (MQTT_Client*)args;
     INFO("MQTT: Report published\r\n");
 
-    // shutdown in 1 milli-second
-    os_timer_arm(&shutdown_timer, 1, 0);
+#ifndef MQTTSN
+    // a pipelined session has no connected callback
+    broker_connected();
+#endif
+    if (pendingPublish > 0) {
+        pendingPublish--;
+    }
+#ifndef MAINS
+    if (pendingPublish == 0) {
+#ifdef MQTTSN
+        if (publishFailed) {
+            // not everything was delivered: no DISCONNECT, so the
+            // wake counts as failed, as if the watchdog had ended it
+            sessionClosedCb(NULL);
+            return;
+        }
+#endif
+        session_close();
+    }
+#endif
+}
+
+
+#ifdef MQTTSN
+/*
+ * mqttsnFailedCb - the gateway rejected a message, or never answered
+ */
+static void ICACHE_FLASH_ATTR
+mqttsnFailedCb(uint32_t *args)
+{
+    INFO("MQTT-SN: Report failed\r\n");
+    publishFailed = true;
+    if (pendingPublish > 0) {
+        pendingPublish--;
+    }
+    // the rest still finish first
+    if (pendingPublish == 0) {
+        sessionClosedCb(NULL);
+    }
 }
+#endif
+
+
+#ifdef MAINS
+static void sample_sensors(void);
+static void mainsPublish(const char *batch);
+#endif
+
+
+/*
+ * init_drivers - start the conversions
+ */
+static void ICACHE_FLASH_ATTR
+init_drivers(void)
+{
+    ds18B20_init(REPORTER_PID, DRIVER_1);
+    als_init(REPORTER_PID, DRIVER_2);
+    battery_init(REPORTER_PID, DRIVER_3);
+}
+
+
+/*
+ * start_sensors - start the driver measurements, once per wake
+ */
+static void ICACHE_FLASH_ATTR
+start_sensors(void)
+{
+    if (sensorsStarted) {
+        return;
+    }
+    sensorsStarted = true;
+
+#ifdef MAINS
+    // and again every MAINS_SAMPLE_S, see mains.h
+    mains_start(sample_sensors, mainsPublish);
+#else
+    ds18B20_start();
+    als_start();
+    battery_start();
+#endif
+}
+
+
+#ifdef SLOT_CHECK
+/*
+ * slot_done - take the broker's wake offset, or its absence
+ */
+static void ICACHE_FLASH_ATTR
+slot_done(const char *data, uint16 len)
+{
+    os_timer_disarm(&slot_timer);
+    slotWaiting = false;
+    schedule_set_offset(data, len);
+    if (closeAfterSlot) {
+        session_close();
+    }
+}
+
+
+static void ICACHE_FLASH_ATTR
+slot_timeout(void *arg)
+{
+    INFO("no slot from the broker\r\n");
+    slot_done(NULL, 0);
+}
+
+
+/*
+ * slot_check - subscribe to the retained wake offset
+ *
+ * The session is held open for the answer, at most
+ * SCHEDULE_SLOT_WAIT_MS.
+ */
+static void ICACHE_FLASH_ATTR
+slot_check(void)
+{
+    char *tBuf = (char *)os_zalloc(strlen(sysCfg.device_id) + 40);
+
+    os_sprintf(tBuf, "%s" SCHEDULE_SLOT_TOPIC, sysCfg.device_id);
+    if (MQTT_Subscribe(&mqttClient, tBuf, 0)) {
+        slotWaiting = true;
+        os_timer_disarm(&slot_timer);
+        os_timer_setfn(&slot_timer, (os_timer_func_t *)slot_timeout, NULL);
+        os_timer_arm(&slot_timer, SCHEDULE_SLOT_WAIT_MS, 0);
+    }
+    os_free(tBuf);
+}
+#endif
 
 
 /*
@@ -118,10 +532,19 @@ mqttConnectedCb(uint32_t *args)
 {
     MQTT_Client* client = (MQTT_Client*)args;
     INFO(" MQTT: Connected\r\n");
-    
-    ds18B20_start();
-    als_start();
-    battery_start();
+#ifndef MQTTSN
+    broker_connected();
+#endif
+
+    if (system_get_cpu_freq() != SYS_CPU_80MHZ) {
+        system_update_cpu_freq(SYS_CPU_80MHZ);
+    }
+#ifdef SLOT_CHECK
+    if (schedule_check_due() && !slotWaiting) {
+        slot_check();
+    }
+#endif
+    start_sensors();
 
 } //end mqttConnectedCb()
 
@@ -152,6 +575,14 @@ mqttDataCb(
     dataBuf[data_len] = 0;
     INFO("   date=%s\r\n", topicBuf);
 
+#ifdef SLOT_CHECK
+    uint16 idLen = os_strlen(sysCfg.device_id);
+    if (slotWaiting && (os_strncmp(topicBuf, sysCfg.device_id, idLen) == 0)
+            && (os_strcmp(topicBuf + idLen, SCHEDULE_SLOT_TOPIC) == 0)) {
+        slot_done(dataBuf, data_len);
+    }
+#endif
+
     os_free(topicBuf);
     os_free(dataBuf);
 
@@ -168,11 +599,40 @@ user_deep_sleep(void)
     ds18B20_shutdown();
     als_shutdown();
     battery_shutdown();
+#ifdef HEAPSTAT
+    heapstat_check();
+#endif
+
+    // the report is out once the session is closing, the wake is put
+    // back on the schedule grid
+    uint32 sleepUs = schedule_sleep_us(DEEP_SLEEP_SECONDS,
+            backoff_sleep_s(DEEP_SLEEP_SECONDS, closing), !closing);
+
+    sint32 tempMc;
+    rfcal_sleep(ds18B20_temp_mc(&tempMc) ? tempMc : RFCAL_NO_TEMP);
+    // the next reading converts while the node sleeps
+    ds18B20_sleep(sleepUs);
+    dump_sleep(closing);
+    warm_sleep(closing);
+#ifdef TLOG
+    tlog_ring_sleep(closing);
+#endif
+#ifndef MQTTSN
+    broker_sleep();
+#endif
 
     uint32_t usec = system_get_time();
     INFO("elapsed: %d.%03d\r\n", usec/1000000, usec % 1000000);
+    INFO("uart tx dropped: %d, high water: %d\r\n",
+            uart_tx_dropped(), uart_tx_highwater());
+
+    walltime_save();
+    energy_sleep(sleepUs);
 
-    system_deep_sleep(DEEP_SLEEP_SECONDS * US_PER_SEC);
+    // don't let deep sleep cut off queued debug messages
+    uart_tx_flush();
+
+    system_deep_sleep(sleepUs);
 }
 
 
@@ -186,11 +646,23 @@ static void ICACHE_FLASH_ATTR
 sys_init_complete(void)
 {
     INFO("sys_init_complete\r\n");
+    rfcal_init_done();
+#ifdef MQTTSN
+    // Reports go to the MQTT-SN gateway, the TCP client is not used
+    mqttsn_init(MQTTSN_HOST, MQTTSN_PORT, sysCfg.device_id,
+            sysCfg.mqtt_keepalive);
+    mqttsn_on_connected(mqttConnectedCb);
+    mqttsn_on_published(mqttPublishedCb);
+    mqttsn_on_failed(mqttsnFailedCb);
+#else
     // Setup Wifi connection and MQTT
     MQTT_InitConnection(&mqttClient, sysCfg.mqtt_host, sysCfg.mqtt_port,
-           // sysCfg.security
-           0 // 1 = SSL
+            sysCfg.security // 1 = SSL, see DEFAULT_SECURITY
             );
+    broker_attach(&mqttClient);
+    if (sysCfg.security) {
+        espconn_secure_set_size(ESPCONN_CLIENT, TLS_BUF_SIZE);
+    }
 
     INFO("Got here\r\n");
     MQTT_OnConnected(&mqttClient, mqttConnectedCb);
@@ -227,11 +699,24 @@ sys_init_complete(void)
     //            0  // 1 = retain  TODO: set to 1
     //        );
 
+#ifdef MQTTPIPE
+    // Read the sensors while associating so the report is ready to go
+    // out with CONNECT
+    if (mqttpipe_init(&mqttClient)) {
+        mqttpipe_on_published(mqttPublishedCb);
+    }
+    start_sensors();
+#endif
+#ifdef MAINS
+    // sample from the start, batches wait in esp_mqtt's queue until
+    // the broker is connected
+    start_sensors();
+#endif
+#endif // MQTTSN
+
+    energy_state(ENERGY_ASSOC);
     WIFI_Connect(sysCfg.sta_ssid, sysCfg.sta_pwd, wifiConnectCb);
     INFO("Got here 4\r\n");
-
-    //dumpInfo();
-
 }  //end of sys_init_complete()
 
 
@@ -267,34 +752,159 @@ initSysCfg()
 }  //end of initSysCfg()
 
 
+/*
+ * publish - send a message with the client this build uses
+ *
+ * topicId is the pre-registered MQTT-SN topic ID for topic. data need
+ * not be text.
+ */
+static void ICACHE_FLASH_ATTR
+publish(const char *topic, uint16 topicId, const char *data, uint16 len,
+        uint8 retain)
+{
+    // count first, the published callback may come before the return
+    pendingPublish++;
+#ifdef MQTTSN
+    if (!mqttsn_publish(topicId, data, len, MQTTSN_QOS, retain)) {
+        pendingPublish--;
+    }
+#else
+#ifdef MQTTPIPE
+    if (mqttpipe_publish(topic, data, len, retain)) {
+        return;
+    }
+#endif
+    MQTT_Publish(&mqttClient, topic, data, len, 0, retain);
+#endif
+} // end publish()
+
+
+#ifdef MAINS
+/*
+ * sample_sensors - take the next sample for the batch
+ *
+ * A sample still being measured when the period is up is left to
+ * finish and this one is skipped.
+ */
+static void ICACHE_FLASH_ATTR
+sample_sensors(void)
+{
+    if (sampling) {
+        INFO("sample skipped, status %x\r\n", driverStatusMask);
+        return;
+    }
+    sampling = true;
+    driverStatusMask = 0;
+    walltime_sync();    // once it is due
+
+    init_drivers();
+    ds18B20_start();
+    als_start();
+    battery_start();
+}
+
+
+/*
+ * mainsPublish - send a batch of samples
+ */
+static void ICACHE_FLASH_ATTR
+mainsPublish(const char *batch)
+{
+    char *tBuf = (char *)os_zalloc(strlen(sysCfg.device_id) + 40);
+
+    os_sprintf(tBuf, "%s/batch", sysCfg.device_id);
+    // no MQTT-SN topic, see mains.h
+    publish(tBuf, 0, batch, os_strlen(batch), 1);
+    INFO("%s:%s\r\n", tBuf, batch);
+    os_free(tBuf);
+}
+#endif // MAINS
+
+
+/*
+ * put_value - append ",<value>" to the report, returns the new end
+ */
+static char * ICACHE_FLASH_ATTR
+put_value(char *p, sint32 value, uint8 scale)
+{
+    *p++ = ',';
+    return(p + report_decimal(p, value, scale));
+}
+
+
+/*
+ * put_report - append a driver's measurement, an empty field if it
+ * has none
+ */
+static char * ICACHE_FLASH_ATTR
+put_report(char *p, const report_t *report)
+{
+    *p++ = ',';
+    return(p + report_format(p, report));
+}
+
+
 /*
  * reporter -  process to collect and send driver results
  *
  * Collect measurements from drivers and when all ready, send them to
  * MQTT broker. Report message has the form:
- *    deviceType,report_version,temperature,lightlevel,voltage,elapsedTime
+ *    deviceType,report_version,temperature,lightlevel,voltage,elapsedTime,
+ *        cycleCharge,daysLeft,failedWakes,rfcalMode,initMs,unixTime
  *    deviceType = 1 (sensorNode with ds18b20 and isl29035)
- *    version_version = 1
- *       temperature: float, degC
- *       lightlevel:  integer, 1/64 lux per count
- *       voltage: float, volts
- *       elapsedTime: float, seconds
+ *    version_version = 6
+ *    The measurements are fixed-point decimals, see report_format(), and
+ *    are empty if the sensor did not answer:
+ *       temperature: degC, 3 decimals
+ *       lightlevel:  lux, 2 decimals
+ *       voltage: volts, 3 decimals
+ *       elapsedTime: seconds, 6 decimals
+ *       cycleCharge: integer, estimated uAh used by the previous wake
+ *                    and sleep cycle (0 after power-on)
+ *       daysLeft: integer, projected battery life at cycleCharge
+ *       failedWakes: integer, wakes in a row that failed to report
+ *                    before this one, see backoff.h
+ *       rfcalMode: integer, RFCAL_FULL or RFCAL_SKIP, the RF
+ *                  calibration this wake ran with, see rfcal.h
+ *       initMs: integer, ms from reset to the init done callback
+ *       unixTime: seconds, 3 decimals, when the sample was taken; empty
+ *                 until the first SNTP sync, see walltime.h
  */
 void ICACHE_FLASH_ATTR
 reporter(os_event_t *event) {
+    if (event->sig == SIG_SLEEP) {
+        // a time sync still out gets a moment to finish
+        if (walltime_wait(sleepAfterSync)) {
+            return;
+        }
+#ifdef OTA
+        // then an update, when a check is due; a download can take
+        // longer than the watchdog allows, ota.c has its own timeout
+        if (ota_check(sleepAfterSync)) {
+            os_timer_disarm(&watchdog_timer);
+            return;
+        }
+#endif
+        user_deep_sleep();
+        return;
+    }
     driverStatusMask |= (event->sig & 0xff);
 
     INFO("reporter status: %x, %x\r\n", driverStatusMask, (DRIVER_1 | DRIVER_2 | DRIVER_3));
     if (driverStatusMask == (DRIVER_1 | DRIVER_2 | DRIVER_3)) {
         INFO("Reporting...\r\n");
         // measurements complete, report
-        uint32 usec = system_get_time();
-        char *timeBuf = (char*)os_zalloc(16);
+        uint32 usec;
 
         // Collect reports
-        report_t *driver1 = ds18B20_report();
-        report_t *driver2 = als_report();
-        report_t *driver3 = battery_report();
+        const report_t *driver1 = ds18B20_report();
+        const report_t *driver2 = als_report();
+        const report_t *driver3 = battery_report();
+#ifdef MAINS
+        sampling = false;
+        mains_add(driver1, driver2, driver3);
+        return;
+#endif
 
         // allocate space for the summary report
         /*
@@ -308,32 +918,85 @@ reporter(os_event_t *event) {
         char *tBuf = (char *)os_zalloc(strlen(sysCfg.device_id) + 40);
 
         // fill out the report
-        (void)strcpy(mBuf, ID_VERSION_STR);  // deviceID and report version
-        (void)strcat(mBuf,",");
-        (void)strcat(mBuf,driver1->buffer);  // temperature
-        (void)strcat(mBuf,",");
-        (void)strcat(mBuf,driver2->buffer);  // ambient light
-        (void)strcat(mBuf,",");
-        (void)strcat(mBuf,driver3->buffer);  // voltage
-        (void)strcat(mBuf,",");
-
-        // elapsed time
+        char *p = mBuf;
+        (void)strcpy(p, ID_VERSION_STR);  // deviceID and report version
+        p += strlen(p);
+        p = put_report(p, driver1);     // temperature, C
+        p = put_report(p, driver2);     // ambient light, lux
+        p = put_report(p, driver3);     // voltage, V
+
+        // elapsed time, seconds
         usec = system_get_time();
-        os_sprintf(timeBuf, "%d.%3d", usec/1000000, usec % 1000000);
-        (void)strcat(mBuf,timeBuf);  // Elapsed Time
+        p = put_value(p, usec, 6);
+
+        // estimated energy use
+        uint32 uah = energy_cycle_uah();
+        p = put_value(p, uah, 0);
+        p = put_value(p, energy_days_left(battery_mv(), uah), 0);
+
+        // wakes in a row that failed to report before this one
+        p = put_value(p, backoff_streak(), 0);
+
+        // RF calibration of this wake and the time it took to init
+        p = put_value(p, rfcal_mode(), 0);
+        p = put_value(p, rfcal_init_ms(), 0);
+
+        // when the sample was taken
+        *p++ = ',';
+        p += walltime_format(p);
 
 
         INFO("Used mBuf = %d\r\n", strlen(mBuf));
+
+#ifdef HEAPSTAT
+        // heap use of the previous wake
+        char *hBuf = (char*)os_zalloc(HEAPSTAT_BUF_SIZE);
+        if (heapstat_summary(hBuf, HEAPSTAT_BUF_SIZE) > 0) {
+            os_sprintf(tBuf, "%s/heap", sysCfg.device_id);
+            publish(tBuf, MQTTSN_TOPIC_HEAP, hBuf, os_strlen(hBuf), 0);
+        }
+        os_free(hBuf);
+#endif
+
+        // diagnostics after a reset, and once in a while
+        if (dump_due()) {
+            uint8 *dBuf = (uint8 *)os_zalloc(DUMP_RECORD_LEN);
+            os_sprintf(tBuf, "%s/diag", sysCfg.device_id);
+            publish(tBuf, MQTTSN_TOPIC_DIAG, (const char *)dBuf,
+                    dump_record(dBuf), 0);
+            os_free(dBuf);
+        }
+        // the sensors on the board, once found and when they change
+        if (warm_hw_due()) {
+            char *wBuf = (char *)os_zalloc(WARM_HW_BUF_SIZE);
+            os_sprintf(tBuf, "%s/hw", sysCfg.device_id);
+            publish(tBuf, MQTTSN_TOPIC_HW, wBuf, warm_hw_format(wBuf), 1);
+            INFO("%s:%s\r\n", tBuf, wBuf);
+            os_free(wBuf);
+        }
+#ifdef TLOG
+        // the log of a wake that reset or failed, see tlog.h
+        if (tlog_ring_due()) {
+            uint8 *lBuf = (uint8 *)os_zalloc(TLOG_RING_LEN);
+            os_sprintf(tBuf, "%s/log", sysCfg.device_id);
+            publish(tBuf, MQTTSN_TOPIC_LOG, (const char *)lBuf,
+                    tlog_ring_copy(lBuf), 0);
+            os_free(lBuf);
+        }
+#endif
+
         // publish the report
         os_sprintf(tBuf, "%s/report", sysCfg.device_id);
-        MQTT_Publish(&mqttClient, tBuf, mBuf, os_strlen(mBuf), 0, 1);
+        publish(tBuf, MQTTSN_TOPIC_REPORT, mBuf, os_strlen(mBuf), 1);
+#ifdef MQTTPIPE
+        mqttpipe_flush();
+#endif
         INFO("%s:%s\r\n", tBuf, mBuf);
         /*
         INFO("Got here\r\n");
         */
 
         // cleanup
-        os_free(timeBuf);
         os_free(mBuf);
         os_free(tBuf);
     }
@@ -351,30 +1014,62 @@ reporter(os_event_t *event) {
 void ICACHE_FLASH_ATTR
 user_init()
 {
+#ifdef TLOG
+    tlog_ring_init();
+#endif
+    bool warmBoot = warm_init();
+
     uart_init(BIT_RATE_115200);
+#ifndef BENCH
+    if (warmBoot) {
+        // start the conversions before the set-up below, see warm.h
+        init_drivers();
+    }
+#endif
+    energy_init();
+    backoff_init();
+    rfcal_init();
+    walltime_init();
+    schedule_init();
+    dump_init();
+#ifdef OTA
+    ota_init();
+#endif
+
+#ifdef BENCH
+    // microbenchmark build, no reports
+    bench_start();
+    return;
+#endif
 
     // Setup mqtt configuration, this is a local alternative
     // to the flash based CFG_load/save function in the MQTT library.
     initSysCfg();
-
-    INFO("%s\r\n", sysCfg.device_id);
-
-    // Initialize drivers
-    ds18B20_init(REPORTER_PID, DRIVER_1);
-    als_init(REPORTER_PID, DRIVER_2);
-    battery_init(REPORTER_PID, DRIVER_3);
+#ifndef MQTTSN
+    // replaces the host and port with the broker to try first
+    broker_init();
+#endif
+
+    if (!warmBoot) {
+        INFO("%s\r\n", sysCfg.device_id);
+        // Initialize drivers
+        init_drivers();
+    }
 
     // setup timers and processes
     os_timer_disarm(&shutdown_timer);
-    os_timer_setfn(&shutdown_timer, (os_timer_func_t *)user_deep_sleep, NULL);
+    os_timer_setfn(&shutdown_timer, (os_timer_func_t *)closeDeadlineCb, NULL);
 
 
-    // watchdog shutdown in 10 seconds (10000 milli-seconds)
+    // watchdog shutdown in 10 seconds, or 5 after a failed wake
     // This limits battery drain if the network or the MQTT server is
-    // not available.
+    // not available, see backoff.h.
     os_timer_disarm(&watchdog_timer);
+    // A mains powered node stays up and keeps trying, see mains.h.
     os_timer_setfn(&watchdog_timer, (os_timer_func_t *)user_deep_sleep, NULL);
-    os_timer_arm(&watchdog_timer, 10000, 0);
+#ifndef MAINS
+    os_timer_arm(&watchdog_timer, backoff_deadline_ms(), 0);
+#endif
 
     system_os_task(reporter, REPORTER_PID, reporter_queue, REPORTER_QLEN);
 
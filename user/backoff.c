@@ -0,0 +1,105 @@
+/*
+ *  backoff.c - sleep longer while the network is down
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <osapi.h>
+#include <os_type.h>
+#include <user_interface.h>
+//#define INFO os_printf  // override debug.h
+#include "debug.h"
+#include "rtcmem.h"
+
+#include "backoff.h"
+
+#define BACKOFF_MAGIC   0x424b4f31  // "BKO1"
+
+typedef struct {
+    uint32 magic;
+    uint32 streak;      // wakes in a row without a delivered report
+} backoff_rtc_t;
+
+// fails to compile if the record outgrows its RTC memory range
+typedef char backoff_rtc_fits[
+    (RTC_BLOCKS(sizeof(backoff_rtc_t)) <= RTC_BACKOFF_SIZE) ? 1 : -1];
+
+static backoff_rtc_t rtc;
+
+
+/*
+ * backoff_init - read the failure streak, call early in user_init()
+ */
+void ICACHE_FLASH_ATTR
+backoff_init(void)
+{
+    system_rtc_mem_read(RTC_BACKOFF_ADDR, &rtc, sizeof(rtc));
+    if (rtc.magic != BACKOFF_MAGIC) {
+        rtc.magic = BACKOFF_MAGIC;
+        rtc.streak = 0;
+    }
+    if (rtc.streak > 0) {
+        INFO("backoff: %d failed wakes\r\n", rtc.streak);
+    }
+} // end backoff_init()
+
+
+/*
+ * backoff_streak - failed wakes before this one, for the report
+ */
+uint8 ICACHE_FLASH_ATTR
+backoff_streak(void)
+{
+    return((rtc.streak > 255) ? 255 : rtc.streak);
+}
+
+
+/*
+ * backoff_deadline_ms - how long this wake may take to report
+ */
+uint32 ICACHE_FLASH_ATTR
+backoff_deadline_ms(void)
+{
+    return((rtc.streak > 0) ? BACKOFF_DEADLINE_MS : BACKOFF_NORMAL_MS);
+}
+
+
+/*
+ * backoff_sleep_s - record the outcome of this wake and return the
+ * deep sleep time that should follow it
+ */
+uint32 ICACHE_FLASH_ATTR
+backoff_sleep_s(uint32 normal_s, bool delivered)
+{
+    uint32 sleep_s = normal_s;
+    uint32 i;
+
+    if (delivered) {
+        rtc.streak = 0;
+    } else if (rtc.streak < 0xffff) {
+        rtc.streak++;
+    }
+    system_rtc_mem_write(RTC_BACKOFF_ADDR, &rtc, sizeof(rtc));
+
+    for (i = 0; (i < rtc.streak) && (sleep_s < BACKOFF_MAX_SLEEP_S); i++) {
+        sleep_s *= 2;
+    }
+    if (sleep_s > BACKOFF_MAX_SLEEP_S) {
+        sleep_s = BACKOFF_MAX_SLEEP_S;
+    }
+    return(sleep_s);
+} // end backoff_sleep_s()
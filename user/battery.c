@@ -30,7 +30,7 @@
 
 static uint32_t reportPID = 0;
 static uint32_t myid = 0;
-static report_t *myReport = NULL;
+static report_t myReport = { 0, 3, UNIT_VOLT, REPORT_OK };
 
 static uint32 voltageRaw = 0;
 
@@ -56,24 +56,31 @@ battery_start()
 } //end battery_start()
 
 
-report_t* ICACHE_FLASH_ATTR
+/*
+ * report the supply voltage in milli-volts
+ */
+const report_t* ICACHE_FLASH_ATTR
 battery_report(void)
 {
-    myReport = newReport(10);
-    os_sprintf(myReport->buffer, "%d.%03d",
-            voltageRaw / 1024,
-            (voltageRaw % 1024) * 1000 / 1024);
-    myReport->len = strlen(myReport->buffer);
-
-    return(myReport);
+    myReport.value = battery_mv();
+    return(&myReport);
 } // end of battery_report()
 
 
+/*
+ * battery voltage in milli-volts
+ */
+uint32_t ICACHE_FLASH_ATTR
+battery_mv(void)
+{
+    return(voltageRaw * 1000 / 1024);
+} // end of battery_mv()
+
+
 void ICACHE_FLASH_ATTR
 battery_shutdown(void)
 {
     INFO("battery_shutdown()\r\n");
-    freeReport(myReport);
     return;
 
 }  //end battery_shutdown()
@@ -0,0 +1,216 @@
+/*
+ *  bench.c - bus primitive microbenchmarks, see bench.h
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifdef BENCH
+#include <ets_sys.h>
+#include <osapi.h>
+#include <os_type.h>
+#include <user_interface.h>
+#include "driver/onewire.h"
+#include "driver/i2c.h"
+#include "driver/i2c_isl.h"
+#include "report.h"
+
+#include "bench.h"
+
+typedef struct {
+    const char *name;
+    void (*prep)(void);     // untimed, before each call, may be NULL
+    void (*run)(void);      // the timed call
+    void (*done)(void);     // untimed, after each call, may be NULL
+} bench_case_t;
+
+static os_timer_t benchTimer;
+static uint8 benchNext = 0;
+static char fmtBuf[32];
+
+
+static void ICACHE_FLASH_ATTR
+run_empty(void)
+{
+}
+
+static void ICACHE_FLASH_ATTR
+run_ds_reset(void)
+{
+    ds_reset();
+}
+
+static void ICACHE_FLASH_ATTR
+run_ds_write(void)
+{
+    ds_write(0xcc);     // Skip ROM, harmless on its own
+}
+
+static void ICACHE_FLASH_ATTR
+prep_ds_read(void)
+{
+    ds_reset();
+    ds_write(0xcc);     // Skip ROM
+    ds_write(0xbe);     // Read scratch pad
+}
+
+static void ICACHE_FLASH_ATTR
+run_ds_read(void)
+{
+    (void)ds_read();
+}
+
+static void ICACHE_FLASH_ATTR
+prep_i2c_read(void)
+{
+    i2c_start();
+    i2c_writeByte(ISL_READ_ADDR);
+    (void)i2c_check_ack();
+}
+
+static void ICACHE_FLASH_ATTR
+run_i2c_read(void)
+{
+    (void)i2c_readByte();
+}
+
+static void ICACHE_FLASH_ATTR
+done_i2c_read(void)
+{
+    i2c_send_ack(0);    // NACK ends the read
+    i2c_stop();
+}
+
+static void ICACHE_FLASH_ATTR
+run_isl_read_word(void)
+{
+    (void)isl_read_word(ISL_DATA_REG);
+}
+
+static void ICACHE_FLASH_ATTR
+run_vdd33(void)
+{
+    (void)system_get_vdd33();
+}
+
+static void ICACHE_FLASH_ATTR
+run_os_sprintf(void)
+{
+    // a report field the way it was formatted before report_decimal()
+    os_sprintf(fmtBuf, "%d.%03d", 21, 562);
+}
+
+static void ICACHE_FLASH_ATTR
+run_report_decimal(void)
+{
+    (void)report_decimal(fmtBuf, 21562, 3);
+}
+
+static const bench_case_t cases[] = {
+    { "empty",          NULL,           run_empty,          NULL },
+    { "ds_reset",       NULL,           run_ds_reset,       NULL },
+    { "ds_write",       NULL,           run_ds_write,       NULL },
+    { "ds_read",        prep_ds_read,   run_ds_read,        NULL },
+    { "i2c_readByte",   prep_i2c_read,  run_i2c_read,       done_i2c_read },
+    { "isl_read_word",  NULL,           run_isl_read_word,  NULL },
+    { "system_get_vdd33", NULL,         run_vdd33,          NULL },
+    { "os_sprintf",     NULL,           run_os_sprintf,     NULL },
+    { "report_decimal", NULL,           run_report_decimal, NULL },
+};
+#define NCASES (sizeof(cases) / sizeof(cases[0]))
+
+
+/*
+ * bench_one - time BENCH_RUNS calls of one primitive and print them
+ */
+static void ICACHE_FLASH_ATTR
+bench_one(const bench_case_t *c)
+{
+    uint32 cycles[BENCH_RUNS];
+    uint32 start;
+    uint32 t;
+    uint8 i;
+    uint8 j;
+
+    for (i = 0; i <= BENCH_RUNS; i++) {
+        if (c->prep != NULL) {
+            c->prep();
+        }
+        start = bench_ccount();
+        c->run();
+        t = bench_ccount() - start;
+        if (c->done != NULL) {
+            c->done();
+        }
+
+        // the first call loads the code into the flash cache
+        if (i == 0) {
+            continue;
+        }
+        // insertion sort, for the median
+        for (j = i - 1; (j > 0) && (cycles[j - 1] > t); j--) {
+            cycles[j] = cycles[j - 1];
+        }
+        cycles[j] = t;
+    }
+
+    os_printf("bench name=%s runs=%d mhz=%d min=%u med=%u max=%u\r\n",
+            c->name, BENCH_RUNS, system_get_cpu_freq(),
+            cycles[0], cycles[BENCH_RUNS / 2], cycles[BENCH_RUNS - 1]);
+} // end bench_one()
+
+
+/*
+ * bench_next - one primitive per timer tick, so the SDK gets to run
+ * and feed its watchdog in between
+ */
+static void ICACHE_FLASH_ATTR
+bench_next(void *arg)
+{
+    if (benchNext >= NCASES) {
+        os_printf("bench done\r\n");
+        return;
+    }
+    bench_one(&cases[benchNext++]);
+    os_timer_arm(&benchTimer, BENCH_GAP_MS, 0);
+} // end bench_next()
+
+
+static void ICACHE_FLASH_ATTR
+bench_init_done(void)
+{
+    os_printf("bench start sdk=%s\r\n", system_get_sdk_version());
+    os_timer_disarm(&benchTimer);
+    os_timer_setfn(&benchTimer, (os_timer_func_t *)bench_next, NULL);
+    os_timer_arm(&benchTimer, BENCH_GAP_MS, 0);
+} // end bench_init_done()
+
+
+/*
+ * bench_start - run the suite instead of the application
+ *
+ * Called from user_init(). The radio is never started, so
+ * system_get_vdd33() reads the supply as it does before association.
+ */
+void ICACHE_FLASH_ATTR
+bench_start(void)
+{
+    ds_init(ONEWIRE_PARASITIC_PWR);
+    i2c_init();
+    system_init_done_cb(bench_init_done);
+} // end bench_start()
+
+#endif // BENCH
@@ -0,0 +1,378 @@
+/*
+ *  broker.c - MQTT broker failover and DNS cache, see broker.h
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef MQTTSN
+#include <ets_sys.h>
+#include <osapi.h>
+#include <os_type.h>
+#include <mem.h>
+#include <user_interface.h>
+#include <espconn.h>
+//#define INFO os_printf  // override debug.h
+#include "debug.h"
+#include "config.h"
+#include "rtcmem.h"
+#include "walltime.h"
+
+#include "broker.h"
+
+#define BROKER_MAGIC    0x42524b32  // "BRK2"
+#define NO_BROKER       0xff
+
+typedef struct {
+    uint32 ip;          // 0 = never looked up
+    uint32 expires_s;   // on the walltime.h clock
+} broker_dns_t;
+
+typedef struct {
+    uint32 magic;
+    uint32 list;        // hash of MQTT_BROKERS, a new list starts over
+    uint8  good;        // the broker that last took a connection
+    uint8  pad[3];
+    broker_dns_t dns[BROKER_MAX];
+} broker_rtc_t;
+
+// fails to compile if the record outgrows its RTC memory range
+typedef char broker_rtc_fits[
+    (RTC_BLOCKS(sizeof(broker_rtc_t)) <= RTC_BROKER_SIZE) ? 1 : -1];
+
+static const char *brokers[] = { MQTT_BROKERS };
+#define NBROKERS    (sizeof(brokers) / sizeof(brokers[0]))
+
+// fails to compile if MQTT_BROKERS lists too many brokers
+typedef char broker_list_fits[(NBROKERS <= BROKER_MAX) ? 1 : -1];
+
+static broker_rtc_t rtc;
+static uint8 current = 0;       // index into brokers[]
+static uint8 tried = 0;         // brokers tried in this pass
+static uint8 passes = 0;        // times through the whole list
+static char name[sizeof(sysCfg.mqtt_host)];
+static bool lookup = false;     // name must be looked up
+static broker_cb_t connectCb = NULL;
+static broker_cb_t giveUpCb = NULL;
+static os_timer_t deadlineTimer;
+static os_timer_t lookupTimer;
+static struct espconn dnsConn;
+static ip_addr_t dnsAddr;
+static uint8 dnsBroker = NO_BROKER;
+
+static void next_broker(void);
+
+
+static uint32 ICACHE_FLASH_ATTR
+list_hash(void)
+{
+    uint32 hash = 2166136261UL;     // FNV-1a
+    const char *p;
+    uint8 i;
+
+    for (i = 0; i < NBROKERS; i++) {
+        for (p = brokers[i]; ; p++) {
+            hash = (hash ^ (uint8)*p) * 16777619UL;
+            if (*p == '\0') {
+                break;
+            }
+        }
+    }
+    return(hash);
+}
+
+
+/*
+ * A cached address is good until it expires. The clock steps at a
+ * time sync and starts over after some resets, so an expiry further
+ * off than the TTL is out of date too.
+ */
+static bool ICACHE_FLASH_ATTR
+dns_fresh(const broker_dns_t *dns)
+{
+    uint32 left = dns->expires_s - (uint32)(walltime_clock_us() / 1000000);
+
+    return((dns->ip != 0) && ((sint32)left > 0) && (left <= BROKER_DNS_TTL_S));
+}
+
+
+static void ICACHE_FLASH_ATTR
+put_ip(uint32 ip)
+{
+    os_sprintf(sysCfg.mqtt_host, "%d.%d.%d.%d", ip & 0xff,
+            (ip >> 8) & 0xff, (ip >> 16) & 0xff, ip >> 24);
+}
+
+
+/*
+ * pick - make the broker tried k-th this pass the current one
+ *
+ * The last good broker comes first, then the rest in list order.
+ * Fills in sysCfg.mqtt_host with its address if one is known, and its
+ * name if not.
+ */
+static void ICACHE_FLASH_ATTR
+pick(uint8 k)
+{
+    const char *b;
+    broker_dns_t *dns;
+    uint32 ip;
+    uint8 n = 0;
+
+    if (k == 0) {
+        current = rtc.good;
+    } else {
+        current = ((k - 1) < rtc.good) ? (k - 1) : k;
+    }
+    dns = &rtc.dns[current];
+
+    // host[:port]
+    b = brokers[current];
+    while ((b[n] != '\0') && (b[n] != ':') && (n < sizeof(name) - 1)) {
+        name[n] = b[n];
+        n++;
+    }
+    name[n] = '\0';
+    sysCfg.mqtt_port = MQTT_PORT;
+    if (b[n] == ':') {
+        sysCfg.mqtt_port = 0;
+        for (n++; (b[n] >= '0') && (b[n] <= '9'); n++) {
+            sysCfg.mqtt_port = sysCfg.mqtt_port * 10 + (b[n] - '0');
+        }
+    }
+
+    lookup = false;
+    ip = ipaddr_addr(name);
+    if (ip != 0xffffffff) {
+        put_ip(ip);
+    } else if (dns_fresh(dns)) {
+        put_ip(dns->ip);
+    } else {
+        os_strcpy(sysCfg.mqtt_host, name);
+        lookup = true;
+    }
+} // end pick()
+
+
+static void ICACHE_FLASH_ATTR
+deadline_cb(void *arg)
+{
+    INFO("broker: %s not connected in time\r\n", sysCfg.mqtt_host);
+    if (giveUpCb != NULL) {
+        giveUpCb();
+    }
+    next_broker();
+}
+
+
+static void ICACHE_FLASH_ATTR
+dns_found(const char *host, ip_addr_t *addr, void *arg)
+{
+    uint8 b = dnsBroker;
+    broker_dns_t *dns;
+
+    dnsBroker = NO_BROKER;
+    if (b >= NBROKERS) {
+        return;
+    }
+    dns = &rtc.dns[b];
+    if ((addr != NULL) && (addr->addr != 0)) {
+        dns->ip = addr->addr;
+        dns->expires_s = (uint32)(walltime_clock_us() / 1000000)
+            + BROKER_DNS_TTL_S;
+    }
+    if (b != current) {
+        // gave up waiting, the address is kept for next time; the
+        // current broker's lookup waited for this one
+        if (lookup) {
+            os_timer_arm(&lookupTimer, 1, 0);
+        }
+        return;
+    }
+
+    if (dns->ip == 0) {
+        INFO("broker: no address for %s\r\n", name);
+        os_timer_disarm(&deadlineTimer);
+        next_broker();
+        return;
+    }
+    // an expired address beats none when the lookup fails
+    put_ip(dns->ip);
+    INFO("broker: %s is %s\r\n", name, sysCfg.mqtt_host);
+    connectCb();
+} // end dns_found()
+
+
+/*
+ * lookup_start - look up the current broker
+ *
+ * One lookup at a time. If an earlier one is still out, dns_found()
+ * starts this one when it comes back.
+ */
+static void ICACHE_FLASH_ATTR
+lookup_start(void)
+{
+    if (!lookup || (dnsBroker != NO_BROKER)) {
+        return;
+    }
+    dnsBroker = current;
+    os_memset(&dnsConn, 0, sizeof(dnsConn));
+    switch (espconn_gethostbyname(&dnsConn, name, &dnsAddr, dns_found)) {
+        case ESPCONN_OK:
+            dns_found(name, &dnsAddr, &dnsConn);
+            break;
+        case ESPCONN_INPROGRESS:
+            break;
+        default:
+            dns_found(name, NULL, &dnsConn);
+            break;
+    }
+} // end lookup_start()
+
+
+/*
+ * start - connect to the current broker, looking it up first if needed
+ */
+static void ICACHE_FLASH_ATTR
+start(void)
+{
+    uint32 ms = sysCfg.security ? BROKER_TLS_CONNECT_MS : BROKER_CONNECT_MS;
+
+    // with one broker there is nothing to fail over to
+    if (NBROKERS > 1) {
+        os_timer_arm(&deadlineTimer, ms << passes, 0);
+    }
+
+    if (!lookup) {
+        connectCb();
+        return;
+    }
+    lookup_start();
+} // end start()
+
+
+static void ICACHE_FLASH_ATTR
+next_broker(void)
+{
+    if (++tried >= NBROKERS) {
+        // round again, with more time for each
+        tried = 0;
+        if (passes < 3) {
+            passes++;
+        }
+    }
+    pick(tried);
+    start();
+}
+
+
+/*
+ * broker_init - read the RTC record and pick the first broker
+ *
+ * Call from user_init() after sysCfg is set up.
+ */
+void ICACHE_FLASH_ATTR
+broker_init(void)
+{
+    uint32 hash = list_hash();
+
+    system_rtc_mem_read(RTC_BROKER_ADDR, &rtc, sizeof(rtc));
+    if ((rtc.magic != BROKER_MAGIC) || (rtc.list != hash)
+            || (rtc.good >= NBROKERS)) {
+        os_memset(&rtc, 0, sizeof(rtc));
+        rtc.magic = BROKER_MAGIC;
+        rtc.list = hash;
+    }
+    os_timer_disarm(&deadlineTimer);
+    os_timer_setfn(&deadlineTimer, (os_timer_func_t *)deadline_cb, NULL);
+    os_timer_disarm(&lookupTimer);
+    os_timer_setfn(&lookupTimer, (os_timer_func_t *)lookup_start, NULL);
+    tried = 0;
+    passes = 0;
+    pick(0);
+    INFO("broker: %s port %d\r\n", sysCfg.mqtt_host, sysCfg.mqtt_port);
+} // end broker_init()
+
+
+/*
+ * broker_attach - have esp_mqtt use sysCfg.mqtt_host
+ *
+ * MQTT_InitConnection() keeps its own copy of the host, which would
+ * not follow a failover. Call right after it.
+ */
+void ICACHE_FLASH_ATTR
+broker_attach(MQTT_Client *client)
+{
+    if ((uint8_t *)client->host != (uint8_t *)sysCfg.mqtt_host) {
+        os_free(client->host);
+        client->host = (uint8_t *)sysCfg.mqtt_host;
+    }
+}
+
+
+/*
+ * broker_connect - start on the current broker
+ *
+ * connect is called with the broker in sysCfg, each time a broker is
+ * tried. give_up is called before moving on to the next one, and
+ * should drop the connection that was started.
+ */
+void ICACHE_FLASH_ATTR
+broker_connect(broker_cb_t connect, broker_cb_t give_up)
+{
+    connectCb = connect;
+    giveUpCb = give_up;
+    start();
+}
+
+
+/*
+ * broker_connected - the current broker took the connection
+ */
+void ICACHE_FLASH_ATTR
+broker_connected(void)
+{
+    os_timer_disarm(&deadlineTimer);
+    if (rtc.good != current) {
+        INFO("broker: now using %s\r\n", brokers[current]);
+        rtc.good = current;
+    }
+}
+
+
+/*
+ * broker_stop - the network is gone, stop failing over
+ */
+void ICACHE_FLASH_ATTR
+broker_stop(void)
+{
+    os_timer_disarm(&deadlineTimer);
+    os_timer_disarm(&lookupTimer);
+}
+
+
+/*
+ * broker_sleep - save the record, call before deep sleep
+ */
+void ICACHE_FLASH_ATTR
+broker_sleep(void)
+{
+    os_timer_disarm(&deadlineTimer);
+    os_timer_disarm(&lookupTimer);
+    system_rtc_mem_write(RTC_BROKER_ADDR, &rtc, sizeof(rtc));
+}
+
+#endif // MQTTSN
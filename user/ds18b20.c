@@ -30,59 +30,127 @@
 #include "debug.h"
 #include "driver/onewire.h"
 #include "report.h"
+#include "energy.h"
+#include "warm.h"
 
 #include "ds18b20.h"
 
 extern MQTT_Client mqttClient;
 
 #define MEASUREMENT_US 750000    // max time from datasheet for 12 bits
+#define CONVERSION_UA  1500      // max active current from datasheet
 
 static os_timer_t read_timer;
 static uint32 measurement_start_time;
 
 static uint32_t reportPID = 0;
 static uint32_t myid = 0;
-static report_t *myReport = NULL;
+static report_t myReport = { 0, 3, UNIT_CELSIUS, REPORT_NOT_READY };
+static bool present = false;    // a probe answered the reset, see warm.h
+static bool prearmed = false;   // read in ds18B20_init(), see ds18b20.h
+
 
 /*
- * report ds18b20 reading
- *
+ * read_scratchpad - read the temperature into the report, and TH and TL
  */
-report_t* ICACHE_FLASH_ATTR
-ds18B20_report(void)
+static void ICACHE_FLASH_ATTR
+read_scratchpad(uint8 *th, uint8 *tl)
 {
     uint16_t tb;
     int16_t  temperature;
-    int16_t mantissa;
-
-    myReport = newReport(10);
+    uint8_t  config;
 
-    // Read measurement
     ds_reset();
     ds_write(0xcc);   // Skip ROM (address all devices)
     ds_write(0xbe);   // CMD = Read scratch pad
 
     tb = (uint16_t)ds_read();
     temperature = (int16_t)(tb + ((uint16_t)ds_read() * 256));
-    mantissa = temperature % 16;
-    temperature /= 16;   // Scale to degC
-    if ((temperature == 0) && (mantissa < 0))
-    {
-        os_sprintf(myReport->buffer, "-%d.%03d",
-                temperature, abs((mantissa * 625)/10));
+    *th = ds_read();
+    *tl = ds_read();
+    config = ds_read();
+
+    // 1/16 degC per bit. Bit 7 of the configuration register always
+    // reads 0, an empty bus reads all ones.
+    myReport.value = (sint32)temperature * 125 / 2;
+    myReport.status = (config & 0x80) ? REPORT_NO_SENSOR : REPORT_OK;
+} // end read_scratchpad()
+
+
+#ifdef DS18B20_WIRED
+/*
+ * read_prearmed - TRUE if the conversion started before deep sleep was
+ * read into the report
+ */
+static bool ICACHE_FLASH_ATTR
+read_prearmed(void)
+{
+    uint8 tag = warm_ds_tag();
+    uint8 th;
+    uint8 tl;
+
+    // good for the first reading of the wake only
+    warm_ds_disarm();
+    if (tag == WARM_NO_TAG) {
+        return(FALSE);
     }
-    else
-    {
-        os_sprintf(myReport->buffer, "%d.%03d",
-                temperature, abs((mantissa * 625)/10));
+    read_scratchpad(&th, &tl);
+    if ((myReport.status != REPORT_OK) || (th != tag)
+            || (tl != (uint8)~tag)) {
+        INFO("pre-armed conversion lost, TH %x TL %x\r\n", th, tl);
+        myReport.status = REPORT_NOT_READY;
+        // ready for the conversion command
+        ds_reset();
+        return(FALSE);
     }
-    myReport->len = strlen(myReport->buffer);
+    return(TRUE);
+} // end read_prearmed()
+#endif
+
+
+/*
+ * report ds18b20 reading in milli-degC
+ *
+ */
+const report_t* ICACHE_FLASH_ATTR
+ds18B20_report(void)
+{
+    uint8 th;
+    uint8 tl;
+
+    if (!present) {
+        myReport.status = REPORT_NO_SENSOR;
+        return(&myReport);
+    }
+    if (prearmed) {
+        // read in ds18B20_init()
+        return(&myReport);
+    }
+
+    // The conversion ends by MEASUREMENT_US at the latest
+    uint32 elapsed_us = system_get_time() - measurement_start_time;
+    energy_sensor((elapsed_us < MEASUREMENT_US) ? elapsed_us : MEASUREMENT_US,
+            CONVERSION_UA);
 
-    return(myReport);
+    read_scratchpad(&th, &tl);
+    return(&myReport);
 
 } //end ds18B20_report(void)
 
 
+/*
+ * ds18B20_temp_mc - the reading in milli-degC
+ *
+ * Returns FALSE if ds18B20_report() has not read one this wake.
+ */
+bool ICACHE_FLASH_ATTR
+ds18B20_temp_mc(sint32 *mc)
+{
+    *mc = myReport.value;
+    return(myReport.status == REPORT_OK);
+}
+
+
 /*
  * ds18B20_init- tell DS18B20 to start measurement
  *
@@ -96,17 +164,32 @@ ds18B20_init(uint32_t pid, uint32_t id)
     myid = id;
 
     INFO("ds18B20_init()\r\n");
+#ifdef DS18B20_WIRED
+    ds_init(ONEWIRE_WIRED_PWR);
+#else
     // I thought the board was designed for WIRED power, but there is a
     // design error on the board or in the onewire code. 2015/08/18
     // 2015/09/05 - looks like I might have ordered parasitic part.
-    //ds_init(ONEWIRE_WIRED_PWR);
     ds_init(ONEWIRE_PARASITIC_PWR);
+#endif
 
-    // Start temperature measurement
+    // Start temperature measurement, unless the probe is known to be
+    // missing
     // TODO: be specific about the number of bits for the measurment
-    ds_reset();
-    ds_write(0xcc);   // Skip ROM (address all devices)
-    ds_write(0x44);   // CMD = Start conversion
+    present = !warm_hw_known(WARM_HW_DS18B20)
+        || warm_hw_present(WARM_HW_DS18B20);
+    if (present) {
+        present = ds_reset();
+        warm_hw_found(WARM_HW_DS18B20, present);
+    }
+    prearmed = false;
+#ifdef DS18B20_WIRED
+    prearmed = present && read_prearmed();
+#endif
+    if (present && !prearmed) {
+        ds_write(0xcc);   // Skip ROM (address all devices)
+        ds_write(0x44);   // CMD = Start conversion
+    }
     measurement_start_time = system_get_time();
 
     // Setup up the timer, but don't start it
@@ -131,9 +214,10 @@ ds18B20_start()
     // No need to worry about overflow or 32-bit wrap because
     // system_get_time() always starts from zero.
     uint32 elapsed_us = system_get_time() - measurement_start_time;
-    if (elapsed_us < MEASUREMENT_US) {
+    if (present && !prearmed && (elapsed_us < MEASUREMENT_US)) {
         INFO("Delaying %d us\r\n", MEASUREMENT_US - elapsed_us);
-        os_timer_arm(&read_timer, (MEASUREMENT_US - elapsed_us) / 1000 , 0);
+        // round up, a 0 ms timer would come straight back here
+        os_timer_arm(&read_timer, (MEASUREMENT_US - elapsed_us + 999) / 1000 , 0);
     }
     else
     {
@@ -149,10 +233,47 @@ ds18B20_shutdown(void)
 {
     INFO("ds18B20_is_shutdown()\r\n");
     // make sure we are not sinking or sourcing power to parasitic
-    // one-wire devices (the DS18B20 in this case).
+    // one-wire devices (the DS18B20 in this case). A wired probe is left
+    // its pull-up, a low bus would be a reset.
     GPIO_DIS_OUTPUT(ONEWIRE_PIN);
+#ifndef DS18B20_WIRED
     GPIO_OUTPUT_SET(ONEWIRE_PIN, 0);
-    freeReport(myReport);
+#endif
 
     return;
 }  //end ds18B20_shutdown()
+
+
+/*
+ * ds18B20_sleep - start the conversion for the next wake, call before
+ * deep sleep with its length
+ *
+ * Only DS18B20_WIRED builds do, see ds18b20.h.
+ */
+void ICACHE_FLASH_ATTR
+ds18B20_sleep(uint32 sleepUs)
+{
+#ifdef DS18B20_WIRED
+    uint8 tag;
+
+    if (!present || (sleepUs < MEASUREMENT_US)
+            || (sleepUs / 1000000 > DS18B20_FRESH_S)) {
+        return;
+    }
+    tag = warm_ds_arm();
+    INFO("ds18B20_sleep() tag %d\r\n", tag);
+
+    ds_reset();
+    ds_write(0xcc);   // Skip ROM (address all devices)
+    ds_write(0x4e);   // CMD = Write scratch pad
+    ds_write(tag);                  // TH
+    ds_write((uint8)~tag);          // TL
+    ds_write(0x7f);                 // configuration, 12 bits
+    ds_reset();
+    ds_write(0xcc);
+    ds_write(0x44);   // CMD = Start conversion
+
+    // the whole conversion, charged to this wake
+    energy_sensor(MEASUREMENT_US, CONVERSION_UA);
+#endif
+} // end ds18B20_sleep()
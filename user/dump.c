@@ -1,112 +1,187 @@
 /*
- * dump.c - dump interesting system information
+ *  dump.c - binary diagnostics record, see dump.h
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
  *
  */
 #include <ets_sys.h>
-#include <driver/uart.h>
 #include <osapi.h>
 #include <os_type.h>
-#include "user_interface.h"
+#include <user_interface.h>
+#include <spi_flash.h>
+//#define INFO os_printf  // override debug.h
+#include "debug.h"
+#include "rtcmem.h"
+#include "battery.h"
+
+#include "dump.h"
+
+#define DUMP_MAGIC      0x444d5031  // "DMP1"
+#define NO_RESET        0xff        // no record owed for a reset
+#define SDK_VERSION_LEN 10
+
+typedef struct {
+    uint32 magic;
+    uint16 wakes;       // since the last record delivered
+    uint8 reason;       // reset a record is owed for, or NO_RESET
+    uint8 exccause;
+    uint32 epc1;        // and its exception registers
+    uint32 epc2;
+    uint32 epc3;
+    uint32 excvaddr;
+    uint32 depc;
+} dump_rtc_t;
+
+// fails to compile if the record outgrows its RTC memory range
+typedef char dump_rtc_fits[
+    (RTC_BLOCKS(sizeof(dump_rtc_t)) <= RTC_DUMP_SIZE) ? 1 : -1];
 
-// Enable debugging messages
-#ifndef INFO
-#define INFO os_printf
-#endif
+static dump_rtc_t rtc;
+static bool sent = false;       // a record went out this wake
 
+
+static uint8 * ICACHE_FLASH_ATTR
+put16(uint8 *p, uint16 v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    return(p + 2);
+}
+
+static uint8 * ICACHE_FLASH_ATTR
+put32(uint8 *p, uint32 v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+    return(p + 4);
+}
+
+
+/*
+ * dump_init - note the reset, call early in user_init()
+ */
 void ICACHE_FLASH_ATTR
-dumpInfo(void) {
-    uint32 voltageRaw = system_get_vdd33();
-    uint32 ticks;
-    enum flash_size_map fmap;
-    enum rst_reason reason;
-    struct rst_info *rstInfo;
-
-    os_printf("\r\n");
-    os_printf("SDK version : %s\r\n", system_get_sdk_version());
-    os_printf("Chip ID : %x\r\n", system_get_chip_id());
-    os_printf("Voltage : %d.%03d (%d)\r\n",
-            voltageRaw / 1024,
-            (voltageRaw % 1024) * 1000 / 1024,
-            voltageRaw);
-    os_printf("meminfo :\r\n");
-    system_print_meminfo();
-    os_printf("\r\n");
-    os_printf("Free Heap : %x (%d)\r\n",
-            system_get_free_heap_size(),
-            system_get_free_heap_size());
-
-    os_printf("Time(us) : %d\r\n", system_get_time());
-    os_printf("RTC us/tic : %d\r\n", system_rtc_clock_cali_proc());
-    ticks = system_get_rtc_time();
-    os_printf("RTC ticks : %d\r\n", ticks);
-    // TODO: Calculate rtc in us
-    os_printf("Boot Version : %d\r\n", system_get_boot_version());
-    os_printf("Userbin Addr : %x\r\n", system_get_userbin_addr());
-    os_printf("Boot Mode : %d\r\n", system_get_boot_mode());
-    os_printf("CPU Freq : %d \r\n", system_get_cpu_freq());
-    fmap = system_get_flash_size_map();
-    os_printf("Flash size-map : %d ", fmap);
-    switch (fmap) {
-        case FLASH_SIZE_4M_MAP_256_256:
-            os_printf("(4M MAP 256 256)");
-            break;
-        case FLASH_SIZE_2M:
-            os_printf("(2M)");
-            break;
-        case FLASH_SIZE_8M_MAP_512_512:
-            os_printf("(8M MAP 512 512)");
-            break;
-        case FLASH_SIZE_16M_MAP_512_512:
-            os_printf("(16M MAP 512 512)");
-            break;
-        case FLASH_SIZE_32M_MAP_512_512:
-            os_printf("(32M MAP 512 512)");
-            break;
-        case FLASH_SIZE_16M_MAP_1024_1024:
-            os_printf("(16M MAP 1024 1024)");
-            break;
-        case FLASH_SIZE_32M_MAP_1024_1024:
-            os_printf("(32M MAP 1024 1024)");
-            break;
-        default:
-            os_printf("(Unknown)");
-            break;
+dump_init(void)
+{
+    struct rst_info *rst = system_get_rst_info();
+
+    system_rtc_mem_read(RTC_DUMP_ADDR, &rtc, sizeof(rtc));
+    if (rtc.magic != DUMP_MAGIC) {
+        rtc.magic = DUMP_MAGIC;
+        rtc.wakes = 0;
+        rtc.reason = NO_RESET;
     }
-    os_printf("\r\n");
-
-    rstInfo = system_get_rst_info();
-    os_printf("Reset Reason : ");
-    switch ((enum rst_reason)rstInfo->reason) {
-        case REASON_DEFAULT_RST:
-            os_printf("Normal startup");
-            break;
-        case REASON_WDT_RST:
-            os_printf("HW watchdog reset");
-            break;
-        case REASON_EXCEPTION_RST:
-            os_printf("Exception reset");
-            break;
-        case REASON_SOFT_WDT_RST:
-            os_printf("SW watchdog reset");
-            break;
-        case REASON_SOFT_RESTART:
-            os_printf("Soft restart");
-            break;
-        case REASON_DEEP_SLEEP_AWAKE:
-            os_printf("Deep Sleep wake up");
-            break;
-        case REASON_EXT_SYS_RST:
-            os_printf("External reset");
-            break;
-        default:
-            os_printf("(Unknown)");
-            break;
+    if (rst->reason != REASON_DEEP_SLEEP_AWAKE) {
+        rtc.reason = rst->reason;
+        rtc.exccause = rst->exccause;
+        rtc.epc1 = rst->epc1;
+        rtc.epc2 = rst->epc2;
+        rtc.epc3 = rst->epc3;
+        rtc.excvaddr = rst->excvaddr;
+        rtc.depc = rst->depc;
     }
-    os_printf("\r\n");
+} // end dump_init()
 
-    os_printf("SPI Flash ID : %x \r\n", spi_flash_get_id());
 
-} // end of dumpInfo()
+/*
+ * dump_due - TRUE if this wake should send a record
+ */
+bool ICACHE_FLASH_ATTR
+dump_due(void)
+{
+    return((rtc.reason != NO_RESET) || (rtc.wakes >= DUMP_WAKES));
+}
 
 
+/*
+ * dump_record - write the record to buf, DUMP_RECORD_LEN bytes
+ *
+ * Returns the length written.
+ */
+uint8 ICACHE_FLASH_ATTR
+dump_record(uint8 *buf)
+{
+    struct rst_info *rst = system_get_rst_info();
+    const char *sdk = system_get_sdk_version();
+    // owed for a reset before this wake
+    bool retry = (rtc.reason != NO_RESET)
+        && (rst->reason == REASON_DEEP_SLEEP_AWAKE);
+    uint8 *p = buf;
+    uint8 i;
+
+    *p++ = DUMP_VERSION;
+    *p++ = retry ? DUMP_RETRY : 0;
+    if (rtc.reason != NO_RESET) {
+        *p++ = rtc.reason;
+        *p++ = rtc.exccause;
+        p = put32(p, rtc.epc1);
+        p = put32(p, rtc.epc2);
+        p = put32(p, rtc.epc3);
+        p = put32(p, rtc.excvaddr);
+        p = put32(p, rtc.depc);
+    } else {
+        *p++ = rst->reason;
+        *p++ = rst->exccause;
+        p = put32(p, 0);
+        p = put32(p, 0);
+        p = put32(p, 0);
+        p = put32(p, 0);
+        p = put32(p, 0);
+    }
+    p = put32(p, spi_flash_get_id());
+    p = put32(p, system_get_userbin_addr());
+    p = put32(p, system_rtc_clock_cali_proc());
+    p = put32(p, system_get_rtc_time());
+    p = put32(p, system_get_time());
+    p = put16(p, system_get_free_heap_size());
+    p = put16(p, battery_mv());
+    p = put16(p, rtc.wakes);
+    *p++ = system_get_cpu_freq();
+    *p++ = system_get_flash_size_map();
+    *p++ = system_get_boot_version();
+    *p++ = system_get_boot_mode();
+    for (i = 0; i < SDK_VERSION_LEN; i++) {
+        *p++ = *sdk;
+        if (*sdk != '\0') {
+            sdk++;
+        }
+    }
 
+    sent = true;
+    return(p - buf);
+} // end dump_record()
+
+
+/*
+ * dump_sleep - count the wake, call before deep sleep
+ *
+ * delivered is TRUE if everything this wake published reached the
+ * broker.
+ */
+void ICACHE_FLASH_ATTR
+dump_sleep(bool delivered)
+{
+    if (sent && delivered) {
+        rtc.wakes = 0;
+        rtc.reason = NO_RESET;
+    } else if (rtc.wakes < 0xffff) {
+        rtc.wakes++;
+    }
+    system_rtc_mem_write(RTC_DUMP_ADDR, &rtc, sizeof(rtc));
+} // end dump_sleep()
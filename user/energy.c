@@ -0,0 +1,183 @@
+/*
+ *  energy.c - estimate the charge used by each wake cycle
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <osapi.h>
+#include <os_type.h>
+#include <user_interface.h>
+//#define INFO os_printf  // override debug.h
+#include "debug.h"
+#include "rtcmem.h"
+
+#include "energy.h"
+
+#define ENERGY_MAGIC    0x454e5231  // "ENR1"
+#define MS_PER_HOUR     3600000
+#define SEC_PER_DAY     86400
+
+/*
+ * Totals for a complete cycle (awake plus the following deep sleep),
+ * kept in RTC memory so the next wake can report them.
+ */
+typedef struct {
+    uint32 magic;
+    uint32 awake_ms;
+    uint32 sleep_ms;
+    uint32 nah;         // charge used in nAh
+} energy_rtc_t;
+
+// fails to compile if the record outgrows its RTC memory range
+typedef char energy_rtc_fits[
+    (RTC_BLOCKS(sizeof(energy_rtc_t)) <= RTC_ENERGY_SIZE) ? 1 : -1];
+
+static energy_state_t state = ENERGY_CPU;
+static uint32 stateStart = 0;
+static uint32 stateUs[ENERGY_STATES];
+static uint32 sensorUaMs = 0;   // sensor charge, uA * ms
+static energy_rtc_t lastCycle;
+
+static const uint32 stateUa[ENERGY_STATES] = {
+    ENERGY_CPU_UA,
+    ENERGY_ASSOC_UA,
+    ENERGY_RADIO_UA,
+};
+
+
+/*
+ * energy_init - call first thing in user_init()
+ *
+ * system_get_time() starts at zero on each wake, so the time before
+ * user_init() is counted as ENERGY_CPU.
+ */
+void ICACHE_FLASH_ATTR
+energy_init(void)
+{
+    os_memset(stateUs, 0, sizeof(stateUs));
+    state = ENERGY_CPU;
+    stateStart = 0;
+    sensorUaMs = 0;
+
+    system_rtc_mem_read(RTC_ENERGY_ADDR, &lastCycle, sizeof(lastCycle));
+    if (lastCycle.magic != ENERGY_MAGIC) {
+        lastCycle.nah = 0;
+    }
+} // end energy_init()
+
+
+void ICACHE_FLASH_ATTR
+energy_state(energy_state_t newState)
+{
+    uint32 now = system_get_time();
+
+    stateUs[state] += now - stateStart;
+    stateStart = now;
+    state = newState;
+} // end energy_state()
+
+
+/*
+ * energy_sensor - add the charge of a sensor conversion that ran for
+ * usec at ua micro-amps.
+ */
+void ICACHE_FLASH_ATTR
+energy_sensor(uint32 usec, uint32 ua)
+{
+    sensorUaMs += (usec / 1000) * ua;
+} // end energy_sensor()
+
+
+/*
+ * energy_sleep - close out this wake and save the cycle totals
+ *
+ * Called from user_deep_sleep() with the sleep time about to be
+ * requested.
+ */
+void ICACHE_FLASH_ATTR
+energy_sleep(uint32 sleep_us)
+{
+    energy_rtc_t rec;
+    uint32 nah = 0;
+    uint8 i;
+
+    energy_state(state);
+
+    rec.magic = ENERGY_MAGIC;
+    rec.awake_ms = 0;
+    for (i = 0; i < ENERGY_STATES; i++) {
+        uint32 ms = stateUs[i] / 1000;
+        rec.awake_ms += ms;
+        // uA * ms / 3600 = nAh, split to stay inside 32 bits
+        nah += (stateUa[i] / 36) * ms / 100;
+    }
+    nah += sensorUaMs / 3600;
+    rec.sleep_ms = sleep_us / 1000;
+    nah += ENERGY_SLEEP_UA * rec.sleep_ms / 3600;
+    rec.nah = nah;
+
+    INFO("energy: cpu %d, assoc %d, radio %d ms, %d nAh\r\n",
+            stateUs[ENERGY_CPU] / 1000, stateUs[ENERGY_ASSOC] / 1000,
+            stateUs[ENERGY_RADIO] / 1000, rec.nah);
+
+    system_rtc_mem_write(RTC_ENERGY_ADDR, &rec, sizeof(rec));
+} // end energy_sleep()
+
+
+/*
+ * energy_cycle_uah - charge used by the previous complete cycle
+ *
+ * Returns 0 after power-on when there is no previous cycle.
+ */
+uint32 ICACHE_FLASH_ATTR
+energy_cycle_uah(void)
+{
+    return((lastCycle.nah + 500) / 1000);
+} // end energy_cycle_uah()
+
+
+/*
+ * energy_days_left - days until the battery is empty at cycle_uah per
+ * cycle of the previous length.
+ */
+uint32 ICACHE_FLASH_ATTR
+energy_days_left(uint32 vbat_mv, uint32 cycle_uah)
+{
+    uint32 remaining_uah;
+    uint32 cycle_s;
+
+    if ((lastCycle.magic != ENERGY_MAGIC) || (cycle_uah == 0)) {
+        return(0);
+    }
+    if (vbat_mv <= ENERGY_VBAT_EMPTY_MV) {
+        return(0);
+    }
+    if (vbat_mv > ENERGY_VBAT_FULL_MV) {
+        vbat_mv = ENERGY_VBAT_FULL_MV;
+    }
+
+    remaining_uah = ENERGY_BATTERY_MAH * 1000
+        / (ENERGY_VBAT_FULL_MV - ENERGY_VBAT_EMPTY_MV)
+        * (vbat_mv - ENERGY_VBAT_EMPTY_MV);
+    cycle_s = (lastCycle.awake_ms + lastCycle.sleep_ms) / 1000;
+    if ((cycle_s == 0) || (cycle_s > SEC_PER_DAY)) {
+        return(0);
+    }
+
+    // uAh per day = cycle_uah * cycles per day
+    return(remaining_uah / (cycle_uah * (SEC_PER_DAY / cycle_s)));
+} // end energy_days_left()
@@ -0,0 +1,245 @@
+/*
+ *  heapstat.c - heap instrumentation
+ *
+ *  Counts allocations per call site, tracks current and peak bytes in
+ *  use and the lowest free heap seen, and reports what is still
+ *  allocated when the node goes to sleep.
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifdef HEAPSTAT
+#define HEAPSTAT_IMPL
+#include <osapi.h>
+#include <os_type.h>
+#include <mem.h>
+#include <user_interface.h>
+//#define INFO os_printf  // override debug.h
+#include "debug.h"
+#include "rtcmem.h"
+
+#include "heapstat.h"
+
+#define HEAPSTAT_MAGIC  0x48535431  // "HST1"
+#define NO_SITE         0xffff
+
+typedef struct {
+    const char *file;
+    uint16 line;
+    uint16 allocs;
+    uint16 outstanding;
+    uint32 bytes;       // outstanding bytes
+} site_t;
+
+// Placed in front of each block. Keeps the caller's block 4 byte
+// aligned.
+typedef struct {
+    uint16 site;
+    uint16 size;
+} header_t;
+
+typedef struct {
+    char file[12];
+    uint16 line;
+    uint16 count;
+} leak_t;
+
+typedef struct {
+    uint32 magic;
+    uint32 peak;
+    uint32 minFree;
+    uint32 outBytes;
+    uint16 allocs;
+    uint16 outCount;
+    leak_t leak[HEAPSTAT_LEAKS];
+} heapstat_rtc_t;
+
+// fails to compile if the record outgrows its RTC memory range
+typedef char heapstat_rtc_fits[
+    (RTC_BLOCKS(sizeof(heapstat_rtc_t)) <= RTC_HEAPSTAT_SIZE) ? 1 : -1];
+
+static site_t sites[HEAPSTAT_SITES];
+static uint8 nsites = 0;
+
+static uint32 curBytes = 0;
+static uint32 peakBytes = 0;
+static uint32 minFree = 0xffffffff;
+static uint16 allocs = 0;
+static uint16 frees = 0;
+
+
+static uint16 ICACHE_FLASH_ATTR
+findSite(const char *file, int line)
+{
+    uint8 i;
+    for (i = 0; i < nsites; i++) {
+        if ((sites[i].line == line) && (sites[i].file == file)) {
+            return(i);
+        }
+    }
+    if (nsites < HEAPSTAT_SITES) {
+        sites[nsites].file = file;
+        sites[nsites].line = line;
+        return(nsites++);
+    }
+    return(NO_SITE);
+} // end findSite()
+
+
+void * ICACHE_FLASH_ATTR
+heapstat_zalloc(uint32 size, const char *file, int line)
+{
+    header_t *hdr = (header_t *)os_zalloc(sizeof(header_t) + size);
+    uint32 heap = system_get_free_heap_size();
+
+    if (heap < minFree) {
+        minFree = heap;
+    }
+    if (hdr == NULL) {
+        os_printf("heapstat: %s:%d alloc of %d failed\r\n",
+                file, line, size);
+        return(NULL);
+    }
+
+    hdr->site = findSite(file, line);
+    hdr->size = size;
+    if (hdr->site != NO_SITE) {
+        site_t *site = &sites[hdr->site];
+        site->allocs++;
+        site->outstanding++;
+        site->bytes += size;
+    }
+
+    allocs++;
+    curBytes += size;
+    if (curBytes > peakBytes) {
+        peakBytes = curBytes;
+    }
+
+    return(hdr + 1);
+} // end heapstat_zalloc()
+
+
+void ICACHE_FLASH_ATTR
+heapstat_free(void *ptr)
+{
+    header_t *hdr;
+
+    if (ptr == NULL) {
+        return;
+    }
+    hdr = (header_t *)ptr - 1;
+
+    if (hdr->site != NO_SITE) {
+        site_t *site = &sites[hdr->site];
+        site->outstanding--;
+        site->bytes -= hdr->size;
+    }
+
+    frees++;
+    curBytes -= hdr->size;
+    os_free(hdr);
+} // end heapstat_free()
+
+
+/*
+ * heapstat_check - log the call sites and save a summary for the next
+ * wake. Called just before deep sleep, so anything still outstanding
+ * is a leak.
+ */
+void ICACHE_FLASH_ATTR
+heapstat_check(void)
+{
+    heapstat_rtc_t rec;
+    uint8 i;
+    uint8 nleaks = 0;
+
+    os_memset(&rec, 0, sizeof(rec));
+    rec.magic = HEAPSTAT_MAGIC;
+    rec.peak = peakBytes;
+    rec.minFree = minFree;
+    rec.outBytes = curBytes;
+    rec.allocs = allocs;
+    rec.outCount = allocs - frees;
+
+    INFO("heap: peak %d, in use %d, allocs %d, frees %d, min free %d\r\n",
+            peakBytes, curBytes, allocs, frees, minFree);
+    for (i = 0; i < nsites; i++) {
+        const char *base = sites[i].file;
+        const char *p;
+
+        INFO("  %s:%d allocs %d, outstanding %d (%d bytes)\r\n",
+                sites[i].file, sites[i].line, sites[i].allocs,
+                sites[i].outstanding, sites[i].bytes);
+
+        if ((sites[i].outstanding > 0) && (nleaks < HEAPSTAT_LEAKS)) {
+            for (p = base; *p != '\0'; p++) {
+                if (*p == '/') {
+                    base = p + 1;
+                }
+            }
+            os_strncpy(rec.leak[nleaks].file, base,
+                    sizeof(rec.leak[nleaks].file) - 1);
+            rec.leak[nleaks].line = sites[i].line;
+            rec.leak[nleaks].count = sites[i].outstanding;
+            nleaks++;
+        }
+    }
+
+    system_rtc_mem_write(RTC_HEAPSTAT_ADDR, &rec, sizeof(rec));
+} // end heapstat_check()
+
+
+/*
+ * heapstat_summary - format the summary saved by the previous wake
+ *
+ * Format:  peak,minFree,allocs,outstanding,outBytes[;file:line:count]...
+ * Returns the string length, or 0 if there is no saved summary.
+ */
+uint8 ICACHE_FLASH_ATTR
+heapstat_summary(char *buf, uint8 bsize)
+{
+    heapstat_rtc_t rec;
+    uint8 len;
+    uint8 i;
+
+    buf[0] = '\0';
+    system_rtc_mem_read(RTC_HEAPSTAT_ADDR, &rec, sizeof(rec));
+    if ((rec.magic != HEAPSTAT_MAGIC) || (bsize < 48)) {
+        return(0);
+    }
+
+    len = os_sprintf(buf, "%d,%d,%d,%d,%d",
+            rec.peak, rec.minFree, rec.allocs, rec.outCount, rec.outBytes);
+    for (i = 0; (i < HEAPSTAT_LEAKS) && (rec.leak[i].line != 0); i++) {
+        // file (11) + line (5) + count (5) + separators
+        if (len + 24 >= bsize) {
+            break;
+        }
+        rec.leak[i].file[sizeof(rec.leak[i].file) - 1] = '\0';
+        len += os_sprintf(buf + len, ";%s:%d:%d",
+                rec.leak[i].file, rec.leak[i].line, rec.leak[i].count);
+    }
+
+    // only publish once
+    rec.magic = 0;
+    system_rtc_mem_write(RTC_HEAPSTAT_ADDR, &rec, sizeof(uint32));
+
+    return(len);
+} // end heapstat_summary()
+
+#endif // HEAPSTAT
@@ -0,0 +1,160 @@
+/*
+ *  mains.c - continuous sampling and batched reports, see mains.h
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifdef MAINS
+#include <ets_sys.h>
+#include <osapi.h>
+#include <os_type.h>
+#include <user_interface.h>
+//#define INFO os_printf  // override debug.h
+#include "debug.h"
+#include "user_config.h"
+#include "walltime.h"
+
+#include "mains.h"
+
+#define US_PER_TENTH    100000
+
+typedef struct {
+    uint32 time_us;     // system_get_time() when it was reported
+    report_t report[3]; // temperature, light, supply
+} mains_sample_t;
+
+// fails to compile if a DS18B20 conversion would not fit in a period
+typedef char mains_period_ok[(MAINS_SAMPLE_S >= 1) ? 1 : -1];
+
+// fails to compile if a full batch would not fit in an esp_mqtt buffer,
+// 64 bytes are left for the topic and the packet header
+typedef char mains_batch_fits[
+    (MAINS_BUF_SIZE + 64 <= MQTT_BUF_SIZE) ? 1 : -1];
+
+static mains_sample_t samples[MAINS_BATCH_MAX];
+static uint8 count = 0;
+static char batchBuf[MAINS_BUF_SIZE];
+static mains_sample_cb_t sampleCb = NULL;
+static mains_flush_cb_t flushCb = NULL;
+static os_timer_t sampleTimer;
+static os_timer_t batchTimer;
+
+
+/*
+ * sample_tick - start the next sample, every MAINS_SAMPLE_S
+ */
+static void ICACHE_FLASH_ATTR
+sample_tick(void *arg)
+{
+    sampleCb();
+}
+
+
+static void ICACHE_FLASH_ATTR
+batch_due(void *arg)
+{
+    mains_flush();
+}
+
+
+/*
+ * mains_start - sample now and every MAINS_SAMPLE_S from now on
+ *
+ * sample starts the drivers, which end up calling mains_add(). flush
+ * is given each batch to publish; the text is only valid during the
+ * call.
+ */
+void ICACHE_FLASH_ATTR
+mains_start(mains_sample_cb_t sample, mains_flush_cb_t flush)
+{
+    sampleCb = sample;
+    flushCb = flush;
+    count = 0;
+
+    os_timer_disarm(&batchTimer);
+    os_timer_setfn(&batchTimer, (os_timer_func_t *)batch_due, NULL);
+    os_timer_disarm(&sampleTimer);
+    os_timer_setfn(&sampleTimer, (os_timer_func_t *)sample_tick, NULL);
+    os_timer_arm(&sampleTimer, MAINS_SAMPLE_S * 1000, 1);
+
+    INFO("mains: sample every %d s, batch %d ms\r\n",
+            MAINS_SAMPLE_S, MAINS_BATCH_MS);
+    sampleCb();
+} // end mains_start()
+
+
+/*
+ * mains_add - keep one sample for the batch
+ */
+void ICACHE_FLASH_ATTR
+mains_add(const report_t *temperature, const report_t *light,
+        const report_t *supply)
+{
+    mains_sample_t *s = &samples[count++];
+
+    s->time_us = system_get_time();
+    s->report[0] = *temperature;
+    s->report[1] = *light;
+    s->report[2] = *supply;
+
+    if ((count >= MAINS_BATCH_MAX) || (MAINS_BATCH_MS == 0)) {
+        mains_flush();
+    } else if (count == 1) {
+        // the latency window starts with the oldest sample
+        os_timer_arm(&batchTimer, MAINS_BATCH_MS, 0);
+    }
+} // end mains_add()
+
+
+/*
+ * mains_flush - format the waiting samples and hand them to flush
+ */
+void ICACHE_FLASH_ATTR
+mains_flush(void)
+{
+    uint32 now = system_get_time();
+    char *p = batchBuf;
+    uint8 i;
+    uint8 j;
+
+    os_timer_disarm(&batchTimer);
+    if (count == 0) {
+        return;
+    }
+
+    os_strcpy(p, MAINS_ID_VERSION_STR);
+    p += os_strlen(p);
+    *p++ = ',';
+    p += report_decimal(p, count, 0);
+    *p++ = ',';
+    p += walltime_format(p);
+    for (i = 0; i < count; i++) {
+        *p++ = '\n';
+        p += report_decimal(p, (now - samples[i].time_us) / US_PER_TENTH, 1);
+        for (j = 0; j < 3; j++) {
+            *p++ = ',';
+            p += report_format(p, &samples[i].report[j]);
+        }
+    }
+    *p = '\0';
+
+    INFO("mains: %d samples, %d bytes\r\n", count, p - batchBuf);
+    count = 0;
+    flushCb(batchBuf);
+} // end mains_flush()
+
+#endif // MAINS
@@ -0,0 +1,540 @@
+/*
+ *  mqttpipe.c - pipelined MQTT CONNECT and PUBLISH
+ *
+ *  Sends CONNECT and the QoS 0 PUBLISH packets of a wake in the first
+ *  TCP segment instead of waiting for CONNACK. Falls back to the
+ *  esp_mqtt client when the broker does not go along with it. See
+ *  include/mqttpipe.h.
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifdef MQTTPIPE
+#include <ets_sys.h>
+#include <osapi.h>
+#include <os_type.h>
+#include <mem.h>
+#include <user_interface.h>
+#include <espconn.h>
+//#define INFO os_printf  // override debug.h
+#include "debug.h"
+#include "heapstat.h"
+#include "config.h"
+#include "rtcmem.h"
+
+#include "mqttpipe.h"
+
+#define MQTTPIPE_MAGIC  0x4d515031  // "MQP1"
+
+// packet types and flags
+#define MQTT_CONNECT    0x10
+#define MQTT_CONNACK    0x20
+#define MQTT_PUBLISH    0x30
+#define MQTT_DISCONNECT 0xe0
+#define MQTT_RETAIN     0x01
+#define MQTT_CLEAN      0x02
+#define MQTT_PASSWORD   0x40
+#define MQTT_USERNAME   0x80
+#define MQTT_ACCEPTED   0x00
+
+#ifdef PROTOCOL_NAMEv31
+#define MQTT_PROTOCOL   "MQIsdp"
+#define MQTT_LEVEL      3
+#else
+#define MQTT_PROTOCOL   "MQTT"
+#define MQTT_LEVEL      4
+#endif
+
+typedef struct {
+    uint32 magic;
+    uint32 skip;        // wakes left before pipelining is tried again
+} mqttpipe_rtc_t;
+
+// fails to compile if the record outgrows its RTC memory range
+typedef char mqttpipe_rtc_fits[
+    (RTC_BLOCKS(sizeof(mqttpipe_rtc_t)) <= RTC_MQTTPIPE_SIZE) ? 1 : -1];
+
+typedef enum {
+    PIPE_OFF,           // not used this wake, or fallen back
+    PIPE_IDLE,          // CONNECT built, waiting for an IP address
+    PIPE_CONNECTING,    // TCP connect started
+    PIPE_SENT,          // buffer written, waiting for CONNACK
+    PIPE_DONE,          // CONNACK received, messages delivered
+} pipe_state_t;
+
+// CONNECT, then the PUBLISH packets
+static uint8 pipeBuf[MQTTPIPE_BUF_SIZE];
+static uint16 connectLen = 0;
+static uint16 pipeLen = 0;
+static uint8 npublish = 0;
+
+static pipe_state_t state = PIPE_OFF;
+static bool tcpUp = false;
+static bool connPending = false;    // espconn_connect() not answered yet
+static bool flushed = false;
+static struct espconn conn;
+static esp_tcp tcp;
+static os_timer_t timeoutTimer;
+static MQTT_Client *mqttClient = NULL;
+static mqttpipe_cb_t publishedCb = NULL;
+static mqttpipe_cb_t closedCb = NULL;
+static bool sentPending = false;    // waiting for the broker's ACK
+static mqttpipe_rtc_t rtc;
+static const char *failReason = NULL;
+
+
+/*
+ * Fixed header with the remaining length, which is at most two bytes
+ * for a buffer this size
+ */
+static uint16 ICACHE_FLASH_ATTR
+put_header(uint16 pos, uint8 type, uint16 remaining)
+{
+    pipeBuf[pos++] = type;
+    if (remaining >= 128) {
+        pipeBuf[pos++] = (remaining & 0x7f) | 0x80;
+        remaining >>= 7;
+    }
+    pipeBuf[pos++] = remaining;
+    return(pos);
+}
+
+
+static uint16 ICACHE_FLASH_ATTR
+put_string(uint16 pos, const char *str, uint16 len)
+{
+    pipeBuf[pos++] = len >> 8;
+    pipeBuf[pos++] = len & 0xff;
+    os_memcpy(&pipeBuf[pos], str, len);
+    return(pos + len);
+}
+
+
+/*
+ * Build the CONNECT packet at the start of pipeBuf
+ */
+static bool ICACHE_FLASH_ATTR
+build_connect(void)
+{
+    uint16 idLen = os_strlen(sysCfg.device_id);
+    uint16 userLen = os_strlen(sysCfg.mqtt_user);
+    uint16 passLen = os_strlen(sysCfg.mqtt_pass);
+    uint16 remaining;
+    uint16 pos;
+    uint8 flags = MQTT_CLEAN;
+
+    remaining = (2 + sizeof(MQTT_PROTOCOL) - 1) + 4 + (2 + idLen);
+    if (userLen > 0) {
+        flags |= MQTT_USERNAME;
+        remaining += 2 + userLen;
+    }
+    if (passLen > 0) {
+        flags |= MQTT_PASSWORD;
+        remaining += 2 + passLen;
+    }
+    if (remaining + 3 > MQTTPIPE_BUF_SIZE) {
+        return(FALSE);
+    }
+
+    pos = put_header(0, MQTT_CONNECT, remaining);
+    pos = put_string(pos, MQTT_PROTOCOL, sizeof(MQTT_PROTOCOL) - 1);
+    pipeBuf[pos++] = MQTT_LEVEL;
+    pipeBuf[pos++] = flags;
+    pipeBuf[pos++] = sysCfg.mqtt_keepalive >> 8;
+    pipeBuf[pos++] = sysCfg.mqtt_keepalive & 0xff;
+    pos = put_string(pos, sysCfg.device_id, idLen);
+    if (userLen > 0) {
+        pos = put_string(pos, sysCfg.mqtt_user, userLen);
+    }
+    if (passLen > 0) {
+        pos = put_string(pos, sysCfg.mqtt_pass, passLen);
+    }
+
+    connectLen = pos;
+    pipeLen = pos;
+    return(TRUE);
+} // end build_connect()
+
+
+/*
+ * Give the queued messages to esp_mqtt, which queues them until it is
+ * connected
+ */
+static void ICACHE_FLASH_ATTR
+pipe_handover(void)
+{
+    uint16 pos = connectLen;
+
+    os_timer_disarm(&timeoutTimer);
+    if (tcpUp) {
+        tcpUp = false;
+        espconn_disconnect(&conn);
+    } else if (connPending) {
+        // a connect that came in now would send everything again
+        connPending = false;
+        espconn_abort(&conn);
+    }
+    state = PIPE_OFF;
+
+    while (pos < pipeLen) {
+        uint8 retain = pipeBuf[pos] & MQTT_RETAIN;
+        uint16 remaining = pipeBuf[pos + 1] & 0x7f;
+        uint16 tlen;
+        char *topic;
+
+        pos += 2;
+        if (pipeBuf[pos - 1] & 0x80) {
+            remaining |= pipeBuf[pos++] << 7;
+        }
+        tlen = (pipeBuf[pos] << 8) | pipeBuf[pos + 1];
+        topic = (char *)os_zalloc(tlen + 1);
+        os_memcpy(topic, &pipeBuf[pos + 2], tlen);
+        MQTT_Publish(mqttClient, topic, (const char *)&pipeBuf[pos + 2 + tlen],
+                remaining - 2 - tlen, 0, retain);
+        os_free(topic);
+        pos += remaining;
+    }
+} // end pipe_handover()
+
+
+/*
+ * Use esp_mqtt for this wake and stop pipelining for a while
+ */
+static void ICACHE_FLASH_ATTR
+pipe_fallback(const char *why)
+{
+    INFO("mqttpipe: %s, using esp_mqtt\r\n", why);
+    rtc.magic = MQTTPIPE_MAGIC;
+    rtc.skip = MQTTPIPE_BACKOFF;
+    system_rtc_mem_write(RTC_MQTTPIPE_ADDR, &rtc, sizeof(rtc));
+
+    MQTT_Connect(mqttClient);
+    pipe_handover();
+} // end pipe_fallback()
+
+
+/*
+ * Fall back from the timer rather than from inside an espconn callback
+ */
+static void ICACHE_FLASH_ATTR
+pipe_fail(const char *why)
+{
+    failReason = why;
+    os_timer_arm(&timeoutTimer, 1, 0);
+}
+
+
+/*
+ * Also closes a connection that came up after the handover
+ */
+static void ICACHE_FLASH_ATTR
+pipe_timeout(void *arg)
+{
+    if (state == PIPE_OFF) {
+        if (tcpUp) {
+            tcpUp = false;
+            espconn_disconnect(&conn);
+        }
+        return;
+    }
+    pipe_fallback(failReason);
+}
+
+
+/*
+ * Every message is queued by now, so DISCONNECT goes in the same
+ * segment and one ACK covers the lot. It is left out of pipeLen so a
+ * fallback only re-sends the PUBLISH packets.
+ */
+static void ICACHE_FLASH_ATTR
+pipe_send(void)
+{
+    INFO("mqttpipe: sending %d bytes, %d messages\r\n", pipeLen, npublish);
+    state = PIPE_SENT;
+    failReason = "no CONNACK";
+    os_timer_arm(&timeoutTimer, MQTTPIPE_TIMEOUT_MS, 0);
+    pipeBuf[pipeLen] = MQTT_DISCONNECT;
+    pipeBuf[pipeLen + 1] = 0;
+    if (espconn_sent(&conn, pipeBuf, pipeLen + 2) != 0) {
+        pipe_fail("send failed");
+        return;
+    }
+    sentPending = true;
+}
+
+
+/*
+ * The sent callback comes once the broker has ACKed the segment
+ */
+static void ICACHE_FLASH_ATTR
+pipe_sent_cb(void *arg)
+{
+    mqttpipe_cb_t cb = closedCb;
+
+    sentPending = false;
+    closedCb = NULL;
+    if (cb != NULL) {
+        cb(NULL);
+    }
+}
+
+
+static void ICACHE_FLASH_ATTR
+pipe_recv_cb(void *arg, char *pdata, unsigned short len)
+{
+    uint8 *p = (uint8 *)pdata;
+    uint8 i;
+
+    if ((state != PIPE_SENT) || (len < 4) || (p[0] != MQTT_CONNACK)) {
+        return;
+    }
+    if (p[3] != MQTT_ACCEPTED) {
+        INFO("mqttpipe: CONNACK %d\r\n", p[3]);
+        pipe_fail("connection refused");
+        return;
+    }
+
+    // the PUBLISH packets followed CONNECT on the same connection
+    os_timer_disarm(&timeoutTimer);
+    state = PIPE_DONE;
+    for (i = 0; (i < npublish) && (publishedCb != NULL); i++) {
+        publishedCb(NULL);
+    }
+} // end pipe_recv_cb()
+
+
+static void ICACHE_FLASH_ATTR
+pipe_connect_cb(void *arg)
+{
+    connPending = false;
+    tcpUp = true;
+    if (state != PIPE_CONNECTING) {
+        // too late, the messages went to esp_mqtt
+        os_timer_arm(&timeoutTimer, 1, 0);
+        return;
+    }
+    espconn_regist_recvcb(&conn, pipe_recv_cb);
+    espconn_regist_sentcb(&conn, pipe_sent_cb);
+    if (flushed) {
+        pipe_send();
+    } else {
+        // waiting for the report is not the broker's fault
+        os_timer_disarm(&timeoutTimer);
+    }
+}
+
+
+static void ICACHE_FLASH_ATTR
+pipe_discon_cb(void *arg)
+{
+    tcpUp = false;
+    if ((state == PIPE_CONNECTING) || (state == PIPE_SENT)) {
+        pipe_fail("closed by broker");
+    }
+}
+
+
+static void ICACHE_FLASH_ATTR
+pipe_recon_cb(void *arg, sint8 err)
+{
+    connPending = false;
+    tcpUp = false;
+    if ((state == PIPE_CONNECTING) || (state == PIPE_SENT)) {
+        INFO("mqttpipe: TCP error %d\r\n", err);
+        pipe_fail("connection failed");
+    }
+}
+
+
+/*
+ * mqttpipe_init - build the CONNECT packet from sysCfg
+ *
+ * Returns FALSE if pipelining is not used this wake. Call after the
+ * esp_mqtt client is set up, it is used for the fallback.
+ */
+bool ICACHE_FLASH_ATTR
+mqttpipe_init(MQTT_Client *client)
+{
+    uint32 ip;
+
+    mqttClient = client;
+    state = PIPE_OFF;
+
+    system_rtc_mem_read(RTC_MQTTPIPE_ADDR, &rtc, sizeof(rtc));
+    if (rtc.magic != MQTTPIPE_MAGIC) {
+        rtc.magic = MQTTPIPE_MAGIC;
+        rtc.skip = 0;
+    }
+    if (rtc.skip > 0) {
+        rtc.skip--;
+        system_rtc_mem_write(RTC_MQTTPIPE_ADDR, &rtc, sizeof(rtc));
+        INFO("mqttpipe: off for %d more wakes\r\n", rtc.skip);
+        return(FALSE);
+    }
+
+    // plain TCP only, TLS connections go through esp_mqtt
+    ip = ipaddr_addr(sysCfg.mqtt_host);
+    if (sysCfg.security || (ip == 0xffffffff) || !build_connect()) {
+        return(FALSE);
+    }
+
+    os_memset(&conn, 0, sizeof(conn));
+    os_memset(&tcp, 0, sizeof(tcp));
+    conn.type = ESPCONN_TCP;
+    conn.state = ESPCONN_NONE;
+    conn.proto.tcp = &tcp;
+    tcp.remote_port = sysCfg.mqtt_port;
+    tcp.local_port = espconn_port();
+    os_memcpy(tcp.remote_ip, &ip, 4);
+    espconn_regist_connectcb(&conn, pipe_connect_cb);
+    espconn_regist_disconcb(&conn, pipe_discon_cb);
+    espconn_regist_reconcb(&conn, pipe_recon_cb);
+
+    os_timer_disarm(&timeoutTimer);
+    os_timer_setfn(&timeoutTimer, (os_timer_func_t *)pipe_timeout, NULL);
+
+    npublish = 0;
+    sentPending = false;
+    closedCb = NULL;
+    flushed = false;
+    tcpUp = false;
+    connPending = false;
+    state = PIPE_IDLE;
+    return(TRUE);
+} // end mqttpipe_init()
+
+
+void ICACHE_FLASH_ATTR
+mqttpipe_on_published(mqttpipe_cb_t cb)
+{
+    publishedCb = cb;
+}
+
+
+/*
+ * mqttpipe_connect - start the TCP connection
+ *
+ * Returns FALSE if pipelining is off and the caller should use
+ * MQTT_Connect().
+ */
+bool ICACHE_FLASH_ATTR
+mqttpipe_connect(void)
+{
+    if (state != PIPE_IDLE) {
+        return(state != PIPE_OFF);
+    }
+
+    state = PIPE_CONNECTING;
+    failReason = "TCP connect timeout";
+    os_timer_arm(&timeoutTimer, MQTTPIPE_TIMEOUT_MS, 0);
+    if (espconn_connect(&conn) != 0) {
+        pipe_fail("espconn_connect failed");
+    } else {
+        connPending = true;
+    }
+    return(TRUE);
+} // end mqttpipe_connect()
+
+
+/*
+ * mqttpipe_publish - queue a QoS 0 message behind CONNECT
+ *
+ * Returns FALSE if the message was not queued and should be given to
+ * MQTT_Publish().
+ */
+bool ICACHE_FLASH_ATTR
+mqttpipe_publish(const char *topic, const char *data, uint16 len,
+        uint8 retain)
+{
+    uint16 tlen = os_strlen(topic);
+    uint16 remaining = 2 + tlen + len;
+    uint16 pos;
+
+    // leave 2 bytes for DISCONNECT
+    if (((state != PIPE_IDLE) && (state != PIPE_CONNECTING)) || flushed
+            || (pipeLen + 3 + remaining + 2 > MQTTPIPE_BUF_SIZE)) {
+        return(FALSE);
+    }
+
+    pos = put_header(pipeLen, MQTT_PUBLISH | (retain ? MQTT_RETAIN : 0),
+            remaining);
+    pos = put_string(pos, topic, tlen);
+    os_memcpy(&pipeBuf[pos], data, len);
+    pipeLen = pos + len;
+    npublish++;
+    return(TRUE);
+} // end mqttpipe_publish()
+
+
+/*
+ * mqttpipe_flush - all messages are queued, send once TCP is up
+ */
+void ICACHE_FLASH_ATTR
+mqttpipe_flush(void)
+{
+    if ((state != PIPE_IDLE) && (state != PIPE_CONNECTING)) {
+        return;
+    }
+    flushed = true;
+    if (tcpUp) {
+        pipe_send();
+    }
+}
+
+
+/*
+ * mqttpipe_disconnect - wait for the session to end before deep sleep
+ *
+ * DISCONNECT went out behind the messages, cb is called once the
+ * broker has ACKed it (right away if it already has). Returns FALSE,
+ * and cb is not called, if the messages went through esp_mqtt.
+ */
+bool ICACHE_FLASH_ATTR
+mqttpipe_disconnect(mqttpipe_cb_t cb)
+{
+    os_timer_disarm(&timeoutTimer);
+    if (!tcpUp || (state != PIPE_DONE)) {
+        return(FALSE);
+    }
+    state = PIPE_OFF;
+    if (sentPending) {
+        closedCb = cb;
+    } else if (cb != NULL) {
+        cb(NULL);
+    }
+    return(TRUE);
+} // end mqttpipe_disconnect()
+
+
+/*
+ * mqttpipe_stop - give up on this broker
+ *
+ * For the broker failover: the queued messages go to esp_mqtt, which
+ * the caller connects to the next broker. Pipelining stays on for
+ * later wakes, the broker was the problem.
+ */
+void ICACHE_FLASH_ATTR
+mqttpipe_stop(void)
+{
+    if ((state == PIPE_OFF) || (state == PIPE_DONE)) {
+        return;
+    }
+    INFO("mqttpipe: broker gave up, using esp_mqtt\r\n");
+    pipe_handover();
+} // end mqttpipe_stop()
+
+#endif // MQTTPIPE
@@ -0,0 +1,444 @@
+/*
+ *  mqttsn.c - MQTT-SN client over UDP
+ *
+ *  Publishes to pre-registered topic IDs at QoS -1, 0 or 1. Only the
+ *  messages a reporting node needs are implemented: CONNECT/CONNACK,
+ *  PUBLISH/PUBACK and DISCONNECT. See include/mqttsn.h.
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifdef MQTTSN
+#include <ets_sys.h>
+#include <osapi.h>
+#include <os_type.h>
+#include <mem.h>
+#include <user_interface.h>
+#include <espconn.h>
+//#define INFO os_printf  // override debug.h
+#include "debug.h"
+#include "heapstat.h"
+
+#include "mqttsn.h"
+
+// message types
+#define SN_CONNECT      0x04
+#define SN_CONNACK      0x05
+#define SN_PUBLISH      0x0c
+#define SN_PUBACK       0x0d
+#define SN_DISCONNECT   0x18
+
+// flags
+#define SN_FLAG_DUP     0x80
+#define SN_FLAG_QOS_M1  0x60
+#define SN_FLAG_QOS1    0x20
+#define SN_FLAG_RETAIN  0x10
+#define SN_FLAG_CLEAN   0x04
+#define SN_TOPIC_PREDEF 0x01
+
+#define SN_PROTOCOL_ID  0x01
+#define SN_ACCEPTED     0x00
+#define SN_CONGESTION   0x01
+
+#define SN_PUBLISH_HDR  7       // length, type, flags, topic ID, msg ID
+#define SN_QUEUE        4       // QoS 1 messages waiting for PUBACK
+
+typedef enum {
+    SN_IDLE,
+    SN_CONNECTING,
+    SN_CONNECTED,
+    SN_DISCONNECTING,
+} sn_state_t;
+
+static struct espconn conn;
+static esp_udp udp;
+static os_timer_t retryTimer;
+static sn_state_t state = SN_IDLE;
+static bool created = false;
+
+static const char *clientId = NULL;
+static uint16 keepAlive = 0;
+static mqttsn_cb_t connectedCb = NULL;
+static mqttsn_cb_t publishedCb = NULL;
+static mqttsn_cb_t failedCb = NULL;
+static mqttsn_cb_t closedCb = NULL;
+
+static uint16 lastMsgId = 0;
+static uint8 retries = 0;
+
+// QoS 1 PUBLISH packets, the head is in flight
+static uint8 *queue[SN_QUEUE];
+static uint8 qhead = 0;
+static uint8 qcount = 0;
+
+// one bit per datagram not yet confirmed by the sent callback, set
+// for QoS -1 and 0 PUBLISH packets, oldest in bit 0
+static uint8 sentBits = 0;
+static uint8 sentCount = 0;
+
+
+static void ICACHE_FLASH_ATTR
+sn_send(uint8 *packet, bool isPublish)
+{
+    if (sentCount < 8) {
+        sentBits |= (isPublish ? 1 : 0) << sentCount;
+        sentCount++;
+    }
+    espconn_sent(&conn, packet, packet[0]);
+} // end sn_send()
+
+
+static void ICACHE_FLASH_ATTR
+sn_send_connect(void)
+{
+    uint8 packet[MQTTSN_MAX_PACKET];
+    uint8 idLen = os_strlen(clientId);
+
+    if (idLen > 23) {
+        idLen = 23;     // longest client ID allowed by the spec
+    }
+    packet[0] = 6 + idLen;
+    packet[1] = SN_CONNECT;
+    packet[2] = SN_FLAG_CLEAN;
+    packet[3] = SN_PROTOCOL_ID;
+    packet[4] = keepAlive >> 8;
+    packet[5] = keepAlive & 0xff;
+    os_memcpy(&packet[6], clientId, idLen);
+
+    sn_send(packet, false);
+    os_timer_arm(&retryTimer, MQTTSN_RETRY_MS, 0);
+} // end sn_send_connect()
+
+
+/*
+ * The head of the QoS 1 queue is done, send the next one
+ */
+static void ICACHE_FLASH_ATTR
+sn_next(void)
+{
+    os_timer_disarm(&retryTimer);
+    os_free(queue[qhead]);
+    queue[qhead] = NULL;
+    qhead = (qhead + 1) % SN_QUEUE;
+    qcount--;
+    retries = 0;
+
+    if (qcount > 0) {
+        sn_send(queue[qhead], false);
+        os_timer_arm(&retryTimer, MQTTSN_RETRY_MS, 0);
+    }
+} // end sn_next()
+
+
+static void ICACHE_FLASH_ATTR
+sn_retry(void *arg)
+{
+    if (retries >= MQTTSN_RETRIES) {
+        // the watchdog in app.c ends the wake
+        INFO("MQTT-SN: no reply from gateway\r\n");
+        if (state == SN_CONNECTING) {
+            state = SN_IDLE;
+        } else if (qcount > 0) {
+            sn_next();
+            if (failedCb != NULL) {
+                failedCb(NULL);
+            }
+        }
+        return;
+    }
+    retries++;
+
+    if (state == SN_CONNECTING) {
+        sn_send_connect();
+    } else if (qcount > 0) {
+        queue[qhead][2] |= SN_FLAG_DUP;
+        sn_send(queue[qhead], false);
+        os_timer_arm(&retryTimer, MQTTSN_RETRY_MS, 0);
+    }
+} // end sn_retry()
+
+
+static void ICACHE_FLASH_ATTR
+sn_sent_cb(void *arg)
+{
+    bool isPublish;
+
+    if (sentCount == 0) {
+        return;
+    }
+    isPublish = sentBits & 1;
+    sentBits >>= 1;
+    sentCount--;
+
+    // QoS -1 and 0 are done once the datagram is sent
+    if (isPublish && (publishedCb != NULL)) {
+        publishedCb(NULL);
+    }
+} // end sn_sent_cb()
+
+
+static void ICACHE_FLASH_ATTR
+sn_recv_cb(void *arg, char *pdata, unsigned short len)
+{
+    uint8 *p = (uint8 *)pdata;
+    uint8 rc;
+
+    if ((len < 2) || (p[0] != len)) {
+        // the three byte length form is never needed for these replies
+        return;
+    }
+
+    switch (p[1]) {
+        case SN_CONNACK:
+            if ((state != SN_CONNECTING) || (len < 3)) {
+                break;
+            }
+            os_timer_disarm(&retryTimer);
+            retries = 0;
+            if (p[2] != SN_ACCEPTED) {
+                INFO("MQTT-SN: connection refused %d\r\n", p[2]);
+                state = SN_IDLE;
+                break;
+            }
+            INFO("MQTT-SN: connected\r\n");
+            state = SN_CONNECTED;
+            if (connectedCb != NULL) {
+                connectedCb(NULL);
+            }
+            break;
+
+        case SN_PUBACK:
+            if ((qcount == 0) || (len < 7)) {
+                break;
+            }
+            if (os_memcmp(&p[4], &queue[qhead][5], 2) != 0) {
+                break;      // reply to an earlier retry
+            }
+            // sending the next one may reuse pdata
+            rc = p[6];
+            if (rc == SN_CONGESTION) {
+                // send it again later, counted as a retry
+                INFO("MQTT-SN: gateway congested\r\n");
+                os_timer_disarm(&retryTimer);
+                os_timer_arm(&retryTimer, MQTTSN_BUSY_MS, 0);
+                break;
+            }
+            sn_next();
+            if (rc != SN_ACCEPTED) {
+                // retrying will not help, the message is lost
+                INFO("MQTT-SN: publish rejected %d\r\n", rc);
+                if (failedCb != NULL) {
+                    failedCb(NULL);
+                }
+            } else if (publishedCb != NULL) {
+                publishedCb(NULL);
+            }
+            break;
+
+        case SN_DISCONNECT:
+            if (state == SN_DISCONNECTING) {
+                // the gateway's answer to our DISCONNECT
+                state = SN_IDLE;
+                if (closedCb != NULL) {
+                    closedCb(NULL);
+                }
+                break;
+            }
+            INFO("MQTT-SN: disconnected by gateway\r\n");
+            state = SN_IDLE;
+            break;
+
+        default:
+            break;
+    }
+} // end sn_recv_cb()
+
+
+/*
+ * mqttsn_init - set up the gateway address and client ID
+ *
+ * host must be a dotted quad IP address. client_id is not copied.
+ */
+void ICACHE_FLASH_ATTR
+mqttsn_init(const char *host, uint16 port, const char *client_id,
+        uint16 keepalive)
+{
+    uint32 ip = ipaddr_addr(host);
+
+    clientId = client_id;
+    keepAlive = keepalive;
+
+    os_memset(&conn, 0, sizeof(conn));
+    os_memset(&udp, 0, sizeof(udp));
+    conn.type = ESPCONN_UDP;
+    conn.state = ESPCONN_NONE;
+    conn.proto.udp = &udp;
+    udp.remote_port = port;
+    udp.local_port = espconn_port();
+    os_memcpy(udp.remote_ip, &ip, 4);
+
+    os_timer_disarm(&retryTimer);
+    os_timer_setfn(&retryTimer, (os_timer_func_t *)sn_retry, NULL);
+} // end mqttsn_init()
+
+
+void ICACHE_FLASH_ATTR
+mqttsn_on_connected(mqttsn_cb_t cb)
+{
+    connectedCb = cb;
+}
+
+
+void ICACHE_FLASH_ATTR
+mqttsn_on_published(mqttsn_cb_t cb)
+{
+    publishedCb = cb;
+}
+
+
+/*
+ * mqttsn_on_failed - cb is called instead of the published callback
+ * for a QoS 1 message the gateway rejected or never acknowledged
+ */
+void ICACHE_FLASH_ATTR
+mqttsn_on_failed(mqttsn_cb_t cb)
+{
+    failedCb = cb;
+}
+
+
+/*
+ * mqttsn_connect - call once the station has an IP address
+ *
+ * At MQTTSN_QOS -1 there is nothing to wait for, so the connected
+ * callback is called right away.
+ */
+void ICACHE_FLASH_ATTR
+mqttsn_connect(void)
+{
+    if (!created) {
+        espconn_regist_recvcb(&conn, sn_recv_cb);
+        espconn_regist_sentcb(&conn, sn_sent_cb);
+        if (espconn_create(&conn) != 0) {
+            INFO("MQTT-SN: espconn_create failed\r\n");
+            return;
+        }
+        created = true;
+    }
+
+#if MQTTSN_QOS < 0
+    state = SN_CONNECTED;
+    if (connectedCb != NULL) {
+        connectedCb(NULL);
+    }
+#else
+    if (state == SN_IDLE) {
+        INFO("MQTT-SN: connect to %s:%d\r\n", MQTTSN_HOST, MQTTSN_PORT);
+        state = SN_CONNECTING;
+        retries = 0;
+        sn_send_connect();
+    }
+#endif
+} // end mqttsn_connect()
+
+
+/*
+ * mqttsn_publish - publish to a pre-registered topic ID
+ *
+ * QoS 0 and 1 need a connection, QoS -1 only needs the UDP socket.
+ * Returns FALSE if the message can not be sent now.
+ */
+bool ICACHE_FLASH_ATTR
+mqttsn_publish(uint16 topic_id, const char *data, uint16 len,
+        sint8 qos, uint8 retain)
+{
+    uint8 *packet;
+    uint16 msgId = 0;
+
+    if ((!created) || (len > MQTTSN_MAX_PACKET - SN_PUBLISH_HDR)
+            || ((qos >= 0) && (state != SN_CONNECTED))
+            || ((qos > 0) && (qcount >= SN_QUEUE))) {
+        return(FALSE);
+    }
+
+    packet = (uint8 *)os_zalloc(SN_PUBLISH_HDR + len);
+    if (packet == NULL) {
+        return(FALSE);
+    }
+
+    if (qos > 0) {
+        if (++lastMsgId == 0) {
+            lastMsgId = 1;
+        }
+        msgId = lastMsgId;
+    }
+    packet[0] = SN_PUBLISH_HDR + len;
+    packet[1] = SN_PUBLISH;
+    packet[2] = SN_TOPIC_PREDEF | (retain ? SN_FLAG_RETAIN : 0)
+        | ((qos < 0) ? SN_FLAG_QOS_M1 : (qos > 0) ? SN_FLAG_QOS1 : 0);
+    packet[3] = topic_id >> 8;
+    packet[4] = topic_id & 0xff;
+    packet[5] = msgId >> 8;
+    packet[6] = msgId & 0xff;
+    os_memcpy(&packet[SN_PUBLISH_HDR], data, len);
+
+    if (qos <= 0) {
+        sn_send(packet, true);
+        os_free(packet);
+        return(TRUE);
+    }
+
+    // QoS 1: one message in flight at a time
+    queue[(qhead + qcount) % SN_QUEUE] = packet;
+    qcount++;
+    if (qcount == 1) {
+        retries = 0;
+        sn_send(packet, false);
+        os_timer_arm(&retryTimer, MQTTSN_RETRY_MS, 0);
+    }
+    return(TRUE);
+} // end mqttsn_publish()
+
+
+/*
+ * mqttsn_disconnect - end the session before deep sleep
+ *
+ * The gateway answers DISCONNECT with DISCONNECT, which also means
+ * every datagram sent before it has left the radio. Returns TRUE if
+ * cb will be called when that answer arrives, FALSE if there is no
+ * session to end (always the case at QoS -1).
+ */
+bool ICACHE_FLASH_ATTR
+mqttsn_disconnect(mqttsn_cb_t cb)
+{
+    os_timer_disarm(&retryTimer);
+    if (state != SN_CONNECTED) {
+        return(FALSE);
+    }
+#if MQTTSN_QOS >= 0
+    uint8 packet[2] = { 2, SN_DISCONNECT };
+    closedCb = cb;
+    state = SN_DISCONNECTING;
+    sn_send(packet, false);
+    return(cb != NULL);
+#else
+    state = SN_IDLE;
+    return(FALSE);
+#endif
+} // end mqttsn_disconnect()
+
+#endif // MQTTSN
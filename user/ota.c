@@ -0,0 +1,808 @@
+/*
+ *  ota.c - delta firmware updates over HTTP, see ota.h
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifdef OTA
+#include <ets_sys.h>
+#include <osapi.h>
+#include <os_type.h>
+#include <mem.h>
+#include <user_interface.h>
+#include <espconn.h>
+#include <spi_flash.h>
+#include <driver/uart.h>
+//#define INFO os_printf  // override debug.h
+#include "debug.h"
+#include "user_config.h"
+#include "rtcmem.h"
+#include "battery.h"
+#include "energy.h"
+
+#include "ota.h"
+
+#define OTA_MAGIC       0x3141544f  // "OTA1"
+#define DELTA_MAGIC     0x32444c54  // "TLD2"
+#define SECTOR          SPI_FLASH_SEC_SIZE
+#define IMAGE_V2_MAGIC  0xea        // first byte of user1.bin and user2.bin
+#define IMAGE_MAGIC     0xe9        // of the part the boot loader copies
+#define DELTA_MAX       (2 * OTA_SLOT_SIZE)
+#define HEAD_MAX        256         // HTTP status line and headers
+#define COPY            0x01        // command flag, else literal bytes
+#define WRITE_TRIES     3
+
+// build_bytes() failures
+#define BUILD_BAD       -1
+#define BUILD_WRITE     -2
+
+// ROM functions, see eagle.rom.addr.v6.ld in the SDK
+typedef struct {
+    uint32 state[5];
+    uint32 count[2];
+    uint8 buffer[64];
+} SHA1_CTX;
+extern void SHA1Init(SHA1_CTX *ctx);
+extern void SHA1Update(SHA1_CTX *ctx, const uint8 *data, uint32 len);
+extern void SHA1Final(uint8 digest[20], SHA1_CTX *ctx);
+
+/*
+ * The delta, as made by tools/ota.py. All values are little endian.
+ * The commands for each sector of the new image, first sector first,
+ * follow the header, each a varint of (length << 1 | COPY):
+ *
+ *  - literal: length bytes of the new image follow
+ *  - copy: a zigzag varint d follows, and length bytes are copied
+ *    from the running image at pos + shift + d, where pos is where
+ *    they go in the new image. shift becomes the new distance, so a
+ *    run of copies moved by the same amount takes a single byte each.
+ *
+ * No command runs on into the next sector.
+ */
+typedef struct {
+    uint32 magic;
+    uint32 len;                 // of the delta, this header included
+    uint8 old_sha1[20];         // the image it applies to
+    uint8 new_sha1[20];         // the image it makes
+    uint32 addr;                // of the slot the new image is linked for
+    uint32 old_len;
+    uint32 new_len;
+} delta_header_t;
+
+enum {
+    DELTA_COMMAND,              // the next byte is part of a command
+    DELTA_DISTANCE,             // or of the distance of a copy
+    DELTA_LITERAL,              // or of the new image
+};
+
+// step 1 of ota.h, in RAM from os_zalloc() while the delta comes in
+typedef struct {
+    uint8 next;                     // DELTA_, what the next byte is
+    uint8 bits;                     // of the varint read so far
+    uint32 varint;
+    uint32 n;                       // bytes left of the command
+    sint32 shift;
+    uint32 start;                   // of the sector, in the new image
+    uint32 len;                     // of the sector
+    uint32 pos;                     // in it
+    uint32 old[OTA_BUF_SIZE / 4];   // copy source, or read back
+    uint32 sector[SECTOR / 4];      // the sector being built
+} build_t;
+
+typedef struct {
+    uint32 magic;
+    uint32 wakes;       // since the last check
+} ota_rtc_t;
+
+// fails to compile if the record outgrows its RTC memory range
+typedef char ota_rtc_fits[
+    (RTC_BLOCKS(sizeof(ota_rtc_t)) <= RTC_OTA_SIZE) ? 1 : -1];
+
+enum {
+    OTA_IDLE,
+    OTA_CONNECTING,
+    OTA_HEAD,           // reading the HTTP header
+    OTA_BODY,           // building the new image as the delta comes
+    OTA_RECEIVED,       // all of the delta is in, building the rest
+    OTA_BUILT,          // and all of the new image is written
+};
+
+static ota_rtc_t rtc;
+static struct espconn conn;
+static esp_tcp tcp;
+static os_timer_t timer;
+static os_timer_t stepTimer;
+static ota_done_cb_t doneCb = NULL;
+static uint8 state = OTA_IDLE;
+static bool checked = false;        // once per wake
+static bool tcpUp = false;
+static bool held = false;           // by espconn_recv_hold()
+static bool radioOff = false;
+static const char *failReason;
+static uint8 running[20];           // SHA1 of the running image
+static uint32 runAddr;              // its slot
+static uint32 runLen;               // and length
+static uint32 newAddr;              // the other slot
+static delta_header_t header;
+static uint8 headerLen;             // bytes of it so far
+static build_t *build = NULL;
+static uint8 *pend = NULL;          // of the delta, received but not used
+static uint32 pendLen;
+static char head[HEAD_MAX + 1];
+static uint16 headLen;
+static uint32 bodyLen;
+static uint32 got;                  // bytes of the body so far
+static uint32 startUs;
+
+
+/*
+ * image_len - length of the image in the slot at addr, 0 if there is
+ * none
+ *
+ * As esptool.py elf2image --version=2 writes it: a header and the
+ * .irom0.text segment, then the segments the boot loader copies to RAM
+ * with a header of their own and a checksum byte, padded to 16, then a
+ * CRC32.
+ */
+static uint32 ICACHE_FLASH_ATTR
+image_len(uint32 addr)
+{
+    uint32 buf[4];
+    uint8 *p = (uint8 *)buf;
+    uint32 off;
+    uint8 count;
+    uint8 i;
+
+    if ((spi_flash_read(addr, buf, 16) != SPI_FLASH_RESULT_OK)
+            || (p[0] != IMAGE_V2_MAGIC) || (buf[3] > OTA_SLOT_SIZE)) {
+        return(0);
+    }
+    off = 16 + buf[3];
+    if ((off & 3) || (off >= OTA_SLOT_SIZE)
+            || (spi_flash_read(addr + off, buf, 8) != SPI_FLASH_RESULT_OK)
+            || (p[0] != IMAGE_MAGIC)) {
+        return(0);
+    }
+    count = p[1];
+    off += 8;
+    for (i = 0; i < count; i++) {
+        // a segment is its address, its size and its bytes
+        if ((spi_flash_read(addr + off, buf, 8) != SPI_FLASH_RESULT_OK)
+                || (buf[1] > OTA_SLOT_SIZE)) {
+            return(0);
+        }
+        off += 8 + buf[1];
+        if ((off & 3) || (off >= OTA_SLOT_SIZE)) {
+            return(0);
+        }
+    }
+    off = (off | 15) + 1 + 4;
+    return((off <= OTA_SLOT_SIZE) ? off : 0);
+} // end image_len()
+
+
+static bool ICACHE_FLASH_ATTR
+image_sha1(uint32 addr, uint32 len, uint8 digest[20])
+{
+    uint32 buf[OTA_BUF_SIZE / 4];
+    uint32 pos;
+    uint32 n;
+    SHA1_CTX sha;
+
+    SHA1Init(&sha);
+    for (pos = 0; pos < len; pos += n) {
+        n = (len - pos < OTA_BUF_SIZE) ? len - pos : OTA_BUF_SIZE;
+        if (spi_flash_read(addr + pos, buf, (n + 3) & ~3)
+                != SPI_FLASH_RESULT_OK) {
+            return(FALSE);
+        }
+        SHA1Update(&sha, (uint8 *)buf, n);
+    }
+    SHA1Final(digest, &sha);
+    return(TRUE);
+}
+
+
+/*
+ * old_read - len bytes of the running image at src, which need not be
+ * aligned
+ */
+static bool ICACHE_FLASH_ATTR
+old_read(build_t *b, uint32 src, uint8 *dst, uint32 len)
+{
+    uint32 addr = runAddr + src;
+    uint32 skip;
+    uint32 n;
+
+    while (len > 0) {
+        skip = addr & 3;
+        n = (len < OTA_BUF_SIZE - skip) ? len : OTA_BUF_SIZE - skip;
+        if (spi_flash_read(addr - skip, b->old, (skip + n + 3) & ~3)
+                != SPI_FLASH_RESULT_OK) {
+            return(FALSE);
+        }
+        os_memcpy(dst, (uint8 *)b->old + skip, n);
+        addr += n;
+        dst += n;
+        len -= n;
+    }
+    return(TRUE);
+}
+
+
+static bool ICACHE_FLASH_ATTR
+sector_same(build_t *b, uint32 addr, uint32 words)
+{
+    uint32 i;
+    uint32 n;
+
+    for (i = 0; i < words; i += n) {
+        n = (words - i < OTA_BUF_SIZE / 4) ? words - i : OTA_BUF_SIZE / 4;
+        if ((spi_flash_read(addr + i * 4, b->old, n * 4)
+                    != SPI_FLASH_RESULT_OK)
+                || (os_memcmp(b->old, &b->sector[i], n * 4) != 0)) {
+            return(FALSE);
+        }
+    }
+    return(TRUE);
+}
+
+
+/*
+ * sector_write - write the sector built to the other slot, unless it
+ * holds it already, and read it back
+ */
+static bool ICACHE_FLASH_ATTR
+sector_write(build_t *b)
+{
+    uint32 addr = newAddr + b->start;
+    uint32 words = (b->len + 3) / 4;
+    uint8 tries;
+
+    // as the erased flash after them reads
+    os_memset((uint8 *)b->sector + b->len, 0xff, words * 4 - b->len);
+    for (tries = 0; tries < WRITE_TRIES; tries++) {
+        if (sector_same(b, addr, words)) {
+            return(TRUE);
+        }
+        spi_flash_erase_sector(addr / SECTOR);
+        spi_flash_write(addr, b->sector, words * 4);
+    }
+    return(sector_same(b, addr, words));
+}
+
+
+/*
+ * build_bytes - run the n bytes of the delta at p, up to the end of the
+ * next sector of the new image, and write that sector
+ *
+ * Returns how many of the bytes were used, all of them unless a sector
+ * was written, or BUILD_BAD or BUILD_WRITE.
+ */
+static sint32 ICACHE_FLASH_ATTR
+build_bytes(const uint8 *p, uint32 n)
+{
+    build_t *b = build;
+    uint8 *out = (uint8 *)b->sector;
+    uint32 used = 0;
+    uint32 src;
+    uint32 v;
+    uint8 c;
+
+    while (used < n) {
+        if (b->start >= header.new_len) {
+            return(BUILD_BAD);          // more than the new image
+        }
+        c = p[used++];
+        if (b->next == DELTA_LITERAL) {
+            out[b->pos++] = c;
+            if (--b->n == 0) {
+                b->next = DELTA_COMMAND;
+            }
+        } else {
+            if (b->bits > 28) {
+                return(BUILD_BAD);
+            }
+            b->varint |= (uint32)(c & 0x7f) << b->bits;
+            b->bits += 7;
+            if (c & 0x80) {
+                continue;
+            }
+            v = b->varint;
+            b->varint = 0;
+            b->bits = 0;
+            if (b->next == DELTA_COMMAND) {
+                b->n = v >> 1;
+                if ((b->n == 0) || (b->n > b->len - b->pos)) {
+                    return(BUILD_BAD);
+                }
+                b->next = (v & COPY) ? DELTA_DISTANCE : DELTA_LITERAL;
+                continue;
+            }
+            src = b->start + b->pos + b->shift + (sint32)((v >> 1) ^ -(v & 1));
+            if ((src > header.old_len) || (b->n > header.old_len - src)
+                    || !old_read(b, src, &out[b->pos], b->n)) {
+                return(BUILD_BAD);
+            }
+            b->shift = src - (b->start + b->pos);
+            b->pos += b->n;
+            b->next = DELTA_COMMAND;
+        }
+
+        if (b->pos == b->len) {
+            if (!sector_write(b)) {
+                return(BUILD_WRITE);
+            }
+            b->start += b->len;
+            b->pos = 0;
+            b->len = (header.new_len - b->start < SECTOR)
+                ? header.new_len - b->start : SECTOR;
+            break;
+        }
+    }
+    return(used);
+} // end build_bytes()
+
+
+/*
+ * ota_end - the check is over, back to the caller of ota_check()
+ */
+static void ICACHE_FLASH_ATTR
+ota_end(const char *why)
+{
+    ota_done_cb_t cb = doneCb;
+
+    INFO("ota: %s\r\n", why);
+    os_timer_disarm(&timer);
+    os_timer_disarm(&stepTimer);
+    if (tcpUp) {
+        tcpUp = false;
+        espconn_disconnect(&conn);
+    }
+    held = false;
+    if (pend != NULL) {
+        os_free(pend);
+        pend = NULL;
+    }
+    if (build != NULL) {
+        os_free(build);
+        build = NULL;
+    }
+    state = OTA_IDLE;
+    doneCb = NULL;
+    if (cb != NULL) {
+        cb();
+    }
+} // end ota_end()
+
+
+/*
+ * End from the timer rather than from inside an espconn callback
+ */
+static void ICACHE_FLASH_ATTR
+ota_fail(const char *why)
+{
+    failReason = why;
+    state = OTA_IDLE;
+    os_timer_arm(&timer, 1, 0);
+}
+
+
+static void ICACHE_FLASH_ATTR
+radio_off(void)
+{
+    if (tcpUp) {
+        tcpUp = false;
+        espconn_disconnect(&conn);
+    }
+    if (!radioOff) {
+        // nothing more goes over the air this wake
+        radioOff = true;
+        wifi_set_opmode_current(NULL_MODE);
+        energy_state(ENERGY_CPU);
+    }
+}
+
+
+/*
+ * ota_switch - steps 2 and 3 of ota.h, does not return if the new
+ * image checks out
+ */
+static void ICACHE_FLASH_ATTR
+ota_switch(void)
+{
+    uint8 digest[20];
+
+    if (!image_sha1(newAddr, header.new_len, digest)
+            || (os_memcmp(digest, header.new_sha1, sizeof(digest)) != 0)) {
+        ota_end("new image does not check");
+        return;
+    }
+    INFO("ota: verified in %d ms, booting slot %d\r\n",
+            (system_get_time() - startUs) / 1000,
+            (newAddr == OTA_SLOT1_ADDR) ? 1 : 2);
+    uart_tx_flush();
+    system_upgrade_flag_set(UPGRADE_FLAG_FINISH);
+    system_upgrade_reboot();
+} // end ota_switch()
+
+
+static void ICACHE_FLASH_ATTR
+ota_timeout(void *arg)
+{
+    if (state == OTA_BUILT) {
+        radio_off();
+        ota_switch();
+    } else {
+        ota_end(failReason);
+    }
+}
+
+
+static bool ICACHE_FLASH_ATTR
+header_ok(void)
+{
+    return((header.magic == DELTA_MAGIC) && (header.len == bodyLen)
+            && (os_memcmp(header.old_sha1, running, 20) == 0)
+            && (header.addr == newAddr) && (header.old_len == runLen)
+            && (header.new_len > 0) && (header.new_len <= OTA_SLOT_SIZE));
+}
+
+
+/*
+ * pend_add - keep n bytes of the delta for ota_step()
+ */
+static bool ICACHE_FLASH_ATTR
+pend_add(const uint8 *p, uint32 n)
+{
+    uint8 *buf = (uint8 *)os_malloc(pendLen + n);
+
+    if (buf == NULL) {
+        return(FALSE);
+    }
+    if (pend != NULL) {
+        os_memcpy(buf, pend, pendLen);
+        os_free(pend);
+    }
+    os_memcpy(buf + pendLen, p, n);
+    pend = buf;
+    pendLen += n;
+    return(TRUE);
+}
+
+
+/*
+ * body_data - build from the next n bytes of the delta
+ *
+ * The header is checked before anything is written. Bytes left over
+ * once a sector is written are kept for ota_step(), and the server is
+ * held back until they are used.
+ */
+static void ICACHE_FLASH_ATTR
+body_data(const uint8 *p, uint32 n)
+{
+    sint32 used;
+
+    if (build == NULL) {
+        while ((n > 0) && (headerLen < sizeof(header))) {
+            ((uint8 *)&header)[headerLen++] = *p++;
+            n--;
+        }
+        if (headerLen < sizeof(header)) {
+            return;
+        }
+        if (!header_ok()) {
+            ota_fail("not a delta for this image");
+            return;
+        }
+        build = (build_t *)os_zalloc(sizeof(build_t));
+        if (build == NULL) {
+            ota_fail("no memory");
+            return;
+        }
+        build->len = (header.new_len < SECTOR) ? header.new_len : SECTOR;
+    }
+
+    used = build_bytes(p, n);
+    if (used < 0) {
+        ota_fail((used == BUILD_WRITE) ? "write failed"
+                : "delta does not apply");
+        return;
+    }
+    if (used < n) {
+        if (!pend_add(p + used, n - used)) {
+            ota_fail("no memory");
+            return;
+        }
+        if ((state == OTA_BODY) && !held) {
+            held = true;
+            espconn_recv_hold(&conn);
+        }
+        os_timer_arm(&stepTimer, 1, 0);
+        return;
+    }
+
+    if (state == OTA_RECEIVED) {
+        if (build->start < header.new_len) {
+            ota_fail("delta ends early");
+            return;
+        }
+        state = OTA_BUILT;
+        os_timer_arm(&timer, 1, 0);
+    }
+} // end body_data()
+
+
+/*
+ * ota_step - build on from the bytes kept by body_data()
+ */
+static void ICACHE_FLASH_ATTR
+ota_step(void *arg)
+{
+    uint8 *p = pend;
+    uint32 n = pendLen;
+
+    if (((state != OTA_BODY) && (state != OTA_RECEIVED)) || (p == NULL)) {
+        return;
+    }
+    if (state == OTA_RECEIVED) {
+        radio_off();
+    }
+    pend = NULL;
+    pendLen = 0;
+    body_data(p, n);
+    os_free(p);
+    if ((pend == NULL) && held && (state == OTA_BODY)) {
+        held = false;
+        espconn_recv_unhold(&conn);
+    }
+} // end ota_step()
+
+
+/*
+ * body_recv - n more bytes of the HTTP body
+ */
+static void ICACHE_FLASH_ATTR
+body_recv(const uint8 *p, uint32 n)
+{
+    if (n > bodyLen - got) {
+        n = bodyLen - got;
+    }
+    got += n;
+    if (got == bodyLen) {
+        INFO("ota: %d bytes in %d ms\r\n", bodyLen,
+                (system_get_time() - startUs) / 1000);
+        state = OTA_RECEIVED;
+    }
+    if (pend != NULL) {
+        // after the bytes still to be used
+        if (!pend_add(p, n)) {
+            ota_fail("no memory");
+        }
+        return;
+    }
+    body_data(p, n);
+} // end body_recv()
+
+
+/*
+ * http_head - take the status and the length of the body from the
+ * HTTP header, head ends after its blank line
+ */
+static void ICACHE_FLASH_ATTR
+http_head(void)
+{
+    const char *p = (const char *)os_strstr(head, "Content-Length:");
+
+    if ((os_strncmp(head, "HTTP/1.", 7) != 0) || (head[8] != ' ')) {
+        ota_fail("not HTTP");
+        return;
+    }
+    if (os_strncmp(&head[9], "200", 3) != 0) {
+        ota_fail(os_strncmp(&head[9], "404", 3) == 0
+                ? "no update" : "HTTP error");
+        return;
+    }
+    bodyLen = 0;
+    if (p != NULL) {
+        for (p += 15; *p == ' '; p++) {
+        }
+        while ((*p >= '0') && (*p <= '9') && (bodyLen < DELTA_MAX)) {
+            bodyLen = bodyLen * 10 + *p++ - '0';
+        }
+    }
+    if ((bodyLen < sizeof(delta_header_t)) || (bodyLen > DELTA_MAX)) {
+        ota_fail("bad length");
+        return;
+    }
+    got = 0;
+    headerLen = 0;
+    state = OTA_BODY;
+} // end http_head()
+
+
+static void ICACHE_FLASH_ATTR
+ota_recv_cb(void *arg, char *pdata, unsigned short len)
+{
+    uint16 before = headLen;
+    uint16 n;
+    char *end;
+
+    if (state == OTA_BODY) {
+        body_recv((const uint8 *)pdata, len);
+        return;
+    }
+    if (state != OTA_HEAD) {
+        return;
+    }
+    n = (len < HEAD_MAX - headLen) ? len : HEAD_MAX - headLen;
+    os_memcpy(&head[headLen], pdata, n);
+    headLen += n;
+    head[headLen] = '\0';
+    end = (char *)os_strstr(head, "\r\n\r\n");
+    if (end == NULL) {
+        if (headLen == HEAD_MAX) {
+            ota_fail("HTTP header too long");
+        }
+        return;
+    }
+    end[2] = '\0';
+    http_head();
+    if (state == OTA_BODY) {
+        // the part of this segment after the header
+        n = end + 4 - head - before;
+        body_recv((const uint8 *)pdata + n, len - n);
+    }
+} // end ota_recv_cb()
+
+
+static void ICACHE_FLASH_ATTR
+ota_connect_cb(void *arg)
+{
+    char *p = head;
+    uint8 i;
+
+    tcpUp = true;
+    espconn_regist_recvcb(&conn, ota_recv_cb);
+
+    p += os_sprintf(p, "GET /ota/");
+    for (i = 0; i < sizeof(running); i++) {
+        p += os_sprintf(p, "%02x", running[i]);
+    }
+    p += os_sprintf(p, " HTTP/1.0\r\nHost: " OTA_HOST "\r\n\r\n");
+    // the server has the request before any of the answer comes
+    state = OTA_HEAD;
+    if (espconn_sent(&conn, (uint8 *)head, p - head) != 0) {
+        ota_fail("send failed");
+        return;
+    }
+    headLen = 0;
+} // end ota_connect_cb()
+
+
+static void ICACHE_FLASH_ATTR
+ota_discon_cb(void *arg)
+{
+    tcpUp = false;
+    if ((state == OTA_CONNECTING) || (state == OTA_HEAD)
+            || (state == OTA_BODY)) {
+        ota_fail("closed by server");
+    }
+}
+
+
+static void ICACHE_FLASH_ATTR
+ota_recon_cb(void *arg, sint8 err)
+{
+    tcpUp = false;
+    if ((state == OTA_CONNECTING) || (state == OTA_HEAD)
+            || (state == OTA_BODY)) {
+        INFO("ota: TCP error %d\r\n", err);
+        ota_fail("connection failed");
+    }
+}
+
+
+/*
+ * ota_init - count the wake, call early in user_init()
+ */
+void ICACHE_FLASH_ATTR
+ota_init(void)
+{
+    system_rtc_mem_read(RTC_OTA_ADDR, &rtc, sizeof(rtc));
+    if (rtc.magic != OTA_MAGIC) {
+        rtc.magic = OTA_MAGIC;
+        rtc.wakes = OTA_CHECK_WAKES;
+    } else if (rtc.wakes < OTA_CHECK_WAKES) {
+        rtc.wakes++;
+    }
+    system_rtc_mem_write(RTC_OTA_ADDR, &rtc, sizeof(rtc));
+
+    os_timer_disarm(&timer);
+    os_timer_setfn(&timer, (os_timer_func_t *)ota_timeout, NULL);
+    os_timer_disarm(&stepTimer);
+    os_timer_setfn(&stepTimer, (os_timer_func_t *)ota_step, NULL);
+} // end ota_init()
+
+
+/*
+ * ota_check - ask the server for an update, if a check is due
+ *
+ * Call once the report is out and the station still has its IP
+ * address. Returns FALSE, and does not call done, if there is no check
+ * this wake. An update that installs does not return; done is called
+ * when there is none, or it failed, at most OTA_TIMEOUT_MS later.
+ */
+bool ICACHE_FLASH_ATTR
+ota_check(ota_done_cb_t done)
+{
+    uint32 ip;
+
+    if (checked || (rtc.wakes < OTA_CHECK_WAKES)
+            || (wifi_station_get_connect_status() != STATION_GOT_IP)) {
+        return(FALSE);
+    }
+    checked = true;
+    // a failed check waits for the next one
+    rtc.wakes = 0;
+    system_rtc_mem_write(RTC_OTA_ADDR, &rtc, sizeof(rtc));
+
+    startUs = system_get_time();
+    if (battery_mv() < OTA_MIN_MV) {
+        INFO("ota: battery low, no check\r\n");
+        return(FALSE);
+    }
+    if (system_upgrade_userbin_check() == UPGRADE_FW_BIN1) {
+        runAddr = OTA_SLOT1_ADDR;
+        newAddr = OTA_SLOT2_ADDR;
+    } else {
+        runAddr = OTA_SLOT2_ADDR;
+        newAddr = OTA_SLOT1_ADDR;
+    }
+    runLen = image_len(runAddr);
+    if ((runLen == 0) || !image_sha1(runAddr, runLen, running)) {
+        INFO("ota: running image not found\r\n");
+        return(FALSE);
+    }
+    INFO("ota: image hashed in %d ms\r\n",
+            (system_get_time() - startUs) / 1000);
+
+    ip = ipaddr_addr(OTA_HOST);
+    os_memset(&conn, 0, sizeof(conn));
+    os_memset(&tcp, 0, sizeof(tcp));
+    conn.type = ESPCONN_TCP;
+    conn.state = ESPCONN_NONE;
+    conn.proto.tcp = &tcp;
+    tcp.remote_port = OTA_PORT;
+    tcp.local_port = espconn_port();
+    os_memcpy(tcp.remote_ip, &ip, 4);
+    espconn_regist_connectcb(&conn, ota_connect_cb);
+    espconn_regist_disconcb(&conn, ota_discon_cb);
+    espconn_regist_reconcb(&conn, ota_recon_cb);
+
+    doneCb = done;
+    state = OTA_CONNECTING;
+    failReason = "timeout";
+    os_timer_arm(&timer, OTA_TIMEOUT_MS, 0);
+    startUs = system_get_time();
+    if (espconn_connect(&conn) != 0) {
+        ota_fail("espconn_connect failed");
+    }
+    return(TRUE);
+} // end ota_check()
+
+#endif // OTA
@@ -19,37 +19,82 @@
  *
  */
 #include <os_type.h>
-#include <mem.h>
 
 #include "report.h"
 
 
 /*
- * newReport - allocate an empty report structure
- *
+ * n / 10 with shifts and adds, the ESP8266 has no divide instruction.
+ * From Hacker's Delight, 10-9.
  */
-report_t * ICACHE_FLASH_ATTR
-newReport(uint8_t bsize) {
-    report_t *report = (report_t *)os_zalloc(sizeof(report_t));
-    report->buffer = (char *)os_zalloc(bsize);
-    report->buffer[0] = '\0';  // null terminator
-    report->len = 0;
-    report->bsize = bsize;
+static inline uint32
+divu10(uint32 n, uint8 *rem)
+{
+    uint32 q = (n >> 1) + (n >> 2);
+    uint32 r;
 
-    return(report);
-} // end of newReport()
+    q += q >> 4;
+    q += q >> 8;
+    q += q >> 16;
+    q >>= 3;
+    r = n - ((q << 3) + (q << 1));
+    if (r > 9) {
+        q++;
+        r -= 10;
+    }
+    *rem = r;
+    return(q);
+} // end divu10()
 
 
 /*
- * freeReport - free the allocated report space
+ * report_decimal - write value * 10^-scale as decimal text
  *
+ * There is always a digit before the point: 62 with scale 3 is
+ * "0.062". buf needs REPORT_MAX_CHARS. Returns the length, not
+ * counting the NUL.
+ */
+uint8 ICACHE_FLASH_ATTR
+report_decimal(char *buf, sint32 value, uint8 scale)
+{
+    char digits[REPORT_MAX_SCALE + 2];
+    uint32 n = (value < 0) ? 0 - (uint32)value : (uint32)value;
+    uint8 nd = 0;
+    uint8 len = 0;
+    uint8 rem;
+
+    if (scale > REPORT_MAX_SCALE) {
+        scale = REPORT_MAX_SCALE;
+    }
+    do {
+        n = divu10(n, &rem);
+        digits[nd++] = '0' + rem;
+    } while ((n > 0) || (nd <= scale));
+
+    if (value < 0) {
+        buf[len++] = '-';
+    }
+    while (nd > 0) {
+        if (nd == scale) {
+            buf[len++] = '.';
+        }
+        buf[len++] = digits[--nd];
+    }
+    buf[len] = '\0';
+    return(len);
+} // end report_decimal()
+
+
+/*
+ * report_format - a driver report as text, empty if there is no
+ * measurement
  */
-void ICACHE_FLASH_ATTR
-freeReport(report_t * report) {
-    if (report != NULL)
-    {
-        os_free(report->buffer);
-        os_free(report);
+uint8 ICACHE_FLASH_ATTR
+report_format(char *buf, const report_t *report)
+{
+    if (report->status != REPORT_OK) {
+        buf[0] = '\0';
+        return(0);
     }
-    return;
-} // end of freeReport()
+    return(report_decimal(buf, report->value, report->scale));
+} // end report_format()
@@ -0,0 +1,135 @@
+/*
+ *  rfcal.c - choose the RF calibration for the next deep sleep wake
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <osapi.h>
+#include <os_type.h>
+#include <user_interface.h>
+//#define INFO os_printf  // override debug.h
+#include "debug.h"
+#include "rtcmem.h"
+
+#include "rfcal.h"
+
+#define RFCAL_MAGIC     0x52464331  // "RFC1"
+
+typedef struct {
+    uint32 magic;
+    uint32 wakes;       // wakes since the last full calibration
+    sint32 cal_temp_mc; // temperature at that calibration
+    uint32 next;        // option set for the next wake
+} rfcal_rtc_t;
+
+// fails to compile if the record outgrows its RTC memory range
+typedef char rfcal_rtc_fits[
+    (RTC_BLOCKS(sizeof(rfcal_rtc_t)) <= RTC_RFCAL_SIZE) ? 1 : -1];
+
+static rfcal_rtc_t rtc;
+static uint8 mode = RFCAL_FULL;     // calibration done on this wake
+static uint32 initMs = 0;
+
+
+/*
+ * rfcal_init - find out how this wake was calibrated
+ *
+ * Call early in user_init().
+ */
+void ICACHE_FLASH_ATTR
+rfcal_init(void)
+{
+    struct rst_info *rst = system_get_rst_info();
+
+    system_rtc_mem_read(RTC_RFCAL_ADDR, &rtc, sizeof(rtc));
+    if ((rtc.magic != RFCAL_MAGIC)
+            || (rst->reason != REASON_DEEP_SLEEP_AWAKE)) {
+        // power-on or reset, the SDK has done a full calibration
+        rtc.magic = RFCAL_MAGIC;
+        rtc.cal_temp_mc = RFCAL_NO_TEMP;
+        rtc.next = RFCAL_FULL;
+    }
+    mode = (rtc.next == RFCAL_SKIP) ? RFCAL_SKIP : RFCAL_FULL;
+    if (mode == RFCAL_FULL) {
+        rtc.wakes = 0;
+    }
+} // end rfcal_init()
+
+
+/*
+ * rfcal_init_done - call from the system init done callback
+ */
+void ICACHE_FLASH_ATTR
+rfcal_init_done(void)
+{
+    initMs = system_get_time() / 1000;
+    INFO("rfcal: %s, init done at %d ms\r\n",
+            (mode == RFCAL_FULL) ? "full" : "skipped", initMs);
+}
+
+
+/*
+ * rfcal_mode - the system_deep_sleep_set_option() value this wake ran
+ * with
+ */
+uint8 ICACHE_FLASH_ATTR
+rfcal_mode(void)
+{
+    return(mode);
+}
+
+
+/*
+ * rfcal_init_ms - reset to the init done callback, 0 until then
+ */
+uint32 ICACHE_FLASH_ATTR
+rfcal_init_ms(void)
+{
+    return(initMs);
+}
+
+
+/*
+ * rfcal_sleep - choose the calibration for the next wake
+ *
+ * temp_mc is this wake's temperature, or RFCAL_NO_TEMP. Call just
+ * before system_deep_sleep().
+ */
+void ICACHE_FLASH_ATTR
+rfcal_sleep(sint32 temp_mc)
+{
+    sint32 delta = 0;
+
+    if ((mode == RFCAL_FULL) && (temp_mc != RFCAL_NO_TEMP)) {
+        rtc.cal_temp_mc = temp_mc;
+    }
+    if ((temp_mc != RFCAL_NO_TEMP) && (rtc.cal_temp_mc != RFCAL_NO_TEMP)) {
+        delta = temp_mc - rtc.cal_temp_mc;
+        if (delta < 0) {
+            delta = -delta;
+        }
+    }
+
+    rtc.wakes++;
+    if ((rtc.wakes >= RFCAL_EVERY) || (delta >= RFCAL_TEMP_DELTA_MC)) {
+        rtc.next = RFCAL_FULL;
+    } else {
+        rtc.next = RFCAL_SKIP;
+    }
+    system_deep_sleep_set_option(rtc.next);
+    system_rtc_mem_write(RTC_RFCAL_ADDR, &rtc, sizeof(rtc));
+} // end rfcal_sleep()
@@ -0,0 +1,148 @@
+/*
+ *  schedule.c - wake schedule on a fixed grid, see schedule.h
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <osapi.h>
+#include <os_type.h>
+#include <user_interface.h>
+//#define INFO os_printf  // override debug.h
+#include "debug.h"
+#include "rtcmem.h"
+#include "walltime.h"
+
+#include "schedule.h"
+
+#define SCHEDULE_MAGIC  0x53434831  // "SCH1"
+#define NO_OFFSET       0xffffffff
+#define US_PER_SEC      1000000ULL
+#define US_PER_MS       1000
+
+typedef struct {
+    uint32 magic;
+    uint32 offset_ms;   // from the broker, NO_OFFSET = none
+    uint32 wakes;       // since the last check of the broker's offset
+} schedule_rtc_t;
+
+// fails to compile if the record outgrows its RTC memory range
+typedef char schedule_rtc_fits[
+    (RTC_BLOCKS(sizeof(schedule_rtc_t)) <= RTC_SCHEDULE_SIZE) ? 1 : -1];
+
+static schedule_rtc_t rtc;
+
+
+/*
+ * offset_us - this node's offset into a period of period_us
+ */
+static uint64 ICACHE_FLASH_ATTR
+offset_us(uint64 period_us)
+{
+    uint32 hash;
+
+    if (rtc.offset_ms != NO_OFFSET) {
+        return(((uint64)rtc.offset_ms * US_PER_MS) % period_us);
+    }
+    if (!SCHEDULE_SLOT) {
+        return(0);
+    }
+    // chip IDs come from the MAC and are often consecutive, the
+    // golden ratio hash spreads them evenly
+    hash = system_get_chip_id() * 2654435761U;
+    return(((uint64)hash * (period_us / US_PER_MS) >> 32) * US_PER_MS);
+} // end offset_us()
+
+
+/*
+ * schedule_init - read the broker's offset, call early in user_init()
+ */
+void ICACHE_FLASH_ATTR
+schedule_init(void)
+{
+    system_rtc_mem_read(RTC_SCHEDULE_ADDR, &rtc, sizeof(rtc));
+    if (rtc.magic != SCHEDULE_MAGIC) {
+        rtc.magic = SCHEDULE_MAGIC;
+        rtc.offset_ms = NO_OFFSET;
+        rtc.wakes = SCHEDULE_CHECK_WAKES;
+    } else if (rtc.wakes < SCHEDULE_CHECK_WAKES) {
+        rtc.wakes++;
+    }
+} // end schedule_init()
+
+
+/*
+ * schedule_check_due - TRUE if this wake should subscribe to the
+ * broker's offset
+ */
+bool ICACHE_FLASH_ATTR
+schedule_check_due(void)
+{
+    return(rtc.wakes >= SCHEDULE_CHECK_WAKES);
+}
+
+
+/*
+ * schedule_set_offset - the answer to a check
+ *
+ * data is the retained <device_id>/slot message, len 0 if none came.
+ */
+void ICACHE_FLASH_ATTR
+schedule_set_offset(const char *data, uint16 len)
+{
+    uint32 ms = 0;
+    uint16 i;
+
+    for (i = 0; i < len; i++) {
+        if ((data[i] < '0') || (data[i] > '9') || (ms > 0xffffff)) {
+            break;
+        }
+        ms = ms * 10 + data[i] - '0';
+    }
+    rtc.offset_ms = ((len > 0) && (i == len)) ? ms : NO_OFFSET;
+    rtc.wakes = 0;
+    INFO("schedule: offset %d ms from the broker\r\n", rtc.offset_ms);
+} // end schedule_set_offset()
+
+
+/*
+ * schedule_sleep_us - the system_deep_sleep() time to the next wake
+ *
+ * period_s is the grid, sleep_s the sleep wanted, a whole number of
+ * periods. retry adds the jitter after a failed wake.
+ */
+uint32 ICACHE_FLASH_ATTR
+schedule_sleep_us(uint32 period_s, uint32 sleep_s, bool retry)
+{
+    uint64 period = period_s * US_PER_SEC;
+    uint64 offset = offset_us(period);
+    uint64 earliest;
+    uint64 next;
+
+    // the wake this one is on the grid for is within half a period;
+    // a period is added so the grid before the offset stays positive
+    earliest = walltime_clock_us() + sleep_s * US_PER_SEC - period / 2;
+    next = (earliest + 2 * period - offset - 1) / period * period
+        - period + offset;
+    if (retry && (SCHEDULE_JITTER_MS > 0)) {
+        next += os_random() % (SCHEDULE_JITTER_MS * US_PER_MS);
+    }
+    system_rtc_mem_write(RTC_SCHEDULE_ADDR, &rtc, sizeof(rtc));
+
+    INFO("schedule: wake at %d.%03d\r\n", (uint32)(next / US_PER_SEC),
+            (uint32)(next % US_PER_SEC) / 1000);
+    return(walltime_sleep_us(next));
+} // end schedule_sleep_us()
@@ -0,0 +1,222 @@
+/*
+ *  tlog.c - tokenized logging backend
+ *
+ *  Sends a message ID and the raw arguments of an INFO() call instead
+ *  of the formatted text. See include/tlog.h for the record format.
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifdef TLOG
+#include <stdarg.h>
+#include <ets_sys.h>
+#include <osapi.h>
+#include <user_interface.h>
+#include <driver/uart.h>
+#include "rtcmem.h"
+
+#include "tlog.h"
+
+// sync + id + length + worst case payload
+#define TLOG_BUF_SIZE   (4 + TLOG_MAX_ARGS * (TLOG_MAX_STR + 1))
+
+#define RING_MAGIC      0x544c5231  // "TLR1"
+#define HEADER_BLOCKS   2
+
+typedef struct {
+    uint32 magic;
+    uint8 first;        // offset of the oldest record
+    uint8 used;         // bytes from there
+    uint8 frozen;       // kept for publishing, nothing added
+    uint8 pad;
+    uint8 bytes[TLOG_RING_LEN];
+} ring_rtc_t;
+
+// fails to compile if the ring does not fill its RTC memory range
+typedef char ring_rtc_fits[
+    (RTC_BLOCKS(sizeof(ring_rtc_t)) == RTC_TLOG_SIZE) ? 1 : -1];
+
+static ring_rtc_t ring;         // magic is 0 until tlog_ring_init()
+static bool sent = false;       // published this wake
+
+
+/*
+ * save - write bytes [pos, pos + len) of the ring to RTC memory, with
+ * the header
+ */
+static void ICACHE_FLASH_ATTR
+save(uint8 pos, uint8 len)
+{
+    uint8 b0 = pos / 4;
+    uint8 b1 = (pos + len + 3) / 4;
+
+    if (len > 0) {
+        system_rtc_mem_write(RTC_TLOG_ADDR + HEADER_BLOCKS + b0,
+                &ring.bytes[b0 * 4], (b1 - b0) * 4);
+    }
+    system_rtc_mem_write(RTC_TLOG_ADDR, &ring, HEADER_BLOCKS * 4);
+}
+
+
+/*
+ * ring_add - append a record, dropping the oldest ones to make room
+ */
+static void ICACHE_FLASH_ATTR
+ring_add(const uint8 *rec, uint8 len)
+{
+    uint8 head;
+    uint8 n;
+
+    if ((ring.magic != RING_MAGIC) || ring.frozen || (len > TLOG_RING_LEN)) {
+        return;
+    }
+    while (ring.used + len > TLOG_RING_LEN) {
+        // byte 3 of a record is its payload length
+        n = 4 + ring.bytes[(ring.first + 3) % TLOG_RING_LEN];
+        ring.first = (ring.first + n) % TLOG_RING_LEN;
+        ring.used -= n;
+    }
+    head = (ring.first + ring.used) % TLOG_RING_LEN;
+    ring.used += len;
+    n = (len < TLOG_RING_LEN - head) ? len : TLOG_RING_LEN - head;
+    os_memcpy(&ring.bytes[head], rec, n);
+    os_memcpy(ring.bytes, rec + n, len - n);
+    save(head, n);
+    if (len > n) {
+        save(0, len - n);
+    }
+}
+
+
+void ICACHE_FLASH_ATTR
+tlog_write(uint16 id, uint8 nargs, uint8 strmask, ...)
+{
+    uint8 buf[TLOG_BUF_SIZE];
+    uint16 len = 4;
+    uint8 i;
+    va_list ap;
+
+    va_start(ap, strmask);
+    for (i = 0; i < nargs; i++) {
+        if (strmask & (1 << i)) {
+            const char *str = va_arg(ap, const char *);
+            uint8 slen = 0;
+            uint16 lenPos = len++;
+
+            while ((str != NULL) && (str[slen] != '\0')
+                    && (slen < TLOG_MAX_STR)) {
+                buf[len++] = str[slen++];
+            }
+            buf[lenPos] = slen;
+        } else {
+            uint32 value = va_arg(ap, uint32);
+
+            // unsigned LEB128
+            while (value >= 0x80) {
+                buf[len++] = (value & 0x7f) | 0x80;
+                value >>= 7;
+            }
+            buf[len++] = value;
+        }
+    }
+    va_end(ap);
+
+    buf[0] = TLOG_SYNC;
+    buf[1] = id & 0xff;
+    buf[2] = id >> 8;
+    buf[3] = len - 4;
+
+    uart0_tx_buffer(buf, len);
+    ring_add(buf, len);
+
+} // end tlog_write()
+
+
+/*
+ * tlog_ring_init - freeze the ring after a watchdog or exception
+ * reset, call first in user_init()
+ */
+void ICACHE_FLASH_ATTR
+tlog_ring_init(void)
+{
+    struct rst_info *rst = system_get_rst_info();
+
+    system_rtc_mem_read(RTC_TLOG_ADDR, &ring, sizeof(ring));
+    if ((ring.magic != RING_MAGIC) || (ring.used > TLOG_RING_LEN)
+            || (ring.first >= TLOG_RING_LEN)) {
+        os_memset(&ring, 0, sizeof(ring));
+        ring.magic = RING_MAGIC;
+    }
+    if ((rst->reason == REASON_WDT_RST)
+            || (rst->reason == REASON_EXCEPTION_RST)
+            || (rst->reason == REASON_SOFT_WDT_RST)) {
+        ring.frozen = 1;
+    }
+    save(0, 0);
+} // end tlog_ring_init()
+
+
+/*
+ * tlog_ring_due - TRUE if the ring is kept for publishing
+ */
+bool ICACHE_FLASH_ATTR
+tlog_ring_due(void)
+{
+    return(ring.frozen && (ring.used > 0));
+}
+
+
+/*
+ * tlog_ring_copy - the records, oldest first, to buf of TLOG_RING_LEN
+ * bytes
+ *
+ * Returns the length written.
+ */
+uint8 ICACHE_FLASH_ATTR
+tlog_ring_copy(uint8 *buf)
+{
+    uint8 n = (ring.used < TLOG_RING_LEN - ring.first)
+        ? ring.used : TLOG_RING_LEN - ring.first;
+
+    os_memcpy(buf, &ring.bytes[ring.first], n);
+    os_memcpy(buf + n, ring.bytes, ring.used - n);
+    sent = true;
+    return(ring.used);
+}
+
+
+/*
+ * tlog_ring_sleep - call before deep sleep
+ *
+ * delivered is TRUE if everything this wake published reached the
+ * broker. A ring that was is emptied, a wake that did not deliver is
+ * kept.
+ */
+void ICACHE_FLASH_ATTR
+tlog_ring_sleep(bool delivered)
+{
+    if (!delivered) {
+        ring.frozen = 1;
+    } else if (sent) {
+        ring.first = 0;
+        ring.used = 0;
+        ring.frozen = 0;
+    }
+    save(0, 0);
+} // end tlog_ring_sleep()
+
+#endif // TLOG
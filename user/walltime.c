@@ -0,0 +1,348 @@
+/*
+ *  walltime.c - wall clock time across deep sleep, see walltime.h
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <ets_sys.h>
+#include <osapi.h>
+#include <os_type.h>
+#include <user_interface.h>
+#include <espconn.h>
+//#define INFO os_printf  // override debug.h
+#include "debug.h"
+#include "user_config.h"
+#include "rtcmem.h"
+#include "report.h"
+
+#include "walltime.h"
+
+#define WALLTIME_MAGIC  0x574c5431  // "WLT1"
+#define NTP_PORT        123
+#define NTP_PACKET_LEN  48
+#define NTP_UNIX_S      2208988800UL    // 1900 to 1970
+#define US_PER_SEC      1000000
+
+typedef struct {
+    uint32 magic;
+    uint32 ticks;       // system_get_rtc_time() at wall_us
+    uint64 wall_us;     // the clock, us, Unix time if known
+    uint32 cal;         // system_rtc_clock_cali_proc() at ticks
+    uint32 synced_s;    // Unix time of the last sync, 0 = none to learn from
+    sint32 trim_ppb;    // learned error of the calibration
+    uint32 known;       // wall_us is Unix time
+} walltime_rtc_t;
+
+// fails to compile if the record outgrows its RTC memory range
+typedef char walltime_rtc_fits[
+    (RTC_BLOCKS(sizeof(walltime_rtc_t)) <= RTC_WALLTIME_SIZE) ? 1 : -1];
+
+static walltime_rtc_t rtc;
+static struct espconn conn;
+static esp_udp udp;
+static bool created = false;
+static bool pending = false;        // a query is out
+static uint32 sentUs;
+static walltime_cb_t doneCb = NULL;
+static os_timer_t replyTimer;
+
+
+/*
+ * advance - move the time on by the RTC ticks since the last call
+ */
+static void ICACHE_FLASH_ATTR
+advance(void)
+{
+    uint32 ticks = system_get_rtc_time();
+    uint32 cal = system_rtc_clock_cali_proc();
+    uint64 us;
+
+    if (rtc.cal == 0) {
+        rtc.cal = cal;
+    }
+    // the interval ran at a period between the two calibrations, us
+    // per tick with 12 fractional bits
+    us = ((uint64)(ticks - rtc.ticks) * ((rtc.cal + cal) / 2)) >> 12;
+    us += (sint64)us * rtc.trim_ppb / 1000000000;
+
+    rtc.ticks = ticks;
+    rtc.cal = cal;
+    rtc.wall_us += us;
+} // end advance()
+
+
+static uint32 ICACHE_FLASH_ATTR
+get_be32(const uint8 *p)
+{
+    return(((uint32)p[0] << 24) | ((uint32)p[1] << 16)
+            | ((uint32)p[2] << 8) | p[3]);
+}
+
+
+static void ICACHE_FLASH_ATTR
+finish(void)
+{
+    walltime_cb_t cb = doneCb;
+
+    pending = false;
+    doneCb = NULL;
+    os_timer_disarm(&replyTimer);
+    if (cb != NULL) {
+        cb();
+    }
+}
+
+
+static void ICACHE_FLASH_ATTR
+reply_timeout(void *arg)
+{
+    INFO("walltime: no reply\r\n");
+    finish();
+}
+
+
+/*
+ * ntp_recv - set the clock from the server's transmit time
+ */
+static void ICACHE_FLASH_ATTR
+ntp_recv(void *arg, char *pdata, unsigned short len)
+{
+    const uint8 *p = (const uint8 *)pdata;
+    uint32 rtt = system_get_time() - sentUs;
+    uint64 ntp_us;
+    sint64 offset;
+    sint32 ppb;
+    uint32 sec;
+
+    // a server reply (mode 4) that is not a kiss-o'-death (stratum 0)
+    if (!pending || (len < NTP_PACKET_LEN) || ((p[0] & 0x07) != 4)
+            || (p[1] == 0)) {
+        return;
+    }
+    sec = get_be32(&p[40]);
+    if (sec < NTP_UNIX_S) {
+        return;
+    }
+    ntp_us = (uint64)(sec - NTP_UNIX_S) * US_PER_SEC
+        + (((uint64)get_be32(&p[44]) * US_PER_SEC) >> 32) + rtt / 2;
+
+    advance();
+    if (rtc.known) {
+        offset = (sint64)(ntp_us - rtc.wall_us);
+        sec = (uint32)(ntp_us / US_PER_SEC) - rtc.synced_s;
+        if ((rtc.synced_s != 0) && (sec >= WALLTIME_LEARN_S)) {
+            ppb = (sint32)(offset * 1000 / sec);
+            if ((ppb < WALLTIME_MAX_PPM * 1000)
+                    && (ppb > -WALLTIME_MAX_PPM * 1000)) {
+                rtc.trim_ppb += ppb;
+            }
+        }
+        INFO("walltime: offset %d ms, trim %d ppb\r\n",
+                (sint32)(offset / 1000), rtc.trim_ppb);
+    }
+    rtc.wall_us = ntp_us;
+    rtc.known = TRUE;
+    rtc.synced_s = (uint32)(ntp_us / US_PER_SEC);
+    finish();
+} // end ntp_recv()
+
+
+/*
+ * walltime_init - carry the time over the sleep
+ *
+ * Call early in user_init().
+ */
+void ICACHE_FLASH_ATTR
+walltime_init(void)
+{
+    struct rst_info *rst = system_get_rst_info();
+
+    system_rtc_mem_read(RTC_WALLTIME_ADDR, &rtc, sizeof(rtc));
+    if (rtc.magic != WALLTIME_MAGIC) {
+        os_memset(&rtc, 0, sizeof(rtc));
+        rtc.magic = WALLTIME_MAGIC;
+    }
+    if ((rst->reason != REASON_DEEP_SLEEP_AWAKE)
+            && (rst->reason != REASON_SOFT_RESTART)) {
+        // the RTC counter started over, the clock goes on from where
+        // it was saved
+        rtc.known = FALSE;
+        rtc.synced_s = 0;
+        rtc.cal = 0;
+        rtc.ticks = system_get_rtc_time();
+    }
+    advance();
+
+    os_timer_disarm(&replyTimer);
+    os_timer_setfn(&replyTimer, (os_timer_func_t *)reply_timeout, NULL);
+} // end walltime_init()
+
+
+/*
+ * walltime_sync - query the NTP server if the time is due a sync
+ *
+ * Call once the station has an IP address. The reply comes one round
+ * trip later.
+ */
+void ICACHE_FLASH_ATTR
+walltime_sync(void)
+{
+    uint8 req[NTP_PACKET_LEN];
+    uint32 ip;
+    uint64 us;
+
+    if (pending || (walltime_now(&us) && (rtc.synced_s != 0)
+                && ((uint32)(us / US_PER_SEC) - rtc.synced_s < WALLTIME_SYNC_S))) {
+        return;
+    }
+
+    if (!created) {
+        ip = ipaddr_addr(WALLTIME_NTP_HOST);
+        os_memset(&conn, 0, sizeof(conn));
+        os_memset(&udp, 0, sizeof(udp));
+        conn.type = ESPCONN_UDP;
+        conn.state = ESPCONN_NONE;
+        conn.proto.udp = &udp;
+        udp.remote_port = NTP_PORT;
+        udp.local_port = espconn_port();
+        os_memcpy(udp.remote_ip, &ip, 4);
+        espconn_regist_recvcb(&conn, ntp_recv);
+        if (espconn_create(&conn) != 0) {
+            INFO("walltime: espconn_create failed\r\n");
+            return;
+        }
+        created = true;
+    }
+
+    // version 4, client mode, nothing else is needed
+    os_memset(req, 0, sizeof(req));
+    req[0] = 0x23;
+    sentUs = system_get_time();
+    if (espconn_sent(&conn, req, sizeof(req)) == 0) {
+        pending = true;
+    }
+} // end walltime_sync()
+
+
+/*
+ * walltime_wait - call done once the query out has an answer
+ *
+ * Returns FALSE, and does not call done, if no query is out. Waits at
+ * most WALLTIME_REPLY_MS.
+ */
+bool ICACHE_FLASH_ATTR
+walltime_wait(walltime_cb_t done)
+{
+    if (!pending) {
+        return(FALSE);
+    }
+    doneCb = done;
+    os_timer_arm(&replyTimer, WALLTIME_REPLY_MS, 0);
+    return(TRUE);
+}
+
+
+/*
+ * walltime_now - the Unix time in us, FALSE if it is not known
+ */
+bool ICACHE_FLASH_ATTR
+walltime_now(uint64 *us)
+{
+    *us = walltime_clock_us();
+    return(rtc.known);
+}
+
+
+/*
+ * walltime_clock_us - the clock, Unix time or not
+ *
+ * Runs through deep sleep from power-on, and steps to Unix time at the
+ * first sync.
+ */
+uint64 ICACHE_FLASH_ATTR
+walltime_clock_us(void)
+{
+    advance();
+    return(rtc.wall_us);
+}
+
+
+/*
+ * walltime_sleep_us - the system_deep_sleep() time to wake at at_us
+ *
+ * The SDK times deep sleep with the RTC calibration, which is off by
+ * the learned trim. Returns WALLTIME_MIN_SLEEP_US if at_us has passed
+ * or is closer than that.
+ */
+uint32 ICACHE_FLASH_ATTR
+walltime_sleep_us(uint64 at_us)
+{
+    uint64 now = walltime_clock_us();
+    uint64 us;
+
+    if (at_us <= now) {
+        return(WALLTIME_MIN_SLEEP_US);
+    }
+    us = at_us - now;
+    us -= (sint64)us * rtc.trim_ppb / 1000000000;
+    if (us < WALLTIME_MIN_SLEEP_US) {
+        return(WALLTIME_MIN_SLEEP_US);
+    }
+    return((uint32)us);
+} // end walltime_sleep_us()
+
+
+/*
+ * walltime_format - write the Unix time as seconds to 1 ms
+ *
+ * Writes an empty string if the time is not known. Returns the
+ * characters written, not counting the NUL.
+ */
+uint8 ICACHE_FLASH_ATTR
+walltime_format(char *buf)
+{
+    uint64 us;
+    uint32 ms;
+    uint8 n;
+
+    if (!walltime_now(&us)) {
+        *buf = '\0';
+        return(0);
+    }
+    // seconds fit a sint32 until 2038
+    n = report_decimal(buf, (sint32)(us / US_PER_SEC), 0);
+    ms = (uint32)(us % US_PER_SEC) / 1000;
+    buf[n++] = '.';
+    buf[n++] = '0' + ms / 100;
+    buf[n++] = '0' + (ms / 10) % 10;
+    buf[n++] = '0' + ms % 10;
+    buf[n] = '\0';
+    return(n);
+} // end walltime_format()
+
+
+/*
+ * walltime_save - keep the time for the next wake
+ *
+ * Call just before system_deep_sleep().
+ */
+void ICACHE_FLASH_ATTR
+walltime_save(void)
+{
+    advance();
+    system_rtc_mem_write(RTC_WALLTIME_ADDR, &rtc, sizeof(rtc));
+}
@@ -0,0 +1,257 @@
+/*
+ *  warm.c - warm boot context, see warm.h
+ *
+ *  Copyright (C) 2015 Jerry Dunmire
+ *  This file is part of TLnodeFW
+ *
+ *  TLnodeFW is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  TLnodeFW is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with TLnodeFW.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <osapi.h>
+#include <os_type.h>
+#include <user_interface.h>
+//#define INFO os_printf  // override debug.h
+#include "debug.h"
+#include "rtcmem.h"
+
+#include "warm.h"
+
+#define WARM_MAGIC      0x57524d33  // "WRM3"
+#define HW_SENT         0x80        // in hwKnown, the set was delivered
+
+typedef struct {
+    uint32 magic;
+    uint8 alsRange;     // ISL_RANGE_*, or WARM_NO_RANGE
+    uint8 hwPresent;    // WARM_HW_* found
+    uint8 hwKnown;      // WARM_HW_* looked for, and HW_SENT
+    uint8 hwAge;        // wakes since the absent parts were looked for
+    uint8 dsTag;        // of the DS18B20 conversion armed, or WARM_NO_TAG
+    uint8 dsSeq;        // the last tag used
+    uint8 hwMisses;     // a nibble per part, wakes in a row it missed
+    uint8 check;        // complement of the sum of the bytes above
+} warm_rtc_t;
+
+// fails to compile if the record outgrows its RTC memory range
+typedef char warm_rtc_fits[
+    (RTC_BLOCKS(sizeof(warm_rtc_t)) <= RTC_WARM_SIZE) ? 1 : -1];
+
+static warm_rtc_t rtc;
+static bool warm = false;
+static bool hwPublished = false;    // the set went out this wake
+
+
+static uint8 ICACHE_FLASH_ATTR
+check(const warm_rtc_t *r)
+{
+    const uint8 *p = (const uint8 *)r;
+    uint8 sum = 0;
+    uint8 i;
+
+    // check is the last byte
+    for (i = 0; i < sizeof(*r) - 1; i++) {
+        sum += p[i];
+    }
+    return(~sum);
+}
+
+
+/*
+ * warm_init - TRUE if this is a warm boot, call first in user_init()
+ */
+bool ICACHE_FLASH_ATTR
+warm_init(void)
+{
+    struct rst_info *rst = system_get_rst_info();
+
+    system_rtc_mem_read(RTC_WARM_ADDR, &rtc, sizeof(rtc));
+    warm = (rst->reason == REASON_DEEP_SLEEP_AWAKE)
+        && (rtc.magic == WARM_MAGIC) && (rtc.check == check(&rtc));
+    if (!warm) {
+        os_memset(&rtc, 0, sizeof(rtc));
+        rtc.magic = WARM_MAGIC;
+        rtc.alsRange = WARM_NO_RANGE;
+    } else if (rtc.hwAge >= WARM_HW_RECHECK_WAKES) {
+        // look for the absent parts again
+        rtc.hwKnown &= rtc.hwPresent | HW_SENT;
+        rtc.hwAge = 0;
+    }
+    return(warm);
+} // end warm_init()
+
+
+bool ICACHE_FLASH_ATTR
+warm_boot(void)
+{
+    return(warm);
+}
+
+
+/*
+ * warm_als_range - the ISL29035 range of the last reading, or
+ * WARM_NO_RANGE
+ */
+uint8 ICACHE_FLASH_ATTR
+warm_als_range(void)
+{
+    return(rtc.alsRange);
+}
+
+void ICACHE_FLASH_ATTR
+warm_set_als_range(uint8 range)
+{
+    rtc.alsRange = range;
+}
+
+
+/*
+ * warm_ds_tag - the tag written with the DS18B20 conversion started
+ * before this wake, or WARM_NO_TAG
+ */
+uint8 ICACHE_FLASH_ATTR
+warm_ds_tag(void)
+{
+    return(rtc.dsTag);
+}
+
+
+/*
+ * warm_ds_arm - a new tag for the conversion started before deep sleep
+ */
+uint8 ICACHE_FLASH_ATTR
+warm_ds_arm(void)
+{
+    if (++rtc.dsSeq == WARM_NO_TAG) {
+        rtc.dsSeq++;
+    }
+    rtc.dsTag = rtc.dsSeq;
+    return(rtc.dsTag);
+}
+
+
+/*
+ * warm_ds_disarm - the conversion was taken, or is no longer good
+ */
+void ICACHE_FLASH_ATTR
+warm_ds_disarm(void)
+{
+    rtc.dsTag = WARM_NO_TAG;
+}
+
+
+/*
+ * warm_hw_known - FALSE if the driver should look for its part
+ */
+bool ICACHE_FLASH_ATTR
+warm_hw_known(uint8 part)
+{
+    return((rtc.hwKnown & part) != 0);
+}
+
+bool ICACHE_FLASH_ATTR
+warm_hw_present(uint8 part)
+{
+    return((rtc.hwPresent & part) != 0);
+}
+
+
+/*
+ * warm_hw_found - the driver looked for its part, or lost it
+ *
+ * A part that was found is only taken as gone after
+ * WARM_HW_MISSES wakes in a row without it, and is tried again on
+ * each of them.
+ */
+void ICACHE_FLASH_ATTR
+warm_hw_found(uint8 part, bool present)
+{
+    uint8 was = rtc.hwPresent;
+    uint8 shift = (part == WARM_HW_DS18B20) ? 0 : 4;
+    uint8 misses = (rtc.hwMisses >> shift) & 0x0f;
+
+    if (present) {
+        rtc.hwPresent |= part;
+        misses = 0;
+    } else if ((rtc.hwPresent & part) && (++misses < WARM_HW_MISSES)) {
+        INFO("hardware %x missed %d\r\n", part, misses);
+    } else {
+        rtc.hwPresent &= ~part;
+        misses = 0;
+    }
+    rtc.hwMisses = (rtc.hwMisses & ~(0x0f << shift)) | (misses << shift);
+    if (!(rtc.hwKnown & part) || (rtc.hwPresent != was)) {
+        INFO("hardware %x found %d\r\n", part, present);
+    }
+    if (rtc.hwPresent != was) {
+        rtc.hwKnown &= ~HW_SENT;
+    }
+    rtc.hwKnown |= part;
+} // end warm_hw_found()
+
+
+/*
+ * warm_hw_due - TRUE if the set of parts should be published
+ */
+bool ICACHE_FLASH_ATTR
+warm_hw_due(void)
+{
+    return(((rtc.hwKnown & WARM_HW_ALL) == WARM_HW_ALL)
+            && !(rtc.hwKnown & HW_SENT));
+}
+
+
+/*
+ * warm_hw_format - write the set to buf, WARM_HW_BUF_SIZE bytes
+ *
+ * Returns the length written, without the NUL.
+ */
+uint8 ICACHE_FLASH_ATTR
+warm_hw_format(char *buf)
+{
+    char *p = buf;
+
+    *p = '\0';
+    if (rtc.hwPresent & WARM_HW_DS18B20) {
+        p += os_sprintf(p, "%sds18b20", (p == buf) ? "" : ",");
+    }
+    if (rtc.hwPresent & WARM_HW_ISL29035) {
+        p += os_sprintf(p, "%sisl29035", (p == buf) ? "" : ",");
+    }
+    if (p == buf) {
+        // an empty retained message would clear the topic
+        p += os_sprintf(p, "none");
+    }
+    hwPublished = true;
+    return(p - buf);
+} // end warm_hw_format()
+
+
+/*
+ * warm_sleep - keep the context for the next wake, call before deep
+ * sleep
+ *
+ * delivered is TRUE if everything this wake published reached the
+ * broker.
+ */
+void ICACHE_FLASH_ATTR
+warm_sleep(bool delivered)
+{
+    if (hwPublished && delivered) {
+        rtc.hwKnown |= HW_SENT;
+    }
+    if ((rtc.hwPresent != WARM_HW_ALL) && (rtc.hwAge < 0xff)) {
+        rtc.hwAge++;
+    }
+    rtc.check = check(&rtc);
+    system_rtc_mem_write(RTC_WARM_ADDR, &rtc, sizeof(rtc));
+} // end warm_sleep()